@@ -20,6 +20,8 @@
 #define SDA_GPIO        21
 #define SCL_GPIO        22    
 #define I2C_PORT        I2C_NUM_0
+#define OLED_WIDTH      128
+#define OLED_HEIGHT     64
 
 #define PIR_GPIO        14
 #define RED_LED_GPIO    25
@@ -38,6 +40,9 @@ static const char *TAG = "SMART_NODE";
 
 int gas_baseline = 0;
 
+static uint8_t oled_fb[SSD1306_FB_SIZE(OLED_WIDTH, OLED_HEIGHT)];
+static ssd1306_t oled;
+
 void calibrate_mq135() {
     printf("Calibrating MQ135...\n");
     int total = 0;
@@ -106,9 +111,10 @@ void app_main(void) {
     ESP_ERROR_CHECK(i2cdev_init());
 
     // OLED INIT
-    ESP_ERROR_CHECK(ssd1306_init_i2c(SSD1306_I2C_ADDRESS, I2C_PORT, SDA_GPIO, SCL_GPIO));
-    ESP_ERROR_CHECK(ssd1306_init());
-    ssd1306_clear();
+    ESP_ERROR_CHECK(ssd1306_init_desc(&oled, OLED_WIDTH, OLED_HEIGHT, oled_fb,
+                                      SSD1306_I2C_ADDRESS, I2C_PORT, SDA_GPIO, SCL_GPIO));
+    ESP_ERROR_CHECK(ssd1306_init(&oled));
+    ssd1306_clear(&oled);
 
     // BMP180 INIT
     bmp180_dev_t bmp;
@@ -161,12 +167,12 @@ void app_main(void) {
         snprintf(line3, sizeof(line3), "G:%d", gas);
         snprintf(line4, sizeof(line4), "M:%s[%s]", motion ? "Y" : "N", alert ? "DNG" : "SAFE");
 
-        ssd1306_clear();
-        ssd1306_draw_string(0, 0, line1, 1, false);
-        ssd1306_draw_string(0, 1, line2, 1, false);
-        ssd1306_draw_string(0, 2, line3, 1, false);
-        ssd1306_draw_string(0, 3, line4, 1, false);
-        ssd1306_refresh();
+        ssd1306_clear(&oled);
+        ssd1306_draw_string(&oled, 0, 0, line1, 1, false);
+        ssd1306_draw_string(&oled, 0, 1, line2, 1, false);
+        ssd1306_draw_string(&oled, 0, 2, line3, 1, false);
+        ssd1306_draw_string(&oled, 0, 3, line4, 1, false);
+        ssd1306_refresh(&oled);
 
         if (++loop_count % 8 == 0) {
             send_to_thingspeak(temp, pressure, gas, motion);
@@ -1,16 +1,24 @@
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_system.h"
-#include "esp_wifi.h"
+#include "esp_timer.h"
 #include "esp_event.h"
 #include "nvs_flash.h"
-#include "driver/adc.h"
 #include "mqtt_client.h"
-#include "esp_netif.h"
+#include "mq_model.h"
+#include "adc_stream.h"
+#include "mq_calib.h"
+#include "periodic_sched.h"
+#include "sensor_hub.h"
+#include "mqtt_pub.h"
+#include "mqtt_backlog.h"
+#include "telem_codec.h"
+#include "wifi_mgr.h"
+#include "boot_graph.h"
 
 #define TAG "GAS_MONITOR"
 
@@ -20,95 +28,132 @@
 
 // MQTT
 #define MQTT_BROKER_URI "mqtt://172.20.10.2"
-#define MQTT_TOPIC      "esp32/sensors/gas"
+// Each node publishes on its own topic, the prefix followed by its
+// station MAC as 12 hex digits, so readings and delta frames of several
+// nodes never mix on one topic
+#define MQTT_TOPIC_PREFIX "esp32/sensors/gas/"
 
-// Sensor constants
-#define RL_VALUE    10000.0
-#define V_REF       1100.0
-#define V_SUPPLY    5000.0
-#define ADC_MAX     4095.0
+// All sensors are scanned continuously at 20 kHz and averaged down
+// to 10 readings/s per channel
+#define ADC_SAMPLE_HZ 20000
+#define ADC_OUTPUT_HZ 10
 
-// MQ-135 (CO2) on GPIO34
-#define MQ135_CHANNEL ADC1_CHANNEL_6
-float R0_MQ135 = 10.0;
+// Shared circuit: 10k load resistor, 5 V heater/divider supply, 1.1 V ADC reference
+#define MQ_CIRCUIT { .rl = 10000.0, .v_ref = 1100.0, .v_supply = 5000.0 }
 
-// MQ-5 (CH4) on GPIO35
-#define MQ5_CHANNEL ADC1_CHANNEL_7
-float R0_MQ5 = 10.0;
+// One row per sensor; the order is the adc_stream slot order and the
+// field order of TELEM_SCHEMA_GAS
+static mq_sensor_desc_t sensors[] = {
+    { .name = "MQ-135", .quantity = "co2", .source = MQ_SOURCE_ADC1, .channel = ADC_CHANNEL_6, // GPIO34
+      .circuit = MQ_CIRCUIT, .curve = { -0.42, 1.92 }, .clean_air_ratio = 3.6, .r0 = 10.0 },
+    { .name = "MQ-5",   .quantity = "ch4", .source = MQ_SOURCE_ADC1, .channel = ADC_CHANNEL_7, // GPIO35
+      .circuit = MQ_CIRCUIT, .curve = { -2.632, 2.5 }, .clean_air_ratio = 6.5, .r0 = 10.0 },
+    { .name = "MQ-9",   .quantity = "co",  .source = MQ_SOURCE_ADC1, .channel = ADC_CHANNEL_4, // GPIO32
+      .circuit = MQ_CIRCUIT, .curve = { -0.48, 1.58 }, .clean_air_ratio = 9.8, .r0 = 10.0 },
+};
+#define SENSOR_COUNT (sizeof(sensors) / sizeof(sensors[0]))
 
-// MQ-9 (CO) on GPIO32
-#define MQ9_CHANNEL ADC1_CHANNEL_4
-float R0_MQ9 = 10.0;
+// Raw code -> ppm tables, rebuilt whenever R0 changes
+static mq_lut_t luts[SENSOR_COUNT];
+static mq_model_t model;
+
+// Calibration: 100 interleaved frames (10 s) for all sensors at once.
+// Stored R0 values are used straight away on a warm boot and nudged
+// towards the fresh result once the background run finishes.
+#define CALIB_FRAMES   100
+#define CALIB_NVS_KEY  "gasnode_r0"
+#define REFINE_WEIGHT  0.25f
+
+static mq_calib_t calib;
+static volatile bool calib_complete = false;
+static volatile bool r0_ready = false;  // Stored or measured R0 in the model
+static bool refined = false;
+
+// Sensors are cached once a second, published on a fixed 5 s grid
+// regardless of how long a publish takes
+#define SAMPLE_PERIOD_US   1000000
+#define PUBLISH_PERIOD_US  5000000
+#define PUBLISH_PHASE_US   100000
+#define STATS_PERIOD_US    (10 * 60 * 1000000)
+
+// Every reading is appended to a log on the "telemetry" partition and
+// sent from there oldest first, REPLAY_PER_RUN at a time: right after it
+// is taken and then once a second, so readings kept while the broker was
+// unreachable go out in order without flooding it
+#define BACKLOG_PARTITION  "telemetry"
+#define REPLAY_PERIOD_US   1000000
+#define REPLAY_PHASE_US    600000
+#define REPLAY_PER_RUN     5
+
+// QoS 1 messages waiting for the broker's acknowledgement are capped, so
+// a slow or absent broker cannot grow the client's outbox without bound.
+// Readings that cannot go out wait in the backlog or, without one, in a
+// single slot where each newer reading replaces the last
+#define MQTT_MAX_INFLIGHT   8
+
+// Readings go out as telem_codec frames of about 14 bytes instead of
+// ~70 bytes of JSON; tools/host/telem_dump turns them back into the JSON
+// this node used to send. Frames are absolute: a delta frame is refused
+// by a subscriber that missed the one before it
+#define PAYLOAD_KEY_INTERVAL 1
 
 esp_mqtt_client_handle_t mqtt_client = NULL;
+static mqtt_pub_t pub;
+static char mqtt_topic[MQTT_BACKLOG_TOPIC_SIZE(MQTT_TOPIC_PREFIX)];
 
-// ---------------------------- Utility Functions ----------------------------
-float read_voltage(adc1_channel_t channel) {
-    int raw = adc1_get_raw(channel);
-    return ((float)raw / ADC_MAX) * V_REF;
-}
+static adc_stream_t *adc;
+static boot_graph_t boot;
+static mqtt_backlog_t backlog;
 
-float calculate_rs(float vout_mv) {
-    return ((V_SUPPLY - vout_mv) / vout_mv) * RL_VALUE;
+static void pub_done(void *ctx, uint32_t seq, bool acked) {
+    if (mqtt_backlog_done(&backlog, seq, acked))
+        boot_graph_mark_now(&boot, "first upload");
 }
 
-float calculate_ppm_mq135(float rs, float r0) {
-    float ratio = rs / r0;
-    float ppm_log = -0.42 * log10(ratio) + 1.92;
-    return pow(10, ppm_log);
-}
+// ---------------------------- Calibration ----------------------------
+// Runs in the adc_stream task for every averaged frame
+static void adc_frame_cb(const uint16_t *values, size_t n, uint32_t seq, void *ctx) {
+    if (calib_complete) return;
 
-float calculate_ppm_mq5(float rs, float r0) {
-    float ratio = rs / r0;
-    float ppm_log = -2.632 * log10(ratio) + 2.5;
-    return pow(10, ppm_log);
+    float rs[SENSOR_COUNT];
+    mq_model_rs(&model, values, rs);
+    if (mq_calib_add(&calib, rs))
+        calib_complete = true;
 }
 
-float calculate_ppm_mq9(float rs, float r0) {
-    float ratio = rs / r0;
-    float ppm_log = -0.48 * log10(ratio) + 1.58;
-    return pow(10, ppm_log);
-}
+static void apply_calibration(float weight) {
+    float avg_rs[SENSOR_COUNT], r0[SENSOR_COUNT];
+    mq_calib_means(&calib, avg_rs);
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+        r0[i] = sensors[i].r0;
+
+    // Blend in R0 space, then push the result back into the model
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+        avg_rs[i] /= sensors[i].clean_air_ratio;
+    mq_calib_blend(r0, avg_rs, SENSOR_COUNT, weight);
 
-float calibrate_r0(adc1_channel_t channel, float clean_air_ratio, const char *label) {
-    ESP_LOGI(TAG, "Calibrating R0 for %s...", label);
-    float sum_rs = 0;
-    for (int i = 0; i < 100; i++) {
-        float vout = read_voltage(channel);
-        float rs = calculate_rs(vout);
-        sum_rs += rs;
-        vTaskDelay(pdMS_TO_TICKS(100));
+    for (size_t i = 0; i < SENSOR_COUNT; i++) {
+        mq_model_set_r0(&model, i, r0[i]);
+        ESP_LOGI(TAG, "%s Calibration complete. R0 = %.2f Ω", sensors[i].name, r0[i]);
     }
-    float avg_rs = sum_rs / 100.0;
-    float r0 = avg_rs / clean_air_ratio;
-    ESP_LOGI(TAG, "%s Calibration complete. R0 = %.2f Ω", label, r0);
-    return r0;
+
+    esp_err_t err = mq_calib_save(CALIB_NVS_KEY, r0, SENSOR_COUNT);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Saving calibration failed: %s", esp_err_to_name(err));
 }
 
 // ---------------------------- Wi-Fi + MQTT ----------------------------
 static void wifi_init(void) {
-    esp_netif_init();
-    esp_event_loop_create_default();
-    esp_netif_create_default_wifi_sta();
-    
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_wifi_init(&cfg);
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-        },
+    wifi_mgr_esp_config_t cfg = {
+        .ssid = WIFI_SSID,
+        .password = WIFI_PASS,
     };
-
-    esp_wifi_set_mode(WIFI_MODE_STA);
-    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-    esp_wifi_start();
-    esp_wifi_connect();
+    ESP_ERROR_CHECK(wifi_mgr_esp_start(&cfg));
 }
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     esp_mqtt_event_handle_t event = event_data;
+    mqtt_pub_esp_event(&pub, event);
     if (event_id == MQTT_EVENT_CONNECTED) {
         ESP_LOGI(TAG, "MQTT Connected");
     } else if (event_id == MQTT_EVENT_DISCONNECTED) {
@@ -117,6 +162,7 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 }
 
 static void mqtt_init(void) {
+    ESP_ERROR_CHECK(mqtt_backlog_topic(MQTT_TOPIC_PREFIX, mqtt_topic, sizeof(mqtt_topic)));
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker = {
             .address.uri = MQTT_BROKER_URI,
@@ -124,61 +170,215 @@ static void mqtt_init(void) {
     };
 
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+    ESP_ERROR_CHECK(mqtt_pub_init_esp(&pub, mqtt_client, 1, MQTT_MAX_INFLIGHT, pub_done, NULL));
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(mqtt_client);
 }
 
 
+// ---------------------------- Periodic jobs ----------------------------
+static psched_t sched;
+static sensor_hub_t hub;
+static size_t gas_id;
+
+static void payload_sent(void *ctx, uint32_t seq, const float *ppm, size_t len) {
+    ESP_LOGI(TAG, "MQTT Published #%" PRIu32 " (%u bytes)", seq, (unsigned)len);
+}
+
+// Retries whatever could not be sent so far: the slot reading without a
+// backlog, the backlog otherwise
+static void replay_job(void *ctx) {
+    mqtt_backlog_poll(&backlog, esp_timer_get_time() / 1000);
+}
+
+static void publish_job(void *ctx) {
+    // Without R0 there are no valid ppm values yet; the backlog is
+    // replayed meanwhile
+    if (!r0_ready)
+        return;
+    if (!refined && calib_complete) {
+        apply_calibration(REFINE_WEIGHT);
+        refined = true;
+    }
+
+    sensor_reading_t rd;
+    if (sensor_hub_read(&hub, gas_id, &rd) != ESP_OK)
+        return;
+
+    uint16_t raw[SENSOR_COUNT];
+    float ppm[SENSOR_COUNT];
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+        raw[i] = rd.values[i];
+    mq_model_convert(&model, raw, ppm);
+    boot_graph_mark_now(&boot, "first sample");
+
+    // Log locally
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+        ESP_LOGI(TAG, "[%-6s] V=%.2f mV | %s = %.2f ppm", sensors[i].name,
+                 mq_gas_voltage(&sensors[i].circuit, raw[i]), sensors[i].quantity, ppm[i]);
+
+    // Send over MQTT through the backlog
+    esp_err_t err = mqtt_backlog_publish(&backlog, ppm, esp_timer_get_time() / 1000);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Keeping the reading failed: %s", esp_err_to_name(err));
+}
+
+static void stats_job(void *ctx) {
+    psched_log_stats(&sched, TAG);
+    wifi_mgr_esp_log_stats(TAG);
+    mqtt_backlog_log_stats(&backlog, TAG);
+}
+
+// ---------------------------- Boot ----------------------------
+// Steps, each run as soon as the ones it depends on have finished
+enum {
+    STEP_NVS,
+    STEP_WIFI,
+    STEP_MQTT,
+    STEP_ADC,
+    STEP_CALIBRATE,
+    STEP_BACKLOG,
+    STEP_SCHED,
+    STEP_COUNT
+};
+
+static esp_err_t boot_nvs(void *ctx) {
+    return nvs_flash_init();
+}
+
+static esp_err_t boot_wifi(void *ctx) {
+    wifi_init();
+    return ESP_OK;
+}
+
+static esp_err_t boot_mqtt(void *ctx) {
+    mqtt_init();
+    return ESP_OK;
+}
+
+static esp_err_t boot_adc(void *ctx) {
+    adc_channel_t channels[SENSOR_COUNT];
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+        channels[i] = sensors[i].channel;
+
+    adc_stream_config_t adc_cfg = {
+        .channels = channels,
+        .n_channels = SENSOR_COUNT,
+        .atten = ADC_ATTEN_DB_12,
+        .sample_freq_hz = ADC_SAMPLE_HZ,
+        .output_hz = ADC_OUTPUT_HZ,
+        .callback = adc_frame_cb,
+        .task_priority = 10,
+        .task_core = tskNO_AFFINITY,
+    };
+    ESP_ERROR_CHECK(mq_model_init(&model, sensors, luts, SENSOR_COUNT));
+    ESP_ERROR_CHECK(mq_calib_init(&calib, SENSOR_COUNT, CALIB_FRAMES));
+    return adc_stream_start(&adc_cfg, &adc);
+}
+
+static esp_err_t boot_calibrate(void *ctx) {
+    mq_calib_record_t stored;
+    bool warm = mq_calib_load(CALIB_NVS_KEY, &stored) == ESP_OK && stored.n_channels == SENSOR_COUNT;
+    if (warm) {
+        for (size_t i = 0; i < SENSOR_COUNT; i++)
+            mq_model_set_r0(&model, i, stored.values[i]);
+        ESP_LOGI(TAG, "Using stored R0 (saved at %" PRId64 "), refining in background", stored.timestamp);
+    } else {
+        ESP_LOGI(TAG, "Calibrating R0 for all sensors...");
+        while (!calib_complete)
+            vTaskDelay(pdMS_TO_TICKS(100));
+        apply_calibration(1.0f);
+    }
+    refined = !warm;
+    r0_ready = true;
+    return ESP_OK;
+}
+
+// The backlog is optional: without the partition, or when it cannot be
+// mounted, only the newest reading is kept while offline. The step then
+// fails, but as an optional step it does not hold up the scheduler
+static esp_err_t boot_backlog(void *ctx) {
+    mqtt_backlog_config_t cfg = {
+        .pub = &pub,
+        .topic = mqtt_topic,
+        .n_values = SENSOR_COUNT,
+        .per_run = REPLAY_PER_RUN,
+        .schema = telem_schema_find(TELEM_SCHEMA_GAS),
+        .key_interval = PAYLOAD_KEY_INTERVAL,
+        .sent = payload_sent,
+    };
+    esp_err_t err = mqtt_backlog_init_esp(&backlog, &cfg, BACKLOG_PARTITION);
+    // A bad configuration leaves nothing to publish through at all
+    if (err == ESP_ERR_INVALID_ARG)
+        ESP_ERROR_CHECK(err);
+    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND)
+        ESP_LOGE(TAG, "Backlog unusable, keeping only the newest reading: %s", esp_err_to_name(err));
+    return err;
+}
+
+static void sched_task(void *arg) {
+    psched_run(&sched);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t boot_sched(void *ctx) {
+    static psched_job_t jobs[4];
+    static sensor_hub_entry_t entries[1];
+    static sensor_adc_t gas_adc;
+    static sensor_channel_t hub_channels[SENSOR_COUNT];
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+        hub_channels[i] = (sensor_channel_t) { sensors[i].name, "raw" };
+
+    psched_clock_t clock;
+    ESP_ERROR_CHECK(psched_esp_clock_create(&clock));
+    ESP_ERROR_CHECK(psched_init(&sched, &clock, jobs, 4));
+    ESP_ERROR_CHECK(sensor_hub_init(&hub, &sched, entries, 1));
+
+    sensor_hub_sensor_config_t gas = { .name = "gas", .dev = &gas_adc,
+                                       .driver = sensor_adc_driver(&gas_adc, adc, 0, SENSOR_COUNT, hub_channels),
+                                       .period_us = SAMPLE_PERIOD_US };
+    psched_job_config_t publish = { .name = "publish", .fn = publish_job,
+                                    .period_us = PUBLISH_PERIOD_US, .phase_us = PUBLISH_PHASE_US };
+    psched_job_config_t replay = { .name = "replay", .fn = replay_job,
+                                   .period_us = REPLAY_PERIOD_US, .phase_us = REPLAY_PHASE_US };
+    psched_job_config_t stats = { .name = "stats", .fn = stats_job,
+                                  .period_us = STATS_PERIOD_US, .phase_us = STATS_PERIOD_US };
+    ESP_ERROR_CHECK(sensor_hub_add(&hub, &gas, &gas_id));
+    ESP_ERROR_CHECK(psched_add(&sched, &publish, NULL));
+    ESP_ERROR_CHECK(psched_add(&sched, &replay, NULL));
+    ESP_ERROR_CHECK(psched_add(&sched, &stats, NULL));
+
+    if (xTaskCreate(sched_task, "sched", 4096, NULL, 5, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
 // ---------------------------- Main Application ----------------------------
 void app_main() {
     // Init
     ESP_LOGI(TAG, "Starting...");
     esp_log_level_set(TAG, ESP_LOG_INFO);
-    nvs_flash_init();
-    wifi_init();
-    mqtt_init();
 
-    // ADC config
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(MQ135_CHANNEL, ADC_ATTEN_DB_11);
-    adc1_config_channel_atten(MQ5_CHANNEL, ADC_ATTEN_DB_11);
-    adc1_config_channel_atten(MQ9_CHANNEL, ADC_ATTEN_DB_11);
-
-    // Calibrate sensors
-    R0_MQ135 = calibrate_r0(MQ135_CHANNEL, 3.6, "MQ-135 (CO2)");
-    R0_MQ5   = calibrate_r0(MQ5_CHANNEL,   6.5, "MQ-5 (CH4)");
-    R0_MQ9   = calibrate_r0(MQ9_CHANNEL,   9.8, "MQ-9 (CO)");
-
-    while (1) {
-        // MQ-135
-        float v_mq135 = read_voltage(MQ135_CHANNEL);
-        float rs_mq135 = calculate_rs(v_mq135);
-        float ppm_co2 = calculate_ppm_mq135(rs_mq135, R0_MQ135);
-
-        // MQ-5
-        float v_mq5 = read_voltage(MQ5_CHANNEL);
-        float rs_mq5 = calculate_rs(v_mq5);
-        float ppm_ch4 = calculate_ppm_mq5(rs_mq5, R0_MQ5);
-
-        // MQ-9
-        float v_mq9 = read_voltage(MQ9_CHANNEL);
-        float rs_mq9 = calculate_rs(v_mq9);
-        float ppm_co = calculate_ppm_mq9(rs_mq9, R0_MQ9);
-
-        // Log locally
-        ESP_LOGI(TAG, "[MQ-135] V=%.2f mV | CO₂ = %.2f ppm", v_mq135, ppm_co2);
-        ESP_LOGI(TAG, "[MQ-5  ] V=%.2f mV | CH₄ = %.2f ppm", v_mq5, ppm_ch4);
-        ESP_LOGI(TAG, "[MQ-9  ] V=%.2f mV | CO  = %.2f ppm", v_mq9, ppm_co);
-
-        // Send over MQTT
-        char payload[128];
-        snprintf(payload, sizeof(payload),
-                 "{\"co2\": %.2f, \"ch4\": %.2f, \"co\": %.2f}",
-                 ppm_co2, ppm_ch4, ppm_co);
-
-        esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC, payload, 0, 1, 0);
-        ESP_LOGI(TAG, "MQTT Published: %s", payload);
-
-        vTaskDelay(pdMS_TO_TICKS(5000));
-    }
+    // The R0 calibration of a cold boot runs alongside everything else:
+    // the scheduler starts as soon as the sensors, the backlog and the
+    // MQTT client are there, replays the backlog and publishes once R0 is
+    // known. The backlog publishes through the MQTT client, so it waits
+    // for it
+    static const boot_step_config_t steps[STEP_COUNT] = {
+        [STEP_NVS]       = { .name = "nvs", .fn = boot_nvs },
+        [STEP_WIFI]      = { .name = "wifi", .fn = boot_wifi, .deps = BOOT_DEP(STEP_NVS) },
+        [STEP_MQTT]      = { .name = "mqtt", .fn = boot_mqtt, .deps = BOOT_DEP(STEP_WIFI) },
+        [STEP_ADC]       = { .name = "adc", .fn = boot_adc },
+        [STEP_CALIBRATE] = { .name = "calibrate", .fn = boot_calibrate,
+                             .deps = BOOT_DEP(STEP_NVS) | BOOT_DEP(STEP_ADC) },
+        [STEP_BACKLOG]   = { .name = "backlog", .fn = boot_backlog, .deps = BOOT_DEP(STEP_MQTT),
+                             .optional = true },
+        [STEP_SCHED]     = { .name = "sched", .fn = boot_sched,
+                             .deps = BOOT_DEP(STEP_ADC) | BOOT_DEP(STEP_BACKLOG) | BOOT_DEP(STEP_MQTT) },
+    };
+    static boot_step_t step_state[STEP_COUNT];
+
+    ESP_ERROR_CHECK(boot_graph_init(&boot, steps, step_state, STEP_COUNT, esp_timer_get_time()));
+    ESP_ERROR_CHECK(boot_graph_run(&boot));
+    boot_graph_log(&boot, TAG);
 }
@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <nvs_flash.h>
@@ -10,6 +13,12 @@
 #include <dht.h>
 #include <bmp180.h>
 #include <i2cdev.h>
+#include <periodic_sched.h>
+#include <sensor_hub.h>
+#include <mqtt_pub.h>
+#include <mqtt_backlog.h>
+#include <telem_codec.h>
+#include <wifi_mgr.h>
 
 #define TAG "MAIN"
 
@@ -19,85 +28,191 @@
 
 // MQTT
 #define MQTT_BROKER_URI "mqtt://172.20.10.2"
-#define MQTT_TOPIC      "esp32/sensors/gas"
+// Each node publishes on its own topic, the prefix followed by its
+// station MAC as 12 hex digits, so readings and delta frames of several
+// nodes never mix on one topic
+#define MQTT_TOPIC_PREFIX "esp32/sensors/env/"
 
 // Sensors
 #define DHT11_GPIO 4
 #define I2C_SDA 21
 #define I2C_SCL 22
 
+// Sensors are cached every 2 s (the DHT11 minimum), bmp180 half a period
+// later so the bus is never busy with both; published on a fixed 5 s grid
+#define SAMPLE_PERIOD_US  2000000
+#define BMP_PHASE_US      1000000
+#define PUBLISH_PERIOD_US 5000000
+#define PUBLISH_PHASE_US  1500000
+#define STATS_PERIOD_US   (10 * 60 * 1000000)
+
+// Every reading is appended to a log on the "telemetry" partition and
+// sent from there oldest first, REPLAY_PER_RUN at a time: right after it
+// is taken and then once a second, so readings kept while the broker was
+// unreachable go out in order without flooding it
+#define BACKLOG_PARTITION "telemetry"
+#define REPLAY_PERIOD_US  1000000
+#define REPLAY_PHASE_US   500000
+#define REPLAY_PER_RUN    5
+
+// QoS 1 messages waiting for the broker's acknowledgement are capped, so
+// a slow or absent broker cannot grow the client's outbox without bound.
+// Readings that cannot go out wait in the backlog or, without one, in a
+// single slot where each newer reading replaces the last
+#define MQTT_MAX_INFLIGHT  8
+
+// Readings go out as telem_codec frames of about 14 bytes instead of
+// ~90 bytes of JSON; tools/host/telem_dump turns them back into the JSON
+// this node used to send. Frames are absolute: a delta frame is refused
+// by a subscriber that missed the one before it
+#define PAYLOAD_KEY_INTERVAL 1
+
 bmp180_dev_t bmp180;
 esp_mqtt_client_handle_t mqtt_client = NULL;
+static mqtt_pub_t pub;
+static char mqtt_topic[MQTT_BACKLOG_TOPIC_SIZE(MQTT_TOPIC_PREFIX)];
+
+static psched_t sched;
+static sensor_hub_t hub;
+static size_t dht_id, bmp_id = SIZE_MAX;
+static mqtt_backlog_t backlog;
+
+// Order of the values in a reading, the field order of TELEM_SCHEMA_ENV
+enum { VALUE_TEMPERATURE, VALUE_PRESSURE_HPA, VALUE_HUMIDITY, VALUE_COUNT };
 
 static void wifi_init()
 {
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-
-    esp_netif_create_default_wifi_sta();
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-        },
+    wifi_mgr_esp_config_t cfg = {
+        .ssid = WIFI_SSID,
+        .password = WIFI_PASS,
+        .auth_threshold = WIFI_AUTH_WPA2_PSK,
     };
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-
     ESP_LOGI(TAG, "Connecting to Wi-Fi...");
 
-    ESP_ERROR_CHECK(esp_wifi_connect());
+    ESP_ERROR_CHECK(wifi_mgr_esp_start(&cfg));
 }
 
-void publish_sensor_data(void *pvParameters)
+static void payload_sent(void *ctx, uint32_t seq, const float *values, size_t len)
 {
-    while (1)
-    {
-        float humidity = 0, dht_temp = 0;
-        float bmp_temp = 0;
-        uint32_t pressure_raw = 0;
-
-        esp_err_t dht_result = dht_read_float_data(DHT_TYPE_DHT11, DHT11_GPIO, &humidity, &dht_temp);
-        if (dht_result != ESP_OK) {
-            ESP_LOGW(TAG, "DHT11 read failed: %s", esp_err_to_name(dht_result));
-            humidity = -1;
-        }
+    ESP_LOGI(TAG, "MQTT published #%" PRIu32 ": %.2f C, %.2f hPa, %.1f %%", seq,
+             values[VALUE_TEMPERATURE], values[VALUE_PRESSURE_HPA], values[VALUE_HUMIDITY]);
+}
 
-        esp_err_t bmp_result = bmp180_measure(&bmp180, &bmp_temp, &pressure_raw, BMP180_MODE_STANDARD);
-        float pressure_hpa = pressure_raw / 100.0f;
-        if (bmp_result != ESP_OK) {
-            ESP_LOGW(TAG, "BMP180 read failed: %s", esp_err_to_name(bmp_result));
-            bmp_temp = -1;
-            pressure_hpa = -1;
-        }
+static void pub_done(void *ctx, uint32_t seq, bool acked)
+{
+    mqtt_backlog_done(&backlog, seq, acked);
+}
 
-        char payload[128];
-        snprintf(payload, sizeof(payload),
-                 "{\"temperature\": %.2f, \"pressure\": %.2f, \"humidity\": %.1f}",
-                 bmp_temp, pressure_hpa, humidity);
+// Retries whatever could not be sent so far: the slot reading without a
+// backlog, the backlog otherwise
+static void replay_job(void *ctx)
+{
+    mqtt_backlog_poll(&backlog, esp_timer_get_time() / 1000);
+}
 
-        if (mqtt_client != NULL) {
-            int msg_id = esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC, payload, 0, 1, 0);
-            ESP_LOGI(TAG, "MQTT published: %s", payload);
-        }
+static void publish_job(void *ctx)
+{
+    sensor_reading_t dht, bmp;
+    esp_err_t dht_result = sensor_hub_read(&hub, dht_id, &dht);
+    if (dht_result == ESP_OK)
+        dht_result = dht.status;
+    esp_err_t bmp_result = sensor_hub_read(&hub, bmp_id, &bmp);
+    if (bmp_result == ESP_OK)
+        bmp_result = bmp.status;
+
+    float humidity = dht.values[0];
+    if (dht_result != ESP_OK) {
+        ESP_LOGW(TAG, "DHT11 read failed: %s", esp_err_to_name(dht_result));
+        humidity = -1;
+    }
 
-        vTaskDelay(pdMS_TO_TICKS(5000));
+    float bmp_temp = bmp.values[0];
+    float pressure_hpa = bmp.values[1] / 100.0f;
+    if (bmp_result != ESP_OK) {
+        ESP_LOGW(TAG, "BMP180 read failed: %s", esp_err_to_name(bmp_result));
+        bmp_temp = -1;
+        pressure_hpa = -1;
     }
+
+    float values[VALUE_COUNT] = {
+        [VALUE_TEMPERATURE] = bmp_temp,
+        [VALUE_PRESSURE_HPA] = pressure_hpa,
+        [VALUE_HUMIDITY] = humidity,
+    };
+    esp_err_t err = mqtt_backlog_publish(&backlog, values, esp_timer_get_time() / 1000);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Keeping the reading failed: %s", esp_err_to_name(err));
+}
+
+static void stats_job(void *ctx)
+{
+    psched_log_stats(&sched, TAG);
+    wifi_mgr_esp_log_stats(TAG);
+    mqtt_backlog_log_stats(&backlog, TAG);
+}
+
+// The backlog is optional: without the partition, or when it cannot be
+// mounted, only the newest reading is kept while offline
+static void backlog_init(void)
+{
+    mqtt_backlog_config_t cfg = {
+        .pub = &pub,
+        .topic = mqtt_topic,
+        .n_values = VALUE_COUNT,
+        .per_run = REPLAY_PER_RUN,
+        .schema = telem_schema_find(TELEM_SCHEMA_ENV),
+        .key_interval = PAYLOAD_KEY_INTERVAL,
+        .sent = payload_sent,
+    };
+    esp_err_t err = mqtt_backlog_init_esp(&backlog, &cfg, BACKLOG_PARTITION);
+    // A bad configuration leaves nothing to publish through at all
+    if (err == ESP_ERR_INVALID_ARG)
+        ESP_ERROR_CHECK(err);
+    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND)
+        ESP_LOGE(TAG, "Backlog unusable, keeping only the newest reading: %s", esp_err_to_name(err));
+}
+
+// One scheduler task for the whole node, started once at boot rather
+// than on every MQTT (re)connect
+static void sensor_task(void *pvParameters)
+{
+    static psched_job_t jobs[5];
+    static sensor_hub_entry_t entries[2];
+    static sensor_dht_t dht11 = { .type = DHT_TYPE_DHT11, .gpio = DHT11_GPIO };
+    psched_clock_t clock;
+    sensor_hub_sensor_config_t dht = { .name = "dht11", .driver = &sensor_dht, .dev = &dht11,
+                                       .period_us = SAMPLE_PERIOD_US };
+    sensor_hub_sensor_config_t bmp = { .name = "bmp180", .driver = &sensor_bmp180, .dev = &bmp180,
+                                       .period_us = SAMPLE_PERIOD_US, .phase_us = BMP_PHASE_US };
+    psched_job_config_t publish = { .name = "publish", .fn = publish_job,
+                                    .period_us = PUBLISH_PERIOD_US, .phase_us = PUBLISH_PHASE_US };
+    psched_job_config_t replay = { .name = "replay", .fn = replay_job,
+                                   .period_us = REPLAY_PERIOD_US, .phase_us = REPLAY_PHASE_US };
+    psched_job_config_t stats = { .name = "stats", .fn = stats_job,
+                                  .period_us = STATS_PERIOD_US, .phase_us = STATS_PERIOD_US };
+
+    backlog_init();
+    ESP_ERROR_CHECK(psched_esp_clock_create(&clock));
+    ESP_ERROR_CHECK(psched_init(&sched, &clock, jobs, 5));
+    ESP_ERROR_CHECK(sensor_hub_init(&hub, &sched, entries, 2));
+    ESP_ERROR_CHECK(sensor_hub_add(&hub, &dht, &dht_id));
+    if (sensor_hub_add(&hub, &bmp, &bmp_id) != ESP_OK)
+        ESP_LOGW(TAG, "BMP180 init failed");
+    ESP_ERROR_CHECK(psched_add(&sched, &publish, NULL));
+    ESP_ERROR_CHECK(psched_add(&sched, &replay, NULL));
+    ESP_ERROR_CHECK(psched_add(&sched, &stats, NULL));
+    psched_run(&sched);
+    vTaskDelete(NULL);
 }
 
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
 {
+    mqtt_pub_esp_event(&pub, event);
     switch (event->event_id)
     {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT connected");
-            xTaskCreate(publish_sensor_data, "sensor_pub_task", 4096, NULL, 5, NULL);
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGW(TAG, "MQTT disconnected");
@@ -120,7 +235,6 @@ void app_main(void)
 
     i2cdev_init();
     bmp180_init_desc(&bmp180, I2C_NUM_0, I2C_SDA, I2C_SCL);
-    bmp180_init(&bmp180);
 
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker = {
@@ -128,7 +242,11 @@ void app_main(void)
         }
     };
 
+    ESP_ERROR_CHECK(mqtt_backlog_topic(MQTT_TOPIC_PREFIX, mqtt_topic, sizeof(mqtt_topic)));
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+    ESP_ERROR_CHECK(mqtt_pub_init_esp(&pub, mqtt_client, 1, MQTT_MAX_INFLIGHT, pub_done, NULL));
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(mqtt_client);
+
+    xTaskCreate(sensor_task, "sensor_pub_task", 4096, NULL, 5, NULL);
 }
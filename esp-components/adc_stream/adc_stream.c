@@ -0,0 +1,282 @@
+/**
+ * @file adc_stream.c
+ *
+ * Continuous ADC1 acquisition with on-chip decimation
+ */
+#include "adc_stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+static const char *TAG = "adc_stream";
+
+// Conversions per DMA frame; the stream task wakes up once per frame
+#define CONV_PER_FRAME  256
+#define FRAME_BYTES     (CONV_PER_FRAME * SOC_ADC_DIGI_RESULT_BYTES)
+#define STREAM_STACK    3072
+
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define OUTPUT_FORMAT   ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define RESULT_CHANNEL(p) ((p)->type1.channel)
+#define RESULT_DATA(p)    ((p)->type1.data)
+#else
+#define OUTPUT_FORMAT   ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define RESULT_CHANNEL(p) ((p)->type2.channel)
+#define RESULT_DATA(p)    ((p)->type2.data)
+#endif
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define NO_SLOT 0xFF
+
+struct adc_stream_s
+{
+    adc_stream_config_t cfg;
+    adc_channel_t channels[ADC_STREAM_MAX_CHANNELS];
+    adc_continuous_handle_t handle;
+    TaskHandle_t task;
+    SemaphoreHandle_t stopped;
+    volatile bool stopping;
+
+    // Decimator state, touched only by the stream task
+    uint8_t slot_of[SOC_ADC_MAX_CHANNEL_NUM];
+    uint32_t decim;
+    uint32_t sum[ADC_STREAM_MAX_CHANNELS];
+    uint32_t count[ADC_STREAM_MAX_CHANNELS];
+    uint16_t pending[ADC_STREAM_MAX_CHANNELS];
+    uint32_t filled;
+
+    // Published frame
+    portMUX_TYPE lock;
+    uint16_t latest[ADC_STREAM_MAX_CHANNELS];
+    uint32_t seq;
+    volatile uint32_t overflows;
+
+    uint8_t frame[FRAME_BYTES];
+};
+
+static bool IRAM_ATTR on_conv_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    adc_stream_t *stream = user_data;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(stream->task, &woken);
+    return woken == pdTRUE;
+}
+
+static bool IRAM_ATTR on_pool_ovf(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    adc_stream_t *stream = user_data;
+    stream->overflows++;
+    return false;
+}
+
+static void publish(adc_stream_t *stream)
+{
+    size_t n = stream->cfg.n_channels;
+    uint32_t seq;
+
+    taskENTER_CRITICAL(&stream->lock);
+    memcpy(stream->latest, stream->pending, n * sizeof(uint16_t));
+    seq = ++stream->seq;
+    taskEXIT_CRITICAL(&stream->lock);
+
+    if (stream->cfg.callback)
+        stream->cfg.callback(stream->pending, n, seq, stream->cfg.callback_ctx);
+}
+
+static void process_frame(adc_stream_t *stream, const uint8_t *buf, uint32_t len)
+{
+    const uint32_t all = (1u << stream->cfg.n_channels) - 1;
+
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+        const adc_digi_output_data_t *p = (const adc_digi_output_data_t *)&buf[i];
+        uint32_t ch = RESULT_CHANNEL(p);
+        if (ch >= SOC_ADC_MAX_CHANNEL_NUM || stream->slot_of[ch] == NO_SLOT)
+            continue;
+
+        uint8_t s = stream->slot_of[ch];
+        stream->sum[s] += RESULT_DATA(p);
+        if (++stream->count[s] < stream->decim)
+            continue;
+
+        // Boxcar average with rounding, all integer
+        stream->pending[s] = (stream->sum[s] + stream->decim / 2) / stream->decim;
+        stream->sum[s] = 0;
+        stream->count[s] = 0;
+        stream->filled |= 1u << s;
+
+        if (stream->filled == all)
+        {
+            publish(stream);
+            stream->filled = 0;
+        }
+    }
+}
+
+static void stream_task(void *arg)
+{
+    adc_stream_t *stream = arg;
+    uint32_t len;
+
+    while (!stream->stopping)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (!stream->stopping &&
+               adc_continuous_read(stream->handle, stream->frame, sizeof(stream->frame), &len, 0) == ESP_OK)
+            process_frame(stream, stream->frame, len);
+    }
+
+    xSemaphoreGive(stream->stopped);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t configure_adc(adc_stream_t *stream)
+{
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = FRAME_BYTES * 4,
+        .conv_frame_size = FRAME_BYTES,
+    };
+    CHECK(adc_continuous_new_handle(&handle_cfg, &stream->handle));
+
+    adc_digi_pattern_config_t pattern[ADC_STREAM_MAX_CHANNELS] = { 0 };
+    for (size_t i = 0; i < stream->cfg.n_channels; i++)
+    {
+        pattern[i].atten = stream->cfg.atten;
+        pattern[i].channel = stream->channels[i] & 0x7;
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = stream->cfg.n_channels,
+        .adc_pattern = pattern,
+        .sample_freq_hz = stream->cfg.sample_freq_hz,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = OUTPUT_FORMAT,
+    };
+    CHECK(adc_continuous_config(stream->handle, &dig_cfg));
+
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = on_conv_done,
+        .on_pool_ovf = on_pool_ovf,
+    };
+    CHECK(adc_continuous_register_event_callbacks(stream->handle, &cbs, stream));
+
+    return ESP_OK;
+}
+
+static void release(adc_stream_t *stream)
+{
+    if (stream->handle)
+        adc_continuous_deinit(stream->handle);
+    if (stream->stopped)
+        vSemaphoreDelete(stream->stopped);
+    free(stream);
+}
+
+esp_err_t adc_stream_start(const adc_stream_config_t *config, adc_stream_t **out)
+{
+    CHECK_ARG(config && out && config->channels);
+    CHECK_ARG(config->n_channels > 0 && config->n_channels <= ADC_STREAM_MAX_CHANNELS);
+    CHECK_ARG(config->sample_freq_hz >= SOC_ADC_SAMPLE_FREQ_THRES_LOW &&
+              config->sample_freq_hz <= SOC_ADC_SAMPLE_FREQ_THRES_HIGH);
+    CHECK_ARG(config->output_hz > 0);
+
+    adc_stream_t *stream = calloc(1, sizeof(adc_stream_t));
+    if (!stream)
+        return ESP_ERR_NO_MEM;
+
+    stream->cfg = *config;
+    memcpy(stream->channels, config->channels, config->n_channels * sizeof(adc_channel_t));
+    stream->cfg.channels = stream->channels;
+    stream->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+
+    memset(stream->slot_of, NO_SLOT, sizeof(stream->slot_of));
+    for (size_t i = 0; i < config->n_channels; i++)
+    {
+        if (config->channels[i] >= SOC_ADC_MAX_CHANNEL_NUM)
+        {
+            free(stream);
+            return ESP_ERR_INVALID_ARG;
+        }
+        stream->slot_of[config->channels[i]] = i;
+    }
+
+    stream->decim = config->sample_freq_hz / config->n_channels / config->output_hz;
+    if (stream->decim == 0)
+        stream->decim = 1;
+
+    stream->stopped = xSemaphoreCreateBinary();
+    if (!stream->stopped)
+    {
+        free(stream);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = configure_adc(stream);
+    if (err != ESP_OK)
+    {
+        release(stream);
+        return err;
+    }
+
+    if (xTaskCreatePinnedToCore(stream_task, "adc_stream", STREAM_STACK, stream,
+                                config->task_priority, &stream->task, config->task_core) != pdPASS)
+    {
+        release(stream);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = adc_continuous_start(stream->handle);
+    if (err != ESP_OK)
+    {
+        adc_stream_stop(stream);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "%u channels at %lu Hz, averaging %lu conversions per output (%lu Hz)",
+             (unsigned)config->n_channels, (unsigned long)config->sample_freq_hz,
+             (unsigned long)stream->decim, (unsigned long)config->output_hz);
+
+    *out = stream;
+    return ESP_OK;
+}
+
+esp_err_t adc_stream_stop(adc_stream_t *stream)
+{
+    CHECK_ARG(stream);
+
+    adc_continuous_stop(stream->handle);
+    stream->stopping = true;
+    xTaskNotifyGive(stream->task);
+    xSemaphoreTake(stream->stopped, portMAX_DELAY);
+    release(stream);
+
+    return ESP_OK;
+}
+
+esp_err_t adc_stream_get(adc_stream_t *stream, uint16_t *values, size_t n, uint32_t *seq)
+{
+    CHECK_ARG(stream && values);
+
+    if (n > stream->cfg.n_channels)
+        n = stream->cfg.n_channels;
+
+    taskENTER_CRITICAL(&stream->lock);
+    memcpy(values, stream->latest, n * sizeof(uint16_t));
+    if (seq)
+        *seq = stream->seq;
+    taskEXIT_CRITICAL(&stream->lock);
+
+    return ESP_OK;
+}
+
+uint32_t adc_stream_overflows(const adc_stream_t *stream)
+{
+    return stream ? stream->overflows : 0;
+}
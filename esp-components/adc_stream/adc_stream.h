@@ -0,0 +1,95 @@
+/**
+ * @file adc_stream.h
+ * @defgroup adc_stream adc_stream
+ * @{
+ *
+ * Continuous ADC1 acquisition with on-chip decimation.
+ *
+ * The channels are scanned round-robin by the DMA-based continuous ADC
+ * driver. A single task wakes up once per DMA frame, accumulates every
+ * conversion into a per-channel boxcar (integer sum / count) and publishes
+ * one averaged value per channel at the configured output rate. Readers
+ * either poll the latest frame or get a callback from the stream task.
+ */
+#ifndef __ADC_STREAM_H__
+#define __ADC_STREAM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_adc/adc_continuous.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ADC_STREAM_MAX_CHANNELS 8 //!< Channels per stream
+
+/**
+ * Called from the stream task each time a new averaged frame is ready.
+ * values[i] is the averaged 12-bit code of config.channels[i].
+ */
+typedef void (*adc_stream_cb_t)(const uint16_t *values, size_t n_channels, uint32_t seq, void *ctx);
+
+/**
+ * Stream configuration
+ */
+typedef struct
+{
+    const adc_channel_t *channels; //!< ADC1 channels to scan
+    size_t n_channels;             //!< Number of channels, up to ADC_STREAM_MAX_CHANNELS
+    adc_atten_t atten;             //!< Attenuation applied to all channels
+    uint32_t sample_freq_hz;       //!< Total conversions per second (all channels)
+    uint32_t output_hz;            //!< Averaged frames per second
+    adc_stream_cb_t callback;      //!< Optional, called for every frame
+    void *callback_ctx;            //!< Passed to callback
+    UBaseType_t task_priority;     //!< Priority of the stream task
+    BaseType_t task_core;          //!< Core of the stream task, tskNO_AFFINITY for any
+} adc_stream_config_t;
+
+typedef struct adc_stream_s adc_stream_t;
+
+/**
+ * @brief Configure the ADC and start continuous conversion
+ *
+ * @param config Stream configuration, copied
+ * @param[out] out Stream handle
+ * @return `ESP_OK` on success
+ */
+esp_err_t adc_stream_start(const adc_stream_config_t *config, adc_stream_t **out);
+
+/**
+ * @brief Stop conversion and release the stream
+ *
+ * @param stream Stream handle
+ * @return `ESP_OK` on success
+ */
+esp_err_t adc_stream_stop(adc_stream_t *stream);
+
+/**
+ * @brief Copy the latest averaged frame
+ *
+ * @param stream Stream handle
+ * @param[out] values Averaged codes, one per configured channel
+ * @param n Size of values, at most the configured channel count is written
+ * @param[out] seq Frame sequence number, 0 until the first frame; may be NULL
+ * @return `ESP_OK` on success
+ */
+esp_err_t adc_stream_get(adc_stream_t *stream, uint16_t *values, size_t n, uint32_t *seq);
+
+/**
+ * @brief Conversions dropped because the stream task fell behind the DMA
+ *
+ * @param stream Stream handle
+ * @return Number of overflow events seen so far
+ */
+uint32_t adc_stream_overflows(const adc_stream_t *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __ADC_STREAM_H__ */
@@ -0,0 +1,182 @@
+/**
+ * @file boot_graph.c
+ *
+ * Startup as a dependency graph of init steps, portable core
+ */
+#include "boot_graph.h"
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+static uint32_t all_steps(size_t n)
+{
+    return n >= 32 ? UINT32_MAX : (1u << n) - 1;
+}
+
+esp_err_t boot_graph_init(boot_graph_t *g, const boot_step_config_t *cfg, boot_step_t *steps, size_t n,
+                          int64_t now_us)
+{
+    CHECK_ARG(g && (!n || (cfg && steps)) && n <= BOOT_GRAPH_MAX_STEPS);
+
+    // Every dependency must exist, and peeling off steps whose
+    // dependencies are all peeled must reach every step, or there is a
+    // cycle
+    uint32_t all = all_steps(n), peeled = 0;
+    for (size_t i = 0; i < n; i++)
+        CHECK_ARG(cfg[i].fn && !(cfg[i].deps & ~all));
+    for (size_t pass = 0; pass < n; pass++)
+        for (size_t i = 0; i < n; i++)
+            if (!(cfg[i].deps & ~peeled))
+                peeled |= BOOT_DEP(i);
+    CHECK_ARG(peeled == all);
+
+    memset(g, 0, sizeof(*g));
+    g->steps = steps;
+    g->n_steps = n;
+    g->start_us = now_us;
+    g->end_us = now_us;
+    for (size_t i = 0; i < n; i++)
+    {
+        memset(&steps[i], 0, sizeof(steps[i]));
+        steps[i].cfg = cfg[i];
+        steps[i].state = BOOT_STEP_WAITING;
+    }
+
+    return ESP_OK;
+}
+
+int boot_graph_next(boot_graph_t *g, int64_t now_us)
+{
+    for (size_t i = 0; i < g->n_steps; i++)
+    {
+        boot_step_t *s = &g->steps[i];
+        if (s->state == BOOT_STEP_WAITING && !(s->cfg.deps & ~g->done))
+        {
+            s->state = BOOT_STEP_RUNNING;
+            s->start_us = now_us;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void finish(boot_graph_t *g, boot_step_t *s, boot_step_state_t state, int64_t now_us)
+{
+    s->state = state;
+    s->end_us = now_us;
+    if (++g->n_finished == g->n_steps)
+        g->end_us = now_us;
+}
+
+void boot_graph_done(boot_graph_t *g, int i, esp_err_t err, int64_t now_us)
+{
+    if (i < 0 || (size_t)i >= g->n_steps || g->steps[i].state != BOOT_STEP_RUNNING)
+        return;
+
+    boot_step_t *s = &g->steps[i];
+    s->err = err;
+    if (err == ESP_OK)
+    {
+        g->done |= BOOT_DEP(i);
+        finish(g, s, BOOT_STEP_DONE, now_us);
+        return;
+    }
+    finish(g, s, BOOT_STEP_FAILED, now_us);
+    if (s->cfg.optional)
+    {
+        g->done |= BOOT_DEP(i);
+        return;
+    }
+
+    // Skip whatever depends on it, directly or through other skipped steps
+    uint32_t bad = BOOT_DEP(i);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t j = 0; j < g->n_steps; j++)
+        {
+            boot_step_t *t = &g->steps[j];
+            if (t->state == BOOT_STEP_WAITING && (t->cfg.deps & bad))
+            {
+                t->start_us = now_us;
+                finish(g, t, BOOT_STEP_SKIPPED, now_us);
+                bad |= BOOT_DEP(j);
+                changed = true;
+            }
+        }
+    }
+}
+
+esp_err_t boot_graph_result(const boot_graph_t *g)
+{
+    const boot_step_t *first = NULL;
+    for (size_t i = 0; i < g->n_steps; i++)
+    {
+        const boot_step_t *s = &g->steps[i];
+        if (s->state == BOOT_STEP_FAILED && !s->cfg.optional && (!first || s->end_us < first->end_us))
+            first = s;
+    }
+    return first ? first->err : ESP_OK;
+}
+
+int64_t boot_graph_critical_path(const boot_graph_t *g, uint32_t *path)
+{
+    int64_t finish_us[BOOT_GRAPH_MAX_STEPS];
+    int pred[BOOT_GRAPH_MAX_STEPS];
+    uint32_t known = 0;
+
+    // Dependencies may point either way in the array, so settle steps in
+    // passes; init() ruled out cycles
+    for (size_t pass = 0; pass < g->n_steps; pass++)
+    {
+        for (size_t i = 0; i < g->n_steps; i++)
+        {
+            const boot_step_t *s = &g->steps[i];
+            if ((known & BOOT_DEP(i)) || (s->cfg.deps & ~known))
+                continue;
+            int64_t before = 0;
+            pred[i] = -1;
+            for (size_t d = 0; d < g->n_steps; d++)
+            {
+                if ((s->cfg.deps & BOOT_DEP(d)) && finish_us[d] > before)
+                {
+                    before = finish_us[d];
+                    pred[i] = d;
+                }
+            }
+            int64_t dur = s->state >= BOOT_STEP_DONE ? s->end_us - s->start_us : 0;
+            finish_us[i] = before + dur;
+            known |= BOOT_DEP(i);
+        }
+    }
+
+    int64_t longest = 0;
+    int last = -1;
+    for (size_t i = 0; i < g->n_steps; i++)
+    {
+        if (finish_us[i] > longest)
+        {
+            longest = finish_us[i];
+            last = i;
+        }
+    }
+    if (path)
+    {
+        *path = 0;
+        for (int i = last; i >= 0; i = pred[i])
+            *path |= BOOT_DEP(i);
+    }
+    return longest;
+}
+
+bool boot_graph_mark(boot_graph_t *g, const char *name, int64_t now_us)
+{
+    for (size_t i = 0; i < g->n_marks; i++)
+        if (!strcmp(g->marks[i].name, name))
+            return false;
+    if (g->n_marks == BOOT_GRAPH_MAX_MARKS)
+        return false;
+    g->marks[g->n_marks++] = (boot_mark_t) { name, now_us };
+    return true;
+}
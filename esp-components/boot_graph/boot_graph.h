@@ -0,0 +1,220 @@
+/**
+ * @file boot_graph.h
+ * @defgroup boot_graph boot_graph
+ * @{
+ *
+ * Startup as a dependency graph of init steps.
+ *
+ * Each step names the steps that must have finished before it may start;
+ * everything else runs concurrently, so a slow step (a sensor
+ * calibration, waiting for Wi-Fi) only delays the steps that actually need
+ * its result. A step that fails takes the steps depending on it, directly
+ * or not, with it: they are skipped and reported, the rest still run. An
+ * optional step, one the application can do without, is reported when it
+ * fails but its dependents still run and the boot still succeeds.
+ *
+ * Start and end of every step are recorded, together with named
+ * milestones (first sample, first upload) that the application reports
+ * later on. From the recorded durations the critical path, the longest
+ * chain of dependent steps, gives the earliest the boot could have
+ * finished with unlimited parallelism.
+ *
+ * The graph bookkeeping is portable and driven by the caller's clock; the
+ * ESP part runs each step in its own task as soon as it is ready.
+ */
+#ifndef __BOOT_GRAPH_H__
+#define __BOOT_GRAPH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_GRAPH_MAX_STEPS 32
+#define BOOT_GRAPH_MAX_MARKS 8
+
+/**
+ * Dependency on the step at index i of the configuration array
+ */
+#define BOOT_DEP(i) (1u << (i))
+
+typedef esp_err_t (*boot_step_fn_t)(void *ctx);
+
+/**
+ * Step description
+ */
+typedef struct
+{
+    const char *name;
+    boot_step_fn_t fn;
+    void *ctx;           //!< Passed to fn
+    uint32_t deps;       //!< BOOT_DEP() of every step that must finish first
+    uint32_t stack;      //!< Stack of the step task, 0 = 4096 bytes
+    bool optional;       //!< A failure skips no steps and does not fail the boot
+} boot_step_config_t;
+
+/**
+ * Step state
+ */
+typedef enum
+{
+    BOOT_STEP_WAITING = 0,
+    BOOT_STEP_RUNNING,
+    BOOT_STEP_DONE,
+    BOOT_STEP_FAILED,
+    BOOT_STEP_SKIPPED,   //!< A step it depends on failed
+} boot_step_state_t;
+
+/**
+ * Step record
+ */
+typedef struct
+{
+    boot_step_config_t cfg;
+    boot_step_state_t state;
+    esp_err_t err;
+    int64_t start_us;
+    int64_t end_us;
+} boot_step_t;
+
+/**
+ * Milestone
+ */
+typedef struct
+{
+    const char *name;
+    int64_t time_us;
+} boot_mark_t;
+
+/**
+ * Boot graph
+ */
+typedef struct
+{
+    boot_step_t *steps;
+    size_t n_steps;
+    size_t n_finished;   //!< Done, failed or skipped
+    uint32_t done;       //!< Steps that finished successfully, or optional ones that failed
+    int64_t start_us;
+    int64_t end_us;      //!< Last step finished
+    boot_mark_t marks[BOOT_GRAPH_MAX_MARKS];
+    size_t n_marks;
+} boot_graph_t;
+
+/**
+ * @brief Initialize a graph on caller-provided step storage
+ *
+ * @param g Graph
+ * @param cfg Steps; dependencies refer to indices in this array
+ * @param steps Storage for n records
+ * @param n Number of steps, up to BOOT_GRAPH_MAX_STEPS
+ * @param now_us Current time
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_ARG` for a dependency on
+ *         a missing step or a dependency cycle
+ */
+esp_err_t boot_graph_init(boot_graph_t *g, const boot_step_config_t *cfg, boot_step_t *steps, size_t n,
+                          int64_t now_us);
+
+/**
+ * @brief Take the next step whose dependencies have all finished
+ *
+ * The step is marked running. Steps become ready in configuration order.
+ *
+ * @param g Graph
+ * @param now_us Current time
+ * @return Index of the step, or -1 if none is ready
+ */
+int boot_graph_next(boot_graph_t *g, int64_t now_us);
+
+/**
+ * @brief Record the end of a running step
+ *
+ * A failed step also marks every step depending on it as skipped,
+ * unless it is optional.
+ *
+ * @param g Graph
+ * @param i Index from boot_graph_next()
+ * @param err Result of the step
+ * @param now_us Current time
+ */
+void boot_graph_done(boot_graph_t *g, int i, esp_err_t err, int64_t now_us);
+
+/**
+ * @brief Whether every step has finished, failed or been skipped
+ */
+static inline bool boot_graph_finished(const boot_graph_t *g)
+{
+    return g->n_finished == g->n_steps;
+}
+
+/**
+ * @brief Result of the boot
+ *
+ * @return `ESP_OK` if every step that is not optional succeeded,
+ *         otherwise the error of the first of them that failed
+ */
+esp_err_t boot_graph_result(const boot_graph_t *g);
+
+/**
+ * @brief Length of the critical path from the recorded durations
+ *
+ * Only meaningful once the graph has finished.
+ *
+ * @param g Graph
+ * @param[out] path BOOT_DEP() of the steps on it; may be NULL
+ * @return Sum of the durations along the longest dependency chain, us
+ */
+int64_t boot_graph_critical_path(const boot_graph_t *g, uint32_t *path);
+
+/**
+ * @brief Record a milestone; only the first one of each name is kept
+ *
+ * @param g Graph
+ * @param name Milestone name, must stay valid
+ * @param now_us Current time
+ * @return true when it was recorded, false if already known or no room
+ */
+bool boot_graph_mark(boot_graph_t *g, const char *name, int64_t now_us);
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Run every step, each in its own task, and wait for all of them
+ *
+ * Step tasks run at the priority of the caller. Times are esp_timer
+ * times, that is since the chip started.
+ *
+ * @param g Graph from boot_graph_init()
+ * @return Result of boot_graph_result()
+ */
+esp_err_t boot_graph_run(boot_graph_t *g);
+
+/**
+ * @brief Record a milestone now and log it, from any task
+ *
+ * @param g Graph
+ * @param name Milestone name, must stay valid
+ */
+void boot_graph_mark_now(boot_graph_t *g, const char *name);
+
+/**
+ * @brief Log the start and end of every step and the critical path
+ *
+ * @param g Graph
+ * @param tag Log tag
+ */
+void boot_graph_log(const boot_graph_t *g, const char *tag);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __BOOT_GRAPH_H__ */
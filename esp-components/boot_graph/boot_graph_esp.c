@@ -0,0 +1,142 @@
+/**
+ * @file boot_graph_esp.c
+ *
+ * boot_graph steps in FreeRTOS tasks, and logging
+ */
+#include "boot_graph.h"
+#include <stdint.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_STACK 4096
+
+static const char *TAG = "boot";
+
+// One graph runs at a time; milestones come from any task later on
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static boot_graph_t *running;
+static SemaphoreHandle_t finished;
+static UBaseType_t step_priority;
+
+static void step_task(void *arg);
+
+// Starts a task for every step that has become ready. Called after each
+// step ends, by the task that ran it
+static void launch_ready(boot_graph_t *g)
+{
+    while (1)
+    {
+        portENTER_CRITICAL(&lock);
+        int i = boot_graph_next(g, esp_timer_get_time());
+        portEXIT_CRITICAL(&lock);
+        if (i < 0)
+            break;
+
+        const boot_step_config_t *cfg = &g->steps[i].cfg;
+        if (xTaskCreate(step_task, cfg->name, cfg->stack ? cfg->stack : DEFAULT_STACK, (void *)(intptr_t)i,
+                        step_priority, NULL) != pdPASS)
+        {
+            portENTER_CRITICAL(&lock);
+            boot_graph_done(g, i, ESP_ERR_NO_MEM, esp_timer_get_time());
+            portEXIT_CRITICAL(&lock);
+        }
+    }
+
+    portENTER_CRITICAL(&lock);
+    bool all = boot_graph_finished(g);
+    portEXIT_CRITICAL(&lock);
+    if (all)
+        xSemaphoreGive(finished);
+}
+
+static void step_task(void *arg)
+{
+    boot_graph_t *g = running;
+    int i = (intptr_t)arg;
+    const boot_step_config_t *cfg = &g->steps[i].cfg;
+
+    esp_err_t err = cfg->fn(cfg->ctx);
+    if (err != ESP_OK && cfg->optional)
+        ESP_LOGW(TAG, "%s failed, continuing without it: %s", cfg->name, esp_err_to_name(err));
+    else if (err != ESP_OK)
+        ESP_LOGE(TAG, "%s failed: %s", cfg->name, esp_err_to_name(err));
+
+    portENTER_CRITICAL(&lock);
+    boot_graph_done(g, i, err, esp_timer_get_time());
+    portEXIT_CRITICAL(&lock);
+
+    launch_ready(g);
+    vTaskDelete(NULL);
+}
+
+esp_err_t boot_graph_run(boot_graph_t *g)
+{
+    CHECK_ARG(g);
+    if (running)
+        return ESP_ERR_INVALID_STATE;
+
+    if (!finished)
+        finished = xSemaphoreCreateBinary();
+    if (!finished)
+        return ESP_ERR_NO_MEM;
+
+    step_priority = uxTaskPriorityGet(NULL);
+    running = g;
+    // Several tasks may find the graph finished; only one wakeup counts
+    xSemaphoreTake(finished, 0);
+    launch_ready(g);
+    xSemaphoreTake(finished, portMAX_DELAY);
+    running = NULL;
+
+    return boot_graph_result(g);
+}
+
+void boot_graph_mark_now(boot_graph_t *g, const char *name)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    bool added = boot_graph_mark(g, name, now);
+    portEXIT_CRITICAL(&lock);
+    if (added)
+        ESP_LOGI(TAG, "%s at %lld ms", name, (long long)(now / 1000));
+}
+
+static const char *state_name(boot_step_state_t state)
+{
+    switch (state)
+    {
+        case BOOT_STEP_DONE:
+            return "";
+        case BOOT_STEP_FAILED:
+            return " FAILED";
+        case BOOT_STEP_SKIPPED:
+            return " skipped";
+        default:
+            return " running";
+    }
+}
+
+void boot_graph_log(const boot_graph_t *g, const char *tag)
+{
+    uint32_t path;
+    int64_t critical = boot_graph_critical_path(g, &path);
+
+    // Times since the chip started, critical path steps starred
+    for (size_t i = 0; i < g->n_steps; i++)
+    {
+        const boot_step_t *s = &g->steps[i];
+        ESP_LOGI(tag, "%c %-12s %6lld - %6lld ms (%lld ms)%s", path & BOOT_DEP(i) ? '*' : ' ',
+                 s->cfg.name ? s->cfg.name : "?", (long long)(s->start_us / 1000), (long long)(s->end_us / 1000),
+                 (long long)((s->end_us - s->start_us) / 1000), state_name(s->state));
+    }
+    ESP_LOGI(tag, "Boot steps took %lld ms from %lld ms, critical path %lld ms",
+             (long long)((g->end_us - g->start_us) / 1000), (long long)(g->start_us / 1000),
+             (long long)(critical / 1000));
+    for (size_t i = 0; i < g->n_marks; i++)
+        ESP_LOGI(tag, "%s at %lld ms", g->marks[i].name, (long long)(g->marks[i].time_us / 1000));
+}
@@ -0,0 +1,232 @@
+/**
+ * @file fixfmt.c
+ *
+ * Text formatting into caller buffers without printf
+ */
+#include "fixfmt.h"
+#include <string.h>
+
+static const uint32_t scale[FIXFMT_DECIMALS_MAX + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+void fixfmt_init(fixfmt_t *f, char *buf, size_t size)
+{
+    f->buf = buf;
+    f->size = size;
+    f->len = 0;
+    f->overflow = !size;
+    if (size)
+        buf[0] = 0;
+}
+
+static void put(fixfmt_t *f, const char *s, size_t n)
+{
+    if (f->overflow)
+        return;
+    if (n >= f->size - f->len)
+    {
+        f->overflow = true;
+        return;
+    }
+    memcpy(f->buf + f->len, s, n);
+    f->len += n;
+    f->buf[f->len] = 0;
+}
+
+void fixfmt_str(fixfmt_t *f, const char *s)
+{
+    put(f, s, strlen(s));
+}
+
+void fixfmt_char(fixfmt_t *f, char c)
+{
+    put(f, &c, 1);
+}
+
+void fixfmt_json_str(fixfmt_t *f, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    fixfmt_char(f, '"');
+    for (; *s; s++)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            char esc[2] = { '\\', c };
+            put(f, esc, 2);
+        }
+        else if (c == '\n')
+            put(f, "\\n", 2);
+        else if (c == '\r')
+            put(f, "\\r", 2);
+        else if (c == '\t')
+            put(f, "\\t", 2);
+        else if (c < 0x20)
+        {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            put(f, esc, 6);
+        }
+        else
+            put(f, (const char *)&c, 1);
+    }
+    fixfmt_char(f, '"');
+}
+
+// Writes at least min_digits digits, zero-padded. Values that fit 32 bits
+// take the cheaper 32-bit divisions, which is nearly all of them
+static void put_digits(fixfmt_t *f, uint64_t v, int min_digits)
+{
+    char tmp[20];
+    int n = 0;
+    while (v > UINT32_MAX)
+    {
+        tmp[sizeof(tmp) - 1 - n++] = '0' + v % 10;
+        v /= 10;
+    }
+    uint32_t v32 = v;
+    do
+    {
+        tmp[sizeof(tmp) - 1 - n++] = '0' + v32 % 10;
+        v32 /= 10;
+    } while (v32);
+    while (n < min_digits)
+        tmp[sizeof(tmp) - 1 - n++] = '0';
+    put(f, tmp + sizeof(tmp) - n, n);
+}
+
+// Numbers are assembled here and appended in one piece, so one that does
+// not fit leaves no partial digits behind. Sign, 39 digits of the largest
+// float, point and decimals
+#define NUMBER_MAX 48
+
+static void put_number(fixfmt_t *f, const fixfmt_t *num)
+{
+    put(f, num->buf, num->len);
+}
+
+void fixfmt_uint(fixfmt_t *f, uint64_t v)
+{
+    char buf[NUMBER_MAX];
+    fixfmt_t num;
+    fixfmt_init(&num, buf, sizeof(buf));
+    put_digits(&num, v, 1);
+    put_number(f, &num);
+}
+
+void fixfmt_int(fixfmt_t *f, int64_t v)
+{
+    char buf[NUMBER_MAX];
+    fixfmt_t num;
+    fixfmt_init(&num, buf, sizeof(buf));
+    if (v < 0)
+        fixfmt_char(&num, '-');
+    put_digits(&num, v < 0 ? 0 - (uint64_t)v : (uint64_t)v, 1);
+    put_number(f, &num);
+}
+
+static void put_fixed(fixfmt_t *f, uint64_t mag, int decimals)
+{
+    put_digits(f, mag / scale[decimals], 1);
+    if (decimals)
+    {
+        fixfmt_char(f, '.');
+        put_digits(f, mag % scale[decimals], decimals);
+    }
+}
+
+void fixfmt_fixed(fixfmt_t *f, int64_t raw, int decimals)
+{
+    if (decimals < 0 || decimals > FIXFMT_DECIMALS_MAX)
+        decimals = FIXFMT_DECIMALS_MAX;
+    char buf[NUMBER_MAX];
+    fixfmt_t num;
+    fixfmt_init(&num, buf, sizeof(buf));
+    if (raw < 0)
+        fixfmt_char(&num, '-');
+    put_fixed(&num, raw < 0 ? 0 - (uint64_t)raw : (uint64_t)raw, decimals);
+    put_number(f, &num);
+}
+
+// m * 2^e for integers beyond 64 bits (floats above about 1.8e19), in
+// base 10^9 limbs; a float stays below 2^128, so 5 limbs hold it
+static void put_big(fixfmt_t *f, uint32_t m, int e)
+{
+    uint32_t limb[5] = { m % 1000000000, m / 1000000000 };
+    int n = 2;
+    while (e > 0)
+    {
+        int k = e > 28 ? 28 : e;
+        uint64_t carry = 0;
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t x = ((uint64_t)limb[i] << k) + carry;
+            limb[i] = x % 1000000000;
+            carry = x / 1000000000;
+        }
+        if (carry)
+            limb[n++] = carry;
+        e -= k;
+    }
+    put_digits(f, limb[n - 1], 1);
+    for (int i = n - 2; i >= 0; i--)
+        put_digits(f, limb[i], 9);
+}
+
+static void put_float(fixfmt_t *f, float v, int decimals)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int exp = (bits >> 23) & 0xff;
+    uint32_t frac = bits & 0x7fffff;
+    if (bits >> 31)
+        fixfmt_char(f, '-');
+    if (exp == 0xff)
+    {
+        fixfmt_str(f, frac ? "nan" : "inf");
+        return;
+    }
+
+    // v = m * 2^e exactly
+    uint32_t m = exp ? frac | 0x800000 : frac;
+    int e = exp ? exp - 150 : -149;
+
+    if (e >= 0)
+    {
+        if (e <= 40)
+            put_digits(f, (uint64_t)m << e, 1);
+        else
+            put_big(f, m, e);
+        if (decimals)
+        {
+            fixfmt_char(f, '.');
+            put_digits(f, 0, decimals);
+        }
+        return;
+    }
+
+    // Scale to the decimals first (below 2^44), then shift the binary
+    // fraction out, rounding half to even like printf
+    uint64_t t = (uint64_t)m * scale[decimals];
+    uint64_t q = 0;
+    if (-e < 64)
+    {
+        int s = -e;
+        q = t >> s;
+        uint64_t rem = t & (((uint64_t)1 << s) - 1);
+        uint64_t half = (uint64_t)1 << (s - 1);
+        if (rem > half || (rem == half && (q & 1)))
+            q++;
+    }
+    put_fixed(f, q, decimals);
+}
+
+void fixfmt_float(fixfmt_t *f, float v, int decimals)
+{
+    if (decimals < 0 || decimals > FIXFMT_DECIMALS_MAX)
+        decimals = FIXFMT_DECIMALS_MAX;
+    char buf[NUMBER_MAX];
+    fixfmt_t num;
+    fixfmt_init(&num, buf, sizeof(buf));
+    put_float(&num, v, decimals);
+    put_number(f, &num);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file fixfmt.h
+ * @defgroup fixfmt fixfmt
+ * @{
+ *
+ * Text formatting into caller buffers without printf.
+ *
+ * newlib's printf converts floats through its dtoa code, which is slow
+ * and takes a lot of stack on the ESP32. These functions append numbers
+ * and strings to a fixed buffer using integer arithmetic only: a float is
+ * split into its binary mantissa and exponent and scaled to the requested
+ * number of decimals exactly, so fixfmt_float(f, v, d) writes the same
+ * text as printf("%.*f", d, v) (ties round to even), including -0.0, inf
+ * and nan.
+ *
+ * The buffer is always NUL-terminated. Once something does not fit the
+ * writer stops and sets overflow; the text written so far stays intact.
+ * A number is appended whole or not at all. No heap, no varargs; safe
+ * from any task that owns the buffer.
+ */
+#ifndef __FIXFMT_H__
+#define __FIXFMT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FIXFMT_DECIMALS_MAX 6
+
+/**
+ * Writer over a caller buffer
+ */
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t len;        //!< Characters written, without the NUL
+    bool overflow;     //!< Something did not fit
+} fixfmt_t;
+
+/**
+ * @brief Start writing into buf
+ *
+ * @param f Writer
+ * @param buf Buffer, at least one byte
+ * @param size Size of buf
+ */
+void fixfmt_init(fixfmt_t *f, char *buf, size_t size);
+
+/**
+ * @brief Append a string
+ */
+void fixfmt_str(fixfmt_t *f, const char *s);
+
+/**
+ * @brief Append a character
+ */
+void fixfmt_char(fixfmt_t *f, char c);
+
+/**
+ * @brief Append a string as a quoted JSON string, escaping quotes,
+ *        backslashes and control characters
+ */
+void fixfmt_json_str(fixfmt_t *f, const char *s);
+
+/**
+ * @brief Append a signed integer, like "%lld"
+ */
+void fixfmt_int(fixfmt_t *f, int64_t v);
+
+/**
+ * @brief Append an unsigned integer, like "%llu"
+ */
+void fixfmt_uint(fixfmt_t *f, uint64_t v);
+
+/**
+ * @brief Append a fixed-point value raw / 10^decimals, e.g. (4125, 2) as
+ *        "41.25"
+ *
+ * @param f Writer
+ * @param raw Scaled value
+ * @param decimals 0 to FIXFMT_DECIMALS_MAX digits after the point
+ */
+void fixfmt_fixed(fixfmt_t *f, int64_t raw, int decimals);
+
+/**
+ * @brief Append a float with a fixed number of decimals, like "%.*f"
+ *
+ * @param f Writer
+ * @param v Value
+ * @param decimals 0 to FIXFMT_DECIMALS_MAX digits after the point
+ */
+void fixfmt_float(fixfmt_t *f, float v, int decimals);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __FIXFMT_H__ */
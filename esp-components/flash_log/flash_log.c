@@ -0,0 +1,345 @@
+/**
+ * @file flash_log.c
+ *
+ * Circular record log on NOR flash with power-loss recovery
+ */
+#include "flash_log.h"
+#include <stddef.h>
+#include <string.h>
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define SECTOR_MAGIC    0x31474c46  // "FLG1"
+#define FLAG_PENDING    0xff
+#define FLAG_ACKED      0x00
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t open_seq;          // Increments with every sector started
+    uint32_t first_seq;         // Sequence number of the first record
+    uint32_t erase_count;
+    uint32_t crc;               // Over the fields above
+} sector_header_t;
+
+typedef struct
+{
+    uint32_t seq;
+    uint16_t len;
+    uint8_t flags;              // Not covered by crc, cleared on ack
+    uint8_t reserved;
+    uint32_t crc;               // Over seq, len and payload
+} record_header_t;
+
+_Static_assert(sizeof(sector_header_t) == FLOG_SECTOR_HEADER, "sector header layout");
+_Static_assert(sizeof(record_header_t) == FLOG_RECORD_HEADER, "record header layout");
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 15];
+        crc = (crc >> 4) ^ table[crc & 15];
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const record_header_t *h, const void *payload)
+{
+    uint32_t crc = crc32_update(0, &h->seq, sizeof(h->seq));
+    crc = crc32_update(crc, &h->len, sizeof(h->len));
+    return crc32_update(crc, payload, h->len);
+}
+
+static const uint8_t *sector_ptr(const flog_t *log, uint32_t sector)
+{
+    return log->flash.map + (size_t)sector * log->flash.sector_size;
+}
+
+static bool is_blank(const uint8_t *p, size_t len)
+{
+    while (len--)
+        if (*p++ != 0xff)
+            return false;
+    return true;
+}
+
+static bool read_header(const flog_t *log, uint32_t sector, sector_header_t *h)
+{
+    memcpy(h, sector_ptr(log, sector), sizeof(*h));
+    return h->magic == SECTOR_MAGIC && h->crc == crc32_update(0, h, offsetof(sector_header_t, crc));
+}
+
+// Valid record carrying the cursor's sequence number at the cursor
+static bool record_at(const flog_t *log, const flog_cursor_t *c, flog_record_t *rec)
+{
+    size_t ss = log->flash.sector_size;
+    if (c->pos + FLOG_RECORD_HEADER > ss)
+        return false;
+
+    const uint8_t *p = sector_ptr(log, c->sector) + c->pos;
+    record_header_t h;
+    memcpy(&h, p, sizeof(h));
+    if (h.seq != c->seq || !h.len || h.len > FLOG_PAYLOAD_MAX || c->pos + FLOG_RECORD_SIZE(h.len) > ss)
+        return false;
+    if (h.crc != record_crc(&h, p + FLOG_RECORD_HEADER))
+        return false;
+
+    rec->seq = h.seq;
+    rec->data = p + FLOG_RECORD_HEADER;
+    rec->len = h.len;
+    rec->at = *c;
+    return true;
+}
+
+static uint8_t record_flags(const flog_record_t *rec)
+{
+    return (rec->data - FLOG_RECORD_HEADER)[offsetof(record_header_t, flags)];
+}
+
+static void step(flog_cursor_t *c, const flog_record_t *rec)
+{
+    c->pos += FLOG_RECORD_SIZE(rec->len);
+    c->seq++;
+}
+
+// Oldest record after the newest one marked delivered; sectors follow the
+// newest one in ring order, oldest first
+static void find_tail(flog_t *log)
+{
+    flog_cursor_t oldest = { log->next_seq, log->head_sector, FLOG_SECTOR_HEADER };
+    flog_cursor_t after_acked;
+    bool have_oldest = false, acked = false;
+
+    for (uint32_t i = 1; i <= log->sectors; i++)
+    {
+        uint32_t s = (log->head_sector + i) % log->sectors;
+        sector_header_t h;
+        if (!read_header(log, s, &h))
+            continue;
+
+        flog_cursor_t c = { h.first_seq, s, FLOG_SECTOR_HEADER };
+        if (!have_oldest)
+        {
+            oldest = c;
+            have_oldest = true;
+        }
+        flog_record_t rec;
+        while (c.seq != log->next_seq && record_at(log, &c, &rec))
+        {
+            step(&c, &rec);
+            if (record_flags(&rec) == FLAG_ACKED)
+            {
+                after_acked = c;
+                acked = true;
+            }
+        }
+    }
+    log->tail = acked ? after_acked : oldest;
+}
+
+esp_err_t flog_mount(flog_t *log, const flog_flash_t *flash)
+{
+    CHECK_ARG(log && flash && flash->map && flash->write && flash->erase);
+    CHECK_ARG(flash->sector_size >= FLOG_SECTOR_HEADER + FLOG_RECORD_SIZE(FLOG_PAYLOAD_MAX));
+    CHECK_ARG(flash->size % flash->sector_size == 0 && flash->size / flash->sector_size >= 2);
+
+    memset(log, 0, sizeof(*log));
+    log->flash = *flash;
+    log->sectors = flash->size / flash->sector_size;
+    log->tail = (flog_cursor_t) { 0, 0, FLOG_SECTOR_HEADER };
+
+    sector_header_t h, head = { 0 };
+    for (uint32_t s = 0; s < log->sectors; s++)
+    {
+        if (!read_header(log, s, &h))
+            continue;
+        if (h.erase_count > log->max_erase)
+            log->max_erase = h.erase_count;
+        if (!log->open || (int32_t)(h.open_seq - head.open_seq) > 0)
+        {
+            head = h;
+            log->head_sector = s;
+            log->open = true;
+        }
+    }
+    if (!log->open)
+        return ESP_OK;
+
+    // The end of the newest sector is the end of the log
+    flog_cursor_t c = { head.first_seq, log->head_sector, FLOG_SECTOR_HEADER };
+    flog_record_t rec;
+    while (record_at(log, &c, &rec))
+        step(&c, &rec);
+    log->open_seq = head.open_seq;
+    log->next_seq = c.seq;
+    log->head_pos = c.pos;
+
+    // Anything but erased flash after the last record is an append that
+    // was cut short. It cannot be overwritten, so the sector is closed
+    // and the next append starts a new one
+    if (!is_blank(sector_ptr(log, log->head_sector) + c.pos, log->flash.sector_size - c.pos))
+    {
+        log->stats.torn++;
+        log->head_pos = log->flash.sector_size;
+    }
+
+    find_tail(log);
+    return ESP_OK;
+}
+
+static esp_err_t open_sector(flog_t *log)
+{
+    size_t ss = log->flash.sector_size;
+    uint32_t s = log->open ? (log->head_sector + 1) % log->sectors : 0;
+    sector_header_t h;
+    uint32_t erase_count = read_header(log, s, &h) ? h.erase_count : log->max_erase;
+
+    // Undelivered records in the sector are lost; the tail moves to the
+    // oldest sector left. Done before erasing, as a power loss during the
+    // erase loses them as well
+    if (log->tail.sector == s)
+    {
+        flog_cursor_t tail = { log->next_seq, s, FLOG_SECTOR_HEADER };
+        for (uint32_t i = 1; i < log->sectors && flog_pending(log); i++)
+        {
+            uint32_t next = (s + i) % log->sectors;
+            if (read_header(log, next, &h))
+            {
+                tail = (flog_cursor_t) { h.first_seq, next, FLOG_SECTOR_HEADER };
+                break;
+            }
+        }
+        log->stats.dropped += tail.seq - log->tail.seq;
+        log->tail = tail;
+    }
+
+    // A failure below leaves the head closed, so the next append retries
+    log->head_pos = ss;
+    if (is_blank(sector_ptr(log, s), ss))
+    {
+        log->stats.erases_skipped++;
+    }
+    else
+    {
+        CHECK(log->flash.erase(log->flash.ctx, (size_t)s * ss, ss));
+        erase_count++;
+        log->stats.erases++;
+    }
+    if (erase_count > log->max_erase)
+        log->max_erase = erase_count;
+
+    h = (sector_header_t) {
+        .magic = SECTOR_MAGIC,
+        .open_seq = log->open_seq + 1,
+        .first_seq = log->next_seq,
+        .erase_count = erase_count,
+    };
+    h.crc = crc32_update(0, &h, offsetof(sector_header_t, crc));
+    CHECK(log->flash.write(log->flash.ctx, (size_t)s * ss, &h, sizeof(h)));
+
+    log->open = true;
+    log->open_seq++;
+    log->head_sector = s;
+    log->head_pos = FLOG_SECTOR_HEADER;
+    return ESP_OK;
+}
+
+esp_err_t flog_append(flog_t *log, const void *data, size_t len, uint32_t *seq)
+{
+    CHECK_ARG(log && data && len && len <= FLOG_PAYLOAD_MAX);
+
+    size_t size = FLOG_RECORD_SIZE(len);
+    size_t ss = log->flash.sector_size;
+    if (!log->open || log->head_pos + size > ss)
+        CHECK(open_sector(log));
+
+    // One write per record; a torn one fails its CRC
+    uint8_t buf[FLOG_RECORD_SIZE(FLOG_PAYLOAD_MAX)];
+    record_header_t h = { .seq = log->next_seq, .len = len, .flags = FLAG_PENDING, .reserved = 0xff };
+    h.crc = record_crc(&h, data);
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), data, len);
+    memset(buf + sizeof(h) + len, 0xff, size - sizeof(h) - len);
+
+    esp_err_t err = log->flash.write(log->flash.ctx, (size_t)log->head_sector * ss + log->head_pos, buf, size);
+    if (err != ESP_OK)
+    {
+        // The area may be partly written, continue in a fresh sector
+        log->head_pos = ss;
+        return err;
+    }
+
+    log->head_pos += size;
+    if (seq)
+        *seq = log->next_seq;
+    log->next_seq++;
+    log->stats.appended++;
+    return ESP_OK;
+}
+
+esp_err_t flog_next(const flog_t *log, flog_cursor_t *cursor, flog_record_t *rec)
+{
+    CHECK_ARG(log && cursor && rec);
+
+    // Each pass returns a record or moves on to the next sector
+    for (uint32_t i = 0; i <= log->sectors && cursor->seq != log->next_seq; i++)
+    {
+        if (record_at(log, cursor, rec))
+        {
+            step(cursor, rec);
+            return ESP_OK;
+        }
+        if (log->open && cursor->sector == log->head_sector)
+            break;
+
+        cursor->sector = (cursor->sector + 1) % log->sectors;
+        cursor->pos = FLOG_SECTOR_HEADER;
+        sector_header_t h;
+        if (read_header(log, cursor->sector, &h) && (int32_t)(h.first_seq - cursor->seq) > 0)
+            cursor->seq = h.first_seq;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t flog_ack(flog_t *log, const flog_record_t *rec)
+{
+    CHECK_ARG(log && rec && rec->seq - log->tail.seq < flog_pending(log));
+
+    // The sector may have been reused since the record was read
+    flog_record_t check;
+    CHECK_ARG(record_at(log, &rec->at, &check));
+
+    uint8_t flags = FLAG_ACKED;
+    size_t off = (size_t)rec->at.sector * log->flash.sector_size + rec->at.pos + offsetof(record_header_t, flags);
+    CHECK(log->flash.write(log->flash.ctx, off, &flags, 1));
+
+    log->stats.acked += rec->seq + 1 - log->tail.seq;
+    log->tail = rec->at;
+    step(&log->tail, rec);
+    return ESP_OK;
+}
+
+void flog_wear(const flog_t *log, uint32_t *min, uint32_t *max)
+{
+    *min = UINT32_MAX;
+    *max = 0;
+    for (uint32_t s = 0; s < log->sectors; s++)
+    {
+        sector_header_t h;
+        uint32_t count = read_header(log, s, &h) ? h.erase_count : 0;
+        if (count < *min)
+            *min = count;
+        if (count > *max)
+            *max = count;
+    }
+}
@@ -0,0 +1,201 @@
+/**
+ * @file flash_log.h
+ * @defgroup flash_log flash_log
+ * @{
+ *
+ * Circular record log on a dedicated flash area, for keeping telemetry
+ * while the network is away and replaying it in order afterwards.
+ *
+ * The area is split into erase sectors used round-robin. Each sector
+ * starts with a header holding its erase count and the sequence number of
+ * its first record; records follow back to back:
+ *
+ *     seq (4) | len (2) | flags (1) | 0xff (1) | crc32 (4) | payload, padded to 4
+ *
+ * A record is valid when its CRC (over seq, len and payload) matches, so
+ * an append cut short by a power loss is recognised on the next mount and
+ * the sector is closed at that point; nothing is ever rewritten in place.
+ * Delivery is tracked by clearing the flags byte of the last record of a
+ * delivered batch (a single byte program, no erase), so the read position
+ * survives reboots without a separate pointer to update.
+ *
+ * Reads are zero-copy: records are returned as pointers into the
+ * memory-mapped area. When the log is full the oldest sector is erased
+ * and its records are counted as dropped, so every sector is erased
+ * exactly once per lap and wear is spread evenly; sectors that are still
+ * blank are not erased at all.
+ *
+ * The log is portable; flash access goes through flog_flash_t, provided
+ * by flog_partition_open() on the target and by a simulated NOR flash on
+ * a host. Not thread-safe; use the log from one task.
+ */
+#ifndef __FLASH_LOG_H__
+#define __FLASH_LOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLOG_SECTOR_HEADER  20   //!< Bytes of each sector taken by its header
+#define FLOG_RECORD_HEADER  12   //!< Bytes of each record before the payload
+#define FLOG_PAYLOAD_MAX    244  //!< Largest payload of one record
+
+/**
+ * Flash space a record with len payload bytes takes
+ */
+#define FLOG_RECORD_SIZE(len) (FLOG_RECORD_HEADER + (((len) + 3) & ~3u))
+
+/**
+ * Flash access. Writes must behave like NOR flash: bits can only be
+ * cleared, erase sets a whole sector to 0xff.
+ */
+typedef struct
+{
+    size_t size;                //!< Multiple of sector_size
+    size_t sector_size;
+    const uint8_t *map;         //!< Whole area mapped for reading
+    esp_err_t (*write)(void *ctx, size_t offset, const void *data, size_t len);
+    esp_err_t (*erase)(void *ctx, size_t offset, size_t len);
+    void *ctx;
+} flog_flash_t;
+
+/**
+ * Position in the log
+ */
+typedef struct
+{
+    uint32_t seq;               //!< Sequence number of the record at this position
+    uint32_t sector;
+    uint32_t pos;               //!< Byte offset within the sector
+} flog_cursor_t;
+
+/**
+ * One record, pointing into the mapped flash
+ */
+typedef struct
+{
+    uint32_t seq;
+    const uint8_t *data;
+    size_t len;
+    flog_cursor_t at;           //!< Position of the record itself
+} flog_record_t;
+
+/**
+ * Counters since mount
+ */
+typedef struct
+{
+    uint32_t appended;
+    uint32_t acked;             //!< Records marked delivered
+    uint32_t dropped;           //!< Undelivered records lost to a full log
+    uint32_t erases;
+    uint32_t erases_skipped;    //!< Sectors reused without erasing, already blank
+    uint32_t torn;              //!< Interrupted appends found at mount
+} flog_stats_t;
+
+/**
+ * Log state
+ */
+typedef struct
+{
+    flog_flash_t flash;
+    uint32_t sectors;
+    bool open;                  //!< A head sector has been started
+    uint32_t head_sector;
+    uint32_t head_pos;          //!< Where the next record goes
+    uint32_t open_seq;          //!< Sectors started so far
+    uint32_t next_seq;          //!< Sequence number of the next record
+    uint32_t max_erase;
+    flog_cursor_t tail;         //!< Oldest undelivered record
+    flog_stats_t stats;
+} flog_t;
+
+/**
+ * @brief Mount a log, recovering from any interrupted append
+ *
+ * Scans all sector headers and the records of the newest sector; a blank
+ * or foreign area yields an empty log.
+ *
+ * @param log Log
+ * @param flash Flash access, copied
+ * @return `ESP_OK` on success
+ */
+esp_err_t flog_mount(flog_t *log, const flog_flash_t *flash);
+
+/**
+ * @brief Append a record
+ *
+ * Starts the next sector when the record does not fit; if that sector
+ * still holds undelivered records they are dropped.
+ *
+ * @param log Log
+ * @param data Payload
+ * @param len 1 to FLOG_PAYLOAD_MAX bytes
+ * @param[out] seq Sequence number of the record; may be NULL
+ * @return `ESP_OK` on success, or the flash error
+ */
+esp_err_t flog_append(flog_t *log, const void *data, size_t len, uint32_t *seq);
+
+/**
+ * @brief Undelivered records
+ */
+static inline uint32_t flog_pending(const flog_t *log)
+{
+    return log->next_seq - log->tail.seq;
+}
+
+/**
+ * @brief Read the record at a cursor and move the cursor past it
+ *
+ * Start with a copy of log->tail to walk the undelivered records in
+ * order. Records lost to a damaged sector are skipped.
+ *
+ * @param log Log
+ * @param cursor Position, advanced on success
+ * @param[out] rec Record; valid until its sector is reused
+ * @return `ESP_OK` on success, `ESP_ERR_NOT_FOUND` at the end of the log
+ */
+esp_err_t flog_next(const flog_t *log, flog_cursor_t *cursor, flog_record_t *rec);
+
+/**
+ * @brief Mark a record and all older ones as delivered
+ *
+ * @param log Log
+ * @param rec A record returned by flog_next() since the last ack
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_ARG` for a record that is
+ *         not pending, or the flash error
+ */
+esp_err_t flog_ack(flog_t *log, const flog_record_t *rec);
+
+/**
+ * @brief Lowest and highest erase count over all sectors
+ *
+ * @param log Log
+ * @param[out] min Lowest count; sectors without a header count as 0
+ * @param[out] max Highest count
+ */
+void flog_wear(const flog_t *log, uint32_t *min, uint32_t *max);
+
+/**
+ * @brief Use a data partition as log area
+ *
+ * Maps the whole partition for reading. ESP-IDF only.
+ *
+ * @param[out] flash Flash access for flog_mount()
+ * @param label Partition label
+ * @return `ESP_OK` on success, `ESP_ERR_NOT_FOUND` without such partition
+ */
+esp_err_t flog_partition_open(flog_flash_t *flash, const char *label);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __FLASH_LOG_H__ */
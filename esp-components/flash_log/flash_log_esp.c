@@ -0,0 +1,45 @@
+/**
+ * @file flash_log_esp.c
+ *
+ * flash_log on an ESP-IDF data partition
+ */
+#include "flash_log.h"
+#include <esp_partition.h>
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+static esp_err_t partition_write(void *ctx, size_t offset, const void *data, size_t len)
+{
+    return esp_partition_write(ctx, offset, data, len);
+}
+
+static esp_err_t partition_erase(void *ctx, size_t offset, size_t len)
+{
+    return esp_partition_erase_range(ctx, offset, len);
+}
+
+esp_err_t flog_partition_open(flog_flash_t *flash, const char *label)
+{
+    CHECK_ARG(flash && label);
+
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part)
+        return ESP_ERR_NOT_FOUND;
+
+    // Mapped once for the lifetime of the log. Writes and erases through
+    // esp_partition invalidate the cached lines of the mapping, so reads
+    // see the new contents
+    const void *map;
+    esp_partition_mmap_handle_t handle;
+    CHECK(esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &map, &handle));
+
+    flash->size = part->size;
+    flash->sector_size = part->erase_size;
+    flash->map = map;
+    flash->write = partition_write;
+    flash->erase = partition_erase;
+    flash->ctx = (void *)part;
+
+    return ESP_OK;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file gas_baseline.c
+ *
+ * Streaming clean-air baseline estimator for gas sensor readings
+ */
+#include "gas_baseline.h"
+#include <string.h>
+
+void gas_baseline_init(gas_baseline_t *b, const gas_baseline_config_t *cfg)
+{
+    memset(b, 0, sizeof(gas_baseline_t));
+    b->cfg = *cfg;
+}
+
+void gas_baseline_reset(gas_baseline_t *b, int32_t value)
+{
+    b->level = value << 16;
+    b->held = 0;
+    b->primed = true;
+}
+
+void gas_baseline_update(gas_baseline_t *b, int32_t sample, bool hold)
+{
+    if (!b->primed)
+    {
+        gas_baseline_reset(b, sample);
+        return;
+    }
+
+    if (hold)
+    {
+        if (b->cfg.hold_limit == 0 || b->held < b->cfg.hold_limit)
+        {
+            b->held++;
+            return;
+        }
+        // Held too long: a level shift, not an event; keep tracking
+    }
+    else
+    {
+        b->held = 0;
+    }
+
+    int32_t delta = (sample << 16) - b->level;
+    if (delta < 0)
+        b->level -= (-delta) >> b->cfg.shift_down;
+    else
+        b->level += delta >> b->cfg.shift_up;
+}
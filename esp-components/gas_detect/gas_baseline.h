@@ -0,0 +1,96 @@
+/**
+ * @file gas_baseline.h
+ * @defgroup gas_baseline gas_baseline
+ * @{
+ *
+ * Streaming clean-air baseline estimator for gas sensor readings.
+ *
+ * An asymmetric exponential average in Q16.16 fixed point: it follows
+ * readings down quickly (clean air after an exposure, heater settling) and
+ * up slowly (drift), and holds still while the caller reports a gas event
+ * so the event itself is not learned as the new baseline. A hold that
+ * lasts longer than hold_limit samples is treated as a level shift and
+ * slow tracking resumes. O(1) memory and cost per sample.
+ */
+#ifndef __GAS_BASELINE_H__
+#define __GAS_BASELINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Tracker tuning, time constants are 2^shift samples
+ */
+typedef struct
+{
+    uint8_t shift_up;     //!< Rising readings, slow (e.g. 12: ~4096 samples)
+    uint8_t shift_down;   //!< Falling readings, fast (e.g. 6: ~64 samples)
+    uint32_t hold_limit;  //!< Max consecutive held samples, 0 = hold forever
+} gas_baseline_config_t;
+
+/**
+ * Tracker state
+ */
+typedef struct
+{
+    gas_baseline_config_t cfg;
+    int32_t level;        //!< Baseline, Q16.16 raw counts
+    uint32_t held;        //!< Consecutive samples held
+    bool primed;          //!< level holds a value
+} gas_baseline_t;
+
+/**
+ * @brief Initialize a tracker
+ *
+ * The first sample passed to gas_baseline_update() becomes the baseline
+ * unless one is set with gas_baseline_reset().
+ *
+ * @param b Tracker
+ * @param cfg Tuning
+ */
+void gas_baseline_init(gas_baseline_t *b, const gas_baseline_config_t *cfg);
+
+/**
+ * @brief Force the baseline, e.g. from a calibration or stored value
+ *
+ * @param b Tracker
+ * @param value Baseline in raw counts
+ */
+void gas_baseline_reset(gas_baseline_t *b, int32_t value);
+
+/**
+ * @brief Feed one sample
+ *
+ * @param b Tracker
+ * @param sample Reading in raw counts
+ * @param hold true while the reading is part of a gas event
+ */
+void gas_baseline_update(gas_baseline_t *b, int32_t sample, bool hold);
+
+/**
+ * @brief Current baseline, rounded to raw counts
+ */
+static inline int32_t gas_baseline_get(const gas_baseline_t *b)
+{
+    return (b->level + 0x8000) >> 16;
+}
+
+/**
+ * @brief Whether a sample exceeds the baseline by more than delta
+ */
+static inline bool gas_baseline_exceeded(const gas_baseline_t *b, int32_t sample, int32_t delta)
+{
+    return b->primed && sample > gas_baseline_get(b) + delta;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __GAS_BASELINE_H__ */
@@ -0,0 +1,70 @@
+/**
+ * @file gas_cusum.c
+ *
+ * Streaming one-sided CUSUM change detector for gas readings
+ */
+#include "gas_cusum.h"
+#include <string.h>
+
+// sigma ~= 1.25 * mean absolute deviation for Gaussian noise
+#define MAD_TO_SIGMA(mad) ((mad) + ((mad) >> 2))
+
+// Evidence is capped at this many thresholds so the alarm clears within
+// a bounded number of samples once the reading returns to baseline
+#define S_CAP_THRESHOLDS 2
+
+void gas_cusum_init(gas_cusum_t *c, const gas_cusum_config_t *cfg, int32_t sigma)
+{
+    memset(c, 0, sizeof(gas_cusum_t));
+    c->cfg = *cfg;
+    if (sigma < cfg->min_sigma)
+        sigma = cfg->min_sigma;
+    c->mad = (int32_t)(((int64_t)sigma << 16) * 4 / 5);
+}
+
+int32_t gas_cusum_sigma(const gas_cusum_t *c)
+{
+    int32_t sigma = MAD_TO_SIGMA(c->mad);
+    int32_t floor = c->cfg.min_sigma << 16;
+    return (sigma > floor ? sigma : floor) >> 16;
+}
+
+bool gas_cusum_update(gas_cusum_t *c, int32_t x, int32_t mu)
+{
+    int32_t sigma = MAD_TO_SIGMA(c->mad);
+    int32_t floor = c->cfg.min_sigma << 16;
+    if (sigma < floor)
+        sigma = floor;
+
+    int64_t dev = (int64_t)(x - mu) << 16;
+    int64_t k = ((int64_t)sigma * c->cfg.k_q8) >> 8;
+    int64_t h = ((int64_t)sigma * c->cfg.h_q8) >> 8;
+
+    // Learn the noise only while there is no evidence of a shift
+    if (c->s == 0)
+    {
+        int64_t abs_dev = dev < 0 ? -dev : dev;
+        c->mad += (int32_t)((abs_dev - c->mad) >> c->cfg.noise_shift);
+    }
+
+    c->s += dev - k;
+    if (c->s < 0)
+        c->s = 0;
+    else if (c->s > h * S_CAP_THRESHOLDS)
+        c->s = h * S_CAP_THRESHOLDS;
+
+    // Latch on crossing h, release only once the evidence is gone
+    if (c->s > h)
+        c->alarm = true;
+    else if (c->s == 0)
+        c->alarm = false;
+
+    return c->alarm;
+}
+
+int32_t gas_cusum_expected_delay(const gas_cusum_config_t *cfg, uint16_t shift_q8)
+{
+    if (shift_q8 <= cfg->k_q8)
+        return -1;
+    return (cfg->h_q8 + (shift_q8 - cfg->k_q8) - 1) / (shift_q8 - cfg->k_q8);
+}
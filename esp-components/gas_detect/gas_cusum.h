@@ -0,0 +1,100 @@
+/**
+ * @file gas_cusum.h
+ * @defgroup gas_cusum gas_cusum
+ * @{
+ *
+ * Streaming one-sided CUSUM change detector for gas readings.
+ *
+ * Works on the deviation of each sample from a reference level (normally
+ * the tracked clean-air baseline), scaled by a running noise estimate so
+ * the tuning is expressed in standard deviations:
+ *
+ *     S = max(0, S + (x - mu) - k*sigma),  alarm while S > h*sigma
+ *
+ * k is the drift allowance (about half the smallest shift worth
+ * detecting) and h the decision threshold. A larger h lowers the false
+ * alarm rate roughly exponentially; for a shift of d sigma the expected
+ * detection delay is about h / (d - k) samples. The noise estimate is a
+ * fixed-point exponential mean absolute deviation that only learns while
+ * S is zero. Everything is integer; cost is a handful of operations per
+ * sample.
+ */
+#ifndef __GAS_CUSUM_H__
+#define __GAS_CUSUM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Detector tuning
+ */
+typedef struct
+{
+    uint16_t k_q8;        //!< Drift allowance, sigma units Q8 (128 = 0.5 sigma)
+    uint16_t h_q8;        //!< Decision threshold, sigma units Q8 (1280 = 5 sigma)
+    uint8_t noise_shift;  //!< Noise estimate time constant, 2^shift samples
+    int32_t min_sigma;    //!< Noise floor, raw counts (ADC quantization)
+} gas_cusum_config_t;
+
+/**
+ * Detector state
+ */
+typedef struct
+{
+    gas_cusum_config_t cfg;
+    int64_t s;            //!< Cumulative sum, Q16 raw counts
+    int32_t mad;          //!< Mean absolute deviation, Q16 raw counts
+    bool alarm;
+} gas_cusum_t;
+
+/**
+ * @brief Initialize a detector
+ *
+ * @param c Detector
+ * @param cfg Tuning
+ * @param sigma Initial noise estimate, raw counts (e.g. from calibration)
+ */
+void gas_cusum_init(gas_cusum_t *c, const gas_cusum_config_t *cfg, int32_t sigma);
+
+/**
+ * @brief Feed one sample
+ *
+ * @param c Detector
+ * @param x Sample, raw counts
+ * @param mu Reference level, raw counts
+ * @return Alarm state after this sample
+ */
+bool gas_cusum_update(gas_cusum_t *c, int32_t x, int32_t mu);
+
+/**
+ * @brief Current noise estimate, raw counts
+ */
+int32_t gas_cusum_sigma(const gas_cusum_t *c);
+
+/**
+ * @brief Forget accumulated evidence and clear the alarm
+ */
+static inline void gas_cusum_reset(gas_cusum_t *c)
+{
+    c->s = 0;
+    c->alarm = false;
+}
+
+/**
+ * @brief Expected detection delay in samples for a step of shift_q8 sigma
+ *
+ * @return Samples, or -1 if the step is within the drift allowance
+ */
+int32_t gas_cusum_expected_delay(const gas_cusum_config_t *cfg, uint16_t shift_q8);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __GAS_CUSUM_H__ */
@@ -0,0 +1,90 @@
+/**
+ * @file gpio_events.c
+ *
+ * GPIO edge interrupts delivered as timestamped events on a queue
+ */
+#include "gpio_events.h"
+#include <esp_attr.h>
+#include <esp_timer.h>
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+typedef struct
+{
+    uint32_t debounce_us;
+    int64_t last_us;
+    bool seen;
+} pin_state_t;
+
+static QueueHandle_t event_queue;
+static pin_state_t pins[GPIO_NUM_MAX];
+static volatile uint32_t dropped;
+
+static void IRAM_ATTR edge_isr(void *arg)
+{
+    gpio_num_t gpio = (gpio_num_t)(intptr_t)arg;
+    pin_state_t *p = &pins[gpio];
+    int64_t now = esp_timer_get_time();
+
+    if (p->seen && now - p->last_us < p->debounce_us)
+        return;
+    p->seen = true;
+    p->last_us = now;
+
+    gpio_event_t ev = {
+        .gpio = gpio,
+        .level = gpio_get_level(gpio),
+        .time_us = now,
+    };
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(event_queue, &ev, &woken) != pdTRUE)
+        dropped++;
+    if (woken == pdTRUE)
+        portYIELD_FROM_ISR();
+}
+
+esp_err_t gpio_events_init(QueueHandle_t queue)
+{
+    CHECK_ARG(queue);
+
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+        return err;
+    event_queue = queue;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_events_add(const gpio_event_pin_t *pin)
+{
+    CHECK_ARG(pin && GPIO_IS_VALID_GPIO(pin->gpio) && pin->edge != GPIO_INTR_DISABLE);
+    if (!event_queue)
+        return ESP_ERR_INVALID_STATE;
+
+    pins[pin->gpio] = (pin_state_t) { .debounce_us = pin->debounce_us };
+
+    gpio_config_t cfg = {
+        .pin_bit_mask = 1ULL << pin->gpio,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = pin->pull == GPIO_PULLUP_ONLY || pin->pull == GPIO_PULLUP_PULLDOWN,
+        .pull_down_en = pin->pull == GPIO_PULLDOWN_ONLY || pin->pull == GPIO_PULLUP_PULLDOWN,
+        .intr_type = pin->edge,
+    };
+    CHECK(gpio_config(&cfg));
+
+    return gpio_isr_handler_add(pin->gpio, edge_isr, (void *)(intptr_t)pin->gpio);
+}
+
+esp_err_t gpio_events_remove(gpio_num_t gpio)
+{
+    CHECK_ARG(GPIO_IS_VALID_GPIO(gpio));
+
+    CHECK(gpio_isr_handler_remove(gpio));
+    return gpio_set_intr_type(gpio, GPIO_INTR_DISABLE);
+}
+
+uint32_t gpio_events_dropped(void)
+{
+    return dropped;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file gpio_events.h
+ * @defgroup gpio_events gpio_events
+ * @{
+ *
+ * GPIO edge interrupts delivered as timestamped events on a queue.
+ *
+ * Each registered pin gets an edge interrupt whose handler reads the pin
+ * level, stamps it with esp_timer_get_time() and posts a gpio_event_t to
+ * the queue given at init, so a task can block on the queue and react to
+ * every edge instead of polling.
+ *
+ * Debounce is a lockout: the first edge after a quiet period is reported
+ * immediately and further edges on that pin are ignored until debounce_us
+ * has elapsed. This gives no added latency on the leading edge; pins whose
+ * settled level matters after a bounce should use an edge type of their
+ * own (e.g. GPIO_INTR_NEGEDGE for a button press) rather than any-edge.
+ */
+#ifndef __GPIO_EVENTS_H__
+#define __GPIO_EVENTS_H__
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <driver/gpio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Event posted for every accepted edge
+ */
+typedef struct
+{
+    gpio_num_t gpio;  //!< Pin that changed
+    uint8_t level;    //!< Level read in the interrupt handler
+    int64_t time_us;  //!< esp_timer_get_time() at the edge
+} gpio_event_t;
+
+/**
+ * Pin configuration
+ */
+typedef struct
+{
+    gpio_num_t gpio;          //!< Input pin
+    gpio_int_type_t edge;     //!< Edge(s) that raise an event
+    gpio_pull_mode_t pull;    //!< Pull resistor
+    uint32_t debounce_us;     //!< Lockout after an accepted edge, 0 for none
+} gpio_event_pin_t;
+
+/**
+ * @brief Install the GPIO ISR service and set the event queue
+ *
+ * @param queue Queue of gpio_event_t, shared by all pins
+ * @return `ESP_OK` on success
+ */
+esp_err_t gpio_events_init(QueueHandle_t queue);
+
+/**
+ * @brief Configure a pin as input and start reporting its edges
+ *
+ * @param pin Pin configuration
+ * @return `ESP_OK` on success
+ */
+esp_err_t gpio_events_add(const gpio_event_pin_t *pin);
+
+/**
+ * @brief Stop reporting edges of a pin
+ *
+ * @param gpio Pin added with gpio_events_add()
+ * @return `ESP_OK` on success
+ */
+esp_err_t gpio_events_remove(gpio_num_t gpio);
+
+/**
+ * @brief Number of events lost because the queue was full
+ */
+uint32_t gpio_events_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __GPIO_EVENTS_H__ */
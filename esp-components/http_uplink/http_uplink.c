@@ -0,0 +1,445 @@
+/**
+ * @file http_uplink.c
+ *
+ * Minimal HTTP/1.1 client that keeps one connection to one endpoint
+ */
+#include "http_uplink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_TIMEOUT_MS  5000
+#define DEFAULT_BACKOFF_MIN 1000
+#define DEFAULT_BACKOFF_MAX 60000
+#define HEADER_MAX          256
+
+static int64_t now_ms(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time() / 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#endif
+}
+
+esp_err_t http_uplink_init(http_uplink_t *u, const http_uplink_config_t *cfg)
+{
+    CHECK_ARG(u && cfg && cfg->host && strlen(cfg->host) < HTTP_UPLINK_HOST_MAX);
+
+    memset(u, 0, sizeof(*u));
+    u->cfg = *cfg;
+    strcpy(u->host, cfg->host);
+    u->cfg.host = u->host;
+    if (!u->cfg.port)
+        u->cfg.port = 80;
+    if (!u->cfg.timeout_ms)
+        u->cfg.timeout_ms = DEFAULT_TIMEOUT_MS;
+    if (!u->cfg.backoff_min_ms)
+        u->cfg.backoff_min_ms = DEFAULT_BACKOFF_MIN;
+    if (u->cfg.backoff_max_ms < u->cfg.backoff_min_ms)
+        u->cfg.backoff_max_ms = u->cfg.backoff_min_ms > DEFAULT_BACKOFF_MAX ? u->cfg.backoff_min_ms : DEFAULT_BACKOFF_MAX;
+    u->fd = -1;
+
+    return ESP_OK;
+}
+
+void http_uplink_close(http_uplink_t *u)
+{
+    if (u->fd >= 0)
+        close(u->fd);
+    u->fd = -1;
+    u->rx_len = u->rx_pos = 0;
+}
+
+uint32_t http_uplink_backoff_left(const http_uplink_t *u)
+{
+    int64_t left = u->retry_at_ms - now_ms();
+    return left > 0 ? (uint32_t)left : 0;
+}
+
+static esp_err_t resolve(http_uplink_t *u)
+{
+    if (u->addr_valid && (!u->cfg.dns_ttl_ms || now_ms() - u->resolved_ms < u->cfg.dns_ttl_ms))
+        return ESP_OK;
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+
+    u->stats.dns_lookups++;
+    if (getaddrinfo(u->host, NULL, &hints, &res) != 0 || !res)
+    {
+        u->addr_valid = false;
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(&u->addr, res->ai_addr, sizeof(u->addr));
+    u->addr.sin_port = htons(u->cfg.port);
+    freeaddrinfo(res);
+
+    u->addr_valid = true;
+    u->resolved_ms = now_ms();
+    return ESP_OK;
+}
+
+static void set_timeouts(int fd, uint32_t ms)
+{
+    struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Non-blocking connect bounded by the timeout, then back to blocking I/O
+// with send/receive timeouts
+static esp_err_t open_connection(http_uplink_t *u)
+{
+    CHECK(resolve(u));
+
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+        return ESP_ERR_NO_MEM;
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    esp_err_t err = ESP_OK;
+    if (connect(fd, (struct sockaddr *)&u->addr, sizeof(u->addr)) != 0)
+    {
+        if (errno != EINPROGRESS)
+            err = ESP_FAIL;
+        else
+        {
+            fd_set wr;
+            FD_ZERO(&wr);
+            FD_SET(fd, &wr);
+            struct timeval tv = { .tv_sec = u->cfg.timeout_ms / 1000, .tv_usec = (u->cfg.timeout_ms % 1000) * 1000 };
+            int so_err = 0;
+            socklen_t len = sizeof(so_err);
+
+            int n = select(fd + 1, NULL, &wr, NULL, &tv);
+            if (n == 0)
+                err = ESP_ERR_TIMEOUT;
+            else if (n < 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_err, &len) != 0 || so_err)
+                err = ESP_FAIL;
+        }
+    }
+    if (err != ESP_OK)
+    {
+        close(fd);
+        u->addr_valid = false;  // the address may have moved
+        return err;
+    }
+
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    set_timeouts(fd, u->cfg.timeout_ms);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    u->fd = fd;
+    u->rx_len = u->rx_pos = 0;
+    u->stats.connects++;
+    return ESP_OK;
+}
+
+// True if the peer has closed (or reset) an idle connection
+static bool peer_closed(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+static esp_err_t send_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        p += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+// --- Buffered response reader ---
+
+static esp_err_t rx_fill(http_uplink_t *u)
+{
+    if (u->rx_pos == u->rx_len)
+        u->rx_pos = u->rx_len = 0;
+    else if (u->rx_pos > 0)
+    {
+        memmove(u->rx, u->rx + u->rx_pos, u->rx_len - u->rx_pos);
+        u->rx_len -= u->rx_pos;
+        u->rx_pos = 0;
+    }
+    if (u->rx_len == sizeof(u->rx))
+        return ESP_ERR_INVALID_SIZE;
+
+    ssize_t n = recv(u->fd, u->rx + u->rx_len, sizeof(u->rx) - u->rx_len, 0);
+    if (n == 0)
+        return ESP_FAIL;
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    u->rx_len += n;
+    return ESP_OK;
+}
+
+// One CRLF-terminated line without the terminator
+static esp_err_t rx_line(http_uplink_t *u, char *line, size_t size)
+{
+    while (1)
+    {
+        char *start = u->rx + u->rx_pos;
+        char *eol = memchr(start, '\n', u->rx_len - u->rx_pos);
+        if (eol)
+        {
+            size_t len = eol - start;
+            if (len && start[len - 1] == '\r')
+                len--;
+            if (len >= size)
+                len = size - 1;
+            memcpy(line, start, len);
+            line[len] = 0;
+            u->rx_pos += eol - start + 1;
+            return ESP_OK;
+        }
+        CHECK(rx_fill(u));
+    }
+}
+
+// Consumes len body bytes, keeping what fits into resp
+static esp_err_t rx_body(http_uplink_t *u, size_t len, http_uplink_response_t *resp)
+{
+    while (len)
+    {
+        if (u->rx_pos == u->rx_len)
+            CHECK(rx_fill(u));
+        size_t n = u->rx_len - u->rx_pos;
+        if (n > len)
+            n = len;
+        if (resp && resp->body && resp->body_len + 1 < resp->body_size)
+        {
+            size_t keep = resp->body_size - 1 - resp->body_len;
+            if (keep > n)
+                keep = n;
+            memcpy(resp->body + resp->body_len, u->rx + u->rx_pos, keep);
+            resp->body_len += keep;
+            resp->body[resp->body_len] = 0;
+        }
+        u->rx_pos += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t read_response(http_uplink_t *u, http_uplink_response_t *resp, bool *keep_alive,
+                               int *status_out, uint32_t *retry_after_ms)
+{
+    char line[HEADER_MAX];
+    int status = 0, minor = 1;
+    long content_length = -1;
+    bool chunked = false;
+
+    CHECK(rx_line(u, line, sizeof(line)));
+    if (sscanf(line, "HTTP/1.%d %d", &minor, &status) != 2)
+        return ESP_FAIL;
+    *status_out = status;
+    *retry_after_ms = 0;
+    *keep_alive = minor >= 1;
+
+    while (1)
+    {
+        CHECK(rx_line(u, line, sizeof(line)));
+        if (!line[0])
+            break;
+        char *colon = strchr(line, ':');
+        if (!colon)
+            continue;
+        *colon = 0;
+        char *value = colon + 1;
+        while (*value == ' ')
+            value++;
+
+        if (!strcasecmp(line, "Content-Length"))
+            content_length = strtol(value, NULL, 10);
+        else if (!strcasecmp(line, "Transfer-Encoding") && strstr(value, "chunked"))
+            chunked = true;
+        else if (!strcasecmp(line, "Connection"))
+            *keep_alive = !strcasecmp(value, "keep-alive") || (minor >= 1 && strcasecmp(value, "close"));
+        else if (!strcasecmp(line, "Retry-After"))
+        {
+            // Only the delta-seconds form; an HTTP date falls back to the doubling wait
+            long s = strtol(value, NULL, 10);
+            if (s > 0)
+                *retry_after_ms = s > UINT32_MAX / 1000 ? UINT32_MAX : (uint32_t)s * 1000;
+        }
+    }
+
+    if (resp)
+    {
+        resp->status = status;
+        resp->body_len = 0;
+        if (resp->body && resp->body_size)
+            resp->body[0] = 0;
+    }
+
+    if (chunked)
+    {
+        while (1)
+        {
+            CHECK(rx_line(u, line, sizeof(line)));
+            long size = strtol(line, NULL, 16);
+            if (size <= 0)
+                break;
+            CHECK(rx_body(u, size, resp));
+            CHECK(rx_line(u, line, sizeof(line)));
+        }
+        // Trailers up to the empty line
+        do
+            CHECK(rx_line(u, line, sizeof(line)));
+        while (line[0]);
+    }
+    else if (content_length >= 0)
+        CHECK(rx_body(u, content_length, resp));
+    else if (status >= 200 && status != 204 && status != 304)
+    {
+        // Body runs until the server closes
+        do
+            CHECK(rx_body(u, u->rx_len - u->rx_pos, resp));
+        while (rx_fill(u) == ESP_OK);
+        *keep_alive = false;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t send_request(http_uplink_t *u, const http_uplink_request_t *req)
+{
+    char head[HEADER_MAX + 128];
+    int len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n",
+                       req->method, req->path, u->host);
+    if (req->body)
+        len += snprintf(head + len, sizeof(head) - len, "Content-Type: %s\r\nContent-Length: %u\r\n",
+                        req->content_type ? req->content_type : "application/octet-stream",
+                        (unsigned)req->body_len);
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+    if (len >= (int)sizeof(head))
+        return ESP_ERR_INVALID_SIZE;
+
+    CHECK(send_all(u->fd, head, len));
+    if (req->body && req->body_len)
+        CHECK(send_all(u->fd, req->body, req->body_len));
+    return ESP_OK;
+}
+
+static void backoff(http_uplink_t *u, uint32_t at_least_ms)
+{
+    if (!u->backoff_ms)
+        u->backoff_ms = u->cfg.backoff_min_ms;
+    else if (u->backoff_ms < u->cfg.backoff_max_ms / 2)
+        u->backoff_ms *= 2;
+    else
+        u->backoff_ms = u->cfg.backoff_max_ms;
+    if (at_least_ms > u->cfg.backoff_max_ms)
+        at_least_ms = u->cfg.backoff_max_ms;
+    u->retry_at_ms = now_ms() + (at_least_ms > u->backoff_ms ? at_least_ms : u->backoff_ms);
+}
+
+// Overload and server errors; repeating the request right away only adds load
+static bool should_back_off(int status)
+{
+    return status == 429 || status >= 500;
+}
+
+esp_err_t http_uplink_request(http_uplink_t *u, const http_uplink_request_t *req, http_uplink_response_t *resp)
+{
+    CHECK_ARG(u && req && req->method && req->path);
+
+    // Also on an open connection: the server may have refused the last request
+    if (http_uplink_backoff_left(u))
+    {
+        u->stats.backoff_skips++;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (u->fd >= 0 && (peer_closed(u->fd) ||
+                       (u->cfg.idle_close_ms && now_ms() - u->last_used_ms > u->cfg.idle_close_ms)))
+        http_uplink_close(u);
+
+    // Two rounds at most: a dead reused connection gets one fresh retry
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        bool reused = u->fd >= 0;
+        if (!reused)
+        {
+            esp_err_t err = open_connection(u);
+            if (err != ESP_OK)
+            {
+                u->stats.failures++;
+                backoff(u, 0);
+                return err;
+            }
+        }
+        else
+            u->stats.reused++;
+
+        bool keep_alive = false;
+        int status = 0;
+        uint32_t retry_after_ms = 0;
+        esp_err_t err = send_request(u, req);
+        if (err == ESP_OK)
+            err = read_response(u, resp, &keep_alive, &status, &retry_after_ms);
+
+        if (err == ESP_OK)
+        {
+            u->stats.requests++;
+            if (should_back_off(status))
+            {
+                u->stats.refused++;
+                backoff(u, retry_after_ms);
+            }
+            else
+                u->backoff_ms = 0;
+            u->last_used_ms = now_ms();
+            if (!keep_alive)
+                http_uplink_close(u);
+            return ESP_OK;
+        }
+
+        // Only a connection the server dropped while idle is retried; a
+        // timeout may mean the request was processed and must not repeat
+        http_uplink_close(u);
+        if (!reused || err != ESP_FAIL)
+        {
+            u->stats.failures++;
+            backoff(u, 0);
+            return err;
+        }
+        u->stats.retries++;
+    }
+    return ESP_FAIL;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file http_uplink.h
+ * @defgroup http_uplink http_uplink
+ * @{
+ *
+ * Minimal HTTP/1.1 client that keeps one connection to one endpoint.
+ *
+ * The connection is opened on the first request and reused for the
+ * following ones (keep-alive), so a periodic upload costs one request on
+ * an open socket instead of a DNS lookup, a TCP handshake and a client
+ * allocation. The resolved address is cached for dns_ttl_ms.
+ *
+ * A request on a reused connection that the server has dropped is retried
+ * once on a fresh one. When a fresh connection fails, further requests
+ * return `ESP_ERR_INVALID_STATE` immediately until an exponentially
+ * growing backoff has passed, so a dead network costs no time per upload.
+ * A 429 or 5xx response starts the same backoff (at least Retry-After, up
+ * to backoff_max_ms), so an overloaded server is not asked again at once.
+ *
+ * Plain BSD sockets only, so the same code runs on lwIP and on a host.
+ * Not thread-safe; use one client per task.
+ */
+#ifndef __HTTP_UPLINK_H__
+#define __HTTP_UPLINK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTP_UPLINK_RX_SIZE   512 //!< Receive buffer, must hold the response headers
+#define HTTP_UPLINK_HOST_MAX  64  //!< Longest host name
+
+/**
+ * Endpoint and timing
+ */
+typedef struct
+{
+    const char *host;          //!< Host name or address, copied
+    uint16_t port;             //!< TCP port, 80 if 0
+    uint32_t timeout_ms;       //!< Connect / send / receive timeout
+    uint32_t backoff_min_ms;   //!< First wait after a failed connection or a 429/5xx
+    uint32_t backoff_max_ms;   //!< Upper bound of the doubling wait
+    uint32_t dns_ttl_ms;       //!< Re-resolve after this long, 0 = only after failures
+    uint32_t idle_close_ms;    //!< Close connections idle this long before reuse, 0 = never
+} http_uplink_config_t;
+
+/**
+ * Request
+ */
+typedef struct
+{
+    const char *method;        //!< "GET", "POST", ...
+    const char *path;          //!< Path and query, e.g. "/update?api_key=..."
+    const char *content_type;  //!< For a body, e.g. "application/json"
+    const void *body;          //!< Optional
+    size_t body_len;
+} http_uplink_request_t;
+
+/**
+ * Response
+ */
+typedef struct
+{
+    int status;                //!< HTTP status code
+    char *body;                //!< Optional buffer for the body, NUL terminated
+    size_t body_size;          //!< Size of body; longer bodies are truncated
+    size_t body_len;           //!< Bytes stored in body
+} http_uplink_response_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint32_t requests;         //!< Requests that got a response
+    uint32_t connects;         //!< TCP connections opened
+    uint32_t dns_lookups;
+    uint32_t reused;           //!< Requests sent on an already open connection
+    uint32_t retries;          //!< Reused connections found dead and replaced
+    uint32_t failures;         //!< Requests that failed after connecting or trying to
+    uint32_t backoff_skips;    //!< Requests refused during backoff
+    uint32_t refused;          //!< Responses with 429 or 5xx, each starting a backoff
+} http_uplink_stats_t;
+
+/**
+ * Client state
+ */
+typedef struct
+{
+    http_uplink_config_t cfg;
+    char host[HTTP_UPLINK_HOST_MAX];
+    int fd;
+    struct sockaddr_in addr;
+    bool addr_valid;
+    int64_t resolved_ms;
+    int64_t last_used_ms;
+    uint32_t backoff_ms;
+    int64_t retry_at_ms;
+    http_uplink_stats_t stats;
+    char rx[HTTP_UPLINK_RX_SIZE];
+    size_t rx_len;
+    size_t rx_pos;
+} http_uplink_t;
+
+/**
+ * @brief Initialize a client; nothing is resolved or opened yet
+ *
+ * @param u Client
+ * @param cfg Endpoint and timing, copied
+ * @return `ESP_OK` on success
+ */
+esp_err_t http_uplink_init(http_uplink_t *u, const http_uplink_config_t *cfg);
+
+/**
+ * @brief Send a request and read the response
+ *
+ * @param u Client
+ * @param req Request
+ * @param[out] resp Status and optional body; may be NULL
+ * @return `ESP_OK` when a response was received (any status; 429 and 5xx
+ *         also start a backoff),
+ *         `ESP_ERR_INVALID_STATE` during backoff, `ESP_ERR_NOT_FOUND` when
+ *         the host does not resolve, `ESP_ERR_TIMEOUT` or `ESP_FAIL` on
+ *         network errors
+ */
+esp_err_t http_uplink_request(http_uplink_t *u, const http_uplink_request_t *req, http_uplink_response_t *resp);
+
+/**
+ * @brief Close the connection, keeping the cached address
+ *
+ * @param u Client
+ */
+void http_uplink_close(http_uplink_t *u);
+
+/**
+ * @brief Milliseconds until the next connection attempt is allowed
+ *
+ * @param u Client
+ * @return 0 when not backing off
+ */
+uint32_t http_uplink_backoff_left(const http_uplink_t *u);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __HTTP_UPLINK_H__ */
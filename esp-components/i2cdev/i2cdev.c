@@ -43,6 +43,7 @@ typedef struct {
     SemaphoreHandle_t lock;
     i2c_config_t config;
     bool installed;
+    i2c_port_stats_t stats;
 } i2c_port_state_t;
 
 static i2c_port_state_t states[I2C_NUM_MAX];
@@ -111,6 +112,24 @@ esp_err_t i2cdev_done()
     return ESP_OK;
 }
 
+// Called with the port lock held
+static void count_transfer(i2c_port_t port, esp_err_t res)
+{
+    states[port].stats.transfers++;
+    if (res != ESP_OK)
+        states[port].stats.errors++;
+    if (res == ESP_ERR_TIMEOUT)
+        states[port].stats.timeouts++;
+}
+
+esp_err_t i2cdev_get_stats(i2c_port_t port, i2c_port_stats_t *stats)
+{
+    if (port < 0 || port >= I2C_NUM_MAX || !stats) return ESP_ERR_INVALID_ARG;
+
+    *stats = states[port].stats;
+    return ESP_OK;
+}
+
 esp_err_t i2c_dev_create_mutex(i2c_dev_t *dev)
 {
 #if !CONFIG_I2CDEV_NOLOCK
@@ -293,6 +312,7 @@ esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_si
         i2c_master_stop(cmd);
 
         res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
+        count_transfer(dev->port, res);
         if (res != ESP_OK)
             ESP_LOGE(TAG, "Could not read from device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
 
@@ -320,6 +340,7 @@ esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_re
         i2c_master_write(cmd, (void *)out_data, out_size, true);
         i2c_master_stop(cmd);
         res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
+        count_transfer(dev->port, res);
         if (res != ESP_OK)
             ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
         i2c_cmd_link_delete(cmd);
@@ -84,6 +84,16 @@ typedef enum {
     I2C_DEV_READ       /**< Read operation */
 } i2c_dev_type_t;
 
+/**
+ * Transfer counters of an I2C port
+ */
+typedef struct
+{
+    uint32_t transfers;      //!< Reads and writes issued, probes not included
+    uint32_t errors;         //!< Transfers that failed, timeouts included
+    uint32_t timeouts;       //!< Transfers that timed out on the bus
+} i2c_port_stats_t;
+
 /**
  * @brief Init library
  *
@@ -103,6 +113,18 @@ esp_err_t i2cdev_init();
  */
 esp_err_t i2cdev_done();
 
+/**
+ * @brief Get transfer counters of a port
+ *
+ * Counters are updated under the port mutex and read without it, so a
+ * snapshot may miss the transfer in progress.
+ *
+ * @param port I2C port number
+ * @param[out] stats Counters since i2cdev_init()
+ * @return ESP_OK on success
+ */
+esp_err_t i2cdev_get_stats(i2c_port_t port, i2c_port_stats_t *stats);
+
 /**
  * @brief Create mutex for device descriptor
  *
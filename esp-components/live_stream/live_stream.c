@@ -0,0 +1,411 @@
+/**
+ * @file live_stream.c
+ *
+ * Server-Sent Events stream of every acquired sample, portable core
+ */
+#include "live_stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "fixfmt.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_STALL_MS 2000
+#define EVERY_MAX        10000
+#define SOCKET_SNDBUF    (4 * LIVE_STREAM_TX_SIZE)
+
+static int64_t now_ms(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time() / 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#endif
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+esp_err_t live_stream_init(live_stream_t *ls, const live_stream_config_t *cfg)
+{
+    CHECK_ARG(ls && cfg && cfg->n_values && cfg->n_values <= LIVE_STREAM_MAX_VALUES);
+    for (size_t i = 0; i < cfg->n_values; i++)
+        CHECK_ARG(cfg->names[i] && cfg->decimals[i] <= FIXFMT_DECIMALS_MAX);
+
+    memset(ls, 0, sizeof(*ls));
+    ls->cfg = *cfg;
+    if (!ls->cfg.stall_ms)
+        ls->cfg.stall_ms = DEFAULT_STALL_MS;
+    for (size_t i = 0; i < LIVE_STREAM_MAX_CLIENTS; i++)
+        ls->clients[i].fd = -1;
+
+    ls->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (ls->listen_fd < 0)
+        return ESP_FAIL;
+    int one = 1;
+    setsockopt(ls->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(cfg->port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(ls->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(ls->listen_fd, 2))
+    {
+        close(ls->listen_fd);
+        ls->listen_fd = -1;
+        return ESP_FAIL;
+    }
+    set_nonblocking(ls->listen_fd);
+
+    return ESP_OK;
+}
+
+void live_stream_publish(live_stream_t *ls, int64_t time_us, const float *values)
+{
+    uint32_t seq = ls->head;
+    live_slot_t *slot = &ls->ring[seq & (LIVE_STREAM_RING - 1)];
+
+    // Same protocol as the sensor_hub cache: readers that copied the slot
+    // while it was rewritten see writing changed and give up on it
+    __atomic_store_n(&slot->writing, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample.seq = seq;
+    slot->sample.time_us = time_us;
+    memcpy(slot->sample.values, values, ls->cfg.n_values * sizeof(float));
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ls->head, seq + 1, __ATOMIC_RELEASE);
+    ls->stats.published++;
+}
+
+// Copies sample seq; false if it has been overwritten
+static bool read_sample(const live_stream_t *ls, uint32_t seq, live_sample_t *out)
+{
+    const live_slot_t *slot = &ls->ring[seq & (LIVE_STREAM_RING - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq)
+        return false;
+    *out = slot->sample;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->writing, __ATOMIC_RELAXED) == seq;
+}
+
+static void drop(live_client_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->state = LIVE_CLIENT_FREE;
+    c->rx_len = c->tx_len = c->tx_pos = 0;
+}
+
+static void queue_text(live_client_t *c, const char *text)
+{
+    size_t n = strlen(text);
+    if (n > sizeof(c->tx) - c->tx_len)
+        n = sizeof(c->tx) - c->tx_len;
+    memcpy(c->tx + c->tx_len, text, n);
+    c->tx_len += n;
+}
+
+static void accept_clients(live_stream_t *ls, int64_t now)
+{
+    int fd;
+    while ((fd = accept(ls->listen_fd, NULL, NULL)) >= 0)
+    {
+        live_client_t *c = NULL;
+        for (size_t i = 0; i < LIVE_STREAM_MAX_CLIENTS && !c; i++)
+            if (ls->clients[i].state == LIVE_CLIENT_FREE)
+                c = &ls->clients[i];
+        if (!c)
+        {
+            static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+                                       "Connection: close\r\n\r\n";
+            send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            ls->stats.rejected++;
+            continue;
+        }
+
+        // Small kernel send buffer too, so a stalled client is noticed
+        // after a few KB rather than after whatever the stack would queue
+        set_nonblocking(fd);
+        int one = 1, sndbuf = SOCKET_SNDBUF;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        c->fd = fd;
+        c->state = LIVE_CLIENT_REQUEST;
+        c->rx_len = c->tx_len = c->tx_pos = 0;
+        c->progress_ms = now;
+    }
+}
+
+// GET /stream[?every=N]; anything else is answered and closed
+static void read_request(live_stream_t *ls, live_client_t *c)
+{
+    ssize_t n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - 1 - c->rx_len, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        drop(c);
+        ls->stats.closed++;
+        return;
+    }
+    if (n > 0)
+        c->rx_len += n;
+    c->rx[c->rx_len] = '\0';
+    if (!strstr(c->rx, "\r\n\r\n"))
+    {
+        if (c->rx_len == sizeof(c->rx) - 1)
+        {
+            queue_text(c, "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\n"
+                          "Connection: close\r\n\r\n");
+            c->state = LIVE_CLIENT_CLOSING;
+            ls->stats.rejected++;
+        }
+        return;
+    }
+
+    if (strncmp(c->rx, "GET /stream", 11) || (c->rx[11] != ' ' && c->rx[11] != '?'))
+    {
+        queue_text(c, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        c->state = LIVE_CLIENT_CLOSING;
+        ls->stats.rejected++;
+        return;
+    }
+
+    c->every = 1;
+    const char *line_end = strstr(c->rx, "\r\n");
+    const char *every = strstr(c->rx, "every=");
+    if (c->rx[11] == '?' && every && every < line_end)
+    {
+        long v = strtol(every + 6, NULL, 10);
+        c->every = v < 1 ? 1 : v > EVERY_MAX ? EVERY_MAX : v;
+    }
+    queue_text(c, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                  "Access-Control-Allow-Origin: *\r\nConnection: keep-alive\r\n\r\n");
+    c->cursor = __atomic_load_n(&ls->head, __ATOMIC_ACQUIRE);
+    c->state = LIVE_CLIENT_STREAMING;
+    ls->stats.accepted++;
+}
+
+static void format_event(const live_stream_t *ls, const live_sample_t *s, fixfmt_t *out)
+{
+    fixfmt_str(out, "id: ");
+    fixfmt_uint(out, s->seq);
+    fixfmt_str(out, "\ndata: {\"seq\":");
+    fixfmt_uint(out, s->seq);
+    fixfmt_str(out, ",\"t_ms\":");
+    fixfmt_int(out, s->time_us / 1000);
+    for (size_t i = 0; i < ls->cfg.n_values; i++)
+    {
+        fixfmt_char(out, ',');
+        fixfmt_json_str(out, ls->cfg.names[i]);
+        fixfmt_char(out, ':');
+        if (isfinite(s->values[i]))
+            fixfmt_float(out, s->values[i], ls->cfg.decimals[i]);
+        else
+            fixfmt_str(out, "null");
+    }
+    fixfmt_str(out, "}\n\n");
+}
+
+// Formats the client's samples up to head into its send buffer while they
+// fit; false if the client has lost samples
+static bool fill(live_stream_t *ls, live_client_t *c, uint32_t head)
+{
+    if (head - c->cursor > LIVE_STREAM_RING)
+        return false;
+
+    if (c->tx_pos)
+    {
+        memmove(c->tx, c->tx + c->tx_pos, c->tx_len - c->tx_pos);
+        c->tx_len -= c->tx_pos;
+        c->tx_pos = 0;
+    }
+
+    while (c->cursor != head)
+    {
+        if (c->cursor % c->every)
+        {
+            c->cursor++;
+            continue;
+        }
+        live_sample_t s;
+        if (!read_sample(ls, c->cursor, &s))
+            return false;
+
+        fixfmt_t out;
+        fixfmt_init(&out, c->tx + c->tx_len, sizeof(c->tx) - c->tx_len);
+        format_event(ls, &s, &out);
+        if (out.overflow)
+            break;
+        c->tx_len += out.len;
+        c->cursor++;
+        ls->stats.events++;
+    }
+    return true;
+}
+
+// Sends what the socket takes; false if the connection is gone
+static bool flush(live_stream_t *ls, live_client_t *c, int64_t now)
+{
+    while (c->tx_pos < c->tx_len)
+    {
+        ssize_t n = send(c->fd, c->tx + c->tx_pos, c->tx_len - c->tx_pos, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (n <= 0)
+            return false;
+        c->tx_pos += n;
+        c->progress_ms = now;
+        ls->stats.bytes += n;
+    }
+    c->tx_pos = c->tx_len = 0;
+    c->progress_ms = now;
+    return true;
+}
+
+// Anything a streaming client sends is ignored; end of file or an error
+// means it went away
+static bool still_connected(live_client_t *c)
+{
+    char buf[64];
+    ssize_t n;
+    while ((n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        ;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void serve_client(live_stream_t *ls, live_client_t *c, bool readable, int64_t now)
+{
+    switch (c->state)
+    {
+        case LIVE_CLIENT_REQUEST:
+            if (readable)
+                read_request(ls, c);
+            if (c->state == LIVE_CLIENT_REQUEST && now - c->progress_ms > ls->cfg.stall_ms)
+            {
+                drop(c);
+                ls->stats.rejected++;
+            }
+            break;
+
+        case LIVE_CLIENT_STREAMING:
+        {
+            if (readable && !still_connected(c))
+            {
+                drop(c);
+                ls->stats.closed++;
+                break;
+            }
+            // Refill as long as the socket takes everything, so a backlog
+            // larger than the send buffer goes out in one poll
+            uint32_t head = __atomic_load_n(&ls->head, __ATOMIC_ACQUIRE);
+            do
+            {
+                if (!fill(ls, c, head))
+                {
+                    drop(c);
+                    ls->stats.dropped_lagging++;
+                }
+                else if (!flush(ls, c, now))
+                {
+                    drop(c);
+                    ls->stats.closed++;
+                }
+            } while (c->state == LIVE_CLIENT_STREAMING && !c->tx_len && c->cursor != head);
+
+            if (c->state == LIVE_CLIENT_STREAMING && c->tx_len && now - c->progress_ms > ls->cfg.stall_ms)
+            {
+                drop(c);
+                ls->stats.dropped_slow++;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    // The response goes out, then the connection closes
+    if (c->state == LIVE_CLIENT_CLOSING && (!flush(ls, c, now) || !c->tx_len ||
+                                            now - c->progress_ms > ls->cfg.stall_ms))
+        drop(c);
+}
+
+esp_err_t live_stream_poll(live_stream_t *ls, uint32_t timeout_ms)
+{
+    fd_set rd, wr;
+    FD_ZERO(&rd);
+    FD_ZERO(&wr);
+    FD_SET(ls->listen_fd, &rd);
+    int max_fd = ls->listen_fd;
+    for (size_t i = 0; i < LIVE_STREAM_MAX_CLIENTS; i++)
+    {
+        const live_client_t *c = &ls->clients[i];
+        if (c->state == LIVE_CLIENT_FREE)
+            continue;
+        FD_SET(c->fd, &rd);
+        if (c->tx_pos < c->tx_len)
+            FD_SET(c->fd, &wr);
+        if (c->fd > max_fd)
+            max_fd = c->fd;
+    }
+
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = timeout_ms % 1000 * 1000 };
+    if (select(max_fd + 1, &rd, &wr, NULL, &tv) < 0)
+    {
+        if (errno != EINTR)
+            return ESP_FAIL;
+        FD_ZERO(&rd);
+    }
+
+    int64_t now = now_ms();
+    if (FD_ISSET(ls->listen_fd, &rd))
+        accept_clients(ls, now);
+    for (size_t i = 0; i < LIVE_STREAM_MAX_CLIENTS; i++)
+    {
+        live_client_t *c = &ls->clients[i];
+        if (c->state != LIVE_CLIENT_FREE)
+            serve_client(ls, c, c->fd >= 0 && FD_ISSET(c->fd, &rd), now);
+    }
+
+    return ESP_OK;
+}
+
+size_t live_stream_clients(const live_stream_t *ls)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < LIVE_STREAM_MAX_CLIENTS; i++)
+        n += ls->clients[i].state == LIVE_CLIENT_STREAMING;
+    return n;
+}
+
+void live_stream_close(live_stream_t *ls)
+{
+    for (size_t i = 0; i < LIVE_STREAM_MAX_CLIENTS; i++)
+        if (ls->clients[i].state != LIVE_CLIENT_FREE)
+            drop(&ls->clients[i]);
+    if (ls->listen_fd >= 0)
+        close(ls->listen_fd);
+    ls->listen_fd = -1;
+}
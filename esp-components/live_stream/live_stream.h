@@ -0,0 +1,198 @@
+/**
+ * @file live_stream.h
+ * @defgroup live_stream live_stream
+ * @{
+ *
+ * Server-Sent Events stream of every acquired sample to local clients.
+ *
+ * The producer (the sampling path) only writes each sample into a shared
+ * ring: no lock, no socket call, no per-client work, so the number and
+ * speed of clients cannot change its timing. A server loop, in its own
+ * task, follows the ring with one cursor per client, formats events into
+ * the client's own bounded send buffer and writes them with non-blocking
+ * sends.
+ *
+ * A client that falls further behind than the ring holds, or whose socket
+ * has accepted nothing for stall_ms while data is waiting, is dropped;
+ * the others are not held back. Clients connect with
+ * `GET /stream?every=N` to receive every Nth sample (sequence numbers
+ * divisible by N, so decimated streams line up).
+ *
+ * Each event is one JSON object:
+ *
+ *     id: 1234
+ *     data: {"seq":1234,"t_ms":61700,"gas":1873,"baseline":1790,...}
+ *
+ * Plain BSD sockets only, so the same code runs on lwIP and on a host.
+ */
+#ifndef __LIVE_STREAM_H__
+#define __LIVE_STREAM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIVE_STREAM_MAX_VALUES  6
+#define LIVE_STREAM_RING        128  //!< Samples kept for clients that lag, power of 2
+#define LIVE_STREAM_MAX_CLIENTS 3
+#define LIVE_STREAM_TX_SIZE     1024 //!< Send buffer per client
+#define LIVE_STREAM_RX_SIZE     256  //!< Request buffer per client
+
+/**
+ * Sample
+ */
+typedef struct
+{
+    uint32_t seq;
+    int64_t time_us;
+    float values[LIVE_STREAM_MAX_VALUES];
+} live_sample_t;
+
+/**
+ * Server configuration
+ */
+typedef struct
+{
+    uint16_t port;
+    size_t n_values;                              //!< Values per sample
+    const char *names[LIVE_STREAM_MAX_VALUES];    //!< JSON key of each value
+    uint8_t decimals[LIVE_STREAM_MAX_VALUES];     //!< Digits after the point of each value
+    uint32_t stall_ms;                            //!< Drop a client that takes nothing for this long, 0 = 2000
+} live_stream_config_t;
+
+/**
+ * Client state
+ */
+typedef enum
+{
+    LIVE_CLIENT_FREE = 0,
+    LIVE_CLIENT_REQUEST,     //!< Reading the request
+    LIVE_CLIENT_STREAMING,
+    LIVE_CLIENT_CLOSING,     //!< Sending a final response, then closed
+} live_client_state_t;
+
+/**
+ * Client
+ */
+typedef struct
+{
+    live_client_state_t state;
+    int fd;
+    uint32_t every;            //!< Decimation
+    uint32_t cursor;           //!< Next sample to send
+    int64_t progress_ms;       //!< Last time the socket took data
+    char rx[LIVE_STREAM_RX_SIZE];
+    size_t rx_len;
+    char tx[LIVE_STREAM_TX_SIZE];
+    size_t tx_len;
+    size_t tx_pos;
+} live_client_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint32_t published;        //!< Samples from the producer
+    uint32_t accepted;         //!< Clients that started streaming
+    uint32_t rejected;         //!< Connections refused: no free slot or bad request
+    uint32_t closed;           //!< Clients that disconnected
+    uint32_t dropped_slow;     //!< Clients dropped for a stalled socket
+    uint32_t dropped_lagging;  //!< Clients dropped for falling out of the ring
+    uint32_t events;           //!< Events queued to clients
+    uint64_t bytes;            //!< Bytes sent to clients
+} live_stream_stats_t;
+
+/**
+ * Shared ring slot
+ */
+typedef struct
+{
+    uint32_t seq;              //!< Sample stored, valid once equal to writing
+    uint32_t writing;          //!< Sample being stored
+    live_sample_t sample;
+} live_slot_t;
+
+/**
+ * Stream
+ */
+typedef struct
+{
+    live_stream_config_t cfg;
+    int listen_fd;
+    uint32_t head;             //!< Samples published; written by the producer only
+    live_slot_t ring[LIVE_STREAM_RING];
+    live_client_t clients[LIVE_STREAM_MAX_CLIENTS];
+    live_stream_stats_t stats;
+} live_stream_t;
+
+/**
+ * @brief Initialize a stream and start listening
+ *
+ * @param ls Stream
+ * @param cfg Configuration, copied; the value names must stay valid
+ * @return `ESP_OK` on success, `ESP_FAIL` if the port cannot be bound
+ */
+esp_err_t live_stream_init(live_stream_t *ls, const live_stream_config_t *cfg);
+
+/**
+ * @brief Add a sample; from the one producer task, never blocks
+ *
+ * The sequence number is assigned here.
+ *
+ * @param ls Stream
+ * @param time_us Sample time
+ * @param values cfg.n_values values
+ */
+void live_stream_publish(live_stream_t *ls, int64_t time_us, const float *values);
+
+/**
+ * @brief Serve clients: accept, read requests, send queued events, drop
+ *        slow clients; from the one server task
+ *
+ * Waits up to timeout_ms for socket activity. New samples do not wake
+ * it up, so the timeout bounds the delivery delay.
+ *
+ * @param ls Stream
+ * @param timeout_ms Longest wait
+ * @return `ESP_OK`, or `ESP_FAIL` if waiting on the sockets failed
+ */
+esp_err_t live_stream_poll(live_stream_t *ls, uint32_t timeout_ms);
+
+/**
+ * @brief Number of streaming clients
+ */
+size_t live_stream_clients(const live_stream_t *ls);
+
+/**
+ * @brief Close every client and the listening socket
+ */
+void live_stream_close(live_stream_t *ls);
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Initialize a stream and serve it from a new task
+ *
+ * @param ls Stream, must stay valid
+ * @param cfg Configuration
+ * @param priority Server task priority, below the sampling tasks
+ * @param core Core of the server task
+ * @return `ESP_OK` on success
+ */
+esp_err_t live_stream_esp_start(live_stream_t *ls, const live_stream_config_t *cfg, unsigned priority, int core);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __LIVE_STREAM_H__ */
@@ -0,0 +1,48 @@
+/**
+ * @file live_stream_esp.c
+ *
+ * live_stream server task
+ */
+#include "live_stream.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define SERVER_STACK 3072
+#define POLL_MS      25 //!< Longest delay between a sample and its event
+
+static const char *TAG = "live_stream";
+
+static void server_task(void *arg)
+{
+    live_stream_t *ls = arg;
+
+    while (1)
+    {
+        if (live_stream_poll(ls, POLL_MS) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "select failed");
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+}
+
+esp_err_t live_stream_esp_start(live_stream_t *ls, const live_stream_config_t *cfg, unsigned priority, int core)
+{
+    CHECK_ARG(ls && cfg);
+
+    esp_err_t err = live_stream_init(ls, cfg);
+    if (err != ESP_OK)
+        return err;
+
+    if (xTaskCreatePinnedToCore(server_task, "live_stream", SERVER_STACK, ls, priority, NULL, core) != pdPASS)
+    {
+        live_stream_close(ls);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "serving /stream on port %u", (unsigned)cfg->port);
+    return ESP_OK;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file mq_calib.c
+ *
+ * Clean-air calibration of MQ sensors
+ */
+#include "mq_calib.h"
+#include <string.h>
+
+esp_err_t mq_calib_init(mq_calib_t *cal, size_t n_channels, uint32_t frames)
+{
+    if (!cal || n_channels == 0 || n_channels > MQ_CALIB_MAX_CHANNELS || frames == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    memset(cal, 0, sizeof(mq_calib_t));
+    cal->n_channels = n_channels;
+    cal->target = frames;
+    return ESP_OK;
+}
+
+bool mq_calib_add(mq_calib_t *cal, const float *values)
+{
+    if (mq_calib_done(cal))
+        return true;
+
+    for (size_t i = 0; i < cal->n_channels; i++)
+        cal->sum[i] += values[i];
+
+    return ++cal->count >= cal->target;
+}
+
+void mq_calib_means(const mq_calib_t *cal, float *means)
+{
+    for (size_t i = 0; i < cal->n_channels; i++)
+        means[i] = cal->count ? (float)(cal->sum[i] / cal->count) : 0;
+}
+
+void mq_calib_blend(float *stored, const float *fresh, size_t n, float weight)
+{
+    for (size_t i = 0; i < n; i++)
+        stored[i] += (fresh[i] - stored[i]) * weight;
+}
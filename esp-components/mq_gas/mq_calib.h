@@ -0,0 +1,130 @@
+/**
+ * @file mq_calib.h
+ * @defgroup mq_calib mq_calib
+ * @{
+ *
+ * Clean-air calibration of MQ sensors.
+ *
+ * All channels are calibrated together from interleaved samples: every
+ * acquired frame contributes one value per channel, so N sensors take as
+ * long as one. Results are kept in NVS with a timestamp so a warm boot can
+ * start monitoring immediately and refine the stored values in the
+ * background.
+ */
+#ifndef __MQ_CALIB_H__
+#define __MQ_CALIB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQ_CALIB_MAX_CHANNELS 8 //!< Channels per calibration set
+#define MQ_CALIB_VERSION      1 //!< Layout version of mq_calib_record_t
+
+/**
+ * Running per-channel mean over a fixed number of frames
+ */
+typedef struct
+{
+    size_t n_channels;
+    uint32_t target;                     //!< Frames needed to complete
+    uint32_t count;                      //!< Frames accumulated so far
+    double sum[MQ_CALIB_MAX_CHANNELS];
+} mq_calib_t;
+
+/**
+ * Calibration result as stored in NVS
+ */
+typedef struct
+{
+    uint32_t version;                    //!< MQ_CALIB_VERSION
+    uint32_t n_channels;
+    int64_t timestamp;                   //!< time() when saved; seconds since boot if the clock was not set
+    float values[MQ_CALIB_MAX_CHANNELS];
+} mq_calib_record_t;
+
+/**
+ * @brief Start a new calibration run
+ *
+ * @param cal Accumulator
+ * @param n_channels Values per frame, up to MQ_CALIB_MAX_CHANNELS
+ * @param frames Frames to average
+ * @return `ESP_OK` on success
+ */
+esp_err_t mq_calib_init(mq_calib_t *cal, size_t n_channels, uint32_t frames);
+
+/**
+ * @brief Add one frame of interleaved samples
+ *
+ * Frames added after completion are ignored.
+ *
+ * @param cal Accumulator
+ * @param values One value per channel (Rs for R0 calibration, raw code for a baseline)
+ * @return true once the run is complete
+ */
+bool mq_calib_add(mq_calib_t *cal, const float *values);
+
+/**
+ * @brief Whether the run has accumulated all its frames
+ */
+static inline bool mq_calib_done(const mq_calib_t *cal)
+{
+    return cal->count >= cal->target;
+}
+
+/**
+ * @brief Per-channel mean of the accumulated frames
+ *
+ * @param cal Accumulator
+ * @param[out] means One value per channel
+ */
+void mq_calib_means(const mq_calib_t *cal, float *means);
+
+/**
+ * @brief Blend a fresh result into a stored one
+ *
+ * stored += (fresh - stored) * weight, per channel. Use weight 1 on a cold
+ * start and a smaller weight when refining values loaded from NVS.
+ *
+ * @param stored Values to update in place
+ * @param fresh New means
+ * @param n Number of channels
+ * @param weight Blend factor in [0, 1]
+ */
+void mq_calib_blend(float *stored, const float *fresh, size_t n, float weight);
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Load a calibration record from NVS
+ *
+ * @param key NVS key identifying the sensor set
+ * @param[out] rec Record
+ * @return `ESP_OK` on success, `ESP_ERR_NOT_FOUND` if nothing valid is stored
+ */
+esp_err_t mq_calib_load(const char *key, mq_calib_record_t *rec);
+
+/**
+ * @brief Save calibration values to NVS with the current timestamp
+ *
+ * @param key NVS key identifying the sensor set
+ * @param values One value per channel
+ * @param n Number of channels
+ * @return `ESP_OK` on success
+ */
+esp_err_t mq_calib_save(const char *key, const float *values, size_t n);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQ_CALIB_H__ */
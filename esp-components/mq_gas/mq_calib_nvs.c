@@ -0,0 +1,71 @@
+/**
+ * @file mq_calib_nvs.c
+ *
+ * NVS persistence of MQ calibration results
+ */
+#include "mq_calib.h"
+#include <string.h>
+#include <time.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+
+#define NVS_NAMESPACE "mq_calib"
+
+// Anything before this is an unset RTC rather than a real date
+#define CLOCK_VALID_AFTER 1700000000
+
+static const char *TAG = "mq_calib";
+
+esp_err_t mq_calib_load(const char *key, mq_calib_record_t *rec)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return ESP_ERR_NOT_FOUND;
+    if (err != ESP_OK)
+        return err;
+
+    size_t len = sizeof(mq_calib_record_t);
+    err = nvs_get_blob(nvs, key, rec, &len);
+    nvs_close(nvs);
+
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return ESP_ERR_NOT_FOUND;
+    if (err != ESP_OK)
+        return err;
+    if (len != sizeof(mq_calib_record_t) || rec->version != MQ_CALIB_VERSION ||
+        rec->n_channels == 0 || rec->n_channels > MQ_CALIB_MAX_CHANNELS)
+    {
+        ESP_LOGW(TAG, "Ignoring stale calibration record '%s'", key);
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mq_calib_save(const char *key, const float *values, size_t n)
+{
+    if (!key || !values || n == 0 || n > MQ_CALIB_MAX_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+
+    mq_calib_record_t rec = {
+        .version = MQ_CALIB_VERSION,
+        .n_channels = n,
+    };
+    memcpy(rec.values, values, n * sizeof(float));
+
+    time_t now = time(NULL);
+    rec.timestamp = now > CLOCK_VALID_AFTER ? (int64_t)now : esp_timer_get_time() / 1000000;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(nvs, key, &rec, sizeof(rec));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    return err;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file mq_gas.c
+ *
+ * Conversion of MQ-series gas sensor ADC readings to ppm
+ */
+#include "mq_gas.h"
+#include <math.h>
+
+float mq_gas_voltage(const mq_circuit_t *circuit, uint16_t raw)
+{
+    return ((float)raw / MQ_ADC_MAX) * circuit->v_ref;
+}
+
+float mq_gas_rs(const mq_circuit_t *circuit, float vout_mv)
+{
+    return ((circuit->v_supply - vout_mv) / vout_mv) * circuit->rl;
+}
+
+float mq_gas_ppm(const mq_curve_t *curve, float rs, float r0)
+{
+    float ratio = rs / r0;
+    float ppm_log = curve->slope * log10f(ratio) + curve->intercept;
+    return powf(10, ppm_log);
+}
+
+// Exact value of the chain at a (possibly fractional) code, in double so
+// the table itself adds no error beyond the final float rounding
+static double ppm_at(const mq_circuit_t *circuit, const mq_curve_t *curve, double r0, double raw)
+{
+    double v = raw / MQ_ADC_MAX * circuit->v_ref;
+    if (v <= 0)
+        return curve->slope < 0 ? 0 : INFINITY; // Rs -> infinity
+    double rs = (circuit->v_supply - v) / v * circuit->rl;
+    return pow(10, curve->slope * log10(rs / r0) + curve->intercept);
+}
+
+void mq_lut_build(mq_lut_t *lut, const mq_circuit_t *circuit, const mq_curve_t *curve, float r0)
+{
+    for (int i = 0; i < MQ_LUT_SIZE; i++)
+        lut->ppm[i] = (float)ppm_at(circuit, curve, r0, (double)(i << MQ_LUT_SHIFT));
+}
+
+void mq_lut_error(const mq_lut_t *lut, const mq_circuit_t *circuit, const mq_curve_t *curve, float r0,
+                  uint16_t raw_min, float *max_abs, float *max_rel)
+{
+    double worst_abs = 0, worst_rel = 0;
+
+    for (int raw = raw_min; raw <= MQ_ADC_MAX; raw++)
+    {
+        double ref = ppm_at(circuit, curve, r0, raw);
+        double err = fabs(mq_lut_ppm(lut, raw) - ref);
+        if (err > worst_abs)
+            worst_abs = err;
+        if (ref > 0 && err / ref > worst_rel)
+            worst_rel = err / ref;
+    }
+    *max_abs = (float)worst_abs;
+    *max_rel = (float)worst_rel;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file mq_gas.h
+ * @defgroup mq_gas mq_gas
+ * @{
+ *
+ * Conversion of MQ-series gas sensor ADC readings to ppm.
+ *
+ * The sensor curve is the usual datasheet fit
+ * log10(ppm) = slope * log10(Rs / R0) + intercept, with Rs derived from
+ * the divider formed by the sensor and its load resistor. Because the
+ * whole raw -> Rs -> ppm chain only depends on the 12-bit code once R0 is
+ * known, it is precomputed into a per-sensor table and a sample costs one
+ * lookup (plus a linear interpolation when the table is decimated).
+ */
+#ifndef __MQ_GAS_H__
+#define __MQ_GAS_H__
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_MQ_GAS_LUT_SHIFT
+#define MQ_LUT_SHIFT CONFIG_MQ_GAS_LUT_SHIFT
+#else
+#define MQ_LUT_SHIFT 2
+#endif
+
+#define MQ_ADC_MAX   4095                                //!< Largest 12-bit code
+#define MQ_LUT_SIZE  (((MQ_ADC_MAX + 1) >> MQ_LUT_SHIFT) + 1) //!< Table entries
+
+/**
+ * Measurement circuit: load resistor and voltages seen by the ADC
+ */
+typedef struct
+{
+    float rl;        //!< Load resistor, ohms
+    float v_ref;     //!< ADC full-scale voltage, mV
+    float v_supply;  //!< Sensor supply voltage, mV
+} mq_circuit_t;
+
+/**
+ * Sensitivity curve: log10(ppm) = slope * log10(Rs / R0) + intercept
+ */
+typedef struct
+{
+    float slope;
+    float intercept;
+} mq_curve_t;
+
+/**
+ * Precomputed raw code -> ppm table for one sensor
+ */
+typedef struct
+{
+    float ppm[MQ_LUT_SIZE];
+} mq_lut_t;
+
+/**
+ * @brief Convert a raw ADC code to the voltage at the ADC pin
+ *
+ * @param circuit Measurement circuit
+ * @param raw 12-bit ADC code
+ * @return Voltage in mV
+ */
+float mq_gas_voltage(const mq_circuit_t *circuit, uint16_t raw);
+
+/**
+ * @brief Sensor resistance from the divider output voltage
+ *
+ * @param circuit Measurement circuit
+ * @param vout_mv Voltage at the ADC pin, mV
+ * @return Rs in ohms
+ */
+float mq_gas_rs(const mq_circuit_t *circuit, float vout_mv);
+
+/**
+ * @brief Reference ppm computation from Rs (log10/pow per call)
+ *
+ * @param curve Sensor curve
+ * @param rs Sensor resistance, ohms
+ * @param r0 Calibrated resistance in clean air, ohms
+ * @return Concentration in ppm
+ */
+float mq_gas_ppm(const mq_curve_t *curve, float rs, float r0);
+
+/**
+ * @brief Fill a lookup table for the given circuit, curve and R0
+ *
+ * Must be called again whenever R0 changes.
+ *
+ * @param lut Table to fill
+ * @param circuit Measurement circuit
+ * @param curve Sensor curve
+ * @param r0 Calibrated resistance in clean air, ohms
+ */
+void mq_lut_build(mq_lut_t *lut, const mq_circuit_t *circuit, const mq_curve_t *curve, float r0);
+
+/**
+ * @brief Largest deviation of the table from the reference formulas
+ *
+ * Evaluates every code in [raw_min, MQ_ADC_MAX]. Relative error is taken
+ * against the reference value and skipped where that value is zero.
+ *
+ * @param lut Table built with the same parameters
+ * @param circuit Measurement circuit
+ * @param curve Sensor curve
+ * @param r0 Calibrated resistance in clean air, ohms
+ * @param raw_min First code to evaluate
+ * @param[out] max_abs Largest absolute error, ppm
+ * @param[out] max_rel Largest relative error (0.01 = 1 %)
+ */
+void mq_lut_error(const mq_lut_t *lut, const mq_circuit_t *circuit, const mq_curve_t *curve, float r0,
+                  uint16_t raw_min, float *max_abs, float *max_rel);
+
+/**
+ * @brief Look up the concentration for a raw ADC code
+ *
+ * @param lut Table filled by mq_lut_build()
+ * @param raw 12-bit ADC code, larger values are clamped
+ * @return Concentration in ppm
+ */
+static inline float mq_lut_ppm(const mq_lut_t *lut, uint16_t raw)
+{
+    if (raw > MQ_ADC_MAX)
+        raw = MQ_ADC_MAX;
+#if MQ_LUT_SHIFT == 0
+    return lut->ppm[raw];
+#else
+    uint16_t i = raw >> MQ_LUT_SHIFT;
+    uint16_t frac = raw & ((1 << MQ_LUT_SHIFT) - 1);
+    float a = lut->ppm[i];
+    return a + (lut->ppm[i + 1] - a) * (float)frac * (1.0f / (1 << MQ_LUT_SHIFT));
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQ_GAS_H__ */
@@ -0,0 +1,53 @@
+/**
+ * @file mq_model.c
+ *
+ * Table-driven set of MQ gas sensors
+ */
+#include "mq_model.h"
+
+esp_err_t mq_model_init(mq_model_t *model, mq_sensor_desc_t *sensors, mq_lut_t *luts, size_t count)
+{
+    if (!model || !sensors || !luts || count == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    model->count = count;
+    model->sensors = sensors;
+    model->luts = luts;
+
+    for (size_t i = 0; i < count; i++)
+        mq_lut_build(&luts[i], &sensors[i].circuit, &sensors[i].curve, sensors[i].r0);
+
+    return ESP_OK;
+}
+
+esp_err_t mq_model_set_r0(mq_model_t *model, size_t index, float r0)
+{
+    if (!model || index >= model->count || !(r0 > 0))
+        return ESP_ERR_INVALID_ARG;
+
+    mq_sensor_desc_t *s = &model->sensors[index];
+    s->r0 = r0;
+    mq_lut_build(&model->luts[index], &s->circuit, &s->curve, r0);
+    return ESP_OK;
+}
+
+void mq_model_calibrate(mq_model_t *model, const float *clean_air_rs)
+{
+    for (size_t i = 0; i < model->count; i++)
+        mq_model_set_r0(model, i, clean_air_rs[i] / model->sensors[i].clean_air_ratio);
+}
+
+void mq_model_rs(const mq_model_t *model, const uint16_t *raw, float *rs)
+{
+    const mq_sensor_desc_t *s = model->sensors;
+    for (size_t i = 0; i < model->count; i++)
+        rs[i] = mq_gas_rs(&s[i].circuit, mq_gas_voltage(&s[i].circuit, raw[i]));
+}
+
+void mq_model_convert(const mq_model_t *model, const uint16_t *raw, float *ppm)
+{
+    const mq_lut_t *lut = model->luts;
+    const size_t n = model->count;
+    for (size_t i = 0; i < n; i++)
+        ppm[i] = mq_lut_ppm(&lut[i], raw[i]);
+}
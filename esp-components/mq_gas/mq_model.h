@@ -0,0 +1,115 @@
+/**
+ * @file mq_model.h
+ * @defgroup mq_model mq_model
+ * @{
+ *
+ * Table-driven set of MQ gas sensors.
+ *
+ * Each sensor is described by data only (where it is read from, its
+ * circuit, curve and calibration), and a whole frame of raw readings is
+ * converted in one pass over struct-of-arrays buffers. Adding a sensor,
+ * including one behind an external ADC, is a new table row rather than new
+ * code.
+ */
+#ifndef __MQ_MODEL_H__
+#define __MQ_MODEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "mq_gas.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Where a sensor's raw readings come from
+ */
+typedef enum
+{
+    MQ_SOURCE_ADC1 = 0,  //!< On-chip ADC1, channel = adc_channel_t
+    MQ_SOURCE_EXTERNAL,  //!< External ADC, channel is its input number
+} mq_source_t;
+
+/**
+ * Sensor descriptor
+ */
+typedef struct
+{
+    const char *name;        //!< Human readable, e.g. "MQ-135"
+    const char *quantity;    //!< Measured gas, used as payload key, e.g. "co2"
+    mq_source_t source;      //!< ADC the sensor is wired to
+    uint8_t channel;         //!< Channel on that ADC
+    mq_circuit_t circuit;    //!< Load resistor and voltages
+    mq_curve_t curve;        //!< log10(ppm) vs log10(Rs/R0) fit
+    float clean_air_ratio;   //!< Rs/R0 in clean air, from the datasheet
+    float r0;                //!< Calibrated R0, ohms
+} mq_sensor_desc_t;
+
+/**
+ * A set of sensors and their conversion tables
+ */
+typedef struct
+{
+    size_t count;
+    mq_sensor_desc_t *sensors; //!< count descriptors, owned by the caller
+    mq_lut_t *luts;            //!< count tables, owned by the caller
+} mq_model_t;
+
+/**
+ * @brief Bind descriptors and table storage, and build every table
+ *
+ * @param model Model to initialize
+ * @param sensors Descriptor table, must outlive the model
+ * @param luts Storage for one table per descriptor
+ * @param count Number of sensors
+ * @return `ESP_OK` on success
+ */
+esp_err_t mq_model_init(mq_model_t *model, mq_sensor_desc_t *sensors, mq_lut_t *luts, size_t count);
+
+/**
+ * @brief Set R0 of one sensor and rebuild its table
+ *
+ * @param model Model
+ * @param index Sensor index
+ * @param r0 Calibrated R0, ohms
+ * @return `ESP_OK` on success
+ */
+esp_err_t mq_model_set_r0(mq_model_t *model, size_t index, float r0);
+
+/**
+ * @brief Set every R0 from clean-air mean Rs values and rebuild all tables
+ *
+ * @param model Model
+ * @param clean_air_rs Mean Rs per sensor measured in clean air, ohms
+ */
+void mq_model_calibrate(mq_model_t *model, const float *clean_air_rs);
+
+/**
+ * @brief Sensor resistance for every sensor in a frame
+ *
+ * @param model Model
+ * @param raw Raw codes, one per sensor
+ * @param[out] rs Rs per sensor, ohms
+ */
+void mq_model_rs(const mq_model_t *model, const uint16_t *raw, float *rs);
+
+/**
+ * @brief Convert a whole frame of raw codes to ppm
+ *
+ * One table lookup per sensor and no per-sensor branching.
+ *
+ * @param model Model
+ * @param raw Raw codes, one per sensor
+ * @param[out] ppm Concentrations, one per sensor
+ */
+void mq_model_convert(const mq_model_t *model, const uint16_t *raw, float *ppm);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQ_MODEL_H__ */
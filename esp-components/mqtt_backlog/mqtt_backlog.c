@@ -0,0 +1,212 @@
+/**
+ * @file mqtt_backlog.c
+ *
+ * Readings kept in a flash_log and published from there through mqtt_pub
+ */
+#include "mqtt_backlog.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_PER_RUN 5
+
+#define RECORD_LEN(b) (offsetof(mqtt_backlog_record_t, values) + (b)->cfg.n_values * sizeof(float))
+
+// Groups the pending readings by boot, keeping the newest boots, then
+// places each boot's readings right before those of the next one
+static void map_boots(mqtt_backlog_t *b)
+{
+    uint32_t first[MQTT_BACKLOG_BOOTS_MAX];
+    flog_cursor_t c = b->log.tail;
+    flog_record_t rec;
+    while (flog_next(&b->log, &c, &rec) == ESP_OK)
+    {
+        mqtt_backlog_record_t r;
+        if (rec.len != RECORD_LEN(b))
+            continue;
+        memcpy(&r, rec.data, rec.len);
+        if (r.boot_id == b->cfg.boot_id)
+            continue;
+        if (!b->n_boots || b->boots[b->n_boots - 1].boot_id != r.boot_id)
+        {
+            if (b->n_boots == MQTT_BACKLOG_BOOTS_MAX)
+            {
+                b->n_boots--;
+                memmove(b->boots, b->boots + 1, b->n_boots * sizeof(b->boots[0]));
+                memmove(first, first + 1, b->n_boots * sizeof(first[0]));
+            }
+            b->boots[b->n_boots].boot_id = r.boot_id;
+            first[b->n_boots++] = r.time_ms;
+        }
+        b->boots[b->n_boots - 1].last_ms = r.time_ms;
+    }
+
+    int64_t next = 0;
+    for (size_t i = b->n_boots; i-- > 0;)
+    {
+        b->boots[i].end_ms = next - 1;
+        next = b->boots[i].end_ms - (uint32_t)(b->boots[i].last_ms - first[i]);
+    }
+}
+
+esp_err_t mqtt_backlog_init(mqtt_backlog_t *b, const mqtt_backlog_config_t *cfg, const flog_flash_t *flash)
+{
+    CHECK_ARG(b && cfg && cfg->pub && cfg->topic && (cfg->encode || cfg->schema));
+    size_t n_values = cfg->n_values || cfg->encode ? cfg->n_values : cfg->schema->n_fields;
+    CHECK_ARG(n_values && n_values <= MQTT_BACKLOG_VALUES_MAX);
+
+    memset(b, 0, sizeof(*b));
+    b->cfg = *cfg;
+    b->cfg.n_values = n_values;
+    if (!b->cfg.per_run)
+        b->cfg.per_run = DEFAULT_PER_RUN;
+    if (!cfg->encode)
+    {
+        CHECK_ARG(n_values <= cfg->schema->n_fields);
+        esp_err_t err = telem_enc_init(&b->enc, cfg->schema, cfg->key_interval);
+        if (err != ESP_OK)
+            return err;
+    }
+    if (!flash)
+        return ESP_OK;
+
+    esp_err_t err = flog_mount(&b->log, flash);
+    if (err != ESP_OK)
+        return err;
+    b->ready = true;
+    b->cursor = b->log.tail;
+    map_boots(b);
+
+    return ESP_OK;
+}
+
+esp_err_t mqtt_backlog_topic_mac(const char *prefix, const uint8_t mac[6], char *buf, size_t size)
+{
+    CHECK_ARG(prefix && mac && buf);
+
+    int n = snprintf(buf, size, "%s%02x%02x%02x%02x%02x%02x", prefix, mac[0], mac[1], mac[2], mac[3], mac[4],
+                     mac[5]);
+    return n >= 0 && (size_t)n < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static void restart(mqtt_backlog_t *b)
+{
+    b->count = 0;
+    b->cursor = b->log.tail;
+    if (!b->cfg.encode)
+        telem_enc_reset(&b->enc);
+    if (b->cfg.rewind)
+        b->cfg.rewind(b->cfg.ctx);
+}
+
+bool mqtt_backlog_done(mqtt_backlog_t *b, uint32_t tag, bool acked)
+{
+    size_t i = 0;
+    while (i < b->count && b->inflight[i].rec.seq != tag)
+        i++;
+    if (i == b->count)
+        return false;
+
+    if (!acked)
+    {
+        // The client gave up on it; everything not acknowledged goes again
+        restart(b);
+        return false;
+    }
+    b->inflight[i].acked = true;
+    size_t n = 0;
+    while (n < b->count && b->inflight[n].acked)
+        n++;
+    if (n)
+    {
+        flog_ack(&b->log, &b->inflight[n - 1].rec);
+        b->count -= n;
+        memmove(b->inflight, b->inflight + n, b->count * sizeof(b->inflight[0]));
+    }
+    return true;
+}
+
+static size_t encode(mqtt_backlog_t *b, const mqtt_backlog_record_t *r, const uint32_t *seq, int64_t now_ms,
+                     uint8_t *buf, size_t size)
+{
+    uint32_t age_ms = (uint32_t)now_ms - r->time_ms;
+    bool aged = seq && r->boot_id == b->cfg.boot_id;
+    for (size_t i = 0; seq && !aged && i < b->n_boots; i++)
+    {
+        if (b->boots[i].boot_id != r->boot_id)
+            continue;
+        int64_t age = now_ms - b->boots[i].end_ms + (uint32_t)(b->boots[i].last_ms - r->time_ms);
+        aged = age <= UINT32_MAX;
+        age_ms = age;
+    }
+    if (b->cfg.encode)
+        return b->cfg.encode(b->cfg.ctx, r->values, seq, aged ? &age_ms : NULL, buf, size);
+
+    // Fields past n_values are left out of the frame
+    float values[TELEM_FIELDS_MAX];
+    for (size_t i = 0; i < b->enc.schema->n_fields; i++)
+        values[i] = i < b->cfg.n_values ? r->values[i] : NAN;
+    size_t len = 0;
+    telem_encode(&b->enc, values, seq, aged ? &age_ms : NULL, buf, size, &len);
+    return len;
+}
+
+void mqtt_backlog_send(mqtt_backlog_t *b, int64_t now_ms)
+{
+    if (!b->ready)
+        return;
+    // Records lost to a full log since they were sent
+    if (b->cursor.seq - b->log.tail.seq > flog_pending(&b->log))
+        restart(b);
+
+    if (!mqtt_pub_ready(b->cfg.pub))
+        return;
+    flog_cursor_t c = b->cursor;
+    flog_record_t rec;
+    for (uint32_t n = 0; n < b->cfg.per_run && b->count < MQTT_PUB_INFLIGHT_MAX &&
+                         flog_next(&b->log, &c, &rec) == ESP_OK; n++)
+    {
+        if (rec.len == RECORD_LEN(b))
+        {
+            mqtt_backlog_record_t r;
+            memcpy(&r, rec.data, rec.len);
+            uint8_t payload[MQTT_PUB_PAYLOAD_MAX];
+            size_t len = encode(b, &r, &rec.seq, now_ms, payload, sizeof(payload));
+            if (mqtt_pub_send(b->cfg.pub, b->cfg.topic, (const char *)payload, len, rec.seq) != ESP_OK)
+                break;
+            if (b->cfg.sent)
+                b->cfg.sent(b->cfg.ctx, rec.seq, r.values, len);
+            b->inflight[b->count++] = (mqtt_backlog_msg_t) { rec, false };
+        }
+        else if (!b->count)
+        {
+            // Written by other firmware; nothing to send
+            flog_ack(&b->log, &rec);
+        }
+        b->cursor = c;
+    }
+}
+
+esp_err_t mqtt_backlog_publish(mqtt_backlog_t *b, const float *values, int64_t now_ms)
+{
+    mqtt_backlog_record_t r = { .boot_id = b->cfg.boot_id, .time_ms = (uint32_t)now_ms };
+    memcpy(r.values, values, b->cfg.n_values * sizeof(float));
+
+    if (!b->ready)
+    {
+        uint8_t payload[MQTT_PUB_PAYLOAD_MAX];
+        size_t len = encode(b, &r, NULL, now_ms, payload, sizeof(payload));
+        return mqtt_pub_latest(b->cfg.pub, b->cfg.topic, (const char *)payload, len, MQTT_PUB_UNTAGGED);
+    }
+    esp_err_t err = flog_append(&b->log, &r, RECORD_LEN(b), NULL);
+    mqtt_backlog_send(b, now_ms);
+    return err;
+}
+
+void mqtt_backlog_poll(mqtt_backlog_t *b, int64_t now_ms)
+{
+    mqtt_pub_poll(b->cfg.pub);
+    mqtt_backlog_send(b, now_ms);
+}
@@ -0,0 +1,259 @@
+/**
+ * @file mqtt_backlog.h
+ * @defgroup mqtt_backlog mqtt_backlog
+ * @{
+ *
+ * Readings kept in a flash_log and published from there through mqtt_pub,
+ * as the MQTT nodes do.
+ *
+ * Every reading is appended to the log with the boot it was taken in and
+ * its time since boot, then sent oldest first, per_run records at a time,
+ * with its log sequence number as message tag. A record stays in flash
+ * until the broker has acknowledged it and every one before it; a record
+ * sent again after an expiry can be acknowledged through an older copy
+ * while the ones in front of it are still on their way. When the client
+ * gives up on a message, everything not acknowledged goes again.
+ *
+ * Every reading carries its age. Those of earlier boots are placed just
+ * before the current boot, as if the node had restarted right after the
+ * newest of them and without downtime: each earlier boot's readings keep
+ * their spacing and end 1 ms before the next boot's first reading. Their
+ * ages are a lower bound, but they stay in order with the readings of
+ * the current boot, so a collector that keeps timestamps increasing
+ * accepts them all. The pending readings are scanned once at init for
+ * this; readings of more than MQTT_BACKLOG_BOOTS_MAX earlier boots go
+ * without an age.
+ *
+ * Without a log (no flash, or it failed to mount) only the newest reading
+ * is kept, in mqtt_pub's coalescing slot.
+ *
+ * Payloads are telem_codec frames of the configured schema, with the
+ * log sequence number and the age, or whatever the caller's encode
+ * callback makes of a reading. Each node publishes on its own topic, a
+ * prefix followed by its station MAC, see mqtt_backlog_topic(). Not
+ * thread-safe; use from the task that publishes.
+ */
+#ifndef __MQTT_BACKLOG_H__
+#define __MQTT_BACKLOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "flash_log.h"
+#include "mqtt_pub.h"
+#include "telem_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_BACKLOG_VALUES_MAX 8   //!< Values per reading
+#define MQTT_BACKLOG_BOOTS_MAX  8   //!< Earlier boots with readings pending that get an age
+
+/**
+ * Topic buffer size for a prefix string literal, see mqtt_backlog_topic()
+ */
+#define MQTT_BACKLOG_TOPIC_SIZE(prefix) (sizeof(prefix) + 12)
+
+/**
+ * Encodes one reading into buf; seq is NULL for a reading sent without
+ * the log, age_ms NULL when the age is not known. Returns the payload
+ * length, 0 when it does not fit.
+ */
+typedef size_t (*mqtt_backlog_encode_fn_t)(void *ctx, const float *values, const uint32_t *seq,
+                                           const uint32_t *age_ms, uint8_t *buf, size_t size);
+
+/**
+ * Called when sending starts over from the oldest unacknowledged record,
+ * e.g. to reset a delta encoder
+ */
+typedef void (*mqtt_backlog_rewind_fn_t)(void *ctx);
+
+/**
+ * Called for every record the client took
+ */
+typedef void (*mqtt_backlog_sent_fn_t)(void *ctx, uint32_t seq, const float *values, size_t len);
+
+/**
+ * Configuration
+ */
+typedef struct
+{
+    mqtt_pub_t *pub;
+    const char *topic;                 //!< Must stay valid
+    size_t n_values;                   //!< Values per reading, up to MQTT_BACKLOG_VALUES_MAX; 0 = the schema's
+    uint32_t per_run;                  //!< Records handed to the client per send, 0 = 5
+    uint32_t boot_id;                  //!< Random per boot
+    const telem_schema_t *schema;      //!< Payloads are frames of it when encode is NULL
+    uint32_t key_interval;             //!< Of those frames, see telem_enc_init()
+    mqtt_backlog_encode_fn_t encode;   //!< NULL = telem_codec frames of schema
+    mqtt_backlog_rewind_fn_t rewind;   //!< Optional; the frame encoder is reset anyway
+    mqtt_backlog_sent_fn_t sent;       //!< Optional
+    void *ctx;                         //!< Passed to the callbacks
+} mqtt_backlog_config_t;
+
+/**
+ * Flash copy of a reading; only the first n_values values are stored
+ */
+typedef struct
+{
+    uint32_t boot_id;
+    uint32_t time_ms;                  //!< Since boot_id's boot
+    float values[MQTT_BACKLOG_VALUES_MAX];
+} mqtt_backlog_record_t;
+
+/**
+ * Readings of an earlier boot, mapped onto the current boot's clock
+ */
+typedef struct
+{
+    uint32_t boot_id;
+    uint32_t last_ms;                  //!< time_ms of its newest reading
+    int64_t end_ms;                    //!< Where that reading lands, < 0
+} mqtt_backlog_boot_t;
+
+/**
+ * Record handed to the client
+ */
+typedef struct
+{
+    flog_record_t rec;
+    bool acked;
+} mqtt_backlog_msg_t;
+
+/**
+ * Backlog state
+ */
+typedef struct
+{
+    mqtt_backlog_config_t cfg;
+    flog_t log;
+    bool ready;                        //!< The log is mounted
+    mqtt_backlog_msg_t inflight[MQTT_PUB_INFLIGHT_MAX]; //!< Oldest first
+    size_t count;
+    flog_cursor_t cursor;              //!< Next record to send
+    mqtt_backlog_boot_t boots[MQTT_BACKLOG_BOOTS_MAX]; //!< Oldest first
+    size_t n_boots;
+    telem_enc_t enc;                   //!< Without an encode callback
+} mqtt_backlog_t;
+
+/**
+ * @brief Initialize a backlog and mount its log
+ *
+ * On a mount error the backlog still works, without the log.
+ *
+ * @param b Backlog
+ * @param cfg Configuration, copied
+ * @param flash Flash for the log, or NULL for none
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_ARG` for a bad
+ *         configuration, otherwise the error of flog_mount()
+ */
+esp_err_t mqtt_backlog_init(mqtt_backlog_t *b, const mqtt_backlog_config_t *cfg, const flog_flash_t *flash);
+
+/**
+ * @brief Build a node's topic: prefix, then the MAC as 12 hex digits
+ *
+ * @param prefix Topic prefix, e.g. "esp32/sensors/gas/"
+ * @param mac Station MAC
+ * @param buf Output, see MQTT_BACKLOG_TOPIC_SIZE()
+ * @param size Size of buf
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_SIZE` when it does not fit
+ */
+esp_err_t mqtt_backlog_topic_mac(const char *prefix, const uint8_t mac[6], char *buf, size_t size);
+
+/**
+ * @brief Whether readings are kept in flash
+ */
+static inline bool mqtt_backlog_ready(const mqtt_backlog_t *b)
+{
+    return b->ready;
+}
+
+/**
+ * @brief Readings in the log not yet acknowledged
+ */
+static inline uint32_t mqtt_backlog_pending(const mqtt_backlog_t *b)
+{
+    return b->ready ? flog_pending(&b->log) : 0;
+}
+
+/**
+ * @brief Keep a reading and send what the in-flight limit allows
+ *
+ * @param b Backlog
+ * @param values n_values values
+ * @param now_ms Time since boot
+ * @return `ESP_OK` when logged or, without a log, sent or kept in the
+ *         slot; otherwise the error of flog_append() or mqtt_pub_latest()
+ */
+esp_err_t mqtt_backlog_publish(mqtt_backlog_t *b, const float *values, int64_t now_ms);
+
+/**
+ * @brief Send the next logged readings, as far as the in-flight limit
+ *        allows
+ *
+ * @param b Backlog
+ * @param now_ms Time since boot, for the age of each reading
+ */
+void mqtt_backlog_send(mqtt_backlog_t *b, int64_t now_ms);
+
+/**
+ * @brief Process acknowledgements, then retry whatever could not be sent
+ *        so far: the slot reading without a log, the log otherwise
+ *
+ * @param b Backlog
+ * @param now_ms Time since boot
+ */
+void mqtt_backlog_poll(mqtt_backlog_t *b, int64_t now_ms);
+
+/**
+ * @brief Record the end of a message; call from mqtt_pub's done callback
+ *
+ * @param b Backlog
+ * @param tag Tag of the message
+ * @param acked true when the broker acknowledged it
+ * @return true when it was a logged reading the broker acknowledged
+ */
+bool mqtt_backlog_done(mqtt_backlog_t *b, uint32_t tag, bool acked);
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Build this node's topic from its station MAC, see
+ *        mqtt_backlog_topic_mac()
+ */
+esp_err_t mqtt_backlog_topic(const char *prefix, char *buf, size_t size);
+
+/**
+ * @brief Initialize a backlog on a data partition, with a random boot_id
+ *
+ * Logs the readings pending from earlier boots, or a warning when the
+ * partition cannot be used.
+ *
+ * @param b Backlog
+ * @param cfg Configuration, copied; boot_id is ignored
+ * @param partition Partition label
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_ARG` for a bad
+ *         configuration, otherwise the error of the partition or the
+ *         mount; the backlog then works without a log
+ */
+esp_err_t mqtt_backlog_init_esp(mqtt_backlog_t *b, const mqtt_backlog_config_t *cfg, const char *partition);
+
+/**
+ * @brief Log the publisher's and the log's counters
+ *
+ * @param b Backlog
+ * @param tag Log tag
+ */
+void mqtt_backlog_log_stats(const mqtt_backlog_t *b, const char *tag);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQTT_BACKLOG_H__ */
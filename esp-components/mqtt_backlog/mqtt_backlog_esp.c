@@ -0,0 +1,57 @@
+/**
+ * @file mqtt_backlog_esp.c
+ *
+ * mqtt_backlog on an ESP-IDF data partition
+ */
+#include "mqtt_backlog.h"
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_random.h>
+
+static const char *TAG = "mqtt_backlog";
+
+esp_err_t mqtt_backlog_topic(const char *prefix, char *buf, size_t size)
+{
+    uint8_t mac[6];
+    esp_err_t err = esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    if (err != ESP_OK)
+        return err;
+    return mqtt_backlog_topic_mac(prefix, mac, buf, size);
+}
+
+esp_err_t mqtt_backlog_init_esp(mqtt_backlog_t *b, const mqtt_backlog_config_t *cfg, const char *partition)
+{
+    if (!cfg)
+        return ESP_ERR_INVALID_ARG;
+    mqtt_backlog_config_t c = *cfg;
+    c.boot_id = esp_random();
+
+    flog_flash_t flash;
+    esp_err_t err = flog_partition_open(&flash, partition);
+    if (err == ESP_OK)
+        err = mqtt_backlog_init(b, &c, &flash);
+    if (err == ESP_ERR_INVALID_ARG)
+        return err;
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No backlog partition (%s), only the newest reading is kept while offline",
+                 esp_err_to_name(err));
+        esp_err_t init = mqtt_backlog_init(b, &c, NULL);
+        return init != ESP_OK ? init : err;
+    }
+    ESP_LOGI(TAG, "Backlog: %" PRIu32 " readings pending", mqtt_backlog_pending(b));
+    return ESP_OK;
+}
+
+void mqtt_backlog_log_stats(const mqtt_backlog_t *b, const char *tag)
+{
+    const mqtt_pub_t *p = b->cfg.pub;
+    ESP_LOGI(tag, "MQTT: %" PRIu32 " published, %" PRIu32 " acked, %" PRIu32 " expired, %" PRIu32
+             " refused, %" PRIu32 " coalesced, %" PRIu32 " in flight (peak %" PRIu32 "), %" PRIu32 " connects",
+             p->stats.published, p->stats.acked, p->stats.expired, p->stats.refused, p->stats.coalesced,
+             mqtt_pub_inflight(p), p->stats.peak_inflight, p->stats.connects);
+    if (b->ready)
+        ESP_LOGI(tag, "Backlog: %" PRIu32 " pending, %" PRIu32 " dropped, %" PRIu32 " torn at boot",
+                 flog_pending(&b->log), b->log.stats.dropped, b->log.stats.torn);
+}
@@ -0,0 +1,148 @@
+/**
+ * @file mqtt_pub.c
+ *
+ * Bounded front end for an MQTT client's QoS 1 outbox
+ */
+#include "mqtt_pub.h"
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_INFLIGHT 8
+
+esp_err_t mqtt_pub_init(mqtt_pub_t *p, const mqtt_pub_config_t *cfg)
+{
+    CHECK_ARG(p && cfg && cfg->send && (cfg->qos == 0 || cfg->qos == 1));
+    CHECK_ARG(cfg->max_inflight <= MQTT_PUB_INFLIGHT_MAX);
+
+    memset(p, 0, sizeof(*p));
+    p->cfg = *cfg;
+    if (!p->cfg.max_inflight)
+        p->cfg.max_inflight = DEFAULT_INFLIGHT;
+
+    return ESP_OK;
+}
+
+void mqtt_pub_set_connected(mqtt_pub_t *p, bool connected)
+{
+    if (connected && !__atomic_load_n(&p->connected, __ATOMIC_RELAXED))
+        p->stats.connects++;
+    __atomic_store_n(&p->connected, connected, __ATOMIC_RELEASE);
+}
+
+void mqtt_pub_done(mqtt_pub_t *p, int msg_id, bool acked)
+{
+    // At most one event per message handed out, so the queue only fills
+    // when the client reports messages it was not given through here
+    uint32_t head = p->ev_head;
+    if (head - __atomic_load_n(&p->ev_tail, __ATOMIC_ACQUIRE) == MQTT_PUB_INFLIGHT_MAX)
+    {
+        p->ev_lost++;
+        return;
+    }
+    p->events[head % MQTT_PUB_INFLIGHT_MAX] = (mqtt_pub_event_t) { msg_id, acked };
+    __atomic_store_n(&p->ev_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Matches queued acknowledgements to in-flight messages. Runs in the
+// publishing task, which also records the ids, so an acknowledgement that
+// arrives before the publish call has returned is still matched
+static void drain_events(mqtt_pub_t *p)
+{
+    uint32_t head = __atomic_load_n(&p->ev_head, __ATOMIC_ACQUIRE);
+    for (uint32_t tail = p->ev_tail; tail != head; tail++)
+    {
+        mqtt_pub_event_t ev = p->events[tail % MQTT_PUB_INFLIGHT_MAX];
+        __atomic_store_n(&p->ev_tail, tail + 1, __ATOMIC_RELEASE);
+
+        size_t i = 0;
+        while (i < p->n_inflight && p->inflight[i].msg_id != ev.msg_id)
+            i++;
+        if (i == p->n_inflight)
+            continue;
+
+        uint32_t tag = p->inflight[i].tag;
+        memmove(&p->inflight[i], &p->inflight[i + 1], (p->n_inflight - i - 1) * sizeof(p->inflight[0]));
+        p->n_inflight--;
+        if (ev.acked)
+            p->stats.acked++;
+        else
+            p->stats.expired++;
+        if (p->cfg.done)
+            p->cfg.done(p->cfg.done_ctx, tag, ev.acked);
+    }
+}
+
+static bool window_open(const mqtt_pub_t *p)
+{
+    return __atomic_load_n(&p->connected, __ATOMIC_ACQUIRE) && p->n_inflight < p->cfg.max_inflight;
+}
+
+bool mqtt_pub_ready(mqtt_pub_t *p)
+{
+    drain_events(p);
+    return window_open(p);
+}
+
+static esp_err_t publish(mqtt_pub_t *p, const char *topic, const char *data, size_t len, uint32_t tag)
+{
+    int msg_id = p->cfg.send(p->cfg.ctx, topic, data, len, p->cfg.qos);
+    if (msg_id < 0)
+    {
+        p->stats.failed++;
+        return ESP_FAIL;
+    }
+    p->stats.published++;
+    if (p->cfg.qos)
+    {
+        p->inflight[p->n_inflight++] = (mqtt_pub_msg_t) { msg_id, tag };
+        if (p->n_inflight > p->stats.peak_inflight)
+            p->stats.peak_inflight = p->n_inflight;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_pub_send(mqtt_pub_t *p, const char *topic, const char *data, size_t len, uint32_t tag)
+{
+    CHECK_ARG(p && topic && data);
+
+    drain_events(p);
+    if (!__atomic_load_n(&p->connected, __ATOMIC_ACQUIRE))
+    {
+        p->stats.refused++;
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!window_open(p))
+    {
+        p->stats.refused++;
+        return ESP_ERR_NO_MEM;
+    }
+    return publish(p, topic, data, len, tag);
+}
+
+bool mqtt_pub_poll(mqtt_pub_t *p)
+{
+    drain_events(p);
+    if (p->slot_topic && window_open(p) && publish(p, p->slot_topic, p->slot, p->slot_len, p->slot_tag) == ESP_OK)
+        p->slot_topic = NULL;
+    return !p->slot_topic;
+}
+
+esp_err_t mqtt_pub_latest(mqtt_pub_t *p, const char *topic, const char *data, size_t len, uint32_t tag)
+{
+    CHECK_ARG(p && topic && data);
+
+    if (mqtt_pub_poll(p) && window_open(p) && publish(p, topic, data, len, tag) == ESP_OK)
+        return ESP_OK;
+
+    if (len > MQTT_PUB_PAYLOAD_MAX)
+        return ESP_ERR_INVALID_SIZE;
+    if (p->slot_topic)
+        p->stats.coalesced++;
+    memcpy(p->slot, data, len);
+    p->slot_len = len;
+    p->slot_tag = tag;
+    p->slot_topic = topic;
+
+    return ESP_OK;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file mqtt_pub.h
+ * @defgroup mqtt_pub mqtt_pub
+ * @{
+ *
+ * Bounded front end for an MQTT client's QoS 1 outbox.
+ *
+ * A QoS 1 message stays in the client's outbox (heap) from the publish
+ * call until the broker acknowledges it, or until the client gives up on
+ * it. The publisher tracks these in-flight messages by message id and
+ * refuses new ones once max_inflight are outstanding or while the client
+ * is disconnected, so a slow or absent broker costs a bounded amount of
+ * memory no matter how long it lasts or how often the connection drops.
+ *
+ * Two ways to publish when the window is closed:
+ *
+ * - mqtt_pub_send() refuses the message (backpressure); the caller keeps
+ *   it, e.g. in a flash backlog, and tries again later.
+ * - mqtt_pub_latest() keeps the message in a single slot, replacing any
+ *   earlier one (coalescing), and mqtt_pub_poll() sends it once the window
+ *   opens. Only the newest reading survives an outage.
+ *
+ * Each message carries a caller tag that is handed back through the done
+ * callback once the broker acknowledged it or the client dropped it, so a
+ * backlog can be released only when the broker has the data.
+ *
+ * Connection and acknowledgement events come from the client's task and
+ * are passed through a lock-free queue; everything else, including the
+ * done callback, runs in the one task that publishes.
+ */
+#ifndef __MQTT_PUB_H__
+#define __MQTT_PUB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_PUB_PAYLOAD_MAX   192        //!< Largest payload kept in the coalescing slot
+#define MQTT_PUB_INFLIGHT_MAX  16         //!< Upper bound of max_inflight
+#define MQTT_PUB_UNTAGGED      UINT32_MAX //!< Tag for messages nobody waits for
+
+/**
+ * Hands a message to the client; returns its message id (>= 0) or -1
+ */
+typedef int (*mqtt_pub_send_fn_t)(void *ctx, const char *topic, const char *data, size_t len, int qos);
+
+/**
+ * Called from the publishing task when a QoS 1 message has been
+ * acknowledged by the broker (acked) or dropped by the client (!acked)
+ */
+typedef void (*mqtt_pub_done_fn_t)(void *ctx, uint32_t tag, bool acked);
+
+/**
+ * Configuration
+ */
+typedef struct
+{
+    mqtt_pub_send_fn_t send;
+    void *ctx;                 //!< Passed to send, e.g. the client handle
+    int qos;                   //!< 0 or 1
+    uint32_t max_inflight;     //!< QoS 1 messages outstanding at most, 0 = 8
+    mqtt_pub_done_fn_t done;   //!< Optional
+    void *done_ctx;
+} mqtt_pub_config_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint32_t published;        //!< Messages accepted by the client
+    uint32_t acked;            //!< Acknowledged by the broker
+    uint32_t expired;          //!< Given up by the client unacknowledged
+    uint32_t refused;          //!< mqtt_pub_send() calls refused while closed
+    uint32_t coalesced;        //!< Slot contents replaced before being sent
+    uint32_t failed;           //!< Rejected by the client
+    uint32_t connects;
+    uint32_t peak_inflight;
+} mqtt_pub_stats_t;
+
+/**
+ * Message waiting for its acknowledgement
+ */
+typedef struct
+{
+    int msg_id;
+    uint32_t tag;
+} mqtt_pub_msg_t;
+
+/**
+ * Acknowledgement passed from the client's task
+ */
+typedef struct
+{
+    int msg_id;
+    bool acked;
+} mqtt_pub_event_t;
+
+/**
+ * Publisher state
+ */
+typedef struct
+{
+    mqtt_pub_config_t cfg;
+    bool connected;            //!< Written by the client's task
+    mqtt_pub_msg_t inflight[MQTT_PUB_INFLIGHT_MAX]; //!< Oldest first
+    size_t n_inflight;
+    mqtt_pub_event_t events[MQTT_PUB_INFLIGHT_MAX]; //!< Single producer, single consumer
+    uint32_t ev_head;          //!< Written by the client's task
+    uint32_t ev_tail;          //!< Written by the publishing task
+    uint32_t ev_lost;          //!< Events that found the queue full
+    const char *slot_topic;    //!< Coalescing slot, NULL when empty
+    uint32_t slot_tag;
+    char slot[MQTT_PUB_PAYLOAD_MAX];
+    size_t slot_len;
+    mqtt_pub_stats_t stats;
+} mqtt_pub_t;
+
+/**
+ * @brief Initialize a publisher, disconnected
+ *
+ * @param p Publisher
+ * @param cfg Configuration, copied
+ * @return `ESP_OK` on success
+ */
+esp_err_t mqtt_pub_init(mqtt_pub_t *p, const mqtt_pub_config_t *cfg);
+
+/**
+ * @brief Record a connection change; call from the client's event handler
+ *
+ * @param p Publisher
+ * @param connected New state
+ */
+void mqtt_pub_set_connected(mqtt_pub_t *p, bool connected);
+
+/**
+ * @brief Record the end of a QoS 1 message; call from the client's event
+ *        handler
+ *
+ * @param p Publisher
+ * @param msg_id Message id
+ * @param acked true when the broker acknowledged it, false when the
+ *        client dropped it
+ */
+void mqtt_pub_done(mqtt_pub_t *p, int msg_id, bool acked);
+
+/**
+ * @brief Process acknowledgements and send the slot message if the window
+ *        is open
+ *
+ * @param p Publisher
+ * @return true when the slot is empty afterwards
+ */
+bool mqtt_pub_poll(mqtt_pub_t *p);
+
+/**
+ * @brief Whether a message would be accepted now
+ */
+bool mqtt_pub_ready(mqtt_pub_t *p);
+
+/**
+ * @brief QoS 1 messages handed to the client and not yet finished, as of
+ *        the last poll
+ */
+static inline uint32_t mqtt_pub_inflight(const mqtt_pub_t *p)
+{
+    return p->n_inflight;
+}
+
+/**
+ * @brief Publish or refuse
+ *
+ * @param p Publisher
+ * @param topic Topic
+ * @param data Payload
+ * @param len Payload length
+ * @param tag Handed to the done callback, or MQTT_PUB_UNTAGGED
+ * @return `ESP_OK` when the client took the message,
+ *         `ESP_ERR_INVALID_STATE` while disconnected, `ESP_ERR_NO_MEM`
+ *         while max_inflight messages are outstanding, `ESP_FAIL` when
+ *         the client rejected it
+ */
+esp_err_t mqtt_pub_send(mqtt_pub_t *p, const char *topic, const char *data, size_t len, uint32_t tag);
+
+/**
+ * @brief Publish, or keep as the one pending message
+ *
+ * A message that cannot go out now replaces the one in the slot. An older
+ * slot message is sent first so readings stay in order.
+ *
+ * @param p Publisher
+ * @param topic Topic; must stay valid until sent
+ * @param data Payload
+ * @param len Up to MQTT_PUB_PAYLOAD_MAX bytes
+ * @param tag Handed to the done callback, or MQTT_PUB_UNTAGGED
+ * @return `ESP_OK` when sent or kept, `ESP_ERR_INVALID_SIZE` for a payload
+ *         too long to keep
+ */
+esp_err_t mqtt_pub_latest(mqtt_pub_t *p, const char *topic, const char *data, size_t len, uint32_t tag);
+
+#ifdef ESP_PLATFORM
+
+#include <mqtt_client.h>
+
+/**
+ * @brief Initialize a publisher on an esp-mqtt client
+ *
+ * @param p Publisher
+ * @param client Client
+ * @param qos 0 or 1
+ * @param max_inflight QoS 1 messages outstanding at most, 0 = 8
+ * @param done Optional done callback
+ * @param done_ctx Passed to done
+ * @return `ESP_OK` on success
+ */
+esp_err_t mqtt_pub_init_esp(mqtt_pub_t *p, esp_mqtt_client_handle_t client, int qos, uint32_t max_inflight,
+                            mqtt_pub_done_fn_t done, void *done_ctx);
+
+/**
+ * @brief Feed an esp-mqtt event to the publisher
+ *
+ * Handles connect, disconnect, published and deleted events; call from
+ * the client's event handler.
+ *
+ * @param p Publisher
+ * @param event Event
+ */
+void mqtt_pub_esp_event(mqtt_pub_t *p, const esp_mqtt_event_t *event);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQTT_PUB_H__ */
@@ -0,0 +1,47 @@
+/**
+ * @file mqtt_pub_esp.c
+ *
+ * mqtt_pub on an esp-mqtt client
+ */
+#include "mqtt_pub.h"
+
+static int esp_send(void *ctx, const char *topic, const char *data, size_t len, int qos)
+{
+    return esp_mqtt_client_publish(ctx, topic, data, len, qos, 0);
+}
+
+esp_err_t mqtt_pub_init_esp(mqtt_pub_t *p, esp_mqtt_client_handle_t client, int qos, uint32_t max_inflight,
+                            mqtt_pub_done_fn_t done, void *done_ctx)
+{
+    mqtt_pub_config_t cfg = {
+        .send = esp_send,
+        .ctx = client,
+        .qos = qos,
+        .max_inflight = max_inflight,
+        .done = done,
+        .done_ctx = done_ctx,
+    };
+    return mqtt_pub_init(p, &cfg);
+}
+
+void mqtt_pub_esp_event(mqtt_pub_t *p, const esp_mqtt_event_t *event)
+{
+    switch (event->event_id)
+    {
+        case MQTT_EVENT_CONNECTED:
+            mqtt_pub_set_connected(p, true);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            mqtt_pub_set_connected(p, false);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            mqtt_pub_done(p, event->msg_id, true);
+            break;
+        case MQTT_EVENT_DELETED:
+            // Expired in the outbox without an acknowledgement
+            mqtt_pub_done(p, event->msg_id, false);
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,133 @@
+/**
+ * @file periodic_sched.c
+ *
+ * Fixed-rate job scheduler on absolute deadlines
+ */
+#include "periodic_sched.h"
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+esp_err_t psched_init(psched_t *s, const psched_clock_t *clock, psched_job_t *jobs, size_t capacity)
+{
+    CHECK_ARG(s && clock && clock->now_us && clock->sleep_until_us && jobs && capacity);
+
+    memset(s, 0, sizeof(*s));
+    s->clock = *clock;
+    s->jobs = jobs;
+    s->capacity = capacity;
+
+    return ESP_OK;
+}
+
+esp_err_t psched_add(psched_t *s, const psched_job_config_t *cfg, size_t *id)
+{
+    CHECK_ARG(s && cfg && cfg->fn && cfg->period_us);
+    if (s->started)
+        return ESP_ERR_INVALID_STATE;
+    if (s->n_jobs == s->capacity)
+        return ESP_ERR_NO_MEM;
+
+    psched_job_t *job = &s->jobs[s->n_jobs];
+    memset(job, 0, sizeof(*job));
+    job->cfg = *cfg;
+    if (id)
+        *id = s->n_jobs;
+    s->n_jobs++;
+
+    return ESP_OK;
+}
+
+static unsigned hist_bin(uint32_t us)
+{
+    unsigned bin = 0;
+    while (us >= 2 && bin < PSCHED_HIST_BINS - 1)
+    {
+        us >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+uint32_t psched_hist_floor_us(unsigned bin)
+{
+    return bin ? 1u << bin : 0;
+}
+
+static void run_job(psched_t *s, psched_job_t *job)
+{
+    psched_stats_t *st = &job->stats;
+    int64_t start = s->clock.now_us(s->clock.ctx);
+
+    job->cfg.fn(job->cfg.ctx);
+
+    int64_t end = s->clock.now_us(s->clock.ctx);
+    uint32_t jitter = (uint32_t)(start - job->release_us);
+    uint32_t exec = (uint32_t)(end - start);
+
+    st->runs++;
+    st->jitter_sum_us += jitter;
+    if (jitter > st->jitter_max_us)
+        st->jitter_max_us = jitter;
+    if (exec > st->exec_max_us)
+        st->exec_max_us = exec;
+    st->exec_sum_us += exec;
+    st->exec_hist[hist_bin(exec)]++;
+
+    // Next release stays on the original grid; whole periods that have
+    // already passed are skipped rather than run late
+    job->release_us += job->cfg.period_us;
+    if (end > job->release_us)
+    {
+        uint32_t missed = (uint32_t)((end - job->release_us) / job->cfg.period_us);
+        st->overruns++;
+        st->skipped += missed;
+        job->release_us += (int64_t)missed * job->cfg.period_us;
+    }
+}
+
+esp_err_t psched_run_once(psched_t *s)
+{
+    CHECK_ARG(s);
+    if (!s->n_jobs)
+        return ESP_ERR_INVALID_STATE;
+
+    if (!s->started)
+    {
+        s->start_us = s->clock.now_us(s->clock.ctx);
+        for (size_t i = 0; i < s->n_jobs; i++)
+            s->jobs[i].release_us = s->start_us + s->jobs[i].cfg.phase_us;
+        s->started = true;
+    }
+
+    int64_t next = s->jobs[0].release_us;
+    for (size_t i = 1; i < s->n_jobs; i++)
+        if (s->jobs[i].release_us < next)
+            next = s->jobs[i].release_us;
+
+    if (s->clock.now_us(s->clock.ctx) < next)
+        s->clock.sleep_until_us(s->clock.ctx, next);
+
+    for (size_t i = 0; i < s->n_jobs; i++)
+        if (s->jobs[i].release_us <= s->clock.now_us(s->clock.ctx))
+            run_job(s, &s->jobs[i]);
+
+    return ESP_OK;
+}
+
+void psched_run(psched_t *s)
+{
+    while (psched_run_once(s) == ESP_OK)
+        ;
+}
+
+const psched_stats_t *psched_stats(const psched_t *s, size_t id)
+{
+    return s && id < s->n_jobs ? &s->jobs[id].stats : NULL;
+}
+
+void psched_reset_stats(psched_t *s)
+{
+    for (size_t i = 0; s && i < s->n_jobs; i++)
+        memset(&s->jobs[i].stats, 0, sizeof(psched_stats_t));
+}
@@ -0,0 +1,194 @@
+/**
+ * @file periodic_sched.h
+ * @defgroup periodic_sched periodic_sched
+ * @{
+ *
+ * Fixed-rate job scheduler on absolute deadlines.
+ *
+ * Each job has its own period and phase. Release times are computed as
+ * phase + k * period from the scheduler start, never from the end of the
+ * previous run, so execution time does not make the schedule drift. A job
+ * that misses whole periods skips them (and counts them) instead of
+ * running back to back to catch up.
+ *
+ * Per job the scheduler records release jitter (start time minus release
+ * time), overruns (runs that ended after the next release) and a log2
+ * histogram of execution times.
+ *
+ * Time comes from a psched_clock_t, so the same code runs on the target
+ * (esp_timer, see psched_esp_clock_create()) and on a host with a virtual
+ * clock.
+ */
+#ifndef __PERIODIC_SCHED_H__
+#define __PERIODIC_SCHED_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSCHED_HIST_BINS 16 //!< Execution time bins: <2 us, [2^i, 2^(i+1)) us, >= 32 ms
+
+/**
+ * Time source
+ */
+typedef struct
+{
+    int64_t (*now_us)(void *ctx);                  //!< Monotonic time, us
+    void (*sleep_until_us)(void *ctx, int64_t t);  //!< Block until now_us() >= t
+    void *ctx;
+} psched_clock_t;
+
+typedef void (*psched_fn_t)(void *ctx);
+
+/**
+ * Job description
+ */
+typedef struct
+{
+    const char *name;
+    psched_fn_t fn;
+    void *ctx;            //!< Passed to fn
+    uint32_t period_us;   //!< Release interval, > 0
+    uint32_t phase_us;    //!< Offset of the first release from the start
+} psched_job_config_t;
+
+/**
+ * Job timing statistics
+ */
+typedef struct
+{
+    uint32_t runs;
+    uint32_t overruns;       //!< Runs that ended after the next release
+    uint32_t skipped;        //!< Releases dropped after overruns
+    uint32_t jitter_max_us;  //!< Largest start - release
+    uint64_t jitter_sum_us;  //!< Sum of start - release over all runs
+    uint32_t exec_max_us;
+    uint64_t exec_sum_us;
+    uint32_t exec_hist[PSCHED_HIST_BINS];
+} psched_stats_t;
+
+/**
+ * Job state
+ */
+typedef struct
+{
+    psched_job_config_t cfg;
+    int64_t release_us;  //!< Next release, absolute
+    psched_stats_t stats;
+} psched_job_t;
+
+/**
+ * Scheduler
+ */
+typedef struct
+{
+    psched_clock_t clock;
+    psched_job_t *jobs;
+    size_t n_jobs;
+    size_t capacity;
+    int64_t start_us;
+    bool started;
+} psched_t;
+
+/**
+ * @brief Initialize a scheduler on caller-provided job storage
+ *
+ * @param s Scheduler
+ * @param clock Time source, copied
+ * @param jobs Storage for up to capacity jobs
+ * @param capacity Number of entries in jobs
+ * @return `ESP_OK` on success
+ */
+esp_err_t psched_init(psched_t *s, const psched_clock_t *clock, psched_job_t *jobs, size_t capacity);
+
+/**
+ * @brief Add a job; only allowed before the first psched_run_once()
+ *
+ * @param s Scheduler
+ * @param cfg Job description, copied
+ * @param[out] id Index of the job for psched_stats(); may be NULL
+ * @return `ESP_OK` on success, `ESP_ERR_NO_MEM` when full,
+ *         `ESP_ERR_INVALID_STATE` once started
+ */
+esp_err_t psched_add(psched_t *s, const psched_job_config_t *cfg, size_t *id);
+
+/**
+ * @brief Wait for the earliest release and run every job that is due
+ *
+ * Jobs due at the same time run in the order they were added.
+ *
+ * @param s Scheduler
+ * @return `ESP_OK`, or `ESP_ERR_INVALID_STATE` without jobs
+ */
+esp_err_t psched_run_once(psched_t *s);
+
+/**
+ * @brief Run jobs forever
+ *
+ * @param s Scheduler
+ */
+void psched_run(psched_t *s);
+
+/**
+ * @brief Timing statistics of a job
+ *
+ * Not synchronized with the scheduler; call it from a job of the same
+ * scheduler for a consistent snapshot.
+ *
+ * @param s Scheduler
+ * @param id Job index from psched_add()
+ * @return Statistics, NULL for an unknown id
+ */
+const psched_stats_t *psched_stats(const psched_t *s, size_t id);
+
+/**
+ * @brief Clear the statistics of all jobs
+ *
+ * @param s Scheduler
+ */
+void psched_reset_stats(psched_t *s);
+
+/**
+ * @brief Smallest execution time, in us, that falls into a histogram bin
+ *
+ * @param bin Bin index
+ * @return Lower bound of the bin, 0 for the first one
+ */
+uint32_t psched_hist_floor_us(unsigned bin);
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief esp_timer based clock with sub-tick wakeups
+ *
+ * sleep_until_us() arms a one-shot esp_timer that notifies the sleeping
+ * task, so releases are not rounded to the FreeRTOS tick. The clock must
+ * only be used by one scheduler task.
+ *
+ * @param[out] clock Clock to fill
+ * @return `ESP_OK` on success
+ */
+esp_err_t psched_esp_clock_create(psched_clock_t *clock);
+
+/**
+ * @brief Log one line of statistics per job
+ *
+ * @param s Scheduler
+ * @param tag Log tag
+ */
+void psched_log_stats(const psched_t *s, const char *tag);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __PERIODIC_SCHED_H__ */
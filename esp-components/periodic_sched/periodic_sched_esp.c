@@ -0,0 +1,106 @@
+/**
+ * @file periodic_sched_esp.c
+ *
+ * esp_timer clock and logging for periodic_sched
+ */
+#include "periodic_sched.h"
+#include <stdlib.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+// Below this the remaining wait is spun out instead of arming a timer
+#define SPIN_US 50
+
+typedef struct
+{
+    esp_timer_handle_t timer;
+    TaskHandle_t waiter;
+} esp_clock_t;
+
+static int64_t esp_now_us(void *ctx)
+{
+    return esp_timer_get_time();
+}
+
+static void wake_waiter(void *arg)
+{
+    esp_clock_t *c = arg;
+    xTaskNotifyGive(c->waiter);
+}
+
+static void esp_sleep_until_us(void *ctx, int64_t t)
+{
+    esp_clock_t *c = ctx;
+    int64_t remaining = t - esp_timer_get_time();
+
+    if (remaining > SPIN_US)
+    {
+        c->waiter = xTaskGetCurrentTaskHandle();
+        ulTaskNotifyTake(pdTRUE, 0);
+        if (esp_timer_start_once(c->timer, remaining) == ESP_OK)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        else
+            vTaskDelay(pdMS_TO_TICKS(remaining / 1000) + 1);
+    }
+    while (esp_timer_get_time() < t)
+        ;
+}
+
+esp_err_t psched_esp_clock_create(psched_clock_t *clock)
+{
+    CHECK_ARG(clock);
+
+    esp_clock_t *c = calloc(1, sizeof(esp_clock_t));
+    if (!c)
+        return ESP_ERR_NO_MEM;
+
+    esp_timer_create_args_t args = {
+        .callback = wake_waiter,
+        .arg = c,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "psched",
+    };
+    esp_err_t err = esp_timer_create(&args, &c->timer);
+    if (err != ESP_OK)
+    {
+        free(c);
+        return err;
+    }
+
+    clock->now_us = esp_now_us;
+    clock->sleep_until_us = esp_sleep_until_us;
+    clock->ctx = c;
+
+    return ESP_OK;
+}
+
+void psched_log_stats(const psched_t *s, const char *tag)
+{
+    for (size_t i = 0; i < s->n_jobs; i++)
+    {
+        const psched_job_t *job = &s->jobs[i];
+        const psched_stats_t *st = &job->stats;
+
+        // Approximate p99 of execution time from the histogram
+        uint32_t p99 = 0, seen = 0;
+        for (unsigned b = 0; b < PSCHED_HIST_BINS; b++)
+        {
+            seen += st->exec_hist[b];
+            if (st->runs && seen * 100ull >= st->runs * 99ull)
+            {
+                p99 = psched_hist_floor_us(b + 1);
+                break;
+            }
+        }
+
+        ESP_LOGI(tag, "%-10s %lu runs, jitter avg %lu max %lu us, exec max %lu p99 <%lu us, %lu overruns, %lu skipped",
+                 job->cfg.name ? job->cfg.name : "?", (unsigned long)st->runs,
+                 (unsigned long)(st->runs ? st->jitter_sum_us / st->runs : 0),
+                 (unsigned long)st->jitter_max_us, (unsigned long)st->exec_max_us, (unsigned long)p99,
+                 (unsigned long)st->overruns, (unsigned long)st->skipped);
+    }
+}
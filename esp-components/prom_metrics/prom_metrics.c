@@ -0,0 +1,268 @@
+/**
+ * @file prom_metrics.c
+ *
+ * Prometheus text exposition through a fixed buffer, portable core
+ */
+#include "prom_metrics.h"
+#include <math.h>
+
+typedef void (*line_fn_t)(fixfmt_t *out, const void *arg);
+
+typedef enum
+{
+    VALUE_INT,
+    VALUE_UINT,
+    VALUE_FIXED,
+    VALUE_FLOAT,
+} value_kind_t;
+
+typedef struct
+{
+    const char *name;
+    const prom_label_t *labels;
+    size_t n_labels;
+    value_kind_t kind;
+    int64_t i;
+    uint64_t u;
+    float f;
+    int decimals;
+} sample_t;
+
+typedef struct
+{
+    const char *name;
+    prom_type_t type;
+    const char *help;
+} family_t;
+
+static const char *const type_names[] = { "counter", "gauge", "histogram" };
+
+void prom_init(prom_writer_t *w, char *buf, size_t size, prom_sink_fn_t sink, void *ctx)
+{
+    fixfmt_init(&w->out, buf, size);
+    w->sink = sink;
+    w->ctx = ctx;
+    w->sent = 0;
+    w->flushes = 0;
+    w->err = ESP_OK;
+}
+
+static void flush(prom_writer_t *w)
+{
+    if (w->err != ESP_OK || !w->out.len)
+        return;
+    w->err = w->sink(w->ctx, w->out.buf, w->out.len);
+    w->sent += w->out.len;
+    w->flushes++;
+    w->out.len = 0;
+    w->out.buf[0] = '\0';
+}
+
+// Writes one line (or a group of lines that belong together) whole: if it
+// does not fit after what is buffered, the buffer goes to the sink first
+// and the line is written again into the empty buffer
+static void put_line(prom_writer_t *w, line_fn_t fn, const void *arg)
+{
+    while (w->err == ESP_OK)
+    {
+        size_t start = w->out.len;
+        fn(&w->out, arg);
+        if (!w->out.overflow)
+            return;
+
+        w->out.len = start;
+        w->out.buf[start] = '\0';
+        w->out.overflow = false;
+        if (!start)
+        {
+            w->err = ESP_ERR_INVALID_SIZE;
+            return;
+        }
+        flush(w);
+    }
+}
+
+// HELP text escapes backslash and newline, label values also quotes
+static void escaped(fixfmt_t *out, const char *s, bool quotes)
+{
+    for (; *s; s++)
+    {
+        if (*s == '\\' || (quotes && *s == '"'))
+        {
+            fixfmt_char(out, '\\');
+            fixfmt_char(out, *s);
+        }
+        else if (*s == '\n')
+            fixfmt_str(out, "\\n");
+        else
+            fixfmt_char(out, *s);
+    }
+}
+
+static void family_line(fixfmt_t *out, const void *arg)
+{
+    const family_t *fam = arg;
+
+    fixfmt_str(out, "# HELP ");
+    fixfmt_str(out, fam->name);
+    fixfmt_char(out, ' ');
+    escaped(out, fam->help, false);
+    fixfmt_str(out, "\n# TYPE ");
+    fixfmt_str(out, fam->name);
+    fixfmt_char(out, ' ');
+    fixfmt_str(out, type_names[fam->type]);
+    fixfmt_char(out, '\n');
+}
+
+static void sample_line(fixfmt_t *out, const void *arg)
+{
+    const sample_t *s = arg;
+
+    fixfmt_str(out, s->name);
+    for (size_t i = 0; i < s->n_labels; i++)
+    {
+        fixfmt_char(out, i ? ',' : '{');
+        fixfmt_str(out, s->labels[i].name);
+        fixfmt_str(out, "=\"");
+        escaped(out, s->labels[i].value, true);
+        fixfmt_char(out, '"');
+    }
+    if (s->n_labels)
+        fixfmt_char(out, '}');
+    fixfmt_char(out, ' ');
+
+    switch (s->kind)
+    {
+        case VALUE_INT:
+            fixfmt_int(out, s->i);
+            break;
+        case VALUE_UINT:
+            fixfmt_uint(out, s->u);
+            break;
+        case VALUE_FIXED:
+            fixfmt_fixed(out, s->i, s->decimals);
+            break;
+        case VALUE_FLOAT:
+            if (isnan(s->f))
+                fixfmt_str(out, "NaN");
+            else if (isinf(s->f))
+                fixfmt_str(out, s->f > 0 ? "+Inf" : "-Inf");
+            else
+                fixfmt_float(out, s->f, s->decimals);
+            break;
+    }
+    fixfmt_char(out, '\n');
+}
+
+void prom_family(prom_writer_t *w, const char *name, prom_type_t type, const char *help)
+{
+    family_t fam = { name, type, help };
+    put_line(w, family_line, &fam);
+}
+
+void prom_int(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, int64_t value)
+{
+    sample_t s = { .name = name, .labels = labels, .n_labels = n_labels, .kind = VALUE_INT, .i = value };
+    put_line(w, sample_line, &s);
+}
+
+void prom_uint(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, uint64_t value)
+{
+    sample_t s = { .name = name, .labels = labels, .n_labels = n_labels, .kind = VALUE_UINT, .u = value };
+    put_line(w, sample_line, &s);
+}
+
+void prom_fixed(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, int64_t raw,
+                int decimals)
+{
+    sample_t s = { .name = name, .labels = labels, .n_labels = n_labels, .kind = VALUE_FIXED, .i = raw,
+                   .decimals = decimals };
+    put_line(w, sample_line, &s);
+}
+
+void prom_float(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, float value,
+                int decimals)
+{
+    sample_t s = { .name = name, .labels = labels, .n_labels = n_labels, .kind = VALUE_FLOAT, .f = value,
+                   .decimals = decimals };
+    put_line(w, sample_line, &s);
+}
+
+// Job labels: job, the optional extra label, room for le
+static size_t job_labels(prom_label_t *labels, const psched_job_t *job, const prom_label_t *label)
+{
+    labels[0] = (prom_label_t) { "job", job->cfg.name ? job->cfg.name : "" };
+    if (!label)
+        return 1;
+    labels[1] = *label;
+    return 2;
+}
+
+void prom_psched(prom_writer_t *w, const psched_t *s, const prom_label_t *label)
+{
+    static const struct
+    {
+        const char *name;
+        prom_type_t type;
+        const char *help;
+    } families[] = {
+        { "node_job_runs_total", PROM_COUNTER, "Scheduled job runs." },
+        { "node_job_overruns_total", PROM_COUNTER, "Job runs that ended after the next release." },
+        { "node_job_skipped_total", PROM_COUNTER, "Job releases dropped after overruns." },
+        { "node_job_jitter_seconds_total", PROM_COUNTER, "Sum of job start delays after their release." },
+        { "node_job_jitter_max_seconds", PROM_GAUGE, "Largest job start delay after its release." },
+        { "node_job_exec_max_seconds", PROM_GAUGE, "Longest job execution time." },
+    };
+    prom_label_t labels[3];
+
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++)
+    {
+        prom_family(w, families[f].name, families[f].type, families[f].help);
+        for (size_t j = 0; j < s->n_jobs; j++)
+        {
+            const psched_stats_t *st = &s->jobs[j].stats;
+            size_t n = job_labels(labels, &s->jobs[j], label);
+            switch (f)
+            {
+                case 0: prom_uint(w, families[f].name, labels, n, st->runs); break;
+                case 1: prom_uint(w, families[f].name, labels, n, st->overruns); break;
+                case 2: prom_uint(w, families[f].name, labels, n, st->skipped); break;
+                case 3: prom_fixed(w, families[f].name, labels, n, st->jitter_sum_us, 6); break;
+                case 4: prom_fixed(w, families[f].name, labels, n, st->jitter_max_us, 6); break;
+                default: prom_fixed(w, families[f].name, labels, n, st->exec_max_us, 6); break;
+            }
+        }
+    }
+
+    // Execution times are whole microseconds, so histogram bin b, below
+    // 2^(b+1) us, is exactly le = 2^(b+1) - 1 us
+    prom_family(w, "node_job_exec_seconds", PROM_HISTOGRAM, "Job execution time.");
+    for (size_t j = 0; j < s->n_jobs; j++)
+    {
+        const psched_stats_t *st = &s->jobs[j].stats;
+        size_t n = job_labels(labels, &s->jobs[j], label);
+        char le[16];
+        uint64_t below = 0;
+
+        labels[n] = (prom_label_t) { "le", le };
+        for (unsigned b = 0; b < PSCHED_HIST_BINS; b++)
+        {
+            fixfmt_t out;
+            fixfmt_init(&out, le, sizeof(le));
+            if (b == PSCHED_HIST_BINS - 1)
+                fixfmt_str(&out, "+Inf");
+            else
+                fixfmt_fixed(&out, (2 << b) - 1, 6);
+            below += st->exec_hist[b];
+            prom_uint(w, "node_job_exec_seconds_bucket", labels, n + 1, below);
+        }
+        prom_fixed(w, "node_job_exec_seconds_sum", labels, n, st->exec_sum_us, 6);
+        prom_uint(w, "node_job_exec_seconds_count", labels, n, below);
+    }
+}
+
+esp_err_t prom_finish(prom_writer_t *w)
+{
+    flush(w);
+    return w->err;
+}
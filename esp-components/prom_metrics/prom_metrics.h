@@ -0,0 +1,200 @@
+/**
+ * @file prom_metrics.h
+ * @defgroup prom_metrics prom_metrics
+ * @{
+ *
+ * Prometheus text exposition (format 0.0.4) streamed through a fixed
+ * buffer.
+ *
+ * The writer formats one line at a time into a caller buffer with fixfmt
+ * and hands the buffer to a sink (an HTTP chunk, a socket write) whenever
+ * the next line does not fit, so a page of any length is rendered
+ * without heap and without knowing its size up front. A line is never
+ * split across sink calls; only a single line longer than the whole
+ * buffer fails, with ESP_ERR_INVALID_SIZE.
+ *
+ * Once the sink fails the writer stops and keeps the error, so a collect
+ * function can write everything unconditionally and check
+ * prom_finish() once.
+ *
+ * On the ESP32, prom_esp_start() serves GET /metrics from esp_http_server
+ * with a collect callback supplied by the application, plus heap, uptime
+ * and task stack metrics.
+ */
+#ifndef __PROM_METRICS_H__
+#define __PROM_METRICS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "fixfmt.h"
+#include "periodic_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Passes size bytes of rendered text on
+ */
+typedef esp_err_t (*prom_sink_fn_t)(void *ctx, const char *data, size_t size);
+
+/**
+ * Metric type, for the TYPE line
+ */
+typedef enum
+{
+    PROM_COUNTER = 0,
+    PROM_GAUGE,
+    PROM_HISTOGRAM,
+} prom_type_t;
+
+/**
+ * Label, name="value"; the value is escaped when written
+ */
+typedef struct
+{
+    const char *name;
+    const char *value;
+} prom_label_t;
+
+/**
+ * Writer
+ */
+typedef struct
+{
+    fixfmt_t out;
+    prom_sink_fn_t sink;
+    void *ctx;
+    size_t sent;         //!< Bytes passed to the sink so far
+    size_t flushes;      //!< Sink calls
+    esp_err_t err;       //!< First error; nothing is written after it
+} prom_writer_t;
+
+/**
+ * @brief Start a page
+ *
+ * @param w Writer
+ * @param buf Line buffer; its size bounds the longest line
+ * @param size Size of buf
+ * @param sink Receives the text
+ * @param ctx Passed to sink
+ */
+void prom_init(prom_writer_t *w, char *buf, size_t size, prom_sink_fn_t sink, void *ctx);
+
+/**
+ * @brief Write the HELP and TYPE lines of a metric family
+ *
+ * Every sample of the family must follow before the next family starts.
+ *
+ * @param w Writer
+ * @param name Metric name, [a-zA-Z_:][a-zA-Z0-9_:]*
+ * @param type Metric type
+ * @param help One line of text; backslashes and newlines are escaped
+ */
+void prom_family(prom_writer_t *w, const char *name, prom_type_t type, const char *help);
+
+/**
+ * @brief Write a sample with an integer value
+ *
+ * @param w Writer
+ * @param name Metric name, with the _bucket/_sum/_count suffix where it applies
+ * @param labels Labels, may be NULL
+ * @param n_labels Number of labels
+ * @param value Value
+ */
+void prom_int(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, int64_t value);
+
+/**
+ * @brief Write a sample with an unsigned integer value
+ */
+void prom_uint(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, uint64_t value);
+
+/**
+ * @brief Write a sample with a fixed-point value raw / 10^decimals, exact,
+ *        e.g. microseconds as seconds with 6 decimals
+ */
+void prom_fixed(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, int64_t raw,
+                int decimals);
+
+/**
+ * @brief Write a sample with a float value; NaN and infinities are
+ *        written as NaN, +Inf and -Inf
+ *
+ * @param decimals 0 to FIXFMT_DECIMALS_MAX digits after the point
+ */
+void prom_float(prom_writer_t *w, const char *name, const prom_label_t *labels, size_t n_labels, float value,
+                int decimals);
+
+/**
+ * @brief Write timing metrics of every job of a scheduler
+ *
+ * Families node_job_runs_total, node_job_overruns_total,
+ * node_job_skipped_total, node_job_jitter_seconds_total,
+ * node_job_jitter_max_seconds, node_job_exec_max_seconds and the
+ * histogram node_job_exec_seconds, labelled job="name" and, if not NULL,
+ * with one more label. The statistics are read without pausing the
+ * scheduler, so one job's values may be one run apart.
+ *
+ * @param w Writer
+ * @param s Scheduler
+ * @param label Extra label such as loop="acquisition", may be NULL
+ */
+void prom_psched(prom_writer_t *w, const psched_t *s, const prom_label_t *label);
+
+/**
+ * @brief Pass the rest of the page to the sink
+ *
+ * @param w Writer
+ * @return `ESP_OK`, or the first error: the sink's, or
+ *         `ESP_ERR_INVALID_SIZE` for a line longer than the buffer
+ */
+esp_err_t prom_finish(prom_writer_t *w);
+
+#ifdef ESP_PLATFORM
+
+#define PROM_ESP_BUF_SIZE 1024
+#define PROM_ESP_MAX_TASKS 16
+
+/**
+ * Writes the application's metrics into a page
+ */
+typedef void (*prom_collect_fn_t)(prom_writer_t *w, void *ctx);
+
+/**
+ * Server configuration
+ */
+typedef struct
+{
+    uint16_t port;              //!< TCP port, 0 = 80
+    prom_collect_fn_t collect;  //!< Application metrics, may be NULL
+    void *ctx;                  //!< Passed to collect
+    const char *const *tasks;   //!< Task names whose stack watermark is reported
+    size_t n_tasks;             //!< Up to PROM_ESP_MAX_TASKS
+} prom_esp_config_t;
+
+/**
+ * @brief Serve GET /metrics
+ *
+ * Each page has node_heap_free_bytes, node_heap_min_free_bytes,
+ * node_heap_largest_free_block_bytes, node_uptime_seconds,
+ * node_task_stack_free_bytes{task} for the configured tasks,
+ * node_scrape_bytes and node_scrape_duration_seconds of the previous
+ * scrape, then the application's metrics. collect() runs in the HTTP
+ * server task and should only read values other tasks keep up to date.
+ *
+ * @param cfg Configuration, copied; the task names must stay valid
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_STATE` if already started
+ */
+esp_err_t prom_esp_start(const prom_esp_config_t *cfg);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __PROM_METRICS_H__ */
@@ -0,0 +1,112 @@
+/**
+ * @file prom_metrics_esp.c
+ *
+ * GET /metrics on esp_http_server
+ */
+#include "prom_metrics.h"
+#include <esp_http_server.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+static const char *TAG = "prom_metrics";
+
+// The server runs one handler at a time, so one buffer serves every scrape
+static httpd_handle_t server;
+static prom_esp_config_t config;
+static char page_buf[PROM_ESP_BUF_SIZE];
+static size_t last_bytes;
+static int64_t last_duration_us;
+
+static esp_err_t send_chunk(void *ctx, const char *data, size_t size)
+{
+    return httpd_resp_send_chunk(ctx, data, size);
+}
+
+static void system_metrics(prom_writer_t *w)
+{
+    prom_family(w, "node_heap_free_bytes", PROM_GAUGE, "Free heap.");
+    prom_uint(w, "node_heap_free_bytes", NULL, 0, esp_get_free_heap_size());
+    prom_family(w, "node_heap_min_free_bytes", PROM_GAUGE, "Lowest free heap since boot.");
+    prom_uint(w, "node_heap_min_free_bytes", NULL, 0, esp_get_minimum_free_heap_size());
+    prom_family(w, "node_heap_largest_free_block_bytes", PROM_GAUGE, "Largest allocatable heap block.");
+    prom_uint(w, "node_heap_largest_free_block_bytes", NULL, 0, heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    prom_family(w, "node_uptime_seconds", PROM_COUNTER, "Time since boot.");
+    prom_fixed(w, "node_uptime_seconds", NULL, 0, esp_timer_get_time(), 6);
+
+    prom_family(w, "node_task_stack_free_bytes", PROM_GAUGE, "Smallest free stack a task has had.");
+    for (size_t i = 0; i < config.n_tasks; i++)
+    {
+        TaskHandle_t task = xTaskGetHandle(config.tasks[i]);
+        if (!task)
+            continue;
+        prom_label_t label = { "task", config.tasks[i] };
+        prom_uint(w, "node_task_stack_free_bytes", &label, 1, uxTaskGetStackHighWaterMark(task));
+    }
+
+    prom_family(w, "node_scrape_bytes", PROM_GAUGE, "Size of the previous metrics page.");
+    prom_uint(w, "node_scrape_bytes", NULL, 0, last_bytes);
+    prom_family(w, "node_scrape_duration_seconds", PROM_GAUGE, "Time taken to render and send the previous page.");
+    prom_fixed(w, "node_scrape_duration_seconds", NULL, 0, last_duration_us, 6);
+}
+
+static esp_err_t metrics_get(httpd_req_t *req)
+{
+    int64_t start = esp_timer_get_time();
+    prom_writer_t w;
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4; charset=utf-8");
+    prom_init(&w, page_buf, sizeof(page_buf), send_chunk, req);
+    system_metrics(&w);
+    if (config.collect)
+        config.collect(&w, config.ctx);
+
+    esp_err_t err = prom_finish(&w);
+    if (err == ESP_OK)
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "scrape failed after %u bytes: %s", (unsigned)w.sent, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    last_bytes = w.sent;
+    last_duration_us = esp_timer_get_time() - start;
+    return ESP_OK;
+}
+
+esp_err_t prom_esp_start(const prom_esp_config_t *cfg)
+{
+    CHECK_ARG(cfg && cfg->n_tasks <= PROM_ESP_MAX_TASKS && (cfg->tasks || !cfg->n_tasks));
+    if (server)
+        return ESP_ERR_INVALID_STATE;
+
+    config = *cfg;
+    httpd_config_t http = HTTPD_DEFAULT_CONFIG();
+    if (cfg->port)
+        http.server_port = cfg->port;
+    esp_err_t err = httpd_start(&server, &http);
+    if (err != ESP_OK)
+        return err;
+
+    httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get,
+    };
+    err = httpd_register_uri_handler(server, &uri);
+    if (err != ESP_OK)
+    {
+        httpd_stop(server);
+        server = NULL;
+        return err;
+    }
+
+    ESP_LOGI(TAG, "serving /metrics on port %u", (unsigned)http.server_port);
+    return ESP_OK;
+}
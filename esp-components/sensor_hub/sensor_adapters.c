@@ -0,0 +1,104 @@
+/**
+ * @file sensor_adapters.c
+ *
+ * sensor_hub drivers for bmp180, dht, adc_stream and GPIO inputs
+ */
+#include "sensor_hub.h"
+#include <string.h>
+
+// --- BMP180 ---
+
+static const sensor_channel_t bmp180_channels[] = {
+    { "temperature", "C" },
+    { "pressure", "Pa" },
+};
+
+static esp_err_t bmp180_sample(void *dev, float *values)
+{
+    uint32_t pressure;
+    esp_err_t err = bmp180_measure(dev, &values[0], &pressure, BMP180_MODE_STANDARD);
+    values[1] = pressure;
+    return err;
+}
+
+const sensor_driver_t sensor_bmp180 = {
+    .type = "bmp180",
+    .n_values = 2,
+    .channels = bmp180_channels,
+    .init = (esp_err_t (*)(void *))bmp180_init,
+    .sample = bmp180_sample,
+};
+
+// --- DHT ---
+
+static const sensor_channel_t dht_channels[] = {
+    { "humidity", "%" },
+    { "temperature", "C" },
+};
+
+static esp_err_t dht_sample(void *dev, float *values)
+{
+    const sensor_dht_t *d = dev;
+    return dht_read_float_data(d->type, d->gpio, &values[0], &values[1]);
+}
+
+const sensor_driver_t sensor_dht = {
+    .type = "dht",
+    .n_values = 2,
+    .channels = dht_channels,
+    .sample = dht_sample,
+};
+
+// --- adc_stream ---
+
+static esp_err_t adc_sample(void *dev, float *values)
+{
+    const sensor_adc_t *a = dev;
+    uint16_t raw[ADC_STREAM_MAX_CHANNELS];
+    uint32_t seq;
+
+    esp_err_t err = adc_stream_get(a->stream, raw, a->first + a->driver.n_values, &seq);
+    if (err != ESP_OK)
+        return err;
+    if (!seq)
+        return ESP_ERR_INVALID_STATE;
+    for (size_t i = 0; i < a->driver.n_values; i++)
+        values[i] = raw[a->first + i];
+    return ESP_OK;
+}
+
+const sensor_driver_t *sensor_adc_driver(sensor_adc_t *dev, adc_stream_t *stream, size_t first,
+                                         size_t count, const sensor_channel_t *channels)
+{
+    if (!dev || !stream || !count || count > SENSOR_HUB_MAX_VALUES || first + count > ADC_STREAM_MAX_CHANNELS)
+        return NULL;
+
+    dev->stream = stream;
+    dev->first = first;
+    dev->driver = (sensor_driver_t) {
+        .type = "adc_stream",
+        .n_values = count,
+        .channels = channels,
+        .sample = adc_sample,
+    };
+    return &dev->driver;
+}
+
+// --- GPIO ---
+
+static const sensor_channel_t gpio_channels[] = {
+    { "level", "" },
+};
+
+static esp_err_t gpio_sample(void *dev, float *values)
+{
+    values[0] = gpio_get_level(*(const gpio_num_t *)dev);
+    return ESP_OK;
+}
+
+const sensor_driver_t sensor_gpio = {
+    .type = "gpio",
+    .n_values = 1,
+    .channels = gpio_channels,
+    .sample = gpio_sample,
+};
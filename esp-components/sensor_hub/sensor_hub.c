@@ -0,0 +1,118 @@
+/**
+ * @file sensor_hub.c
+ *
+ * Sensor registry with a shared last-value cache
+ */
+#include "sensor_hub.h"
+#include <string.h>
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+esp_err_t sensor_hub_init(sensor_hub_t *hub, psched_t *sched, sensor_hub_entry_t *entries, size_t capacity)
+{
+    CHECK_ARG(hub && sched && entries && capacity);
+
+    memset(hub, 0, sizeof(*hub));
+    hub->sched = sched;
+    hub->entries = entries;
+    hub->capacity = capacity;
+
+    return ESP_OK;
+}
+
+void sensor_hub_sample(sensor_hub_entry_t *entry)
+{
+    uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+    const sensor_reading_t *cur = &entry->slot[seq & 1];
+    sensor_reading_t *next = &entry->slot[(seq + 1) & 1];
+    psched_clock_t *clock = &entry->hub->sched->clock;
+
+    // Readers copy slot[seq & 1]; announce the other one before touching
+    // it so a reader that is still on it from two samples ago retries
+    __atomic_store_n(&entry->writing, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    next->status = entry->driver->sample(entry->dev, next->values);
+    if (next->status != ESP_OK)
+        memcpy(next->values, cur->values, sizeof(next->values));
+    next->time_us = clock->now_us(clock->ctx);
+    next->count = cur->count + 1;
+
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static void sample_job(void *ctx)
+{
+    sensor_hub_sample(ctx);
+}
+
+esp_err_t sensor_hub_add(sensor_hub_t *hub, const sensor_hub_sensor_config_t *cfg, size_t *id)
+{
+    CHECK_ARG(hub && cfg && cfg->name && cfg->driver && cfg->driver->sample);
+    CHECK_ARG(cfg->driver->n_values > 0 && cfg->driver->n_values <= SENSOR_HUB_MAX_VALUES);
+    if (hub->n_entries == hub->capacity)
+        return ESP_ERR_NO_MEM;
+
+    if (cfg->driver->init)
+        CHECK(cfg->driver->init(cfg->dev));
+
+    sensor_hub_entry_t *e = &hub->entries[hub->n_entries];
+    memset(e, 0, sizeof(*e));
+    e->name = cfg->name;
+    e->driver = cfg->driver;
+    e->dev = cfg->dev;
+    e->hub = hub;
+
+    psched_job_config_t job = {
+        .name = cfg->name,
+        .fn = sample_job,
+        .ctx = e,
+        .period_us = cfg->period_us,
+        .phase_us = cfg->phase_us,
+    };
+    CHECK(psched_add(hub->sched, &job, NULL));
+
+    if (id)
+        *id = hub->n_entries;
+    hub->n_entries++;
+
+    return ESP_OK;
+}
+
+esp_err_t sensor_hub_find(const sensor_hub_t *hub, const char *name, size_t *id)
+{
+    CHECK_ARG(hub && name && id);
+
+    for (size_t i = 0; i < hub->n_entries; i++)
+        if (!strcmp(hub->entries[i].name, name))
+        {
+            *id = i;
+            return ESP_OK;
+        }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t sensor_hub_read(const sensor_hub_t *hub, size_t id, sensor_reading_t *out)
+{
+    CHECK_ARG(hub && out && id < hub->n_entries);
+
+    const sensor_hub_entry_t *e = &hub->entries[id];
+    uint32_t seq, writing;
+
+    // slot[seq & 1] is only rewritten once the writer starts sample seq + 2
+    do
+    {
+        seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        memcpy(out, &e->slot[seq & 1], sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        writing = __atomic_load_n(&e->writing, __ATOMIC_RELAXED);
+    } while (writing - seq >= 2);
+
+    return out->count ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+const sensor_driver_t *sensor_hub_driver(const sensor_hub_t *hub, size_t id)
+{
+    return hub && id < hub->n_entries ? hub->entries[id].driver : NULL;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file sensor_hub.h
+ * @defgroup sensor_hub sensor_hub
+ * @{
+ *
+ * Sensor registry with a shared last-value cache.
+ *
+ * Every sensor implements sensor_driver_t (init, sample, channel
+ * metadata). The hub registers one periodic_sched job per sensor, so each
+ * sensor is sampled exactly once per period by the scheduler task however
+ * many consumers read it. Results go to a timestamped cache that readers
+ * copy without touching the bus and without locks.
+ *
+ * Each cache entry is double-buffered under a sequence counter: the
+ * writer fills the slot readers are not using and then publishes it by
+ * incrementing the counter. A reader only retries if the writer started
+ * overwriting the slot it was copying, i.e. a second sample began while
+ * it copied, and never waits on a writer that is itself preempted.
+ */
+#ifndef __SENSOR_HUB_H__
+#define __SENSOR_HUB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "periodic_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSOR_HUB_MAX_VALUES 4 //!< Channels per sensor
+
+/**
+ * Description of one value produced by a sensor
+ */
+typedef struct
+{
+    const char *name;   //!< e.g. "temperature"
+    const char *unit;   //!< e.g. "C"
+} sensor_channel_t;
+
+/**
+ * Sensor interface
+ */
+typedef struct
+{
+    const char *type;                    //!< Driver name, e.g. "bmp180"
+    size_t n_values;                     //!< Values per sample, up to SENSOR_HUB_MAX_VALUES
+    const sensor_channel_t *channels;    //!< n_values entries
+    esp_err_t (*init)(void *dev);        //!< Optional, called once from sensor_hub_add()
+    esp_err_t (*sample)(void *dev, float *values); //!< Read n_values values
+} sensor_driver_t;
+
+/**
+ * Cached sample
+ */
+typedef struct
+{
+    int64_t time_us;    //!< Clock time at the end of the read
+    uint32_t count;     //!< Samples taken so far, 0 before the first one
+    esp_err_t status;   //!< Result of the last sample() call
+    float values[SENSOR_HUB_MAX_VALUES]; //!< Last successful values
+} sensor_reading_t;
+
+/**
+ * Registered sensor
+ */
+typedef struct
+{
+    const char *name;
+    const sensor_driver_t *driver;
+    void *dev;
+    uint32_t seq;             //!< Published slot count
+    uint32_t writing;         //!< Slot count being written, seq or seq + 1
+    sensor_reading_t slot[2]; //!< Current reading is slot[seq & 1]
+    struct sensor_hub_s *hub;
+} sensor_hub_entry_t;
+
+/**
+ * Hub
+ */
+typedef struct sensor_hub_s
+{
+    psched_t *sched;
+    sensor_hub_entry_t *entries;
+    size_t n_entries;
+    size_t capacity;
+} sensor_hub_t;
+
+/**
+ * Sensor registration
+ */
+typedef struct
+{
+    const char *name;               //!< Instance name, e.g. "indoor"
+    const sensor_driver_t *driver;
+    void *dev;                      //!< Passed to the driver
+    uint32_t period_us;             //!< Sampling period
+    uint32_t phase_us;              //!< Offset of the first sample
+} sensor_hub_sensor_config_t;
+
+/**
+ * @brief Initialize a hub whose sensors are sampled by a scheduler
+ *
+ * The scheduler needs one job slot per sensor on top of its other jobs.
+ *
+ * @param hub Hub
+ * @param sched Scheduler that runs the sampling jobs, not started yet
+ * @param entries Storage for up to capacity sensors
+ * @param capacity Number of entries
+ * @return `ESP_OK` on success
+ */
+esp_err_t sensor_hub_init(sensor_hub_t *hub, psched_t *sched, sensor_hub_entry_t *entries, size_t capacity);
+
+/**
+ * @brief Initialize a sensor and schedule its sampling
+ *
+ * @param hub Hub
+ * @param cfg Registration
+ * @param[out] id Sensor index for sensor_hub_read(); may be NULL
+ * @return `ESP_OK` on success, the driver's init() error otherwise
+ */
+esp_err_t sensor_hub_add(sensor_hub_t *hub, const sensor_hub_sensor_config_t *cfg, size_t *id);
+
+/**
+ * @brief Find a sensor by instance name
+ *
+ * @param hub Hub
+ * @param name Instance name
+ * @param[out] id Sensor index
+ * @return `ESP_OK` or `ESP_ERR_NOT_FOUND`
+ */
+esp_err_t sensor_hub_find(const sensor_hub_t *hub, const char *name, size_t *id);
+
+/**
+ * @brief Copy the latest cached sample, lock-free, from any task
+ *
+ * @param hub Hub
+ * @param id Sensor index
+ * @param[out] out Reading
+ * @return `ESP_OK`, `ESP_ERR_INVALID_STATE` before the first sample
+ */
+esp_err_t sensor_hub_read(const sensor_hub_t *hub, size_t id, sensor_reading_t *out);
+
+/**
+ * @brief Driver of a registered sensor, for channel metadata
+ *
+ * @param hub Hub
+ * @param id Sensor index
+ * @return Driver, NULL for an unknown id
+ */
+const sensor_driver_t *sensor_hub_driver(const sensor_hub_t *hub, size_t id);
+
+/**
+ * @brief Sample a sensor now and publish the result
+ *
+ * This is what the scheduled job runs. Only call it from the scheduler
+ * task; the cache allows a single writer per sensor.
+ *
+ * @param entry Registered sensor
+ */
+void sensor_hub_sample(sensor_hub_entry_t *entry);
+
+#ifdef ESP_PLATFORM
+
+/*
+ * Adapters for the drivers in this repo
+ */
+
+#include <driver/gpio.h>
+#include <dht.h>
+#include <bmp180.h>
+#include "adc_stream.h"
+
+/** BMP180: temperature (C), pressure (Pa); dev is a bmp180_dev_t set up by the caller */
+extern const sensor_driver_t sensor_bmp180;
+
+/** DHT11/22 device */
+typedef struct
+{
+    dht_sensor_type_t type;
+    gpio_num_t gpio;
+} sensor_dht_t;
+
+/** DHT: humidity (%), temperature (C); dev is a sensor_dht_t */
+extern const sensor_driver_t sensor_dht;
+
+/** Consecutive channels of a running adc_stream */
+typedef struct
+{
+    adc_stream_t *stream;
+    size_t first;            //!< First stream channel
+    sensor_driver_t driver;  //!< Filled by sensor_adc_driver()
+} sensor_adc_t;
+
+/**
+ * @brief Driver for channels first .. first + count - 1 of an adc_stream
+ *
+ * Samples are the latest averaged 12-bit codes from adc_stream's own
+ * cache, so no conversion is started. The driver lives in dev.
+ *
+ * @param dev Device to fill, must outlive the hub
+ * @param stream Running stream
+ * @param first First stream channel
+ * @param count Number of channels, up to SENSOR_HUB_MAX_VALUES
+ * @param channels count metadata entries
+ * @return Driver to register with dev, NULL if count is out of range
+ */
+const sensor_driver_t *sensor_adc_driver(sensor_adc_t *dev, adc_stream_t *stream, size_t first,
+                                         size_t count, const sensor_channel_t *channels);
+
+/** Input level (0/1); dev is a gpio_num_t configured by the caller */
+extern const sensor_driver_t sensor_gpio;
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __SENSOR_HUB_H__ */
@@ -1,60 +1,122 @@
 #include "ssd1306.h"
 #include "font8x8_basic.h"
+#include <stdlib.h>
 #include <string.h>
 
-static uint8_t buffer[128 * 8];
-static i2c_dev_t dev;
-
-esp_err_t ssd1306_init_i2c(uint8_t addr, i2c_port_t port, gpio_num_t sda, gpio_num_t scl) {
-    memset(&dev, 0, sizeof(i2c_dev_t));
-    dev.port = port;
-    dev.addr = addr;
-    dev.cfg.sda_io_num = sda;
-    dev.cfg.scl_io_num = scl;
-    dev.cfg.sda_pullup_en = GPIO_PULLUP_ENABLE;
-    dev.cfg.scl_pullup_en = GPIO_PULLUP_ENABLE;
-    dev.cfg.master.clk_speed = 400000;
-    esp_err_t err = i2c_dev_create_mutex(&dev);
+esp_err_t ssd1306_init_fb(ssd1306_t *dev, uint8_t width, uint8_t height, uint8_t *fb) {
+    if (!dev || width == 0 || width > SSD1306_MAX_WIDTH ||
+        (height != 32 && height != 64))
+        return ESP_ERR_INVALID_ARG;
+
+    memset(dev, 0, sizeof(ssd1306_t));
+    dev->width = width;
+    dev->height = height;
+    dev->pages = height / 8;
+
+    if (fb) {
+        dev->buffer = fb;
+    } else {
+        dev->buffer = malloc(SSD1306_FB_SIZE(width, height));
+        if (!dev->buffer) return ESP_ERR_NO_MEM;
+        dev->owns_buffer = true;
+    }
+    memset(dev->buffer, 0x00, SSD1306_FB_SIZE(width, height));
+    return ESP_OK;
+}
+
+esp_err_t ssd1306_free_desc(ssd1306_t *dev) {
+    if (!dev) return ESP_ERR_INVALID_ARG;
+    if (dev->owns_buffer) free(dev->buffer);
+    dev->buffer = NULL;
+    dev->owns_buffer = false;
+#ifdef ESP_PLATFORM
+    if (dev->i2c_dev.mutex) return i2c_dev_delete_mutex(&dev->i2c_dev);
+#endif
+    return ESP_OK;
+}
+
+#ifdef ESP_PLATFORM
+esp_err_t ssd1306_init_desc(ssd1306_t *dev, uint8_t width, uint8_t height, uint8_t *fb,
+                            uint8_t addr, i2c_port_t port, gpio_num_t sda, gpio_num_t scl) {
+    esp_err_t err = ssd1306_init_fb(dev, width, height, fb);
     if (err != ESP_OK) return err;
+
+    dev->i2c_dev.port = port;
+    dev->i2c_dev.addr = addr;
+    dev->i2c_dev.cfg.sda_io_num = sda;
+    dev->i2c_dev.cfg.scl_io_num = scl;
+    dev->i2c_dev.cfg.sda_pullup_en = GPIO_PULLUP_ENABLE;
+    dev->i2c_dev.cfg.scl_pullup_en = GPIO_PULLUP_ENABLE;
+    dev->i2c_dev.cfg.master.clk_speed = 400000;
+    err = i2c_dev_create_mutex(&dev->i2c_dev);
+    if (err != ESP_OK) {
+        ssd1306_free_desc(dev);
+        return err;
+    }
     return ESP_OK;
+}
 
+static esp_err_t write_cmd(ssd1306_t *dev, uint8_t cmd) {
+    return i2c_dev_write_reg(&dev->i2c_dev, 0x00, &cmd, 1);
 }
 
-static void write_cmd(uint8_t cmd) {
-    i2c_dev_write_reg(&dev, 0x00, &cmd, 1);
+esp_err_t ssd1306_init(ssd1306_t *dev) {
+    // Multiplex ratio and COM pin layout are the only geometry-dependent settings
+    const uint8_t cmds[] = {
+        0xAE,
+        0xA8, dev->height - 1,
+        0xD3, 0x00,
+        0x40,
+        0xA1,
+        0xC0,
+        0xDA, dev->height == 32 ? 0x02 : 0x12,
+        0x81, 0x7F,
+        0xA4,
+        0xA6,
+        0xD5, 0x80,
+        0x8D, 0x14,
+        0x20, 0x00,
+        0xAF,
+    };
+    for (size_t i = 0; i < sizeof(cmds); i++) {
+        esp_err_t err = write_cmd(dev, cmds[i]);
+        if (err != ESP_OK) return err;
+    }
+    return ESP_OK;
 }
 
-esp_err_t ssd1306_init(void) {
-    write_cmd(0xAE);
-    write_cmd(0xA8); write_cmd(0x3F);
-    write_cmd(0xD3); write_cmd(0x00);
-    write_cmd(0x40);
-    write_cmd(0xA1);
-    write_cmd(0xC0);
-    write_cmd(0xDA); write_cmd(0x12);
-    write_cmd(0x81); write_cmd(0x7F);
-    write_cmd(0xA4);
-    write_cmd(0xA6);
-    write_cmd(0xD5); write_cmd(0x80);
-    write_cmd(0x8D); write_cmd(0x14);
-    write_cmd(0x20); write_cmd(0x00);
-    write_cmd(0xAF);
+esp_err_t ssd1306_refresh(ssd1306_t *dev) {
+    for (uint8_t page = 0; page < dev->pages; page++) {
+        esp_err_t err;
+        if ((err = write_cmd(dev, 0xB0 + page)) != ESP_OK) return err;
+        if ((err = write_cmd(dev, 0x00)) != ESP_OK) return err;
+        if ((err = write_cmd(dev, 0x10)) != ESP_OK) return err;
+        err = i2c_dev_write_reg(&dev->i2c_dev, 0x40, &dev->buffer[dev->width * page], dev->width);
+        if (err != ESP_OK) return err;
+    }
     return ESP_OK;
 }
+#endif /* ESP_PLATFORM */
 
-void ssd1306_clear(void) {
-    memset(buffer, 0x00, sizeof(buffer));
+void ssd1306_clear(ssd1306_t *dev) {
+    memset(dev->buffer, 0x00, SSD1306_FB_SIZE(dev->width, dev->height));
 }
 
-void ssd1306_draw_string(uint8_t x, uint8_t page, const char *text, uint8_t font_size, bool invert)
+void ssd1306_draw_string(ssd1306_t *dev, uint8_t x, uint8_t page, const char *text, uint8_t font_size, bool invert)
 {
     (void)font_size;
 
-    for (size_t i = 0; i < strlen(text); i++) {
+    if (page >= dev->pages) return;
+    uint8_t *row = &dev->buffer[page * dev->width];
+
+    for (size_t i = 0; text[i] != '\0'; i++) {
         uint8_t c = text[i];
         if (c > 127) c = '?';
 
         for (int col = 0; col < 8; col++) {
+            size_t index = x + i * 8 + col;
+            if (index >= dev->width) return;
+
             // Read 1 column of font data (vertical 8 pixels)
             uint8_t col_data = font8x8_basic[c][col];
 
@@ -67,25 +129,15 @@ void ssd1306_draw_string(uint8_t x, uint8_t page, const char *text, uint8_t font
 
             if (invert) reversed = ~reversed;
 
-            size_t index = (page * 128) + x + i * 8 + col;
-            if (index < sizeof(buffer))
-                buffer[index] = reversed;
+            row[index] = reversed;
         }
     }
 }
 
-
-
-
-
-
-
-
-void ssd1306_refresh(void) {
-    for (uint8_t page = 0; page < 8; page++) {
-        write_cmd(0xB0 + page);
-        write_cmd(0x00);
-        write_cmd(0x10);
-        i2c_dev_write_reg(&dev, 0x40, &buffer[128 * page], 128);
-    }
+bool ssd1306_get_pixel(const ssd1306_t *dev, uint8_t x, uint8_t y) {
+    if (x >= dev->width || y >= dev->height) return false;
+    // ssd1306_init selects normal COM scan (0xC0), so the panel shows RAM
+    // rows bottom-up; that is what the bit reversal in draw_string undoes.
+    uint8_t row = dev->height - 1 - y;
+    return (dev->buffer[(row / 8) * dev->width + x] >> (row % 8)) & 1;
 }
@@ -1,11 +1,66 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+#ifdef ESP_PLATFORM
 #include "i2cdev.h"
+#endif
 
 #define SSD1306_I2C_ADDRESS 0x3C
 
-esp_err_t ssd1306_init_i2c(uint8_t addr, i2c_port_t port, gpio_num_t sda, gpio_num_t scl);
-esp_err_t ssd1306_init(void);
-void ssd1306_clear(void);
-void ssd1306_draw_string(uint8_t x, uint8_t y, const char *text, uint8_t font_size, bool invert);
-void ssd1306_refresh(void);
+#define SSD1306_MAX_WIDTH   128
+#define SSD1306_MAX_HEIGHT  64
+
+// Framebuffer bytes needed for a panel: one byte per column per 8-row page
+#define SSD1306_FB_SIZE(width, height) ((size_t)(width) * ((height) / 8))
+
+// Worst-case size of a PBM (P4) / PGM (P5) snapshot including header
+#define SSD1306_PBM_SIZE(width, height) (32 + (((size_t)(width) + 7) / 8) * (height))
+#define SSD1306_PGM_SIZE(width, height) (32 + (size_t)(width) * (height))
+
+typedef struct {
+#ifdef ESP_PLATFORM
+    i2c_dev_t i2c_dev;
+#endif
+    uint8_t width;       // columns, up to 128
+    uint8_t height;      // rows, 32 or 64
+    uint8_t pages;       // height / 8
+    uint8_t *buffer;     // width * pages bytes, page-major
+    bool owns_buffer;    // buffer was allocated by ssd1306_init_desc
+} ssd1306_t;
+
+/**
+ * Set up geometry and framebuffer only, without any transport. This is
+ * all that is needed to render off-target.
+ */
+esp_err_t ssd1306_init_fb(ssd1306_t *dev, uint8_t width, uint8_t height, uint8_t *fb);
+
+#ifdef ESP_PLATFORM
+/**
+ * Set up a panel handle. Pass a framebuffer of at least
+ * SSD1306_FB_SIZE(width, height) bytes, or NULL to have one allocated
+ * at exactly that size.
+ */
+esp_err_t ssd1306_init_desc(ssd1306_t *dev, uint8_t width, uint8_t height, uint8_t *fb,
+                            uint8_t addr, i2c_port_t port, gpio_num_t sda, gpio_num_t scl);
+esp_err_t ssd1306_init(ssd1306_t *dev);
+esp_err_t ssd1306_refresh(ssd1306_t *dev);
+#endif
+
+esp_err_t ssd1306_free_desc(ssd1306_t *dev);
+
+void ssd1306_clear(ssd1306_t *dev);
+void ssd1306_draw_string(ssd1306_t *dev, uint8_t x, uint8_t page, const char *text, uint8_t font_size, bool invert);
+
+// Pixel at (x, y) as the panel shows it, true = lit
+bool ssd1306_get_pixel(const ssd1306_t *dev, uint8_t x, uint8_t y);
+
+/**
+ * Encode the framebuffer as a binary PBM (P4) or PGM (P5) image into
+ * out. Returns the number of bytes written, or 0 if cap is too small
+ * (see SSD1306_PBM_SIZE / SSD1306_PGM_SIZE).
+ */
+size_t ssd1306_snapshot_pbm(const ssd1306_t *dev, uint8_t *out, size_t cap);
+size_t ssd1306_snapshot_pgm(const ssd1306_t *dev, uint8_t *out, size_t cap);
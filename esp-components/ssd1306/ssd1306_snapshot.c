@@ -0,0 +1,42 @@
+#include "ssd1306.h"
+#include <stdio.h>
+#include <string.h>
+
+static size_t write_header(const char *magic, const ssd1306_t *dev, bool gray, uint8_t *out, size_t cap) {
+    char hdr[32];
+    int n = gray ? snprintf(hdr, sizeof(hdr), "%s\n%u %u\n255\n", magic, dev->width, dev->height)
+                 : snprintf(hdr, sizeof(hdr), "%s\n%u %u\n", magic, dev->width, dev->height);
+    if (n < 0 || (size_t)n > cap) return 0;
+    memcpy(out, hdr, n);
+    return n;
+}
+
+size_t ssd1306_snapshot_pbm(const ssd1306_t *dev, uint8_t *out, size_t cap) {
+    size_t row_bytes = (dev->width + 7) / 8;
+    size_t n = write_header("P4", dev, false, out, cap);
+    if (n == 0 || cap - n < row_bytes * dev->height) return 0;
+
+    // PBM rows are MSB-first bitmaps with 1 = black, so lit pixels come
+    // out black on white. Rows are in panel order, see ssd1306_get_pixel.
+    for (uint8_t y = 0; y < dev->height; y++) {
+        uint8_t *row = &out[n];
+        memset(row, 0, row_bytes);
+        for (uint8_t x = 0; x < dev->width; x++) {
+            if (ssd1306_get_pixel(dev, x, y))
+                row[x / 8] |= 0x80 >> (x % 8);
+        }
+        n += row_bytes;
+    }
+    return n;
+}
+
+size_t ssd1306_snapshot_pgm(const ssd1306_t *dev, uint8_t *out, size_t cap) {
+    size_t n = write_header("P5", dev, true, out, cap);
+    if (n == 0 || cap - n < (size_t)dev->width * dev->height) return 0;
+
+    for (uint8_t y = 0; y < dev->height; y++) {
+        for (uint8_t x = 0; x < dev->width; x++)
+            out[n++] = ssd1306_get_pixel(dev, x, y) ? 255 : 0;
+    }
+    return n;
+}
@@ -0,0 +1,315 @@
+/**
+ * @file telem_codec.c
+ *
+ * Compact binary encoding of sensor readings
+ */
+#include "telem_codec.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+// Largest fixed-point magnitude kept, safely inside int32
+#define RAW_LIMIT 2.0e9
+
+static const telem_schema_t schemas[] = {
+    { .id = TELEM_SCHEMA_GAS, .n_fields = 3, .name = { "co2", "ch4", "co" }, .decimals = { 2, 2, 2 } },
+    { .id = TELEM_SCHEMA_ENV, .n_fields = 3, .name = { "temperature", "pressure", "humidity" },
+      .decimals = { 2, 2, 1 } },
+};
+
+static const float scale[TELEM_DECIMALS_MAX + 1] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f };
+static const uint32_t iscale[TELEM_DECIMALS_MAX + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+const telem_schema_t *telem_schema_find(uint8_t id)
+{
+    for (size_t i = 0; i < sizeof(schemas) / sizeof(schemas[0]); i++)
+        if (schemas[i].id == id)
+            return &schemas[i];
+    return NULL;
+}
+
+typedef struct
+{
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+} writer_t;
+
+static bool put_byte(writer_t *w, uint8_t b)
+{
+    if (w->len == w->size)
+        return false;
+    w->buf[w->len++] = b;
+    return true;
+}
+
+static bool put_uvarint(writer_t *w, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        if (!put_byte(w, (v & 0x7f) | 0x80))
+            return false;
+        v >>= 7;
+    }
+    return put_byte(w, v);
+}
+
+static bool put_svarint(writer_t *w, int32_t v)
+{
+    return put_uvarint(w, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+typedef struct
+{
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+} reader_t;
+
+static bool get_byte(reader_t *r, uint8_t *b)
+{
+    if (r->pos == r->len)
+        return false;
+    *b = r->buf[r->pos++];
+    return true;
+}
+
+static bool get_uvarint(reader_t *r, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        uint8_t b;
+        if (!get_byte(r, &b))
+            return false;
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool get_svarint(reader_t *r, int32_t *v)
+{
+    uint32_t u;
+    if (!get_uvarint(r, &u))
+        return false;
+    *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+    return true;
+}
+
+esp_err_t telem_enc_init(telem_enc_t *e, const telem_schema_t *schema, uint32_t key_interval)
+{
+    CHECK_ARG(e && schema && schema->n_fields <= TELEM_FIELDS_MAX);
+    for (int i = 0; i < schema->n_fields; i++)
+        CHECK_ARG(schema->decimals[i] <= TELEM_DECIMALS_MAX);
+
+    memset(e, 0, sizeof(*e));
+    e->schema = schema;
+    e->key_interval = key_interval;
+
+    return ESP_OK;
+}
+
+void telem_enc_reset(telem_enc_t *e)
+{
+    e->have_prev = false;
+}
+
+esp_err_t telem_encode(telem_enc_t *e, const float *values, const uint32_t *seq, const uint32_t *age_ms,
+                       uint8_t *buf, size_t size, size_t *len)
+{
+    CHECK_ARG(e && values && buf && len);
+
+    const telem_schema_t *s = e->schema;
+    int32_t raw[TELEM_FIELDS_MAX];
+    uint8_t mask = 0;
+    for (int i = 0; i < s->n_fields; i++)
+    {
+        // A float times a power of ten up to 10^6 is exact in a double, so
+        // this rounds exactly like printf("%.*f") did
+        double q = (double)values[i] * iscale[s->decimals[i]];
+        if (isfinite(q) && fabs(q) <= RAW_LIMIT)
+        {
+            raw[i] = (int32_t)lrint(q);
+            mask |= 1u << i;
+        }
+    }
+
+    // The difference of two in-range values can exceed int32; such a frame
+    // is sent absolute
+    bool delta = seq && e->have_prev && e->key_interval > 1 && e->since_key + 1 < e->key_interval &&
+                 *seq == e->prev_seq + 1 && mask == e->prev_mask;
+    int32_t out[TELEM_FIELDS_MAX];
+    for (int i = 0; i < s->n_fields; i++)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+        out[i] = raw[i];
+        if (delta)
+        {
+            int64_t d = (int64_t)raw[i] - e->prev[i];
+            if (d < INT32_MIN || d > INT32_MAX)
+                delta = false;
+        }
+    }
+    if (delta)
+        for (int i = 0; i < s->n_fields; i++)
+            if (mask & (1u << i))
+                out[i] = raw[i] - e->prev[i];
+
+    uint8_t flags = (seq ? TELEM_FLAG_SEQ : 0) | (age_ms ? TELEM_FLAG_AGE : 0) | (delta ? TELEM_FLAG_DELTA : 0);
+    writer_t w = { .buf = buf, .size = size };
+    bool ok = put_byte(&w, TELEM_VERSION << 4 | flags) && put_byte(&w, s->id) && put_byte(&w, mask);
+    for (int i = 0; ok && i < s->n_fields; i++)
+        if (mask & (1u << i))
+            ok = put_svarint(&w, out[i]);
+    if (ok && seq)
+        ok = put_uvarint(&w, *seq);
+    if (ok && age_ms)
+        ok = put_uvarint(&w, *age_ms);
+    if (!ok)
+        return ESP_ERR_INVALID_SIZE;
+
+    // Without a sequence number the next frame cannot refer to this one
+    e->have_prev = seq != NULL;
+    if (seq)
+    {
+        e->prev_seq = *seq;
+        e->prev_mask = mask;
+        e->since_key = delta ? e->since_key + 1 : 0;
+        memcpy(e->prev, raw, sizeof(raw));
+    }
+    *len = w.len;
+
+    return ESP_OK;
+}
+
+void telem_dec_init(telem_dec_t *d)
+{
+    memset(d, 0, sizeof(*d));
+}
+
+esp_err_t telem_decode(telem_dec_t *d, const uint8_t *buf, size_t len, telem_frame_t *f)
+{
+    CHECK_ARG(d && buf && f);
+
+    reader_t r = { .buf = buf, .len = len };
+    uint8_t header, id, mask;
+    if (!get_byte(&r, &header) || !get_byte(&r, &id) || !get_byte(&r, &mask))
+        return ESP_ERR_INVALID_SIZE;
+    if (header >> 4 != TELEM_VERSION || (header & ~(TELEM_FLAG_SEQ | TELEM_FLAG_AGE | TELEM_FLAG_DELTA) & 0x0f))
+        return ESP_ERR_NOT_SUPPORTED;
+    const telem_schema_t *s = telem_schema_find(id);
+    if (!s)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (mask >> s->n_fields)
+        return ESP_ERR_INVALID_SIZE;
+
+    memset(f, 0, sizeof(*f));
+    f->schema = s;
+    f->flags = header & 0x0f;
+    f->mask = mask;
+    for (int i = 0; i < s->n_fields; i++)
+        if ((mask & (1u << i)) && !get_svarint(&r, &f->raw[i]))
+            return ESP_ERR_INVALID_SIZE;
+    if ((f->flags & TELEM_FLAG_SEQ) && !get_uvarint(&r, &f->seq))
+        return ESP_ERR_INVALID_SIZE;
+    if ((f->flags & TELEM_FLAG_AGE) && !get_uvarint(&r, &f->age_ms))
+        return ESP_ERR_INVALID_SIZE;
+    if (r.pos != len)
+        return ESP_ERR_INVALID_SIZE;
+
+    bool has_seq = f->flags & TELEM_FLAG_SEQ;
+    if (f->flags & TELEM_FLAG_DELTA)
+    {
+        if (!has_seq || !d->have_prev || d->prev_schema != id || d->prev_mask != mask || f->seq != d->prev_seq + 1)
+            return ESP_ERR_INVALID_STATE;
+        for (int i = 0; i < s->n_fields; i++)
+            if (mask & (1u << i))
+                f->raw[i] = (int32_t)((uint32_t)d->prev[i] + (uint32_t)f->raw[i]);
+    }
+
+    for (int i = 0; i < s->n_fields; i++)
+        f->value[i] = (mask & (1u << i)) ? f->raw[i] / scale[s->decimals[i]] : NAN;
+
+    d->have_prev = has_seq;
+    if (has_seq)
+    {
+        d->prev_schema = id;
+        d->prev_mask = mask;
+        d->prev_seq = f->seq;
+        memcpy(d->prev, f->raw, sizeof(d->prev));
+    }
+
+    return ESP_OK;
+}
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} text_t;
+
+static void put(text_t *t, const char *fmt, ...)
+{
+    if (t->overflow)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(t->buf + t->len, t->size - t->len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= t->size - t->len)
+        t->overflow = true;
+    else
+        t->len += n;
+}
+
+esp_err_t telem_to_json(const telem_frame_t *f, char *buf, size_t size, size_t *len)
+{
+    CHECK_ARG(f && f->schema && buf && size);
+
+    // Fixed point is printed as integers, so the text is exact
+    const telem_schema_t *s = f->schema;
+    text_t t = { .buf = buf, .size = size };
+    const char *sep = "{";
+    for (int i = 0; i < s->n_fields; i++)
+    {
+        if (!(f->mask & (1u << i)))
+            continue;
+        int d = s->decimals[i];
+        int32_t v = f->raw[i];
+        uint32_t mag = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+        if (d)
+            put(&t, "%s\"%s\": %s%lu.%0*lu", sep, s->name[i], v < 0 ? "-" : "",
+                (unsigned long)(mag / iscale[d]), d, (unsigned long)(mag % iscale[d]));
+        else
+            put(&t, "%s\"%s\": %ld", sep, s->name[i], (long)v);
+        sep = ", ";
+    }
+    if (f->flags & TELEM_FLAG_SEQ)
+    {
+        put(&t, "%s\"seq\": %lu", sep, (unsigned long)f->seq);
+        sep = ", ";
+    }
+    if (f->flags & TELEM_FLAG_AGE)
+    {
+        put(&t, "%s\"age_ms\": %lu", sep, (unsigned long)f->age_ms);
+        sep = ", ";
+    }
+    put(&t, "%s}", *sep == '{' ? "{" : "");
+    if (t.overflow)
+    {
+        buf[0] = 0;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (len)
+        *len = t.len;
+
+    return ESP_OK;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file telem_codec.h
+ * @defgroup telem_codec telem_codec
+ * @{
+ *
+ * Compact binary encoding of sensor readings, replacing per-message JSON.
+ *
+ * A frame carries the readings of one sample as fixed-point integers,
+ * scaled by the number of decimals the field is reported with, so the
+ * node multiplies and rounds instead of formatting floats:
+ *
+ *     header (1) | schema (1) | mask (1) | fields | [seq] | [age_ms]
+ *
+ * - header: format version in the high nibble, flags in the low one
+ *   (TELEM_FLAG_*). Version 1 frames start with 0x1?, never with '{', so
+ *   a receiver can tell them from the JSON payloads they replace.
+ * - schema: which fields the frame carries, by id from the table shared
+ *   by the nodes and the receivers (telem_schema_find()).
+ * - mask: bit i set when field i is present; absent fields (NaN, or out
+ *   of range) take no space.
+ * - fields: one zigzag LEB128 varint per present field, the value times
+ *   10^decimals, or in a delta frame the difference to the same field of
+ *   the previous frame.
+ * - seq, age_ms: unsigned LEB128 varints, when flagged.
+ *
+ * Delta frames are optional. The encoder only emits one when the frame
+ * directly follows the previous one (seq + 1, same fields) and fewer
+ * than key_interval frames have passed since the last absolute one; the
+ * decoder applies it only on top of that previous frame and refuses it
+ * otherwise, so a lost message costs at most key_interval - 1 frames.
+ * Use them only where frames arrive in order and one lost message is
+ * acceptable.
+ *
+ * Encoder and decoder hold the state of one stream each; decode frames
+ * from different senders with different decoders. Not thread-safe.
+ */
+#ifndef __TELEM_CODEC_H__
+#define __TELEM_CODEC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEM_VERSION      1
+#define TELEM_FIELDS_MAX   8    //!< Fields per schema, one mask bit each
+#define TELEM_DECIMALS_MAX 6
+
+#define TELEM_FLAG_SEQ     0x01 //!< seq follows the fields
+#define TELEM_FLAG_AGE     0x02 //!< age_ms follows seq (or the fields)
+#define TELEM_FLAG_DELTA   0x04 //!< Fields are differences to the previous frame
+
+/**
+ * Longest frame: header, schema, mask, 5 bytes per field and per counter
+ */
+#define TELEM_FRAME_MAX    (3 + 5 * TELEM_FIELDS_MAX + 2 * 5)
+
+/**
+ * Schema ids
+ */
+typedef enum
+{
+    TELEM_SCHEMA_GAS = 1,      //!< GasNODE: co2, ch4, co in ppm
+    TELEM_SCHEMA_ENV = 2,      //!< TempNODE: temperature (°C), pressure (hPa), humidity (%)
+} telem_schema_id_t;
+
+/**
+ * Field layout of a frame
+ */
+typedef struct
+{
+    uint8_t id;
+    uint8_t n_fields;
+    const char *name[TELEM_FIELDS_MAX];      //!< JSON key of each field
+    uint8_t decimals[TELEM_FIELDS_MAX];      //!< Digits after the point
+} telem_schema_t;
+
+/**
+ * Encoder state
+ */
+typedef struct
+{
+    const telem_schema_t *schema;
+    uint32_t key_interval;     //!< Frames per absolute frame, 0 or 1 = no deltas
+    bool have_prev;
+    uint8_t prev_mask;
+    uint32_t prev_seq;
+    uint32_t since_key;        //!< Delta frames since the last absolute one
+    int32_t prev[TELEM_FIELDS_MAX];
+} telem_enc_t;
+
+/**
+ * Decoder state
+ */
+typedef struct
+{
+    bool have_prev;
+    uint8_t prev_schema;
+    uint8_t prev_mask;
+    uint32_t prev_seq;
+    int32_t prev[TELEM_FIELDS_MAX];
+} telem_dec_t;
+
+/**
+ * Decoded frame
+ */
+typedef struct
+{
+    const telem_schema_t *schema;
+    uint8_t flags;
+    uint8_t mask;
+    int32_t raw[TELEM_FIELDS_MAX];   //!< Fixed point, value * 10^decimals
+    float value[TELEM_FIELDS_MAX];   //!< NaN when absent
+    uint32_t seq;
+    uint32_t age_ms;
+} telem_frame_t;
+
+/**
+ * @brief Look up a schema by id
+ *
+ * @return The schema or NULL
+ */
+const telem_schema_t *telem_schema_find(uint8_t id);
+
+/**
+ * @brief Initialize an encoder
+ *
+ * @param e Encoder
+ * @param schema Field layout, must stay valid
+ * @param key_interval Frames per absolute frame; 0 or 1 for absolute
+ *        frames only
+ * @return `ESP_OK` on success
+ */
+esp_err_t telem_enc_init(telem_enc_t *e, const telem_schema_t *schema, uint32_t key_interval);
+
+/**
+ * @brief Make the next frame an absolute one, e.g. when frames are sent
+ *        again from an earlier point
+ */
+void telem_enc_reset(telem_enc_t *e);
+
+/**
+ * @brief Encode one sample
+ *
+ * @param e Encoder
+ * @param values schema->n_fields readings; NaN for a missing one
+ * @param seq Sequence number, or NULL
+ * @param age_ms Age of the sample, or NULL
+ * @param buf Output, TELEM_FRAME_MAX bytes always suffice
+ * @param size Size of buf
+ * @param[out] len Frame length
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_SIZE` when buf is too small
+ */
+esp_err_t telem_encode(telem_enc_t *e, const float *values, const uint32_t *seq, const uint32_t *age_ms,
+                       uint8_t *buf, size_t size, size_t *len);
+
+/**
+ * @brief Initialize a decoder
+ */
+void telem_dec_init(telem_dec_t *d);
+
+/**
+ * @brief Decode one frame
+ *
+ * @param d Decoder of the sending stream
+ * @param buf Frame
+ * @param len Frame length
+ * @param[out] f Decoded frame
+ * @return `ESP_OK` on success, `ESP_ERR_NOT_SUPPORTED` for another
+ *         version or an unknown schema, `ESP_ERR_INVALID_SIZE` for a
+ *         truncated or overlong frame, `ESP_ERR_INVALID_STATE` for a delta
+ *         frame whose previous frame was not decoded last; f->flags and
+ *         f->seq are valid then, so a redelivered frame can be told apart
+ */
+esp_err_t telem_decode(telem_dec_t *d, const uint8_t *buf, size_t len, telem_frame_t *f);
+
+/**
+ * @brief Render a decoded frame as the JSON object the nodes used to send,
+ *        e.g. `{"co2": 412.50, "ch4": 3.10, "co": 1.25, "seq": 7}`
+ *
+ * Absent fields are left out.
+ *
+ * @param f Frame
+ * @param buf Output, NUL-terminated
+ * @param size Size of buf
+ * @param[out] len String length, optional
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_SIZE` when buf is too small
+ */
+esp_err_t telem_to_json(const telem_frame_t *f, char *buf, size_t size, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __TELEM_CODEC_H__ */
@@ -0,0 +1,207 @@
+/**
+ * @file thingspeak_batch.c
+ *
+ * Bounded buffer of ThingSpeak updates sent through the bulk-update API
+ */
+#include "thingspeak_batch.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "fixfmt.h"
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+esp_err_t ts_batch_init(ts_batch_t *b, const ts_batch_config_t *cfg, ts_batch_entry_t *ring, size_t cap)
+{
+    CHECK_ARG(b && cfg && cfg->api_key && ring && cap);
+    CHECK_ARG(strlen(cfg->api_key) <= TS_BATCH_KEY_MAX);
+    for (int i = 0; i < TS_BATCH_FIELDS; i++)
+        CHECK_ARG(cfg->decimals[i] <= 6);
+
+    memset(b, 0, sizeof(*b));
+    b->cfg = *cfg;
+    strcpy(b->api_key, cfg->api_key);
+    b->cfg.api_key = b->api_key;
+    if (!b->cfg.max_batch || b->cfg.max_batch > cap)
+        b->cfg.max_batch = cap;
+    if (b->cfg.max_batch > TS_BATCH_BULK_MAX)
+        b->cfg.max_batch = TS_BATCH_BULK_MAX;
+    b->ring = ring;
+    b->cap = cap;
+
+    return ESP_OK;
+}
+
+void ts_batch_add(ts_batch_t *b, const ts_batch_entry_t *e)
+{
+    if (b->count == b->cap)
+    {
+        b->head = (b->head + 1) % b->cap;
+        b->count--;
+        b->stats.dropped++;
+    }
+    b->ring[(b->head + b->count) % b->cap] = *e;
+    b->count++;
+    b->stats.added++;
+}
+
+void ts_batch_consume(ts_batch_t *b, size_t entries)
+{
+    if (entries > b->count)
+        entries = b->count;
+    b->head = (b->head + entries) % b->cap;
+    b->count -= entries;
+}
+
+esp_err_t ts_batch_encode(const ts_batch_t *b, char *buf, size_t size, size_t *len, size_t *entries)
+{
+    CHECK_ARG(b && buf && size && len && entries);
+
+    *len = *entries = 0;
+    buf[0] = 0;
+    if (!b->count)
+        return ESP_ERR_NOT_FOUND;
+
+    // The closing "]}" is reserved up front so that an entry that does not
+    // fit can simply be cut off at the previous one
+    const size_t tail = 2;
+    if (size <= tail)
+        return ESP_ERR_INVALID_SIZE;
+    fixfmt_t w;
+    fixfmt_init(&w, buf, size - tail);
+    fixfmt_str(&w, "{\"write_api_key\":");
+    fixfmt_json_str(&w, b->api_key);
+    fixfmt_str(&w, ",\"updates\":[");
+    if (w.overflow)
+        return ESP_ERR_INVALID_SIZE;
+
+    size_t n = b->count < b->cfg.max_batch ? b->count : b->cfg.max_batch;
+    size_t done = 0;
+    int64_t prev_us = ts_batch_at(b, 0)->time_us;
+    for (; done < n; done++)
+    {
+        const ts_batch_entry_t *e = ts_batch_at(b, done);
+        size_t mark = w.len;
+
+        // Whole milliseconds, formatted as fixed point so long gaps lose
+        // no precision to float rounding
+        int64_t delta_ms = (e->time_us - prev_us) / 1000;
+        if (delta_ms < 0)
+            delta_ms = 0;
+        fixfmt_str(&w, done ? ",{\"delta_t\":" : "{\"delta_t\":");
+        fixfmt_fixed(&w, delta_ms, 3);
+        for (int f = 0; f < TS_BATCH_FIELDS; f++)
+        {
+            if (!(e->mask & (1u << f)) || !isfinite(e->field[f]))
+                continue;
+            fixfmt_str(&w, ",\"field");
+            fixfmt_int(&w, f + 1);
+            fixfmt_str(&w, "\":");
+            fixfmt_float(&w, e->field[f], b->cfg.decimals[f]);
+        }
+        fixfmt_char(&w, '}');
+
+        if (w.overflow)
+        {
+            w.len = mark;
+            break;
+        }
+        prev_us = e->time_us;
+    }
+    if (!done)
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(buf + w.len, "]}", 3);
+    *len = w.len + tail;
+    *entries = done;
+
+    return ESP_OK;
+}
+
+// The newest entry as GET /update, the request a key without a channel
+// number allows
+static esp_err_t flush_single(ts_batch_t *b, http_uplink_t *u, char *buf, size_t size, size_t *sent)
+{
+    const ts_batch_entry_t *e = ts_batch_at(b, b->count - 1);
+    fixfmt_t w;
+    fixfmt_init(&w, buf, size);
+    fixfmt_str(&w, "/update?api_key=");
+    fixfmt_str(&w, b->api_key);
+    for (int f = 0; f < TS_BATCH_FIELDS; f++)
+    {
+        if (!(e->mask & (1u << f)) || !isfinite(e->field[f]))
+            continue;
+        fixfmt_str(&w, "&field");
+        fixfmt_int(&w, f + 1);
+        fixfmt_char(&w, '=');
+        fixfmt_float(&w, e->field[f], b->cfg.decimals[f]);
+    }
+    if (w.overflow)
+        return ESP_ERR_INVALID_SIZE;
+
+    char entry[16] = "";
+    http_uplink_request_t req = { .method = "GET", .path = buf };
+    http_uplink_response_t resp = { .body = entry, .body_size = sizeof(entry) };
+    esp_err_t err = http_uplink_request(u, &req, &resp);
+    if (err == ESP_OK && (resp.status != 200 || !strcmp(entry, "0")))
+        err = ESP_FAIL;
+    if (err != ESP_OK)
+    {
+        b->stats.failed++;
+        return err;
+    }
+
+    b->stats.superseded += b->count - 1;
+    ts_batch_consume(b, b->count);
+    b->stats.sent++;
+    b->stats.requests++;
+    if (sent)
+        *sent = 1;
+
+    return ESP_OK;
+}
+
+esp_err_t ts_batch_flush(ts_batch_t *b, http_uplink_t *u, char *buf, size_t size, size_t *sent)
+{
+    CHECK_ARG(b && u && buf && size);
+
+    if (sent)
+        *sent = 0;
+    if (!b->count)
+        return ESP_OK;
+    if (!b->cfg.channel_id)
+        return flush_single(b, u, buf, size, sent);
+    size_t len, entries;
+    esp_err_t err = ts_batch_encode(b, buf, size, &len, &entries);
+    if (err == ESP_ERR_NOT_FOUND)
+        return ESP_OK;
+    if (err != ESP_OK)
+        return err;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/channels/%lu/bulk_update.json", (unsigned long)b->cfg.channel_id);
+    http_uplink_request_t req = {
+        .method = "POST",
+        .path = path,
+        .content_type = "application/json",
+        .body = buf,
+        .body_len = len,
+    };
+    http_uplink_response_t resp = { 0 };
+    err = http_uplink_request(u, &req, &resp);
+    if (err == ESP_OK && resp.status != 200 && resp.status != 202)
+        err = ESP_FAIL;
+    if (err != ESP_OK)
+    {
+        b->stats.failed++;
+        return err;
+    }
+
+    ts_batch_consume(b, entries);
+    b->stats.sent += entries;
+    b->stats.requests++;
+    if (sent)
+        *sent = entries;
+
+    return ESP_OK;
+}
@@ -0,0 +1,187 @@
+/**
+ * @file thingspeak_batch.h
+ * @defgroup thingspeak_batch thingspeak_batch
+ * @{
+ *
+ * Buffers timestamped ThingSpeak updates and uploads them in one request
+ * through the bulk-update JSON endpoint
+ * (`POST /channels/<id>/bulk_update.json`).
+ *
+ * Entries go into a caller-provided ring of fixed size; when it is full
+ * the oldest entry is dropped and counted, so the memory footprint is
+ * bounded no matter how long the network is away. A flush encodes as
+ * many of the oldest entries as fit in the body buffer (at most
+ * max_batch), sends them and removes them only once the server has
+ * accepted them; after a failure they stay for the next flush. Delivery
+ * is at least once: a batch whose response was lost is sent again.
+ *
+ * Entries are stamped with the local monotonic clock and sent with
+ * relative timestamps: `delta_t` is the number of seconds since the
+ * previous entry of the same request (0 for the first one), so no wall
+ * clock is needed on the node.
+ *
+ * Without a channel_id the bulk endpoint cannot be used; a flush then
+ * sends only the newest entry as a single update (`GET /update`, which
+ * the write key alone allows) and drops the older ones, counted as
+ * superseded, as they have no way to carry their time.
+ *
+ * Not thread-safe; fill and flush from one task.
+ */
+#ifndef __THINGSPEAK_BATCH_H__
+#define __THINGSPEAK_BATCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "http_uplink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TS_BATCH_FIELDS       8    //!< ThingSpeak channels have field1..field8
+#define TS_BATCH_KEY_MAX      24   //!< Longest write API key
+#define TS_BATCH_BULK_MAX     960  //!< Most entries ThingSpeak takes per request
+#define TS_BATCH_ENTRY_MAX    (32 + TS_BATCH_FIELDS * 32) //!< Encoded entry bound for values below 1e12
+
+/**
+ * Body buffer size that always holds n entries
+ */
+#define TS_BATCH_BODY_SIZE(n) (64 + TS_BATCH_KEY_MAX + (n) * (TS_BATCH_ENTRY_MAX + 1))
+
+/**
+ * One update
+ */
+typedef struct
+{
+    int64_t time_us;                   //!< Monotonic sample time
+    uint8_t mask;                      //!< Bit i set: field i+1 is present
+    float field[TS_BATCH_FIELDS];      //!< field[0] is ThingSpeak's field1
+} ts_batch_entry_t;
+
+/**
+ * Channel and encoding
+ */
+typedef struct
+{
+    uint32_t channel_id;               //!< Channel number, 0 = single updates
+    const char *api_key;               //!< Channel write API key, copied
+    uint8_t decimals[TS_BATCH_FIELDS]; //!< Digits after the point per field
+    size_t max_batch;                  //!< Entries per request, 0 = ring size
+} ts_batch_config_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint32_t added;
+    uint32_t dropped;                  //!< Oldest entries overwritten while full
+    uint32_t sent;                     //!< Entries accepted by the server
+    uint32_t requests;                 //!< Requests accepted
+    uint32_t failed;                   //!< Flushes that sent nothing
+    uint32_t superseded;               //!< Older entries dropped by single updates
+} ts_batch_stats_t;
+
+/**
+ * Buffer state
+ */
+typedef struct
+{
+    ts_batch_config_t cfg;
+    char api_key[TS_BATCH_KEY_MAX + 1];
+    ts_batch_entry_t *ring;
+    size_t cap;
+    size_t head;                       //!< Oldest entry
+    size_t count;
+    ts_batch_stats_t stats;
+} ts_batch_t;
+
+/**
+ * @brief Initialize a batch buffer
+ *
+ * @param b Buffer
+ * @param cfg Channel and encoding, copied
+ * @param ring Storage for cap entries
+ * @param cap Ring capacity
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_ARG` for a missing key
+ */
+esp_err_t ts_batch_init(ts_batch_t *b, const ts_batch_config_t *cfg, ts_batch_entry_t *ring, size_t cap);
+
+/**
+ * @brief Append an entry, dropping the oldest one when the ring is full
+ *
+ * @param b Buffer
+ * @param e Entry, copied
+ */
+void ts_batch_add(ts_batch_t *b, const ts_batch_entry_t *e);
+
+/**
+ * @brief Number of buffered entries
+ */
+static inline size_t ts_batch_count(const ts_batch_t *b)
+{
+    return b->count;
+}
+
+/**
+ * @brief Buffered entry i, 0 being the oldest
+ */
+static inline const ts_batch_entry_t *ts_batch_at(const ts_batch_t *b, size_t i)
+{
+    return &b->ring[(b->head + i) % b->cap];
+}
+
+/**
+ * @brief Encode the oldest entries as a bulk-update JSON body
+ *
+ * Stops at max_batch entries or at the last entry that fits in buf.
+ * Fields that are not finite are left out, JSON has no NaN.
+ *
+ * @param b Buffer
+ * @param buf Output, NUL terminated
+ * @param size Size of buf
+ * @param[out] len Body length
+ * @param[out] entries Entries encoded
+ * @return `ESP_OK` on success, `ESP_ERR_NOT_FOUND` when the buffer is
+ *         empty, `ESP_ERR_INVALID_SIZE` when not even one entry fits
+ */
+esp_err_t ts_batch_encode(const ts_batch_t *b, char *buf, size_t size, size_t *len, size_t *entries);
+
+/**
+ * @brief Remove the oldest entries after they have been sent
+ *
+ * @param b Buffer
+ * @param entries Number of entries
+ */
+void ts_batch_consume(ts_batch_t *b, size_t entries);
+
+/**
+ * @brief Send the oldest entries in one bulk-update request
+ *
+ * Entries are removed when the server answers 200 or 202. A 429 or 5xx
+ * answer also puts the client into backoff, see http_uplink_request().
+ * Without a channel_id the newest entry goes as a single update instead;
+ * once the server answers with an entry id (not "0", which ThingSpeak
+ * sends e.g. within 15 s of the last update) every entry is removed.
+ *
+ * @param b Buffer
+ * @param u HTTP client connected to the ThingSpeak host
+ * @param buf Scratch buffer for the body or the single update's path,
+ *        see TS_BATCH_BODY_SIZE()
+ * @param size Size of buf
+ * @param[out] sent Entries accepted, 1 for a single update; may be NULL
+ * @return `ESP_OK` when accepted or nothing was buffered, `ESP_FAIL` when
+ *         the server refused the batch, otherwise the error of
+ *         http_uplink_request()
+ */
+esp_err_t ts_batch_flush(ts_batch_t *b, http_uplink_t *u, char *buf, size_t size, size_t *sent);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __THINGSPEAK_BATCH_H__ */
@@ -0,0 +1,160 @@
+/**
+ * @file wifi_mgr.c
+ *
+ * Station connection manager, portable core
+ */
+#include "wifi_mgr.h"
+#include <string.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_BACKOFF_MIN   1000
+#define DEFAULT_BACKOFF_MAX   60000
+#define DEFAULT_FAST_ATTEMPTS 2
+
+esp_err_t wifi_mgr_init(wifi_mgr_t *m, const wifi_mgr_config_t *cfg, const wifi_mgr_cache_t *cache, int64_t now_ms)
+{
+    CHECK_ARG(m && cfg);
+
+    memset(m, 0, sizeof(*m));
+    m->cfg = *cfg;
+    if (!m->cfg.backoff_min_ms)
+        m->cfg.backoff_min_ms = DEFAULT_BACKOFF_MIN;
+    if (m->cfg.backoff_max_ms < m->cfg.backoff_min_ms)
+        m->cfg.backoff_max_ms = m->cfg.backoff_min_ms > DEFAULT_BACKOFF_MAX ? m->cfg.backoff_min_ms : DEFAULT_BACKOFF_MAX;
+    if (!m->cfg.fast_attempts)
+        m->cfg.fast_attempts = DEFAULT_FAST_ATTEMPTS;
+
+    if (cache && cache->version == WIFI_MGR_CACHE_VERSION)
+        m->cache = *cache;
+    m->cache.version = WIFI_MGR_CACHE_VERSION;
+    m->state = WIFI_MGR_IDLE;
+    m->retry_at_ms = now_ms;
+    m->offline_since_ms = now_ms;
+
+    return ESP_OK;
+}
+
+wifi_mgr_action_t wifi_mgr_next(wifi_mgr_t *m, int64_t now_ms)
+{
+    if (m->state != WIFI_MGR_IDLE || now_ms < m->retry_at_ms)
+        return WIFI_MGR_WAIT;
+
+    m->attempt_fast = m->cache.ap_valid && m->fast_failed < m->cfg.fast_attempts;
+    m->attempt_static = m->attempt_fast && m->cfg.reuse_ip && m->cache.ip_valid;
+    m->attempt_ms = now_ms;
+    m->state = WIFI_MGR_ASSOCIATING;
+    if (m->attempt_fast)
+        m->stats.fast_attempts++;
+    else
+        m->stats.full_attempts++;
+    if (m->attempt_static)
+        m->stats.static_ip++;
+
+    return m->attempt_fast ? WIFI_MGR_CONNECT_FAST : WIFI_MGR_CONNECT_FULL;
+}
+
+uint32_t wifi_mgr_wait_ms(const wifi_mgr_t *m, int64_t now_ms)
+{
+    if (m->state != WIFI_MGR_IDLE)
+        return UINT32_MAX;
+    return m->retry_at_ms > now_ms ? (uint32_t)(m->retry_at_ms - now_ms) : 0;
+}
+
+void wifi_mgr_associated(wifi_mgr_t *m, const uint8_t bssid[6], uint8_t channel, int64_t now_ms)
+{
+    uint32_t ms = now_ms - m->attempt_ms;
+    m->stats.assoc_last_ms = ms;
+    if (!m->stats.assoc_count || ms < m->stats.assoc_min_ms)
+        m->stats.assoc_min_ms = ms;
+    if (ms > m->stats.assoc_max_ms)
+        m->stats.assoc_max_ms = ms;
+    m->stats.assoc_count++;
+    m->stats.assoc_sum_ms += ms;
+
+    if (!m->cache.ap_valid || m->cache.channel != channel || memcmp(m->cache.bssid, bssid, 6))
+    {
+        // Another AP may be another network; its address comes from DHCP
+        if (m->cache.ap_valid && memcmp(m->cache.bssid, bssid, 6))
+            m->cache.ip_valid = false;
+        m->cache.ap_valid = true;
+        m->cache.channel = channel;
+        memcpy(m->cache.bssid, bssid, 6);
+        m->cache_dirty = true;
+    }
+    m->assoc_ms = now_ms;
+    m->state = WIFI_MGR_ASSOCIATED;
+}
+
+void wifi_mgr_got_ip(wifi_mgr_t *m, uint32_t ip, uint32_t netmask, uint32_t gw, uint32_t dns, bool from_dhcp,
+                     int64_t now_ms)
+{
+    m->stats.ip_last_ms = now_ms - m->assoc_ms;
+    m->stats.offline_ms = now_ms - m->offline_since_ms;
+    m->backoff_ms = 0;
+    m->fast_failed = 0;
+    m->state = WIFI_MGR_ONLINE;
+
+    if (from_dhcp)
+    {
+        if (!m->cache.ip_valid || m->cache.ip != ip || m->cache.netmask != netmask || m->cache.gw != gw ||
+            m->cache.dns != dns)
+        {
+            m->cache.ip_valid = true;
+            m->cache.ip = ip;
+            m->cache.netmask = netmask;
+            m->cache.gw = gw;
+            m->cache.dns = dns;
+            m->cache_dirty = true;
+        }
+    }
+}
+
+void wifi_mgr_disconnected(wifi_mgr_t *m, int64_t now_ms)
+{
+    switch (m->state)
+    {
+        case WIFI_MGR_IDLE:
+            return;
+        case WIFI_MGR_ONLINE:
+            // Lost the link: try again at once, fast if the AP is known
+            m->stats.drops++;
+            m->offline_since_ms = now_ms;
+            m->retry_at_ms = now_ms;
+            break;
+        case WIFI_MGR_ASSOCIATING:
+        case WIFI_MGR_ASSOCIATED:
+            // An attempt that ends before an address counts as failed, so
+            // an AP that accepts and then drops the station is not retried
+            // in a tight loop
+            if (m->attempt_fast)
+            {
+                // Not worth a wait: the next attempt is fast again or,
+                // once fast_attempts have failed, a full scan
+                m->stats.fast_failures++;
+                m->fast_failed++;
+                m->retry_at_ms = now_ms;
+                break;
+            }
+            m->stats.failures++;
+            m->fast_failed = 0;
+            if (!m->backoff_ms)
+                m->backoff_ms = m->cfg.backoff_min_ms;
+            else if (m->backoff_ms < m->cfg.backoff_max_ms / 2)
+                m->backoff_ms *= 2;
+            else
+                m->backoff_ms = m->cfg.backoff_max_ms;
+            m->retry_at_ms = now_ms + m->backoff_ms;
+            break;
+    }
+    m->state = WIFI_MGR_IDLE;
+}
+
+bool wifi_mgr_take_cache(wifi_mgr_t *m, wifi_mgr_cache_t *cache)
+{
+    if (!m->cache_dirty)
+        return false;
+    *cache = m->cache;
+    m->cache_dirty = false;
+    return true;
+}
@@ -0,0 +1,259 @@
+/**
+ * @file wifi_mgr.h
+ * @defgroup wifi_mgr wifi_mgr
+ * @{
+ *
+ * Station connection manager: reconnects after every disconnect, backs
+ * off exponentially while the AP stays away and reconnects fast to the
+ * AP it was last associated with.
+ *
+ * The BSSID and channel of the last association, and the address of the
+ * last DHCP lease, are kept in a small cache that the ESP glue persists
+ * in NVS. With a valid cache an attempt skips the all-channel scan and
+ * joins that BSSID on that channel directly (fast attempt); optionally
+ * the cached address is configured statically so no DHCP exchange is
+ * needed either. After fast_attempts fast attempts in a row have failed
+ * the next one scans all channels (full attempt) straight away, so a
+ * moved or replaced AP costs a few short attempts and no backoff. Only
+ * full attempts back off; the wait doubles from backoff_min_ms up to
+ * backoff_max_ms and is reset once an address has been obtained. Every
+ * round after a wait starts with fast attempts again, so the AP is found
+ * quickly when it comes back after an outage.
+ *
+ * Reuse the cached address only where the DHCP server reserves it for
+ * the node: a static address is not renewed and may collide with another
+ * device once the lease has been handed out again. Associating with a
+ * different AP drops the cached address until DHCP hands out one there.
+ *
+ * The core below is portable and driven by the caller's clock; the ESP
+ * part runs it from the default event loop and reports association time
+ * (connect call to association) and time to an address per attempt.
+ */
+#ifndef __WIFI_MGR_H__
+#define __WIFI_MGR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WIFI_MGR_CACHE_VERSION 1
+
+/**
+ * What to remember of the last association, IPv4 addresses in network
+ * byte order
+ */
+typedef struct
+{
+    uint8_t version;
+    bool ap_valid;
+    bool ip_valid;
+    uint8_t channel;
+    uint8_t bssid[6];
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+} wifi_mgr_cache_t;
+
+/**
+ * Configuration
+ */
+typedef struct
+{
+    uint32_t backoff_min_ms;   //!< First wait after a failed full attempt, 0 = 1 s
+    uint32_t backoff_max_ms;   //!< Upper bound of the doubling wait, 0 = 60 s
+    uint32_t fast_attempts;    //!< Fast attempts before a full one, 0 = 2
+    bool reuse_ip;             //!< Configure the cached address statically on fast attempts
+} wifi_mgr_config_t;
+
+/**
+ * Connection state
+ */
+typedef enum
+{
+    WIFI_MGR_IDLE = 0,         //!< Waiting for the next attempt
+    WIFI_MGR_ASSOCIATING,
+    WIFI_MGR_ASSOCIATED,       //!< Waiting for an address
+    WIFI_MGR_ONLINE,
+} wifi_mgr_state_t;
+
+/**
+ * What the caller has to do now
+ */
+typedef enum
+{
+    WIFI_MGR_WAIT = 0,
+    WIFI_MGR_CONNECT_FAST,     //!< Join the cached BSSID on the cached channel
+    WIFI_MGR_CONNECT_FULL,     //!< Scan all channels for the SSID
+} wifi_mgr_action_t;
+
+/**
+ * Counters and timings, in milliseconds
+ */
+typedef struct
+{
+    uint32_t fast_attempts;
+    uint32_t full_attempts;
+    uint32_t fast_failures;    //!< Fast attempts that ended before an address
+    uint32_t failures;         //!< Full attempts that ended before an address
+    uint32_t drops;            //!< Disconnects while online
+    uint32_t static_ip;        //!< Times the cached address was used
+    uint32_t assoc_last_ms;    //!< Association time of the last attempt
+    uint32_t assoc_min_ms;
+    uint32_t assoc_max_ms;
+    uint32_t assoc_count;
+    uint64_t assoc_sum_ms;     //!< For the mean, with assoc_count
+    uint32_t ip_last_ms;       //!< Association to address, last attempt
+    uint32_t offline_ms;       //!< Time from the last drop (or start) to the last address
+} wifi_mgr_stats_t;
+
+/**
+ * Manager state
+ */
+typedef struct
+{
+    wifi_mgr_config_t cfg;
+    wifi_mgr_state_t state;
+    wifi_mgr_cache_t cache;
+    bool cache_dirty;          //!< Changed since taken by wifi_mgr_take_cache()
+    bool attempt_fast;
+    bool attempt_static;
+    uint32_t fast_failed;      //!< Fast attempts failed in a row
+    uint32_t backoff_ms;
+    int64_t retry_at_ms;
+    int64_t attempt_ms;        //!< Start of the current attempt
+    int64_t assoc_ms;          //!< Association of the current attempt
+    int64_t offline_since_ms;
+    wifi_mgr_stats_t stats;
+} wifi_mgr_t;
+
+/**
+ * @brief Initialize a manager; the first attempt is due at once
+ *
+ * @param m Manager
+ * @param cfg Configuration, copied
+ * @param cache Persisted cache or NULL; ignored unless its version matches
+ * @param now_ms Current time
+ * @return `ESP_OK` on success
+ */
+esp_err_t wifi_mgr_init(wifi_mgr_t *m, const wifi_mgr_config_t *cfg, const wifi_mgr_cache_t *cache, int64_t now_ms);
+
+/**
+ * @brief Start the next attempt if one is due
+ *
+ * @param m Manager
+ * @param now_ms Current time
+ * @return The attempt to make, or WIFI_MGR_WAIT
+ */
+wifi_mgr_action_t wifi_mgr_next(wifi_mgr_t *m, int64_t now_ms);
+
+/**
+ * @brief Milliseconds until wifi_mgr_next() starts an attempt
+ *
+ * @return 0 when one is due, UINT32_MAX while an attempt or connection
+ *         is in progress
+ */
+uint32_t wifi_mgr_wait_ms(const wifi_mgr_t *m, int64_t now_ms);
+
+/**
+ * @brief Whether the current fast attempt uses the cached address
+ */
+static inline bool wifi_mgr_static_ip(const wifi_mgr_t *m)
+{
+    return m->attempt_static;
+}
+
+/**
+ * @brief Record the association with an AP
+ *
+ * @param m Manager
+ * @param bssid AP the station associated with
+ * @param channel Its channel
+ * @param now_ms Current time
+ */
+void wifi_mgr_associated(wifi_mgr_t *m, const uint8_t bssid[6], uint8_t channel, int64_t now_ms);
+
+/**
+ * @brief Record the address obtained, from DHCP or the static setting
+ *
+ * @param m Manager
+ * @param ip Address, netmask, gateway and DNS server in network byte order
+ * @param from_dhcp false when the cached address was configured
+ * @param now_ms Current time
+ */
+void wifi_mgr_got_ip(wifi_mgr_t *m, uint32_t ip, uint32_t netmask, uint32_t gw, uint32_t dns, bool from_dhcp,
+                     int64_t now_ms);
+
+/**
+ * @brief Record a disconnect or a failed attempt
+ *
+ * @param m Manager
+ * @param now_ms Current time
+ */
+void wifi_mgr_disconnected(wifi_mgr_t *m, int64_t now_ms);
+
+/**
+ * @brief Take the cache for saving if it changed
+ *
+ * @param m Manager
+ * @param[out] cache Copy of the cache
+ * @return true when it changed since the last call
+ */
+bool wifi_mgr_take_cache(wifi_mgr_t *m, wifi_mgr_cache_t *cache);
+
+#ifdef ESP_PLATFORM
+
+/**
+ * Station settings for wifi_mgr_esp_start()
+ */
+typedef struct
+{
+    const char *ssid;
+    const char *password;
+    int auth_threshold;        //!< wifi_auth_mode_t, 0 = any
+    wifi_mgr_config_t mgr;
+} wifi_mgr_esp_config_t;
+
+/**
+ * @brief Bring up the station and keep it connected
+ *
+ * Initializes netif, the default event loop and the Wi-Fi driver, loads
+ * the cache from NVS (nvs_flash_init() must have been called) and starts
+ * the first attempt. All state changes run in the default event loop.
+ *
+ * @param cfg Station settings, copied
+ * @return `ESP_OK` on success
+ */
+esp_err_t wifi_mgr_esp_start(const wifi_mgr_esp_config_t *cfg);
+
+/**
+ * @brief Whether the station has an address
+ */
+bool wifi_mgr_esp_online(void);
+
+/**
+ * @brief Copy of the counters
+ */
+void wifi_mgr_esp_stats(wifi_mgr_stats_t *stats);
+
+/**
+ * @brief Log the counters and timings
+ *
+ * @param tag Log tag
+ */
+void wifi_mgr_esp_log_stats(const char *tag);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __WIFI_MGR_H__ */
@@ -0,0 +1,316 @@
+/**
+ * @file wifi_mgr_esp.c
+ *
+ * wifi_mgr on the ESP-IDF Wi-Fi driver, with the cache in NVS
+ */
+#include "wifi_mgr.h"
+#include <string.h>
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <nvs.h>
+
+#define CHECK(x) do { esp_err_t __; if ((__ = x) != ESP_OK) return __; } while (0)
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define NVS_NAMESPACE "wifi_mgr"
+#define NVS_KEY       "cache"
+
+// Posted by the retry timer so that attempts, like every other state
+// change, are made from the default event loop
+ESP_EVENT_DEFINE_BASE(WIFI_MGR_EVENT);
+#define WIFI_MGR_EVENT_RETRY 0
+
+static const char *TAG = "wifi_mgr";
+
+static wifi_mgr_t mgr;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;   // Readers in other tasks
+static wifi_config_t sta_config;
+static esp_netif_t *netif;
+static esp_timer_handle_t retry_timer;
+static bool started;
+
+static int64_t now_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+static esp_err_t cache_load(wifi_mgr_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    size_t len = sizeof(*cache);
+    err = nvs_get_blob(nvs, NVS_KEY, cache, &len);
+    nvs_close(nvs);
+
+    if (err != ESP_OK)
+        return err;
+    if (len != sizeof(*cache) || cache->version != WIFI_MGR_CACHE_VERSION)
+    {
+        ESP_LOGW(TAG, "Ignoring stale connection cache");
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t cache_save(const wifi_mgr_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(nvs, NVS_KEY, cache, sizeof(*cache));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    return err;
+}
+
+static void set_static_ip(const wifi_mgr_cache_t *cache)
+{
+    esp_err_t err = esp_netif_dhcpc_stop(netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED)
+        ESP_LOGW(TAG, "Stopping DHCP failed: %s", esp_err_to_name(err));
+
+    esp_netif_ip_info_t ip = {
+        .ip.addr = cache->ip,
+        .netmask.addr = cache->netmask,
+        .gw.addr = cache->gw,
+    };
+    err = esp_netif_set_ip_info(netif, &ip);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Setting the address failed: %s", esp_err_to_name(err));
+
+    if (cache->dns)
+    {
+        esp_netif_dns_info_t dns = { .ip.type = ESP_IPADDR_TYPE_V4, .ip.u_addr.ip4.addr = cache->dns };
+        esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+}
+
+static void use_dhcp(void)
+{
+    esp_err_t err = esp_netif_dhcpc_start(netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED)
+        ESP_LOGW(TAG, "Starting DHCP failed: %s", esp_err_to_name(err));
+}
+
+// Starts the next attempt if one is due, or arms the timer for it
+static void attempt(void)
+{
+    wifi_mgr_cache_t cache;
+    bool use_static;
+
+    portENTER_CRITICAL(&lock);
+    int64_t now = now_ms();
+    wifi_mgr_action_t action = wifi_mgr_next(&mgr, now);
+    uint32_t wait = wifi_mgr_wait_ms(&mgr, now);
+    use_static = wifi_mgr_static_ip(&mgr);
+    cache = mgr.cache;
+    portEXIT_CRITICAL(&lock);
+
+    if (action == WIFI_MGR_WAIT)
+    {
+        if (wait != UINT32_MAX)
+        {
+            ESP_LOGI(TAG, "Next attempt in %" PRIu32 " ms", wait);
+            esp_timer_stop(retry_timer);
+            esp_timer_start_once(retry_timer, (uint64_t)wait * 1000);
+        }
+        return;
+    }
+
+    wifi_sta_config_t *sta = &sta_config.sta;
+    if (action == WIFI_MGR_CONNECT_FAST)
+    {
+        sta->scan_method = WIFI_FAST_SCAN;
+        sta->bssid_set = true;
+        memcpy(sta->bssid, cache.bssid, sizeof(sta->bssid));
+        sta->channel = cache.channel;
+        ESP_LOGI(TAG, "Fast attempt: " MACSTR " on channel %u%s", MAC2STR(cache.bssid), cache.channel,
+                 use_static ? ", cached address" : "");
+    }
+    else
+    {
+        sta->scan_method = WIFI_ALL_CHANNEL_SCAN;
+        sta->sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+        sta->bssid_set = false;
+        sta->channel = 0;
+        ESP_LOGI(TAG, "Full attempt: scanning all channels");
+    }
+
+    if (use_static)
+        set_static_ip(&cache);
+    else
+        use_dhcp();
+
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+    if (err == ESP_OK)
+        err = esp_wifi_connect();
+    if (err != ESP_OK)
+    {
+        // Counts as a failed attempt, so the retry backs off
+        ESP_LOGW(TAG, "Connect failed: %s", esp_err_to_name(err));
+        portENTER_CRITICAL(&lock);
+        wifi_mgr_disconnected(&mgr, now_ms());
+        portEXIT_CRITICAL(&lock);
+        attempt();
+    }
+}
+
+static void on_wifi_event(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    switch (id)
+    {
+        case WIFI_EVENT_STA_START:
+            attempt();
+            break;
+        case WIFI_EVENT_STA_CONNECTED:
+        {
+            const wifi_event_sta_connected_t *ev = data;
+            portENTER_CRITICAL(&lock);
+            wifi_mgr_associated(&mgr, ev->bssid, ev->channel, now_ms());
+            bool fast = mgr.attempt_fast;
+            uint32_t ms = mgr.stats.assoc_last_ms;
+            portEXIT_CRITICAL(&lock);
+            ESP_LOGI(TAG, "Associated with " MACSTR " on channel %u in %" PRIu32 " ms (%s)", MAC2STR(ev->bssid),
+                     ev->channel, ms, fast ? "fast" : "full");
+            break;
+        }
+        case WIFI_EVENT_STA_DISCONNECTED:
+        {
+            const wifi_event_sta_disconnected_t *ev = data;
+            portENTER_CRITICAL(&lock);
+            bool online = mgr.state == WIFI_MGR_ONLINE;
+            wifi_mgr_disconnected(&mgr, now_ms());
+            portEXIT_CRITICAL(&lock);
+            ESP_LOGW(TAG, "%s, reason %u", online ? "Connection lost" : "Attempt failed", ev->reason);
+            attempt();
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void on_got_ip(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    const ip_event_got_ip_t *ev = data;
+    esp_netif_dns_info_t dns = { 0 };
+    esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+
+    wifi_mgr_cache_t cache;
+    portENTER_CRITICAL(&lock);
+    bool from_dhcp = !wifi_mgr_static_ip(&mgr);
+    wifi_mgr_got_ip(&mgr, ev->ip_info.ip.addr, ev->ip_info.netmask.addr, ev->ip_info.gw.addr,
+                    dns.ip.type == ESP_IPADDR_TYPE_V4 ? dns.ip.u_addr.ip4.addr : 0, from_dhcp, now_ms());
+    wifi_mgr_stats_t st = mgr.stats;
+    bool changed = wifi_mgr_take_cache(&mgr, &cache);
+    portEXIT_CRITICAL(&lock);
+
+    ESP_LOGI(TAG, "Address " IPSTR " (%s) %" PRIu32 " ms after association, offline for %" PRIu32 " ms",
+             IP2STR(&ev->ip_info.ip), from_dhcp ? "DHCP" : "cached", st.ip_last_ms, st.offline_ms);
+
+    if (changed)
+    {
+        esp_err_t err = cache_save(&cache);
+        if (err != ESP_OK)
+            ESP_LOGW(TAG, "Saving the connection cache failed: %s", esp_err_to_name(err));
+    }
+}
+
+static void on_retry(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    attempt();
+}
+
+static void retry_timer_cb(void *arg)
+{
+    esp_event_post(WIFI_MGR_EVENT, WIFI_MGR_EVENT_RETRY, NULL, 0, 0);
+}
+
+esp_err_t wifi_mgr_esp_start(const wifi_mgr_esp_config_t *cfg)
+{
+    CHECK_ARG(cfg && cfg->ssid);
+    if (started)
+        return ESP_ERR_INVALID_STATE;
+
+    wifi_mgr_cache_t cache;
+    bool cached = cache_load(&cache) == ESP_OK;
+    CHECK(wifi_mgr_init(&mgr, &cfg->mgr, cached ? &cache : NULL, now_ms()));
+    if (cached && cache.ap_valid)
+        ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %u", MAC2STR(cache.bssid), cache.channel);
+
+    memset(&sta_config, 0, sizeof(sta_config));
+    // Both fields may be used in full, without a terminating NUL
+    memcpy(sta_config.sta.ssid, cfg->ssid, strnlen(cfg->ssid, sizeof(sta_config.sta.ssid)));
+    if (cfg->password)
+        memcpy(sta_config.sta.password, cfg->password, strnlen(cfg->password, sizeof(sta_config.sta.password)));
+    sta_config.sta.threshold.authmode = cfg->auth_threshold;
+
+    CHECK(esp_netif_init());
+    esp_err_t err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+        return err;
+    netif = esp_netif_create_default_wifi_sta();
+    if (!netif)
+        return ESP_FAIL;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = retry_timer_cb,
+        .name = "wifi_mgr",
+    };
+    CHECK(esp_timer_create(&timer_args, &retry_timer));
+
+    CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, on_wifi_event, NULL));
+    CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, on_got_ip, NULL));
+    CHECK(esp_event_handler_register(WIFI_MGR_EVENT, WIFI_MGR_EVENT_RETRY, on_retry, NULL));
+
+    wifi_init_config_t init = WIFI_INIT_CONFIG_DEFAULT();
+    CHECK(esp_wifi_init(&init));
+    CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+    // The first attempt is made on WIFI_EVENT_STA_START
+    CHECK(esp_wifi_start());
+
+    started = true;
+    return ESP_OK;
+}
+
+bool wifi_mgr_esp_online(void)
+{
+    portENTER_CRITICAL(&lock);
+    bool online = mgr.state == WIFI_MGR_ONLINE;
+    portEXIT_CRITICAL(&lock);
+    return online;
+}
+
+void wifi_mgr_esp_stats(wifi_mgr_stats_t *stats)
+{
+    portENTER_CRITICAL(&lock);
+    *stats = mgr.stats;
+    portEXIT_CRITICAL(&lock);
+}
+
+void wifi_mgr_esp_log_stats(const char *tag)
+{
+    wifi_mgr_stats_t st;
+    wifi_mgr_esp_stats(&st);
+
+    ESP_LOGI(tag, "Wi-Fi: %s, %" PRIu32 " fast (%" PRIu32 " failed, %" PRIu32 " cached address) / %" PRIu32
+             " full (%" PRIu32 " failed) attempts, %" PRIu32 " drops, association last %" PRIu32 " min %" PRIu32
+             " avg %" PRIu32 " max %" PRIu32 " ms, address %" PRIu32 " ms, last outage %" PRIu32 " ms",
+             wifi_mgr_esp_online() ? "online" : "offline", st.fast_attempts, st.fast_failures, st.static_ip,
+             st.full_attempts, st.failures, st.drops, st.assoc_last_ms, st.assoc_min_ms,
+             (uint32_t)(st.assoc_count ? st.assoc_sum_ms / st.assoc_count : 0), st.assoc_max_ms, st.ip_last_ms,
+             st.offline_ms);
+}
@@ -1,20 +1,36 @@
 #include <stdio.h>
+#include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/gpio.h"
-#include "driver/adc.h"
 #include "esp_log.h"
 #include "esp_err.h"
-#include "esp_wifi.h"
 #include "esp_event.h"
-#include "esp_netif.h"
-#include "esp_http_client.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "bmp180.h"
 #include "ssd1306.h"
 #include "i2cdev.h"
+#include "adc_stream.h"
+#include "mq_calib.h"
+#include "gas_baseline.h"
+#include "gas_cusum.h"
+#include "gpio_events.h"
+#include "http_uplink.h"
+#include "thingspeak_batch.h"
+#include "flash_log.h"
+#include "periodic_sched.h"
+#include "sensor_hub.h"
+#include "fixfmt.h"
+#include "status_screen.h"
+#include "wifi_mgr.h"
+#include "boot_graph.h"
+#include "prom_metrics.h"
+#include "live_stream.h"
 
 // === CONFIG ===
 #define SDA_GPIO        21
@@ -25,157 +41,937 @@
 #define RED_LED_GPIO    25
 #define GREEN_LED_GPIO  26
 #define BUTTON_GPIO     27
-#define MQ_ADC_CHANNEL  ADC1_CHANNEL_6 // GPIO34
+#define MQ_ADC_CHANNEL  ADC_CHANNEL_6 // GPIO34
+
+// Continuous ADC: 20 kHz conversions averaged down to 20 readings/s
+#define ADC_SAMPLE_HZ   20000
+#define GAS_OUTPUT_HZ   20
 
 #define WIFI_SSID       "Yahyas_iphone"
 #define WIFI_PASS       "yahya2004"
 #define THINGSPEAK_KEY  "CCXDKK2LLFZ13JHK"
-
-#define CALIBRATION_SAMPLES 100
-#define GAS_DELTA           300
+#define THINGSPEAK_CHANNEL_ID   0   // channel of THINGSPEAK_KEY; 0 = one /update per flush, newest frame only
+
+#define CALIBRATION_SAMPLES 100     // gas frames, 5 s at GAS_OUTPUT_HZ
+#define BASELINE_NVS_KEY    "mq135_base"
+
+// Baseline tracking on every gas frame: follow drift up over ~3.4 min,
+// recover downwards in ~3 s, hold during events for at most 10 min
+#define BASELINE_SHIFT_UP   12
+#define BASELINE_SHIFT_DOWN 6
+#define BASELINE_HOLD_LIMIT (GAS_OUTPUT_HZ * 600)
+#define BASELINE_SAVE_MS    (10 * 60 * 1000)
+
+// CUSUM gas detector on every gas frame: drift allowance 1 sigma, threshold
+// 10 sigma (a 3 sigma step alarms after ~5 frames, 250 ms); noise learned
+// over ~256 frames starting from 8 counts
+#define CUSUM_K_Q8          256
+#define CUSUM_H_Q8          2560
+#define CUSUM_NOISE_SHIFT   8
+#define CUSUM_MIN_SIGMA     2
+#define CUSUM_INIT_SIGMA    8
+
+#define OLED_WIDTH      128
+#define OLED_HEIGHT     64
+
+// Task graph: acquisition -> processing -> { display, uplink }. Sampling
+// and alerting run on core 1 next to adc_stream (priority 10); display and
+// uplink run below them on core 0 with the Wi-Fi stack
+
+// Acquisition jobs run on absolute deadlines, each sensor at its own
+// rate; the frame job is phased after both so it never waits behind a
+// BMP180 conversion and always sees fresh values
+#define BMP_PERIOD_US       2000000
+#define GAS_PERIOD_US       1000000
+#define GAS_PHASE_US        250000
+#define SAMPLE_PERIOD_US    1000000
+#define SAMPLE_PHASE_US     500000
+#define SCHED_STATS_US      (10 * 60 * 1000000)
+#define UPLINK_TIMEOUT_MS   5000
+
+// Every frame is buffered and sent in bulk: when UPLINK_BATCH entries are
+// waiting, UPLINK_FLUSH_MS after the last upload (ThingSpeak takes one
+// bulk update per 15 s) or right away for an alert. The first frame after
+// boot goes out as soon as Wi-Fi is up; if that attempt fails the frames
+// wait for the normal interval. Without a backlog
+// partition the ring holds two minutes of frames while the network is
+// away, then drops the oldest
+#define UPLINK_BATCH        15
+#define UPLINK_FLUSH_MS     15000
+#define UPLINK_RING_LEN     120
+
+// While uploads fail, buffered frames move to a log on the "telemetry"
+// partition (256 KB, about 3 h of frames) instead of being dropped. Once
+// the network is back the backlog goes out oldest first, REPLAY_BATCH
+// frames per flush interval, with new frames queued behind it; a batch
+// that does not fit UPLINK_BODY_SIZE is sent in parts
+#define BACKLOG_PARTITION   "telemetry"
+#define REPLAY_BATCH        40
+#define UPLINK_BODY_SIZE    4096
+
+// One keep-alive connection carries every update; after a failure the
+// next attempts wait 1 s doubling up to a minute. The address is looked
+// up again hourly and the connection is dropped after a minute idle,
+// before the server times it out
+#define THINGSPEAK_HOST     "api.thingspeak.com"
+#define UPLINK_BACKOFF_MIN_MS   1000
+#define UPLINK_BACKOFF_MAX_MS   60000
+#define UPLINK_DNS_TTL_MS       (60 * 60 * 1000)
+#define UPLINK_IDLE_CLOSE_MS    60000
+
+// Prometheus metrics at http://<node>/metrics: sensor values, job and
+// stage timings, I2C and uplink counters, heap and task stacks
+#define METRICS_PORT        80
+
+// Every gas frame as Server-Sent Events at http://<node>:8080/stream,
+// ?every=N for every Nth. The server task runs below everything else on
+// core 0; the adc_stream callback only copies the frame into a ring
+#define STREAM_PORT         8080
+#define STREAM_TASK_PRIO    2
+#define STREAM_TASK_CORE    0
+
+#define ACQ_TASK_PRIO       8
+#define PROC_TASK_PRIO      9
+#define DISPLAY_TASK_PRIO   4
+#define UPLINK_TASK_PRIO    3
+#define ACQ_TASK_CORE       1
+#define PROC_TASK_CORE      1
+#define DISPLAY_TASK_CORE   0
+#define UPLINK_TASK_CORE    0
+
+#define SAMPLE_QUEUE_LEN    4
+#define EVENT_QUEUE_LEN     16      // GPIO edges
+#define GAS_QUEUE_LEN       4       // CUSUM onsets
+
+// Button presses are reported on the falling edge, further edges within
+// the debounce window are ignored. A PIR pulse keeps motion active for a
+// while after its falling edge so short pulses still pair with gas
+#define BUTTON_DEBOUNCE_US  50000
+#define MOTION_HOLD_US      5000000
+#define UPLINK_QUEUE_LEN    16      // frames arriving during one upload
 
 static const char *TAG = "SMART_NODE";
 
-int gas_baseline = 0;
+static uint8_t oled_fb[SSD1306_FB_SIZE(OLED_WIDTH, OLED_HEIGHT)];
+static ssd1306_t oled;
+static bmp180_dev_t bmp;
+
+// One acquisition pass, filled in by the stages it flows through
+typedef struct {
+    TickType_t tick;
+    uint32_t seq;
+    float temp;
+    uint32_t pressure;
+    int gas;
+    bool motion;      // set by processing from PIR events
+    bool alert;       // set by processing
+    bool raised;      // alert raised by this frame
+} sample_frame_t;
+
+static QueueHandle_t sample_queue;   // acquisition -> processing
+static QueueHandle_t display_queue;  // processing -> display, latest only
+static QueueHandle_t uplink_queue;   // processing -> uplink
+static QueueHandle_t event_queue;    // GPIO ISR -> processing
+static QueueHandle_t gas_queue;      // adc_stream -> processing, onset time
+static QueueSetHandle_t proc_set;
+static volatile uint32_t max_reaction_us;
+static volatile uint32_t sample_drops;
+static volatile uint32_t uplink_drops;
+
+// Time spent per frame in each stage after acquisition, written by the
+// stage's task and read by the metrics server
+typedef struct {
+    const char *name;
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+} stage_time_t;
+
+enum { STAGE_PROCESSING, STAGE_DISPLAY, STAGE_UPLOAD, STAGE_COUNT };
+static stage_time_t stage_times[STAGE_COUNT] = {
+    [STAGE_PROCESSING] = { "processing" },
+    [STAGE_DISPLAY] = { "display" },
+    [STAGE_UPLOAD] = { "upload" },
+};
+
+static void stage_done(int stage, int64_t start_us) {
+    stage_time_t *st = &stage_times[stage];
+    uint32_t us = esp_timer_get_time() - start_us;
+    st->count++;
+    st->sum_us += us;
+    if (us > st->max_us)
+        st->max_us = us;
+}
 
-void calibrate_mq135() {
-    printf("Calibrating MQ135...\n");
-    int total = 0;
-    for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
-        total += adc1_get_raw(MQ_ADC_CHANNEL);
-        vTaskDelay(pdMS_TO_TICKS(50));
+static gas_baseline_t baseline;
+static gas_cusum_t cusum;
+static volatile bool baseline_tracking = false;
+static volatile bool gas_alarm = false;          // CUSUM state, every frame
+static volatile int alert = 0;
+
+static adc_stream_t *gas_stream;
+static live_stream_t live;
+static volatile bool stream_ready = false;
+
+// Runs in the adc_stream task on every gas frame: collects the initial
+// calibration, then runs the detector and keeps the baseline up to date
+static mq_calib_t baseline_calib;
+static volatile bool baseline_ready = false;
+
+static void gas_frame_cb(const uint16_t *values, size_t n, uint32_t seq, void *ctx) {
+    static bool was_alarm = false;
+    int32_t gas = values[0];
+    if (baseline_tracking) {
+        bool alarm = gas_cusum_update(&cusum, gas, gas_baseline_get(&baseline));
+        gas_alarm = alarm;
+        if (alarm && !was_alarm) {
+            int64_t now = esp_timer_get_time();
+            xQueueSend(gas_queue, &now, 0);
+        }
+        was_alarm = alarm;
+        gas_baseline_update(&baseline, gas, alert || alarm);
+    } else if (!baseline_ready) {
+        float value = gas;
+        if (mq_calib_add(&baseline_calib, &value))
+            baseline_ready = true;
+    }
+    if (stream_ready) {
+        float v[] = { gas, baseline_tracking ? gas_baseline_get(&baseline) : NAN, gas_alarm, alert };
+        live_stream_publish(&live, esp_timer_get_time(), v);
     }
-    gas_baseline = total / CALIBRATION_SAMPLES;
-    printf("MQ135 baseline: %d\n", gas_baseline);
 }
 
-void wifi_init_sta(void) {
-    static bool wifi_initialized = false;
-    if (wifi_initialized) return;
+static void gas_stream_start(void) {
+    static const adc_channel_t channels[] = { MQ_ADC_CHANNEL };
+    adc_stream_config_t cfg = {
+        .channels = channels,
+        .n_channels = 1,
+        .atten = ADC_ATTEN_DB_12,
+        .sample_freq_hz = ADC_SAMPLE_HZ,
+        .output_hz = GAS_OUTPUT_HZ,
+        .callback = gas_frame_cb,
+        .task_priority = 10,
+        .task_core = 1,
+    };
+    ESP_ERROR_CHECK(mq_calib_init(&baseline_calib, 1, CALIBRATION_SAMPLES));
+    ESP_ERROR_CHECK(adc_stream_start(&cfg, &gas_stream));
+}
 
-    ESP_ERROR_CHECK(esp_netif_init());
+static void save_baseline(void) {
+    float value = gas_baseline_get(&baseline);
+    esp_err_t err = mq_calib_save(BASELINE_NVS_KEY, &value, 1);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Saving baseline failed: %s", esp_err_to_name(err));
+}
 
-    esp_err_t err = esp_event_loop_create_default();
-    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
-        ESP_ERROR_CHECK(err);
+// Seeds the baseline tracker from NVS, or from a blocking calibration on
+// a cold boot, and starts tracking and detection
+void calibrate_mq135() {
+    gas_baseline_config_t cfg = {
+        .shift_up = BASELINE_SHIFT_UP,
+        .shift_down = BASELINE_SHIFT_DOWN,
+        .hold_limit = BASELINE_HOLD_LIMIT,
+    };
+    gas_baseline_init(&baseline, &cfg);
 
-    esp_netif_create_default_wifi_sta();
+    gas_cusum_config_t cusum_cfg = {
+        .k_q8 = CUSUM_K_Q8,
+        .h_q8 = CUSUM_H_Q8,
+        .noise_shift = CUSUM_NOISE_SHIFT,
+        .min_sigma = CUSUM_MIN_SIGMA,
+    };
+    gas_cusum_init(&cusum, &cusum_cfg, CUSUM_INIT_SIGMA);
+
+    mq_calib_record_t stored;
+    if (mq_calib_load(BASELINE_NVS_KEY, &stored) == ESP_OK && stored.n_channels == 1) {
+        gas_baseline_reset(&baseline, (int32_t)(stored.values[0] + 0.5f));
+        printf("MQ135 baseline: %ld (stored)\n", (long)gas_baseline_get(&baseline));
+    } else {
+        printf("Calibrating MQ135...\n");
+        while (!baseline_ready)
+            vTaskDelay(pdMS_TO_TICKS(50));
+
+        float mean;
+        mq_calib_means(&baseline_calib, &mean);
+        gas_baseline_reset(&baseline, (int32_t)(mean + 0.5f));
+        printf("MQ135 baseline: %ld\n", (long)gas_baseline_get(&baseline));
+        save_baseline();
+    }
+    baseline_tracking = true;
+}
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+// Reconnects after drops with backoff; after the first boot it rejoins
+// the last AP directly instead of scanning all channels
+esp_err_t wifi_init_sta(void) {
+    wifi_mgr_esp_config_t cfg = {
+        .ssid = WIFI_SSID,
+        .password = WIFI_PASS,
+    };
+    return wifi_mgr_esp_start(&cfg);
+}
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-        },
+static boot_graph_t boot;
+
+static http_uplink_t thingspeak;
+static ts_batch_t uplink_batch;
+static ts_batch_entry_t uplink_ring[UPLINK_RING_LEN];
+static char uplink_body[UPLINK_BODY_SIZE];
+static flog_t backlog;
+static bool backlog_ready;
+
+// Flash copy of a buffered frame
+typedef struct __attribute__((packed)) {
+    uint32_t time_ms;
+    int16_t temp_c100;
+    uint16_t pressure_hpa10;
+    uint16_t gas;
+    uint8_t flags;          // bit 0 motion, bit 1 alert
+} backlog_record_t;
+
+void buffer_for_thingspeak(TickType_t tick, float temp, float pressure, int gas, int motion, int alert) {
+    ts_batch_entry_t e = {
+        .time_us = (int64_t)pdTICKS_TO_MS(tick) * 1000,
+        .mask = 0x1f,
+        .field = { temp, pressure / 100.0f, gas, motion, alert },
     };
+    ts_batch_add(&uplink_batch, &e);
+}
+
+esp_err_t send_to_thingspeak(size_t *sent) {
+    esp_err_t err = ts_batch_flush(&uplink_batch, &thingspeak, uplink_body, sizeof(uplink_body), sent);
+    if (err == ESP_OK) {
+        if (*sent) {
+            printf("ThingSpeak updated (%u entries).\n", (unsigned)*sent);
+            boot_graph_mark_now(&boot, "first upload");
+        }
+    } else if (err == ESP_ERR_INVALID_STATE) {
+        printf("ThingSpeak upload skipped, retrying in %lu ms.\n",
+               (unsigned long)http_uplink_backoff_left(&thingspeak));
+    } else {
+        printf("ThingSpeak upload failed: %s.\n", esp_err_to_name(err));
+    }
+    return err;
+}
+
+// Moves every buffered frame to the flash backlog, oldest first
+static void spill_to_backlog(void) {
+    size_t n = ts_batch_count(&uplink_batch);
+    for (size_t i = 0; i < n; i++) {
+        const ts_batch_entry_t *e = ts_batch_at(&uplink_batch, i);
+        backlog_record_t r = {
+            .time_ms = e->time_us / 1000,
+            .temp_c100 = lroundf(e->field[0] * 100),
+            .pressure_hpa10 = lroundf(e->field[1] * 10),
+            .gas = e->field[2],
+            .flags = (e->field[3] != 0) | (e->field[4] != 0) << 1,
+        };
+        esp_err_t err = flog_append(&backlog, &r, sizeof(r), NULL);
+        if (err != ESP_OK)
+            ESP_LOGW(TAG, "backlog append failed: %s", esp_err_to_name(err));
+    }
+    ts_batch_consume(&uplink_batch, n);
+}
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    ESP_ERROR_CHECK(esp_wifi_connect());
+// Sends the oldest backlogged frames as one bulk update and marks the
+// ones the server accepted as delivered
+static void replay_backlog(void) {
+    flog_cursor_t c = backlog.tail;
+    flog_record_t rec;
+    while (ts_batch_count(&uplink_batch) < REPLAY_BATCH && flog_next(&backlog, &c, &rec) == ESP_OK) {
+        backlog_record_t r;
+        memcpy(&r, rec.data, sizeof(r));
+        ts_batch_entry_t e = {
+            .time_us = (int64_t)r.time_ms * 1000,
+            .mask = 0x1f,
+            .field = { r.temp_c100 / 100.0f, r.pressure_hpa10 / 10.0f, r.gas, r.flags & 1, r.flags >> 1 & 1 },
+        };
+        ts_batch_add(&uplink_batch, &e);
+    }
 
-    wifi_initialized = true;
+    size_t sent = 0;
+    if (send_to_thingspeak(&sent) == ESP_OK && sent) {
+        c = backlog.tail;
+        for (size_t i = 0; i < sent; i++)
+            flog_next(&backlog, &c, &rec);
+        esp_err_t err = flog_ack(&backlog, &rec);
+        if (err != ESP_OK)
+            ESP_LOGW(TAG, "backlog ack failed: %s", esp_err_to_name(err));
+    }
+    // Whatever is left is still in flash
+    ts_batch_consume(&uplink_batch, ts_batch_count(&uplink_batch));
 }
 
-void send_to_thingspeak(float temp, float pressure, int gas, int motion) {
-    char url[256];
-    snprintf(url, sizeof(url),
-             "http://api.thingspeak.com/update?api_key=%s&field1=%.2f&field2=%.2f&field3=%d&field4=%d",
-             THINGSPEAK_KEY, temp, pressure / 100.0, gas, motion);
+// New frames queue behind an existing backlog so ThingSpeak gets them in
+// order; without one they go straight out and only move to flash when the
+// upload fails. During backoff nothing is read from or replayed out of
+// flash; frames wait in RAM and are spilled once the ring is half full
+static void upload(void) {
+    if (http_uplink_backoff_left(&thingspeak)) {
+        if (backlog_ready && ts_batch_count(&uplink_batch) >= UPLINK_RING_LEN / 2)
+            spill_to_backlog();
+        return;
+    }
+    if (backlog_ready && flog_pending(&backlog)) {
+        spill_to_backlog();
+        replay_backlog();
+        return;
+    }
+    size_t sent;
+    if (send_to_thingspeak(&sent) != ESP_OK && backlog_ready)
+        spill_to_backlog();
+}
 
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_GET
+// Acquisition: the sensor hub samples each sensor on its own period into
+// its cache, the frame job only reads the cache
+static psched_t acq_sched;
+static sensor_hub_t hub;
+static size_t env_id, gas_id;
+
+// Hands a frame with the latest readings on without waiting
+static void sample_job(void *ctx) {
+    static uint32_t seq;
+    sensor_reading_t env, gas;
+    sensor_hub_read(&hub, env_id, &env);
+    sensor_hub_read(&hub, gas_id, &gas);
+
+    sample_frame_t f = {
+        .seq = seq++,
+        .tick = xTaskGetTickCount(),
+        .temp = env.values[0],
+        .pressure = env.values[1],
+        .gas = gas.values[0],
     };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (esp_http_client_perform(client) == ESP_OK)
-        printf("ThingSpeak updated.\n");
-    else
-        printf("ThingSpeak upload failed.\n");
-    esp_http_client_cleanup(client);
+    if (env.status != ESP_OK)
+        ESP_LOGW(TAG, "BMP180 measurement failed: %s", esp_err_to_name(env.status));
+
+    if (xQueueSend(sample_queue, &f, 0) != pdTRUE)
+        sample_drops++;
 }
 
-void app_main(void) {
-    // Initialize NVS and WiFi
-    ESP_ERROR_CHECK(nvs_flash_init());
-    wifi_init_sta();
+static void sched_stats_job(void *ctx) {
+    psched_log_stats(&acq_sched, TAG);
+    wifi_mgr_esp_log_stats(TAG);
+}
 
-    // Initialize I2C and devices
-    ESP_ERROR_CHECK(i2cdev_init());
+static void acquisition_setup(void) {
+    static psched_job_t jobs[4];
+    static sensor_hub_entry_t sensors[2];
+    static sensor_adc_t gas_adc;
+    static const sensor_channel_t gas_channel[] = { { "mq135", "raw" } };
+    psched_clock_t clock;
+
+    ESP_ERROR_CHECK(psched_esp_clock_create(&clock));
+    ESP_ERROR_CHECK(psched_init(&acq_sched, &clock, jobs, 4));
+    ESP_ERROR_CHECK(sensor_hub_init(&hub, &acq_sched, sensors, 2));
+
+    sensor_hub_sensor_config_t env = { .name = "bmp180", .driver = &sensor_bmp180, .dev = &bmp,
+                                       .period_us = BMP_PERIOD_US };
+    sensor_hub_sensor_config_t gas = { .name = "mq135", .dev = &gas_adc,
+                                       .driver = sensor_adc_driver(&gas_adc, gas_stream, 0, 1, gas_channel),
+                                       .period_us = GAS_PERIOD_US, .phase_us = GAS_PHASE_US };
+    ESP_ERROR_CHECK(sensor_hub_add(&hub, &env, &env_id));
+    ESP_ERROR_CHECK(sensor_hub_add(&hub, &gas, &gas_id));
+
+    psched_job_config_t frame_job = { .name = "sample", .fn = sample_job,
+                                      .period_us = SAMPLE_PERIOD_US, .phase_us = SAMPLE_PHASE_US };
+    psched_job_config_t stats_job = { .name = "stats", .fn = sched_stats_job,
+                                      .period_us = SCHED_STATS_US, .phase_us = SCHED_STATS_US };
+    ESP_ERROR_CHECK(psched_add(&acq_sched, &frame_job, NULL));
+    ESP_ERROR_CHECK(psched_add(&acq_sched, &stats_job, NULL));
+}
 
-    // OLED INIT
-    ESP_ERROR_CHECK(ssd1306_init_i2c(SSD1306_I2C_ADDRESS, I2C_PORT, SDA_GPIO, SCL_GPIO));
-    ESP_ERROR_CHECK(ssd1306_init());
-    ssd1306_clear();
+static void acquisition_task(void *arg) {
+    psched_run(&acq_sched);
+    vTaskDelete(NULL);
+}
 
-    // BMP180 INIT
-    bmp180_dev_t bmp;
-    memset(&bmp, 0, sizeof(bmp));
-    ESP_ERROR_CHECK(bmp180_init_desc(&bmp, I2C_PORT, SDA_GPIO, SCL_GPIO));
-    ESP_ERROR_CHECK(bmp180_init(&bmp));
+// Queues a frame for the uplink, dropping the oldest one when the network
+// has fallen behind so the newest data and alerts always get through
+static void uplink_push(const sample_frame_t *f) {
+    if (xQueueSend(uplink_queue, f, 0) == pdTRUE)
+        return;
+    sample_frame_t stale;
+    xQueueReceive(uplink_queue, &stale, 0);
+    uplink_drops++;
+    xQueueSend(uplink_queue, f, 0);
+}
 
-    // Setup other hardware
-    gpio_set_direction(PIR_GPIO, GPIO_MODE_INPUT);
-    gpio_set_direction(BUTTON_GPIO, GPIO_MODE_INPUT);
-    gpio_set_pull_mode(BUTTON_GPIO, GPIO_PULLUP_ONLY);
-    gpio_set_direction(RED_LED_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_direction(GREEN_LED_GPIO, GPIO_MODE_OUTPUT);
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(MQ_ADC_CHANNEL, ADC_ATTEN_DB_11);
+// Alert state machine, owned by the processing task
+static sample_frame_t last_frame;
+static bool motion_level;
+static int64_t last_motion_us = INT64_MIN / 2;
 
-    calibrate_mq135();
+static bool motion_active(int64_t now) {
+    return motion_level || now - last_motion_us < MOTION_HOLD_US;
+}
+
+static void set_leds(bool danger) {
+    gpio_set_level(RED_LED_GPIO, danger);
+    gpio_set_level(GREEN_LED_GPIO, !danger);
+}
+
+// Raises the alert on behalf of the event stamped event_us and sends an
+// immediate update built on the latest frame
+static void raise_alert(int64_t event_us) {
+    set_leds(true);
+    alert = 1;
+
+    uint32_t reaction = esp_timer_get_time() - event_us;
+    if (reaction > max_reaction_us)
+        max_reaction_us = reaction;
+
+    sample_frame_t f = last_frame;
+    f.motion = true;
+    f.alert = true;
+    f.raised = true;
+    xQueueOverwrite(display_queue, &f);
+    uplink_push(&f);
+}
+
+static void clear_alert(void) {
+    set_leds(false);
+    alert = 0;
+
+    sample_frame_t f = last_frame;
+    f.alert = false;
+    xQueueOverwrite(display_queue, &f);
+}
+
+static void on_gpio_event(const gpio_event_t *ev) {
+    if (ev->gpio == PIR_GPIO) {
+        motion_level = ev->level;
+        if (ev->level)
+            last_motion_us = ev->time_us;
+        if (ev->level && gas_alarm && !alert)
+            raise_alert(ev->time_us);
+    } else if (ev->gpio == BUTTON_GPIO && alert) {
+        clear_alert();
+    }
+}
 
-    int alert = 0;
-    int loop_count = 0;
+static void on_frame(sample_frame_t *f) {
+    if (f->seq == 0)
+        boot_graph_mark_now(&boot, "first sample");
+    f->motion = motion_active(esp_timer_get_time());
+    f->alert = alert;
+    last_frame = *f;
+
+    // Catches a gas alarm that was still active when the alert was cleared
+    if (gas_alarm && f->motion && !alert) {
+        raise_alert(esp_timer_get_time());
+        return;
+    }
+
+    xQueueOverwrite(display_queue, f);
+    uplink_push(f);
+}
+
+// Reacts to GPIO edges, gas onsets and sample frames as they arrive; owns
+// the alert state and the LEDs and never waits on a downstream stage
+static void processing_task(void *arg) {
+    set_leds(false);
 
     while (1) {
-        float temp = 0;
-        uint32_t pressure = 0;
-        ESP_ERROR_CHECK(bmp180_measure(&bmp, &temp, &pressure, BMP180_MODE_STANDARD));
-
-        int gas = adc1_get_raw(MQ_ADC_CHANNEL);
-        int motion = gpio_get_level(PIR_GPIO);
-        int button = (gpio_get_level(BUTTON_GPIO) == 0);
-
-        if (gas > gas_baseline + GAS_DELTA && motion && !alert) {
-            gpio_set_level(RED_LED_GPIO, 1);
-            gpio_set_level(GREEN_LED_GPIO, 0);
-            alert = 1;
-        } else if (button && alert) {
-            gpio_set_level(RED_LED_GPIO, 0);
-            gpio_set_level(GREEN_LED_GPIO, 1);
-            alert = 0;
-        } else if (!alert) {
-            gpio_set_level(RED_LED_GPIO, 0);
-            gpio_set_level(GREEN_LED_GPIO, 1);
+        QueueSetMemberHandle_t member = xQueueSelectFromSet(proc_set, portMAX_DELAY);
+
+        if (member == event_queue) {
+            gpio_event_t ev;
+            if (xQueueReceive(event_queue, &ev, 0) == pdTRUE)
+                on_gpio_event(&ev);
+        } else if (member == gas_queue) {
+            int64_t onset_us;
+            if (xQueueReceive(gas_queue, &onset_us, 0) == pdTRUE &&
+                motion_active(onset_us) && !alert)
+                raise_alert(onset_us);
+        } else if (member == sample_queue) {
+            sample_frame_t f;
+            if (xQueueReceive(sample_queue, &f, 0) == pdTRUE) {
+                int64_t start = esp_timer_get_time();
+                on_frame(&f);
+                stage_done(STAGE_PROCESSING, start);
+            }
         }
+    }
+}
 
-        printf("Temp: %.1f C | Pressure: %.0f hPa | Gas: %d | Motion: %s | Status: %s\n",
-               temp, pressure / 100.0, gas, motion ? "YES" : "NO", alert ? "DANGER" : "SAFE");
+static void display_task(void *arg) {
+    sample_frame_t f;
 
-        char line1[32], line2[32], line3[32], line4[32];
-        snprintf(line1, sizeof(line1), "T:%.1fC", temp);
-        snprintf(line2, sizeof(line2), "P:%.0fhPa", pressure / 100.0);
-        snprintf(line3, sizeof(line3), "G:%d", gas);
-        snprintf(line4, sizeof(line4), "M:%s[%s]", motion ? "Y" : "N", alert ? "DNG" : "SAFE");
+    while (1) {
+        xQueueReceive(display_queue, &f, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+
+        char line[96];
+        fixfmt_t out;
+        fixfmt_init(&out, line, sizeof(line));
+        fixfmt_str(&out, "Temp: ");
+        fixfmt_float(&out, f.temp, 1);
+        fixfmt_str(&out, " C | Pressure: ");
+        fixfmt_float(&out, f.pressure / 100.0f, 0);
+        fixfmt_str(&out, " hPa | Gas: ");
+        fixfmt_int(&out, f.gas);
+        fixfmt_str(&out, " | Motion: ");
+        fixfmt_str(&out, f.motion ? "YES" : "NO");
+        fixfmt_str(&out, " | Status: ");
+        fixfmt_str(&out, f.alert ? "DANGER" : "SAFE");
+        puts(line);
+
+        status_screen_t screen = {
+            .temp = f.temp,
+            .pressure = f.pressure,
+            .gas = f.gas,
+            .motion = f.motion,
+            .alert = f.alert,
+        };
+        status_screen_render(&oled, &screen);
+        ssd1306_refresh(&oled);
+        stage_done(STAGE_DISPLAY, start);
+    }
+}
 
-        ssd1306_clear();
-        ssd1306_draw_string(0, 0, line1, 1, false);
-        ssd1306_draw_string(0, 1, line2, 1, false);
-        ssd1306_draw_string(0, 2, line3, 1, false);
-        ssd1306_draw_string(0, 3, line4, 1, false);
-        ssd1306_refresh();
+static void uplink_task(void *arg) {
+    sample_frame_t f;
+    http_uplink_config_t cfg = {
+        .host = THINGSPEAK_HOST,
+        .port = 80,
+        .timeout_ms = UPLINK_TIMEOUT_MS,
+        .backoff_min_ms = UPLINK_BACKOFF_MIN_MS,
+        .backoff_max_ms = UPLINK_BACKOFF_MAX_MS,
+        .dns_ttl_ms = UPLINK_DNS_TTL_MS,
+        .idle_close_ms = UPLINK_IDLE_CLOSE_MS,
+    };
+    ts_batch_config_t batch_cfg = {
+        .channel_id = THINGSPEAK_CHANNEL_ID,
+        .api_key = THINGSPEAK_KEY,
+        .decimals = { 2, 2 },
+        .max_batch = REPLAY_BATCH,
+    };
+    ESP_ERROR_CHECK(http_uplink_init(&thingspeak, &cfg));
+    ESP_ERROR_CHECK(ts_batch_init(&uplink_batch, &batch_cfg, uplink_ring, UPLINK_RING_LEN));
+    if (!THINGSPEAK_CHANNEL_ID) {
+        // Single updates carry no time, so a backlog could only be
+        // replayed as its newest frame; frames missed offline are dropped
+        ESP_LOGW(TAG, "THINGSPEAK_CHANNEL_ID not set: sending the newest frame per update, no backlog");
+    } else {
+        flog_flash_t flash;
+        esp_err_t err = flog_partition_open(&flash, BACKLOG_PARTITION);
+        if (err == ESP_OK)
+            err = flog_mount(&backlog, &flash);
+        if (err == ESP_OK) {
+            backlog_ready = true;
+            ESP_LOGI(TAG, "backlog: %lu frames pending", (unsigned long)flog_pending(&backlog));
+        } else {
+            ESP_LOGW(TAG, "no backlog partition (%s), frames are dropped while offline", esp_err_to_name(err));
+        }
+    }
 
-        if (++loop_count % 8 == 0) {
-            send_to_thingspeak(temp, pressure, gas, motion);
+    // Waits for frames until the flush interval is up; a timeout means
+    // the interval has passed. A flush during backoff returns at once
+    // and the entries wait for the next interval
+    TickType_t last_flush = xTaskGetTickCount();
+    bool early_flush = true;
+    while (1) {
+        TickType_t since = xTaskGetTickCount() - last_flush;
+        TickType_t wait = since < pdMS_TO_TICKS(UPLINK_FLUSH_MS) ? pdMS_TO_TICKS(UPLINK_FLUSH_MS) - since : 0;
+        if (xQueueReceive(uplink_queue, &f, wait) == pdTRUE) {
+            buffer_for_thingspeak(f.tick, f.temp, f.pressure, f.gas, f.motion, f.alert);
+            bool first = early_flush && wifi_mgr_esp_online();
+            if (!f.raised && !first && ts_batch_count(&uplink_batch) < UPLINK_BATCH)
+                continue;
         }
+        // One attempt online is enough, successful or not
+        if (wifi_mgr_esp_online())
+            early_flush = false;
+        int64_t start = esp_timer_get_time();
+        upload();
+        stage_done(STAGE_UPLOAD, start);
+        last_flush = xTaskGetTickCount();
+    }
+}
+
+static void counter(prom_writer_t *w, const char *name, const char *help, uint64_t value) {
+    prom_family(w, name, PROM_COUNTER, help);
+    prom_uint(w, name, NULL, 0, value);
+}
 
-        vTaskDelay(pdMS_TO_TICKS(2000));
+// Runs in the HTTP server task on every scrape; only reads state the
+// other tasks keep up to date
+static void metrics_collect(prom_writer_t *w, void *ctx) {
+    sensor_reading_t env, gas;
+    bool env_ok = sensor_hub_read(&hub, env_id, &env) == ESP_OK && env.status == ESP_OK;
+    bool gas_ok = sensor_hub_read(&hub, gas_id, &gas) == ESP_OK && gas.status == ESP_OK;
+
+    prom_family(w, "node_temperature_celsius", PROM_GAUGE, "BMP180 temperature.");
+    if (env_ok)
+        prom_float(w, "node_temperature_celsius", NULL, 0, env.values[0], 2);
+    prom_family(w, "node_pressure_pascals", PROM_GAUGE, "BMP180 pressure.");
+    if (env_ok)
+        prom_uint(w, "node_pressure_pascals", NULL, 0, env.values[1]);
+    prom_family(w, "node_gas_raw", PROM_GAUGE, "MQ135 ADC reading.");
+    if (gas_ok)
+        prom_int(w, "node_gas_raw", NULL, 0, gas.values[0]);
+    prom_family(w, "node_gas_baseline_raw", PROM_GAUGE, "MQ135 clean-air baseline.");
+    if (baseline_tracking)
+        prom_int(w, "node_gas_baseline_raw", NULL, 0, gas_baseline_get(&baseline));
+    prom_family(w, "node_sensor_ok", PROM_GAUGE, "1 if the last sample of the sensor succeeded.");
+    prom_int(w, "node_sensor_ok", &(prom_label_t) { "sensor", "bmp180" }, 1, env_ok);
+    prom_int(w, "node_sensor_ok", &(prom_label_t) { "sensor", "mq135" }, 1, gas_ok);
+    prom_family(w, "node_motion", PROM_GAUGE, "1 while the PIR reports motion.");
+    prom_int(w, "node_motion", NULL, 0, motion_level);
+    prom_family(w, "node_alert", PROM_GAUGE, "1 while the gas and motion alert is raised.");
+    prom_int(w, "node_alert", NULL, 0, alert);
+
+    prom_psched(w, &acq_sched, &(prom_label_t) { "loop", "acquisition" });
+
+    prom_family(w, "node_stage_seconds_total", PROM_COUNTER, "Time spent per frame stage.");
+    for (int i = 0; i < STAGE_COUNT; i++)
+        prom_fixed(w, "node_stage_seconds_total", &(prom_label_t) { "stage", stage_times[i].name }, 1,
+                   stage_times[i].sum_us, 6);
+    prom_family(w, "node_stage_runs_total", PROM_COUNTER, "Frames through each stage.");
+    for (int i = 0; i < STAGE_COUNT; i++)
+        prom_uint(w, "node_stage_runs_total", &(prom_label_t) { "stage", stage_times[i].name }, 1,
+                  stage_times[i].count);
+    prom_family(w, "node_stage_max_seconds", PROM_GAUGE, "Longest time a frame spent in a stage.");
+    for (int i = 0; i < STAGE_COUNT; i++)
+        prom_fixed(w, "node_stage_max_seconds", &(prom_label_t) { "stage", stage_times[i].name }, 1,
+                   stage_times[i].max_us, 6);
+    prom_family(w, "node_alert_reaction_max_seconds", PROM_GAUGE, "Longest time from gas or motion to alert.");
+    prom_fixed(w, "node_alert_reaction_max_seconds", NULL, 0, max_reaction_us, 6);
+
+    counter(w, "node_sample_drops_total", "Frames dropped with processing behind.", sample_drops);
+    counter(w, "node_uplink_queue_drops_total", "Frames dropped with the uplink behind.", uplink_drops);
+    counter(w, "node_gpio_event_drops_total", "GPIO edges dropped.", gpio_events_dropped());
+
+    i2c_port_stats_t i2c;
+    if (i2cdev_get_stats(I2C_PORT, &i2c) == ESP_OK) {
+        counter(w, "node_i2c_transfers_total", "I2C reads and writes.", i2c.transfers);
+        counter(w, "node_i2c_errors_total", "Failed I2C transfers, timeouts included.", i2c.errors);
+        counter(w, "node_i2c_timeouts_total", "I2C transfers that timed out.", i2c.timeouts);
     }
+
+    prom_family(w, "node_wifi_online", PROM_GAUGE, "1 while the node has an address.");
+    prom_int(w, "node_wifi_online", NULL, 0, wifi_mgr_esp_online());
+    counter(w, "node_uplink_requests_total", "ThingSpeak requests that got a response.",
+            thingspeak.stats.requests);
+    counter(w, "node_uplink_failures_total", "ThingSpeak requests that failed.", thingspeak.stats.failures);
+    counter(w, "node_uplink_backoff_skips_total", "ThingSpeak uploads skipped during backoff.",
+            thingspeak.stats.backoff_skips);
+    counter(w, "node_uplink_refused_total", "ThingSpeak answers with 429 or 5xx.", thingspeak.stats.refused);
+    counter(w, "node_uplink_connects_total", "TCP connections to ThingSpeak.", thingspeak.stats.connects);
+    counter(w, "node_uplink_samples_sent_total", "Frames accepted by ThingSpeak.", uplink_batch.stats.sent);
+    counter(w, "node_uplink_samples_dropped_total", "Buffered frames dropped.", uplink_batch.stats.dropped);
+    counter(w, "node_uplink_samples_superseded_total", "Frames left out of single updates for a newer one.",
+            uplink_batch.stats.superseded);
+    prom_family(w, "node_backlog_pending", PROM_GAUGE, "Frames waiting in the flash backlog.");
+    if (backlog_ready)
+        prom_uint(w, "node_backlog_pending", NULL, 0, flog_pending(&backlog));
+
+    prom_family(w, "node_stream_clients", PROM_GAUGE, "Clients on the live stream.");
+    prom_uint(w, "node_stream_clients", NULL, 0, live_stream_clients(&live));
+    counter(w, "node_stream_events_total", "Live stream events queued to clients.", live.stats.events);
+    counter(w, "node_stream_sent_bytes_total", "Bytes sent to live stream clients.", live.stats.bytes);
+    counter(w, "node_stream_rejected_total", "Live stream connections refused.", live.stats.rejected);
+    prom_family(w, "node_stream_dropped_total", PROM_COUNTER, "Live stream clients dropped for falling behind.");
+    prom_uint(w, "node_stream_dropped_total", &(prom_label_t) { "reason", "slow" }, 1, live.stats.dropped_slow);
+    prom_uint(w, "node_stream_dropped_total", &(prom_label_t) { "reason", "lagging" }, 1,
+              live.stats.dropped_lagging);
+}
+
+static void start_task(TaskFunction_t fn, const char *name, uint32_t stack, UBaseType_t prio, BaseType_t core) {
+    if (xTaskCreatePinnedToCore(fn, name, stack, NULL, prio, NULL, core) != pdPASS)
+        ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+}
+
+// Boot steps, each run as soon as the ones it depends on have finished
+enum {
+    STEP_NVS,
+    STEP_WIFI,
+    STEP_QUEUES,
+    STEP_I2C,
+    STEP_OLED,
+    STEP_BMP,
+    STEP_GPIO,
+    STEP_GAS,
+    STEP_CALIBRATE,
+    STEP_PROCESSING,
+    STEP_DISPLAY,
+    STEP_UPLINK,
+    STEP_ACQUISITION,
+    STEP_METRICS,
+    STEP_STREAM,
+    STEP_COUNT
+};
+
+static esp_err_t boot_nvs(void *ctx) {
+    return nvs_flash_init();
+}
+
+static esp_err_t boot_wifi(void *ctx) {
+    return wifi_init_sta();
+}
+
+// The processing task waits on all of its inputs at once; the queues
+// must still be empty when added to the set
+static esp_err_t boot_queues(void *ctx) {
+    sample_queue = xQueueCreate(SAMPLE_QUEUE_LEN, sizeof(sample_frame_t));
+    event_queue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(gpio_event_t));
+    gas_queue = xQueueCreate(GAS_QUEUE_LEN, sizeof(int64_t));
+    display_queue = xQueueCreate(1, sizeof(sample_frame_t));
+    uplink_queue = xQueueCreate(UPLINK_QUEUE_LEN, sizeof(sample_frame_t));
+    proc_set = xQueueCreateSet(SAMPLE_QUEUE_LEN + EVENT_QUEUE_LEN + GAS_QUEUE_LEN);
+    if (!sample_queue || !event_queue || !gas_queue || !display_queue || !uplink_queue || !proc_set)
+        return ESP_ERR_NO_MEM;
+    xQueueAddToSet(sample_queue, proc_set);
+    xQueueAddToSet(event_queue, proc_set);
+    xQueueAddToSet(gas_queue, proc_set);
+    return ESP_OK;
+}
+
+static esp_err_t boot_i2c(void *ctx) {
+    return i2cdev_init();
+}
+
+static esp_err_t boot_oled(void *ctx) {
+    esp_err_t err = ssd1306_init_desc(&oled, OLED_WIDTH, OLED_HEIGHT, oled_fb,
+                                      SSD1306_I2C_ADDRESS, I2C_PORT, SDA_GPIO, SCL_GPIO);
+    if (err == ESP_OK)
+        err = ssd1306_init(&oled);
+    if (err == ESP_OK)
+        ssd1306_clear(&oled);
+    return err;
+}
+
+static esp_err_t boot_bmp(void *ctx) {
+    memset(&bmp, 0, sizeof(bmp));
+    return bmp180_init_desc(&bmp, I2C_PORT, SDA_GPIO, SCL_GPIO);
+}
+
+static esp_err_t boot_gpio(void *ctx) {
+    gpio_set_direction(RED_LED_GPIO, GPIO_MODE_OUTPUT);
+    gpio_set_direction(GREEN_LED_GPIO, GPIO_MODE_OUTPUT);
+
+    esp_err_t err = gpio_events_init(event_queue);
+    if (err != ESP_OK)
+        return err;
+    gpio_event_pin_t pir = { .gpio = PIR_GPIO, .edge = GPIO_INTR_ANYEDGE, .pull = GPIO_FLOATING };
+    gpio_event_pin_t button = {
+        .gpio = BUTTON_GPIO,
+        .edge = GPIO_INTR_NEGEDGE,
+        .pull = GPIO_PULLUP_ONLY,
+        .debounce_us = BUTTON_DEBOUNCE_US,
+    };
+    err = gpio_events_add(&pir);
+    if (err == ESP_OK)
+        err = gpio_events_add(&button);
+    motion_level = gpio_get_level(PIR_GPIO);
+    return err;
+}
+
+static esp_err_t boot_gas(void *ctx) {
+    gas_stream_start();
+    return ESP_OK;
+}
+
+static esp_err_t boot_calibrate(void *ctx) {
+    calibrate_mq135();
+    return ESP_OK;
+}
+
+static esp_err_t boot_processing(void *ctx) {
+    start_task(processing_task, "processing", 3072, PROC_TASK_PRIO, PROC_TASK_CORE);
+    return ESP_OK;
+}
+
+static esp_err_t boot_display(void *ctx) {
+    start_task(display_task, "display", 3072, DISPLAY_TASK_PRIO, DISPLAY_TASK_CORE);
+    return ESP_OK;
 }
 
+static esp_err_t boot_uplink(void *ctx) {
+    start_task(uplink_task, "uplink", 4096, UPLINK_TASK_PRIO, UPLINK_TASK_CORE);
+    return ESP_OK;
+}
+
+static esp_err_t boot_metrics(void *ctx) {
+    static const char *const tasks[] = { "main", "acquisition", "processing", "display", "uplink", "live_stream" };
+    prom_esp_config_t cfg = {
+        .port = METRICS_PORT,
+        .collect = metrics_collect,
+        .tasks = tasks,
+        .n_tasks = sizeof(tasks) / sizeof(tasks[0]),
+    };
+    return prom_esp_start(&cfg);
+}
+
+static esp_err_t boot_stream(void *ctx) {
+    live_stream_config_t cfg = {
+        .port = STREAM_PORT,
+        .n_values = 4,
+        .names = { "gas", "baseline", "alarm", "alert" },
+    };
+    esp_err_t err = live_stream_esp_start(&live, &cfg, STREAM_TASK_PRIO, STREAM_TASK_CORE);
+    if (err == ESP_OK)
+        stream_ready = true;
+    return err;
+}
 
+static esp_err_t boot_acquisition(void *ctx) {
+    acquisition_setup();
+    start_task(acquisition_task, "acquisition", 4096, ACQ_TASK_PRIO, ACQ_TASK_CORE);
+    return ESP_OK;
+}
+
+void app_main(void) {
+    // Wi-Fi associates and the MQ135 calibrates while everything else
+    // comes up. Sampling and uploads do not wait for the calibration: the
+    // raw gas reading is valid before it, only detection needs the baseline
+    static const boot_step_config_t steps[STEP_COUNT] = {
+        [STEP_NVS]         = { .name = "nvs", .fn = boot_nvs },
+        [STEP_WIFI]        = { .name = "wifi", .fn = boot_wifi, .deps = BOOT_DEP(STEP_NVS) },
+        [STEP_QUEUES]      = { .name = "queues", .fn = boot_queues },
+        [STEP_I2C]         = { .name = "i2c", .fn = boot_i2c },
+        [STEP_OLED]        = { .name = "oled", .fn = boot_oled, .deps = BOOT_DEP(STEP_I2C) },
+        [STEP_BMP]         = { .name = "bmp180", .fn = boot_bmp, .deps = BOOT_DEP(STEP_I2C) },
+        [STEP_GPIO]        = { .name = "gpio", .fn = boot_gpio, .deps = BOOT_DEP(STEP_QUEUES) },
+        [STEP_GAS]         = { .name = "gas", .fn = boot_gas },
+        [STEP_CALIBRATE]   = { .name = "calibrate", .fn = boot_calibrate,
+                               .deps = BOOT_DEP(STEP_NVS) | BOOT_DEP(STEP_GAS) | BOOT_DEP(STEP_QUEUES) },
+        [STEP_PROCESSING]  = { .name = "processing", .fn = boot_processing,
+                               .deps = BOOT_DEP(STEP_QUEUES) | BOOT_DEP(STEP_GPIO) },
+        [STEP_DISPLAY]     = { .name = "display", .fn = boot_display,
+                               .deps = BOOT_DEP(STEP_QUEUES) | BOOT_DEP(STEP_OLED) },
+        // Sockets need the network stack that the Wi-Fi step brings up
+        [STEP_UPLINK]      = { .name = "uplink", .fn = boot_uplink,
+                               .deps = BOOT_DEP(STEP_QUEUES) | BOOT_DEP(STEP_WIFI) },
+        [STEP_ACQUISITION] = { .name = "acquisition", .fn = boot_acquisition,
+                               .deps = BOOT_DEP(STEP_BMP) | BOOT_DEP(STEP_GAS) | BOOT_DEP(STEP_PROCESSING) },
+        // Serves what the acquisition and uplink keep up to date
+        [STEP_METRICS]     = { .name = "metrics", .fn = boot_metrics,
+                               .deps = BOOT_DEP(STEP_WIFI) | BOOT_DEP(STEP_ACQUISITION) },
+        [STEP_STREAM]      = { .name = "stream", .fn = boot_stream, .deps = BOOT_DEP(STEP_WIFI) },
+    };
+    static boot_step_t step_state[STEP_COUNT];
 
+    ESP_ERROR_CHECK(boot_graph_init(&boot, steps, step_state, STEP_COUNT, esp_timer_get_time()));
+    ESP_ERROR_CHECK(boot_graph_run(&boot));
+    boot_graph_log(&boot, TAG);
 
+    // Housekeeping: periodic baseline save, off the sampling path
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(BASELINE_SAVE_MS));
+        save_baseline();
+        ESP_LOGI(TAG, "dropped: %lu sample, %lu uplink, %lu gpio; max alert reaction %lu us",
+                 (unsigned long)sample_drops, (unsigned long)uplink_drops,
+                 (unsigned long)gpio_events_dropped(), (unsigned long)max_reaction_us);
+        ESP_LOGI(TAG, "uplink: %lu requests, %lu connects, %lu reused, %lu failures",
+                 (unsigned long)thingspeak.stats.requests, (unsigned long)thingspeak.stats.connects,
+                 (unsigned long)thingspeak.stats.reused, (unsigned long)thingspeak.stats.failures);
+        ESP_LOGI(TAG, "batch: %lu buffered, %lu sent in %lu requests, %lu dropped",
+                 (unsigned long)uplink_batch.stats.added, (unsigned long)uplink_batch.stats.sent,
+                 (unsigned long)uplink_batch.stats.requests, (unsigned long)uplink_batch.stats.dropped);
+        if (backlog_ready)
+            ESP_LOGI(TAG, "backlog: %lu pending, %lu dropped, %lu torn at boot",
+                     (unsigned long)flog_pending(&backlog), (unsigned long)backlog.stats.dropped,
+                     (unsigned long)backlog.stats.torn);
+    }
+}
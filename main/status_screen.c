@@ -0,0 +1,34 @@
+#include "fixfmt.h"
+#include "status_screen.h"
+
+void status_screen_render(ssd1306_t *oled, const status_screen_t *s) {
+    char line1[32], line2[32], line3[32], line4[32];
+    fixfmt_t f;
+
+    fixfmt_init(&f, line1, sizeof(line1));
+    fixfmt_str(&f, "T:");
+    fixfmt_float(&f, s->temp, 1);
+    fixfmt_char(&f, 'C');
+
+    fixfmt_init(&f, line2, sizeof(line2));
+    fixfmt_str(&f, "P:");
+    fixfmt_float(&f, s->pressure / 100.0f, 0);
+    fixfmt_str(&f, "hPa");
+
+    fixfmt_init(&f, line3, sizeof(line3));
+    fixfmt_str(&f, "G:");
+    fixfmt_int(&f, s->gas);
+
+    fixfmt_init(&f, line4, sizeof(line4));
+    fixfmt_str(&f, "M:");
+    fixfmt_str(&f, s->motion ? "Y" : "N");
+    fixfmt_char(&f, '[');
+    fixfmt_str(&f, s->alert ? "DNG" : "SAFE");
+    fixfmt_char(&f, ']');
+
+    ssd1306_clear(oled);
+    ssd1306_draw_string(oled, 0, 0, line1, 1, false);
+    ssd1306_draw_string(oled, 0, 1, line2, 1, false);
+    ssd1306_draw_string(oled, 0, 2, line3, 1, false);
+    ssd1306_draw_string(oled, 0, 3, line4, 1, false);
+}
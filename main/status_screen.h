@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ssd1306.h"
+
+// Everything shown on the node's OLED status page
+typedef struct {
+    float temp;         // degrees C
+    uint32_t pressure;  // Pa
+    int gas;            // raw MQ135 reading
+    bool motion;
+    bool alert;
+} status_screen_t;
+
+// Clear the framebuffer and draw the four status lines (no refresh)
+void status_screen_render(ssd1306_t *oled, const status_screen_t *s);
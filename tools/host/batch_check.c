@@ -0,0 +1,220 @@
+/*
+ * Checks thingspeak_batch against a local HTTP server (see http_standin.py).
+ *
+ *   batch_check [-H HOST] [-p PORT] [-n SAMPLES] [-b BATCH] [-r RING] [-i INTERVAL_MS]
+ *
+ * Buffers SAMPLES (default 1000) updates stamped INTERVAL_MS apart
+ * (default 250) and flushes whenever BATCH (default 60) are waiting, like
+ * the uplink task does on a size trigger. The server must then have seen
+ * ceil(SAMPLES / BATCH) bulk requests carrying exactly SAMPLES updates.
+ * Then a buffer without a channel number flushes five entries as one
+ * single update of the newest, counting the other four as superseded.
+ *
+ * Without a server it still runs the offline checks: a RING-entry buffer
+ * (default 64) fed three times its size keeps only the newest entries and
+ * counts the rest as dropped, and a full ring of worst-case values fits
+ * in a TS_BATCH_BODY_SIZE(RING) body.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thingspeak_batch.h"
+
+static long json_field(const char *json, const char *key)
+{
+    char pat[64];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(json, pat);
+    return p ? strtol(p + strlen(pat), NULL, 10) : -1;
+}
+
+static ts_batch_entry_t sample(long i, int interval_ms)
+{
+    ts_batch_entry_t e = {
+        .time_us = (int64_t)i * interval_ms * 1000,
+        .mask = 0x1f,
+        .field = { 21.5f + i % 7, 1013.25f, 400 + i % 50, i % 2, 0 },
+    };
+    return e;
+}
+
+static bool check_offline(size_t ring_size)
+{
+    ts_batch_config_t cfg = { .channel_id = 1, .api_key = "TESTKEY", .decimals = { 6, 6, 6, 6, 6, 6, 6, 6 } };
+    ts_batch_entry_t *ring = calloc(ring_size, sizeof(ts_batch_entry_t));
+    size_t body_size = TS_BATCH_BODY_SIZE(ring_size);
+    char *body = malloc(body_size);
+    ts_batch_t b;
+    bool ok = true;
+
+    if (!ring || !body || ts_batch_init(&b, &cfg, ring, ring_size) != ESP_OK)
+        return false;
+
+    // Overflow keeps the newest entries
+    for (size_t i = 0; i < 3 * ring_size; i++) {
+        ts_batch_entry_t e = { .time_us = i * 1000000, .mask = 1, .field = { (float)i } };
+        ts_batch_add(&b, &e);
+    }
+    size_t len, entries;
+    ts_batch_encode(&b, body, body_size, &len, &entries);
+    char first[32];
+    snprintf(first, sizeof(first), "\"field1\":%zu.", 2 * ring_size);
+    if (b.stats.dropped != 2 * ring_size || ts_batch_count(&b) != ring_size || !strstr(body, first)) {
+        printf("overflow: dropped %" PRIu32 ", count %zu, body starts %.80s\n", b.stats.dropped,
+               ts_batch_count(&b), body);
+        ok = false;
+    }
+
+    // Worst case: every field present, large negative values, long gaps
+    ts_batch_consume(&b, ring_size);
+    for (size_t i = 0; i < ring_size; i++) {
+        ts_batch_entry_t e = { .time_us = i * 999999999999LL, .mask = 0xff };
+        for (int f = 0; f < TS_BATCH_FIELDS; f++)
+            e.field[f] = -9.99e11f;
+        ts_batch_add(&b, &e);
+    }
+    if (ts_batch_encode(&b, body, body_size, &len, &entries) != ESP_OK || entries != ring_size ||
+        len != strlen(body)) {
+        printf("worst case: %zu/%zu entries in %zu bytes\n", entries, ring_size, body_size);
+        ok = false;
+    }
+    printf("worst case entry %zu bytes encoded (bound %d)\n", (len - 64) / ring_size, TS_BATCH_ENTRY_MAX);
+
+    // Non-finite values are left out rather than producing invalid JSON
+    ts_batch_consume(&b, ring_size);
+    ts_batch_entry_t e = { .mask = 3, .field = { NAN, 1 } };
+    ts_batch_add(&b, &e);
+    ts_batch_encode(&b, body, body_size, &len, &entries);
+    if (strstr(body, "nan") || strstr(body, "field1") || !strstr(body, "field2")) {
+        printf("nan: %s\n", body);
+        ok = false;
+    }
+
+    printf("footprint: %zu entries x %zu bytes + %zu byte body = %zu bytes\n", ring_size,
+           sizeof(ts_batch_entry_t), body_size, ring_size * sizeof(ts_batch_entry_t) + body_size);
+    free(ring);
+    free(body);
+    return ok;
+}
+
+// Without a channel number only the newest entry goes, through /update
+static bool check_single(http_uplink_t *u, long updates_before)
+{
+    ts_batch_config_t cfg = { .api_key = "TESTKEY", .decimals = { 2, 2 } };
+    ts_batch_entry_t ring[8];
+    char buf[TS_BATCH_BODY_SIZE(1)], resp_body[256];
+    ts_batch_t b;
+    size_t sent = 0;
+    if (ts_batch_init(&b, &cfg, ring, 8) != ESP_OK)
+        return false;
+    for (long i = 0; i < 5; i++) {
+        ts_batch_entry_t e = sample(i, 1000);
+        ts_batch_add(&b, &e);
+    }
+    esp_err_t err = ts_batch_flush(&b, u, buf, sizeof(buf), &sent);
+
+    http_uplink_response_t resp = { .body = resp_body, .body_size = sizeof(resp_body) };
+    http_uplink_request_t stats = { .method = "GET", .path = "/stats" };
+    long updates = http_uplink_request(u, &stats, &resp) == ESP_OK ? json_field(resp_body, "updates") : -1;
+    printf("single update: %s, %zu sent, %" PRIu32 " superseded, %zu left, server +%ld\n", esp_err_to_name(err),
+           sent, b.stats.superseded, ts_batch_count(&b), updates - updates_before);
+    return err == ESP_OK && sent == 1 && b.stats.superseded == 4 && !ts_batch_count(&b) &&
+           updates == updates_before + 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "localhost";
+    uint16_t port = 8080;
+    long n = 1000;
+    size_t batch = 60, ring_size = 64;
+    int interval_ms = 250;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:n:b:r:i:")) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': n = atol(optarg); break;
+            case 'b': batch = strtoul(optarg, NULL, 10); break;
+            case 'r': ring_size = strtoul(optarg, NULL, 10); break;
+            case 'i': interval_ms = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-H HOST] [-p PORT] [-n SAMPLES] [-b BATCH] [-r RING] [-i INTERVAL_MS]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (!batch || batch > ring_size || batch > TS_BATCH_BULK_MAX) {
+        fprintf(stderr, "BATCH must be 1..min(RING, %d)\n", TS_BATCH_BULK_MAX);
+        return 2;
+    }
+
+    bool ok = check_offline(ring_size);
+    printf("offline checks %s\n", ok ? "ok" : "FAILED");
+
+    http_uplink_t u;
+    http_uplink_config_t ucfg = { .host = host, .port = port, .timeout_ms = 2000 };
+    http_uplink_init(&u, &ucfg);
+
+    char resp_body[256];
+    http_uplink_response_t resp = { .body = resp_body, .body_size = sizeof(resp_body) };
+    http_uplink_request_t reset = { .method = "POST", .path = "/stats/reset", .body = "", .body_len = 0 };
+    if (http_uplink_request(&u, &reset, &resp) != ESP_OK) {
+        fprintf(stderr, "no server on %s:%u, skipping the upload check\n", host, port);
+        return ok ? 0 : 1;
+    }
+
+    ts_batch_config_t cfg = {
+        .channel_id = 123456,
+        .api_key = "TESTKEY",
+        .decimals = { 2, 2, 0, 0, 0 },
+        .max_batch = batch,
+    };
+    ts_batch_entry_t *ring = calloc(ring_size, sizeof(ts_batch_entry_t));
+    size_t body_size = TS_BATCH_BODY_SIZE(batch);
+    char *body = malloc(body_size);
+    ts_batch_t b;
+    if (!ring || !body || ts_batch_init(&b, &cfg, ring, ring_size) != ESP_OK)
+        return 1;
+
+    long flush_errors = 0;
+    for (long i = 0; i < n; i++) {
+        ts_batch_entry_t e = sample(i, interval_ms);
+        ts_batch_add(&b, &e);
+        if (ts_batch_count(&b) >= batch && ts_batch_flush(&b, &u, body, body_size, NULL) != ESP_OK)
+            flush_errors++;
+    }
+    while (ts_batch_count(&b) && flush_errors < 10)
+        if (ts_batch_flush(&b, &u, body, body_size, NULL) != ESP_OK)
+            flush_errors++;
+
+    http_uplink_request_t stats = { .method = "GET", .path = "/stats" };
+    if (http_uplink_request(&u, &stats, &resp) != ESP_OK) {
+        fprintf(stderr, "stats request failed\n");
+        return 1;
+    }
+    long bulk = json_field(resp_body, "bulk_requests");
+    long updates = json_field(resp_body, "updates");
+    long max_batch = json_field(resp_body, "max_batch");
+    long expected = (n + batch - 1) / batch;
+
+    printf("batch: %" PRIu32 " added, %" PRIu32 " sent in %" PRIu32 " requests, %" PRIu32 " dropped, %" PRIu32
+           " failed flushes\n", b.stats.added, b.stats.sent, b.stats.requests, b.stats.dropped, b.stats.failed);
+    printf("server: %s\n", resp_body);
+    printf("%ld samples in %ld bulk requests (expected %ld, single updates would take %ld), %" PRIu32
+           " connection(s)\n", updates, bulk, expected, n, u.stats.connects);
+
+    bool up_ok = !flush_errors && bulk == expected && updates == n && max_batch <= (long)batch &&
+                 b.stats.dropped == 0;
+    up_ok &= check_single(&u, updates);
+    printf("upload check %s\n", up_ok ? "ok" : "FAILED");
+    free(ring);
+    free(body);
+    return ok && up_ok ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/*
+ * Virtual-clock runs of boot_graph with the firmware's boot steps.
+ *
+ *   boot_sim [-n GRAPHS] [-s SEED] [-v]
+ *
+ * First GRAPHS (default 10000) random graphs of up to 32 steps with
+ * random durations, some steps failing, are run with every ready step
+ * started at once, as boot_graph_run() does on the target. No step may
+ * start before the steps it depends on have finished, exactly the
+ * dependents of a failed step must be skipped, unless the step is
+ * optional, only failed steps that are not optional may fail the boot,
+ * and the critical path must
+ * equal the time the run took. Cycles and unknown dependencies must be
+ * refused.
+ *
+ * Then the boot of main.c and of GasNODE.c, cold (no calibration in NVS,
+ * no Wi-Fi cache) and warm, is run with rough step durations measured on
+ * an ESP32, once in the old fixed order and once as a graph: boot time,
+ * first sample and first upload. -v prints the graph timelines.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "boot_graph.h"
+
+static esp_err_t noop(void *ctx)
+{
+    (void)ctx;
+    return ESP_OK;
+}
+
+// Runs g with unlimited parallelism: step i takes dur_us[i] and ends with
+// err[i]. Returns false if a step started before one of its dependencies
+static bool run_graph(boot_graph_t *g, const int64_t *dur_us, const esp_err_t *err)
+{
+    int64_t now = g->start_us;
+    int64_t end_at[BOOT_GRAPH_MAX_STEPS];
+    bool ok = true;
+
+    while (!boot_graph_finished(g)) {
+        int i;
+        while ((i = boot_graph_next(g, now)) >= 0) {
+            for (size_t d = 0; d < g->n_steps; d++)
+                if ((g->steps[i].cfg.deps & BOOT_DEP(d)) &&
+                    (!(g->steps[d].state == BOOT_STEP_DONE ||
+                       (g->steps[d].state == BOOT_STEP_FAILED && g->steps[d].cfg.optional)) ||
+                     g->steps[d].end_us > now))
+                    ok = false;
+            end_at[i] = now + dur_us[i];
+        }
+
+        // Earliest running step ends next
+        int first = -1;
+        for (size_t j = 0; j < g->n_steps; j++)
+            if (g->steps[j].state == BOOT_STEP_RUNNING && (first < 0 || end_at[j] < end_at[first]))
+                first = j;
+        if (first < 0)
+            return false;
+        now = end_at[first];
+        boot_graph_done(g, first, err[first], now);
+    }
+    return ok;
+}
+
+static bool check_random(long graphs)
+{
+    boot_step_config_t cfg[BOOT_GRAPH_MAX_STEPS];
+    boot_step_t steps[BOOT_GRAPH_MAX_STEPS];
+    int64_t dur[BOOT_GRAPH_MAX_STEPS];
+    esp_err_t err[BOOT_GRAPH_MAX_STEPS];
+    long bad = 0, failed_runs = 0;
+
+    for (long k = 0; k < graphs; k++) {
+        size_t n = 1 + rand() % BOOT_GRAPH_MAX_STEPS;
+        // Random DAG over a shuffled order, so dependencies point both ways
+        // in the array
+        int order[BOOT_GRAPH_MAX_STEPS];
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+        for (size_t i = n - 1; i > 0; i--) {
+            size_t j = rand() % (i + 1);
+            int t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+        bool any_fail = false;
+        for (size_t r = 0; r < n; r++) {
+            int i = order[r];
+            cfg[i] = (boot_step_config_t) { .name = "step", .fn = noop, .optional = rand() % 5 == 0 };
+            for (size_t q = 0; q < r; q++)
+                if (rand() % 4 == 0)
+                    cfg[i].deps |= BOOT_DEP(order[q]);
+            dur[i] = rand() % 3 ? rand() % 50000 : 1000000 + rand() % 9000000;
+            err[i] = rand() % 20 ? ESP_OK : ESP_FAIL;
+            any_fail |= err[i] != ESP_OK;
+        }
+
+        boot_graph_t g;
+        if (boot_graph_init(&g, cfg, steps, n, 1000) != ESP_OK || !run_graph(&g, dur, err)) {
+            bad++;
+            continue;
+        }
+        failed_runs += any_fail;
+
+        // A step is skipped exactly when one of its dependencies failed,
+        // other than an optional one, or was skipped; otherwise it ran
+        // with its own result. Only steps that are not optional fail the
+        // boot
+        bool right = true, any_failed = false;
+        for (size_t r = 0; r < n; r++) {
+            int i = order[r];
+            bool dep_bad = false;
+            for (size_t d = 0; d < n; d++)
+                if ((cfg[i].deps & BOOT_DEP(d)) && (g.steps[d].state == BOOT_STEP_SKIPPED ||
+                                                    (g.steps[d].state == BOOT_STEP_FAILED && !cfg[d].optional)))
+                    dep_bad = true;
+            boot_step_state_t want = dep_bad ? BOOT_STEP_SKIPPED : err[i] ? BOOT_STEP_FAILED : BOOT_STEP_DONE;
+            right &= g.steps[i].state == want;
+            any_failed |= want == BOOT_STEP_FAILED && !cfg[i].optional;
+        }
+        right &= (boot_graph_result(&g) != ESP_OK) == any_failed;
+        if (!any_fail)
+            right &= boot_graph_critical_path(&g, NULL) == g.end_us - g.start_us;
+        bad += !right;
+    }
+
+    // Refusals
+    boot_step_config_t cyc[3] = {
+        { .name = "a", .fn = noop, .deps = BOOT_DEP(2) },
+        { .name = "b", .fn = noop, .deps = BOOT_DEP(0) },
+        { .name = "c", .fn = noop, .deps = BOOT_DEP(1) },
+    };
+    boot_graph_t g;
+    if (boot_graph_init(&g, cyc, steps, 3, 0) != ESP_ERR_INVALID_ARG)
+        bad++;
+    cyc[0].deps = BOOT_DEP(5);
+    if (boot_graph_init(&g, cyc, steps, 3, 0) != ESP_ERR_INVALID_ARG)
+        bad++;
+    cyc[0].deps = BOOT_DEP(0);
+    if (boot_graph_init(&g, cyc, steps, 3, 0) != ESP_ERR_INVALID_ARG)
+        bad++;
+
+    printf("%ld random graphs (%ld with failing steps): %ld wrong\n", graphs, failed_runs, bad);
+    return !bad;
+}
+
+// --- Firmware boots -------------------------------------------------------
+
+typedef struct {
+    const char *name;
+    uint32_t deps;
+    int64_t cold_ms;
+    int64_t warm_ms;
+} sim_step_t;
+
+typedef struct {
+    int64_t boot_ms;
+    int64_t sample_ms;
+    int64_t upload_ms;
+} outcome_t;
+
+// Time from starting the Wi-Fi manager to an address, from wifi_mgr_sim
+#define WIFI_COLD_MS    2900
+#define WIFI_WARM_MS    1200
+#define HTTP_MS         400     // ThingSpeak bulk update
+#define MQTT_CONNECT_MS 300
+#define MQTT_ACK_MS     50
+
+enum { M_NVS, M_WIFI, M_QUEUES, M_I2C, M_OLED, M_BMP, M_GPIO, M_GAS, M_CALIBRATE, M_PROCESSING, M_DISPLAY,
+       M_UPLINK, M_ACQUISITION, M_METRICS, M_STREAM,
+       M_COUNT };
+
+static const sim_step_t main_steps[M_COUNT] = {
+    [M_NVS]         = { "nvs", 0, 30, 30 },
+    [M_WIFI]        = { "wifi", BOOT_DEP(M_NVS), 60, 60 },
+    [M_QUEUES]      = { "queues", 0, 1, 1 },
+    [M_I2C]         = { "i2c", 0, 2, 2 },
+    [M_OLED]        = { "oled", BOOT_DEP(M_I2C), 60, 60 },
+    [M_BMP]         = { "bmp180", BOOT_DEP(M_I2C), 5, 5 },
+    [M_GPIO]        = { "gpio", BOOT_DEP(M_QUEUES), 3, 3 },
+    [M_GAS]         = { "gas", 0, 10, 10 },
+    [M_CALIBRATE]   = { "calibrate", BOOT_DEP(M_NVS) | BOOT_DEP(M_GAS) | BOOT_DEP(M_QUEUES), 5000, 5 },
+    [M_PROCESSING]  = { "processing", BOOT_DEP(M_QUEUES) | BOOT_DEP(M_GPIO), 1, 1 },
+    [M_DISPLAY]     = { "display", BOOT_DEP(M_QUEUES) | BOOT_DEP(M_OLED), 1, 1 },
+    [M_UPLINK]      = { "uplink", BOOT_DEP(M_QUEUES) | BOOT_DEP(M_WIFI), 1, 1 },
+    [M_ACQUISITION] = { "acquisition", BOOT_DEP(M_BMP) | BOOT_DEP(M_GAS) | BOOT_DEP(M_PROCESSING), 2, 2 },
+    [M_METRICS]     = { "metrics", BOOT_DEP(M_WIFI) | BOOT_DEP(M_ACQUISITION), 4, 4 },
+    [M_STREAM]      = { "stream", BOOT_DEP(M_WIFI), 1, 1 },
+};
+
+// app_main before the boot graph
+static const int main_old_order[M_COUNT] = { M_NVS, M_WIFI, M_I2C, M_OLED, M_BMP, M_QUEUES, M_GAS, M_CALIBRATE,
+                                             M_GPIO, M_ACQUISITION, M_PROCESSING, M_DISPLAY, M_UPLINK,
+                                             M_METRICS, M_STREAM };
+
+// First frame half a second after the acquisition starts. The old uplink
+// sent once 15 frames were buffered; now the first frame goes as soon as
+// Wi-Fi is up
+static outcome_t main_outcome(const int64_t *end_ms, bool warm, bool graph)
+{
+    outcome_t o = { 0 };
+    int64_t online = end_ms[M_WIFI] + (warm ? WIFI_WARM_MS : WIFI_COLD_MS);
+    o.sample_ms = end_ms[M_ACQUISITION] + 500;
+    if (graph) {
+        // Checked on each frame, once a second
+        int64_t t = o.sample_ms;
+        while (t < online)
+            t += 1000;
+        o.upload_ms = t + HTTP_MS;
+    } else {
+        o.upload_ms = o.sample_ms + 14 * 1000 + HTTP_MS;
+    }
+    return o;
+}
+
+enum { G_NVS, G_WIFI, G_MQTT, G_ADC, G_CALIBRATE, G_BACKLOG, G_SCHED, G_COUNT };
+
+static const sim_step_t gas_steps[G_COUNT] = {
+    [G_NVS]       = { "nvs", 0, 30, 30 },
+    [G_WIFI]      = { "wifi", BOOT_DEP(G_NVS), 60, 60 },
+    [G_MQTT]      = { "mqtt", BOOT_DEP(G_WIFI), 15, 15 },
+    [G_ADC]       = { "adc", 0, 15, 15 },
+    [G_CALIBRATE] = { "calibrate", BOOT_DEP(G_NVS) | BOOT_DEP(G_ADC), 10000, 5 },
+    [G_BACKLOG]   = { "backlog", BOOT_DEP(G_MQTT), 40, 40 },
+    [G_SCHED]     = { "sched", BOOT_DEP(G_ADC) | BOOT_DEP(G_BACKLOG) | BOOT_DEP(G_MQTT), 3, 3 },
+};
+
+static const int gas_old_order[G_COUNT] = { G_NVS, G_WIFI, G_MQTT, G_ADC, G_CALIBRATE, G_BACKLOG, G_SCHED };
+
+// Publishes on a 5 s grid from 100 ms after the scheduler starts, once R0
+// is known; backlogged readings from before the reboot are replayed on a
+// 1 s grid from 600 ms, as soon as the broker is connected
+static outcome_t gas_outcome(const int64_t *end_ms, bool warm, bool graph)
+{
+    (void)graph;
+    outcome_t o = { 0 };
+    int64_t sched = end_ms[G_SCHED];
+    int64_t connected = end_ms[G_MQTT] + (warm ? WIFI_WARM_MS : WIFI_COLD_MS) + MQTT_CONNECT_MS;
+    o.sample_ms = sched + 100;
+    while (o.sample_ms < end_ms[G_CALIBRATE])
+        o.sample_ms += 5000;
+    int64_t replay = sched + 600;
+    while (replay < connected)
+        replay += 1000;
+    o.upload_ms = replay + MQTT_ACK_MS;
+    return o;
+}
+
+typedef struct {
+    const char *name;
+    const sim_step_t *steps;
+    size_t n;
+    const int *old_order;
+    outcome_t (*outcome)(const int64_t *end_ms, bool warm, bool graph);
+} firmware_t;
+
+static bool run_firmware(const firmware_t *fw, bool warm, bool verbose)
+{
+    boot_step_config_t cfg[BOOT_GRAPH_MAX_STEPS];
+    boot_step_t steps[BOOT_GRAPH_MAX_STEPS];
+    int64_t dur[BOOT_GRAPH_MAX_STEPS], end_ms[BOOT_GRAPH_MAX_STEPS];
+    esp_err_t err[BOOT_GRAPH_MAX_STEPS] = { 0 };
+
+    // Old order: one after the other
+    int64_t t = 0;
+    for (size_t k = 0; k < fw->n; k++) {
+        int i = fw->old_order[k];
+        t += warm ? fw->steps[i].warm_ms : fw->steps[i].cold_ms;
+        end_ms[i] = t;
+    }
+    outcome_t old = fw->outcome(end_ms, warm, false);
+    old.boot_ms = t;
+
+    for (size_t i = 0; i < fw->n; i++) {
+        cfg[i] = (boot_step_config_t) { .name = fw->steps[i].name, .fn = noop, .deps = fw->steps[i].deps };
+        dur[i] = (warm ? fw->steps[i].warm_ms : fw->steps[i].cold_ms) * 1000;
+    }
+    boot_graph_t g;
+    if (boot_graph_init(&g, cfg, steps, fw->n, 0) != ESP_OK || !run_graph(&g, dur, err)) {
+        printf("%s: graph refused or run out of order\n", fw->name);
+        return false;
+    }
+    for (size_t i = 0; i < fw->n; i++)
+        end_ms[i] = g.steps[i].end_us / 1000;
+    outcome_t now = fw->outcome(end_ms, warm, true);
+    now.boot_ms = g.end_us / 1000;
+    uint32_t path;
+    int64_t critical = boot_graph_critical_path(&g, &path);
+
+    printf("%-8s %-5s  boot %6" PRId64 " -> %6" PRId64 " ms, first sample %6" PRId64 " -> %6" PRId64
+           " ms, first upload %6" PRId64 " -> %6" PRId64 " ms\n", fw->name, warm ? "warm" : "cold", old.boot_ms,
+           now.boot_ms, old.sample_ms, now.sample_ms, old.upload_ms, now.upload_ms);
+    if (verbose) {
+        for (size_t i = 0; i < fw->n; i++)
+            printf("    %c %-12s %6" PRId64 " - %6" PRId64 " ms\n", path & BOOT_DEP(i) ? '*' : ' ', steps[i].cfg.name,
+                   steps[i].start_us / 1000, steps[i].end_us / 1000);
+        printf("    critical path %" PRId64 " ms\n", critical / 1000);
+    }
+    return critical == g.end_us - g.start_us && now.boot_ms <= old.boot_ms && now.sample_ms <= old.sample_ms &&
+           now.upload_ms <= old.upload_ms;
+}
+
+int main(int argc, char **argv)
+{
+    long graphs = 10000;
+    unsigned seed = 1;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+        switch (opt) {
+            case 'n': graphs = strtol(optarg, NULL, 10); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n GRAPHS] [-s SEED] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    srand(seed);
+    bool ok = check_random(graphs);
+
+    static const firmware_t firmware[] = {
+        { "main", main_steps, M_COUNT, main_old_order, main_outcome },
+        { "GasNODE", gas_steps, G_COUNT, gas_old_order, gas_outcome },
+    };
+    printf("\nold order -> boot graph\n");
+    for (size_t f = 0; f < sizeof(firmware) / sizeof(firmware[0]); f++) {
+        ok &= run_firmware(&firmware[f], false, verbose);
+        ok &= run_firmware(&firmware[f], true, verbose);
+    }
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
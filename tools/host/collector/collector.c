@@ -0,0 +1,262 @@
+/*
+ * Subscribes to the nodes' MQTT topics and stores every reading in a
+ * tsdb directory, one compressed series per node and field.
+ *
+ *   collector [-h BROKER] [-p PORT] [-t FILTER] [-i CLIENT_ID] [-d DIR] [-f FLUSH_S]
+ *   collector -d DIR -l
+ *   collector -d DIR -x SERIES [-s FROM_MS] [-e TO_MS] [-r STEP_MS]
+ *
+ * Defaults: localhost:1883, filter esp32/sensors/#, client id
+ * cz-collector, directory ./tsdb, open blocks written every 10 s. The
+ * session is persistent (clean session off, QoS 1), so the broker keeps
+ * what arrives while the collector is down and delivers it on reconnect;
+ * connection losses are retried with a backoff of 1 s doubling to 30 s.
+ * Counters are printed every minute. SIGINT or SIGTERM flush and exit.
+ *
+ * -l lists the series with their point counts and bytes per point; -x
+ * prints a series as "ts_ms,value" lines, or with -r as
+ * "ts_ms,count,min,max,mean" lines per STEP_MS, read from the coarsest
+ * rollup (1 min, 1 h, 1 day) that divides the step.
+ */
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ingest.h"
+#include "mqtt_sub.h"
+#include "tsdb.h"
+
+#define KEEPALIVE_S     30
+#define CONNECT_TIMEOUT 5000
+#define POLL_MS         1000
+#define BACKOFF_MIN_MS  1000
+#define BACKOFF_MAX_MS  30000
+#define STATS_MS        60000
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int64_t wall_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int64_t mono_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void on_message(void *ctx, const char *topic, const uint8_t *payload, size_t len)
+{
+    ingest_t *in = ctx;
+    esp_err_t err = ingest_message(in, topic, payload, len, wall_ms());
+    if (err != ESP_OK)
+        fprintf(stderr, "%s: %zu byte message not stored: %s\n", topic, len, esp_err_to_name(err));
+}
+
+static void print_stats(const ingest_t *in, const tsdb_t *db, const mqtt_sub_t *m)
+{
+    printf("%" PRIu64 " messages (%" PRIu64 " frames, %" PRIu64 " JSON, %" PRIu64 " undecodable, %" PRIu64
+           " duplicates, %" PRIu64 " bad ages), %" PRIu64 " points stored, %" PRIu64 " rejected, %zu series, %" PRIu64
+           " blocks sealed, %" PRIu32 " acked\n",
+           in->stats.messages, in->stats.frames, in->stats.json, in->stats.undecodable, in->stats.duplicates,
+           in->stats.bad_age, in->stats.points, in->stats.rejected, db->n_series, db->stats.sealed, m->stats.acked);
+    fflush(stdout);
+}
+
+static int collect(tsdb_t *db, const char *host, int port, const char *filter, const char *client_id,
+                   int flush_s)
+{
+    static mqtt_sub_t m;
+    ingest_t in;
+    ingest_init(&in, db);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int64_t backoff = BACKOFF_MIN_MS, last_flush = mono_ms(), last_stats = last_flush;
+    while (!stop) {
+        esp_err_t err = mqtt_sub_connect(&m, host, port, client_id, false, KEEPALIVE_S, CONNECT_TIMEOUT);
+        if (err == ESP_OK)
+            err = mqtt_sub_subscribe(&m, filter, 1);
+        if (err != ESP_OK) {
+            fprintf(stderr, "%s:%d: %s, retrying in %" PRId64 " ms\n", host, port,
+                    err == ESP_ERR_NOT_SUPPORTED ? "refused" : esp_err_to_name(err), backoff);
+            mqtt_sub_close(&m);
+            for (int64_t t = mono_ms(); !stop && mono_ms() - t < backoff;)
+                usleep(100000);
+            backoff = backoff * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : backoff * 2;
+            continue;
+        }
+        printf("connected to %s:%d, subscribed to %s\n", host, port, filter);
+        backoff = BACKOFF_MIN_MS;
+
+        while (!stop && (err = mqtt_sub_poll(&m, POLL_MS, on_message, &in)) == ESP_OK) {
+            int64_t now = mono_ms();
+            if (now - last_flush >= flush_s * 1000LL) {
+                if (tsdb_flush(db, true) != ESP_OK)
+                    perror("tsdb_flush");
+                last_flush = now;
+            }
+            if (now - last_stats >= STATS_MS) {
+                print_stats(&in, db, &m);
+                last_stats = now;
+            }
+        }
+        if (err != ESP_OK)
+            fprintf(stderr, "connection lost: %s\n", esp_err_to_name(err));
+        mqtt_sub_close(&m);
+    }
+
+    print_stats(&in, db, &m);
+    ingest_free(&in);
+    return 0;
+}
+
+static void count_point(void *ctx, int64_t ts_ms, double value)
+{
+    (void)ts_ms;
+    (void)value;
+    (*(uint64_t *)ctx)++;
+}
+
+static void print_point(void *ctx, int64_t ts_ms, double value)
+{
+    (void)ctx;
+    printf("%" PRId64 ",%.17g\n", ts_ms, value);
+}
+
+static void print_bucket(void *ctx, const tsdb_bucket_t *b)
+{
+    (void)ctx;
+    printf("%" PRId64 ",%" PRIu32 ",%.17g,%.17g,%.17g\n", b->ts_ms, b->count, b->min, b->max, b->mean);
+}
+
+static int list(tsdb_t *db)
+{
+    for (size_t i = 0; i < db->n_series; i++) {
+        const tsdb_series_t *s = &db->series[i];
+        uint64_t n = 0;
+        esp_err_t err = tsdb_query(db, i, INT64_MIN, INT64_MAX, count_point, &n);
+        int64_t first = s->n_blocks ? s->blocks[0].first_ts : s->open->first_ts;
+        int64_t last = s->open->count ? s->open->last_ts : s->n_blocks ? s->blocks[s->n_blocks - 1].last_ts : 0;
+        uint64_t bytes = s->file_bytes + TSDB_BLOCK_HEADER + (s->open->ts_bits + 7) / 8 +
+                         (s->open->val_bits + 7) / 8;
+        printf("%-48s %8" PRIu64 " points %6zu blocks %6.2f bytes/point  %" PRId64 "..%" PRId64 "%s\n", s->name,
+               n, s->n_blocks, n ? (double)bytes / n : 0.0, first, last,
+               err == ESP_OK ? "" : "  DAMAGED");
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "localhost", *filter = "esp32/sensors/#", *client_id = "cz-collector", *dir = "tsdb";
+    const char *dump = NULL;
+    int port = 1883, flush_s = 10;
+    int64_t from = INT64_MIN, to = INT64_MAX, step = 0;
+    bool do_list = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:t:i:d:f:lx:s:e:r:")) != -1) {
+        switch (opt) {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                filter = optarg;
+                break;
+            case 'i':
+                client_id = optarg;
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'f':
+                flush_s = atoi(optarg);
+                break;
+            case 'l':
+                do_list = true;
+                break;
+            case 'x':
+                dump = optarg;
+                break;
+            case 's':
+                from = strtoll(optarg, NULL, 10);
+                break;
+            case 'e':
+                to = strtoll(optarg, NULL, 10);
+                break;
+            case 'r':
+                step = strtoll(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-h BROKER] [-p PORT] [-t FILTER] [-i CLIENT_ID] [-d DIR] [-f FLUSH_S]\n"
+                        "       %s -d DIR -l\n"
+                        "       %s -d DIR -x SERIES [-s FROM_MS] [-e TO_MS] [-r STEP_MS]\n",
+                        argv[0], argv[0], argv[0]);
+                return 2;
+        }
+    }
+    if (port <= 0 || port > 65535 || flush_s <= 0 || step < 0) {
+        fprintf(stderr, "bad port, flush interval or step\n");
+        return 2;
+    }
+
+    // Reading must not create the directory or the series
+    struct stat st;
+    if ((do_list || dump) && stat(dir, &st)) {
+        perror(dir);
+        return 1;
+    }
+    tsdb_t db;
+    if (tsdb_open(&db, dir) != ESP_OK) {
+        perror(dir);
+        return 1;
+    }
+
+    int ret;
+    if (do_list) {
+        ret = list(&db);
+    } else if (dump) {
+        size_t id = 0;
+        while (id < db.n_series && strcmp(db.series[id].name, dump))
+            id++;
+        if (id == db.n_series) {
+            fprintf(stderr, "%s: no such series\n", dump);
+            ret = 1;
+        } else {
+            esp_err_t err = step ? tsdb_range(&db, id, from, to, step, print_bucket, NULL)
+                                 : tsdb_query(&db, id, from, to, print_point, NULL);
+            if (err != ESP_OK)
+                fprintf(stderr, "%s: %s\n", dump, esp_err_to_name(err));
+            ret = err != ESP_OK;
+        }
+    } else {
+        ret = collect(&db, host, port, filter, client_id, flush_s);
+    }
+
+    if (tsdb_close(&db) != ESP_OK) {
+        perror("tsdb_close");
+        ret = 1;
+    }
+    return ret;
+}
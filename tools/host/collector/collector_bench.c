@@ -0,0 +1,494 @@
+/*
+ * Storage size and ingest speed of the collector.
+ *
+ *   collector_bench [-n POINTS] [-k NODES] [-m MESSAGES] [-s SEED]
+ *
+ * Store: POINTS (default 200000) readings per series for the six series
+ * of a gas and an environment node, a 5 s period with up to 20 ms of
+ * jitter and values wandering like the real ones at their reported
+ * precision, plus a series stuck at one value. They are appended
+ * interleaved, as they arrive, into a fresh tsdb directory; the store is
+ * closed, a torn block is added to one file, the store is opened again
+ * and every point must read back exactly, the torn block cut off.
+ * Reported: append and read rates, and bytes per point per series
+ * against 16 bytes for a raw (int64, double) pair.
+ *
+ * MQTT: a broker stand-in on the loopback sends MESSAGES (default 20000)
+ * telem_codec frames for each of NODES gas and NODES environment nodes
+ * (default 4) on per-node topics, with delta frames and every 100th
+ * message delivered twice, as QoS 1 PUBLISH packets; the collector's
+ * subscriber and ingest path store them. Every series must end up with
+ * MESSAGES points equal to what was encoded, the copies skipped.
+ * Reported: messages and points per second end to end.
+ */
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ingest.h"
+#include "mqtt_sub.h"
+#include "telem_codec.h"
+#include "tsdb.h"
+
+#define PERIOD_MS    5000
+#define JITTER_MS    20
+#define KEY_INTERVAL 10
+#define DUP_EVERY    100
+#define N_SERIES     7
+
+static uint32_t rng_state = 1;
+
+static double rnd(void)
+{
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return (rng_state >> 8) / 16777216.0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double quantize(double v, int decimals)
+{
+    double scale = pow(10, decimals);
+    return round(v * scale) / scale;
+}
+
+static void remove_dir(const char *dir)
+{
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd))
+        fprintf(stderr, "could not remove %s\n", dir);
+}
+
+// --- Store ----------------------------------------------------------------
+
+typedef struct
+{
+    const char *name;
+    int decimals;
+    double v;
+    double step;               //!< Random walk step
+    double lo, hi;
+} series_gen_t;
+
+static series_gen_t gens[N_SERIES] = {
+    { "bench.gas.co2", 2, 600, 20, 400, 2000 },
+    { "bench.gas.ch4", 2, 4, 0.2, 0, 50 },
+    { "bench.gas.co", 2, 1.5, 0.1, 0, 50 },
+    { "bench.env.temperature", 2, 22.5, 0.1, -20, 50 },
+    { "bench.env.pressure", 2, 1013.2, 0.05, 900, 1100 },
+    { "bench.env.humidity", 1, 45, 0.4, 0, 100 },
+    { "bench.stuck", 2, 0, 0, 0, 0 },
+};
+
+typedef struct
+{
+    int64_t *ts;
+    double *v;
+    long n;
+    long next;
+    bool bad;
+} expect_t;
+
+static void check_point(void *ctx, int64_t ts_ms, double value)
+{
+    expect_t *e = ctx;
+    if (e->next >= e->n || (e->ts && e->ts[e->next] != ts_ms) || memcmp(&e->v[e->next], &value, sizeof(value)))
+        e->bad = true;
+    e->next++;
+}
+
+static bool bench_store(long n)
+{
+    char dir[] = "/tmp/collector_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return false;
+    }
+
+    expect_t exp[N_SERIES];
+    for (int s = 0; s < N_SERIES; s++) {
+        exp[s] = (expect_t) { malloc(n * sizeof(int64_t)), malloc(n * sizeof(double)), n, 0, false };
+        int64_t t = 1700000000000LL + s * 777;
+        for (long i = 0; i < n; i++) {
+            series_gen_t *g = &gens[s];
+            g->v = fmin(fmax(g->v + (rnd() - 0.5) * g->step, g->lo), g->hi);
+            t += PERIOD_MS + (int64_t)(rnd() * 2 * JITTER_MS) - JITTER_MS;
+            exp[s].ts[i] = t;
+            exp[s].v[i] = quantize(g->v, g->decimals);
+        }
+    }
+
+    tsdb_t db;
+    size_t id[N_SERIES];
+    bool ok = tsdb_open(&db, dir) == ESP_OK;
+    for (int s = 0; ok && s < N_SERIES; s++)
+        ok = tsdb_series(&db, gens[s].name, &id[s]) == ESP_OK;
+    if (!ok) {
+        perror(dir);
+        return false;
+    }
+
+    double t0 = now_s();
+    for (long i = 0; i < n; i++)
+        for (int s = 0; s < N_SERIES; s++)
+            ok &= tsdb_append(&db, id[s], exp[s].ts[i], exp[s].v[i]) == ESP_OK;
+    double append_s = now_s() - t0;
+    ok &= tsdb_close(&db) == ESP_OK;
+    printf("append: %ld points in %.3f s, %.2f M points/s\n", n * N_SERIES, append_s, n * N_SERIES / append_s / 1e6);
+
+    // A block torn by a crash in the middle of sealing it
+    char path[400];
+    snprintf(path, sizeof(path), "%s/%s.tsb", dir, gens[0].name);
+    FILE *f = fopen(path, "ab");
+    fwrite("TSB1 torn", 1, 9, f);
+    fclose(f);
+
+    ok &= tsdb_open(&db, dir) == ESP_OK && db.n_series == N_SERIES;
+    printf("reopen: %zu series, %" PRIu64 " torn block cut off\n", db.n_series, db.stats.torn);
+    ok &= db.stats.torn == 1;
+
+    uint64_t total_bytes = 0;
+    t0 = now_s();
+    for (int s = 0; ok && s < N_SERIES; s++) {
+        ok &= tsdb_series(&db, gens[s].name, &id[s]) == ESP_OK &&
+              tsdb_query(&db, id[s], INT64_MIN, INT64_MAX, check_point, &exp[s]) == ESP_OK;
+    }
+    double read_s = now_s() - t0;
+    printf("read:   %ld points in %.3f s, %.2f M points/s\n", n * N_SERIES, read_s, n * N_SERIES / read_s / 1e6);
+
+    printf("%-24s %10s %12s\n", "series", "bytes", "bytes/point");
+    for (int s = 0; ok && s < N_SERIES; s++) {
+        const tsdb_series_t *se = &db.series[id[s]];
+        uint64_t bytes = se->file_bytes + (se->open->count ? TSDB_BLOCK_HEADER + (se->open->ts_bits + 7) / 8 +
+                                                                 (se->open->val_bits + 7) / 8 : 0);
+        total_bytes += bytes;
+        printf("%-24s %10" PRIu64 " %12.2f%s\n", gens[s].name, bytes, (double)bytes / n,
+               exp[s].bad || exp[s].next != n ? "  READ BACK WRONG" : "");
+        ok &= !exp[s].bad && exp[s].next == n;
+    }
+    printf("%-24s %10" PRIu64 " %12.2f  (raw 16.00, %.1fx smaller)\n", "all", total_bytes,
+           (double)total_bytes / (n * N_SERIES), 16.0 * n * N_SERIES / total_bytes);
+
+    // A range inside one block
+    long from = n / 2, to = n / 2 + 100;
+    expect_t part = exp[3];
+    part.next = from;
+    ok &= tsdb_query(&db, id[3], exp[3].ts[from], exp[3].ts[to], check_point, &part) == ESP_OK && !part.bad &&
+          part.next == to;
+
+    tsdb_close(&db);
+    for (int s = 0; s < N_SERIES; s++) {
+        free(exp[s].ts);
+        free(exp[s].v);
+    }
+    remove_dir(dir);
+    return ok;
+}
+
+// --- MQTT -----------------------------------------------------------------
+
+typedef struct
+{
+    char topic[64];
+    const telem_schema_t *schema;
+    telem_enc_t enc;
+    double v[3];
+    uint32_t seq;
+    double *expect;            //!< Values as stored, message by message
+} node_t;
+
+typedef struct
+{
+    int lfd;
+    node_t *nodes;
+    int n_nodes;
+    long messages;             //!< Per node
+    long sent;                 //!< Packets, copies included
+    long acks;
+} broker_t;
+
+static void read_exact(int fd, uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+// Skips one packet from the client
+static uint8_t read_packet(int fd)
+{
+    uint8_t type, b;
+    size_t len = 0;
+    int shift = 0;
+    read_exact(fd, &type, 1);
+    do {
+        read_exact(fd, &b, 1);
+        len |= (size_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    uint8_t body[512];
+    while (len) {
+        size_t n = len < sizeof(body) ? len : sizeof(body);
+        read_exact(fd, body, n);
+        len -= n;
+    }
+    return type;
+}
+
+typedef struct
+{
+    int fd;
+    long *acks;
+    long want;
+} ack_reader_t;
+
+static void *ack_thread(void *arg)
+{
+    ack_reader_t *a = arg;
+    while (*a->acks < a->want) {
+        uint8_t ack[4];
+        read_exact(a->fd, ack, sizeof(ack));
+        if (ack[0] != 0x40)
+            break;
+        (*a->acks)++;
+    }
+    return NULL;
+}
+
+static size_t put_publish(uint8_t *p, const char *topic, const uint8_t *payload, size_t len, uint16_t id, bool dup)
+{
+    size_t tlen = strlen(topic), rem = 2 + tlen + 2 + len, n = 0;
+    p[n++] = 0x32 | (dup ? 0x08 : 0);
+    do {
+        p[n] = rem & 0x7f;
+        rem >>= 7;
+        if (rem)
+            p[n] |= 0x80;
+        n++;
+    } while (rem);
+    p[n++] = tlen >> 8;
+    p[n++] = tlen;
+    memcpy(p + n, topic, tlen);
+    n += tlen;
+    p[n++] = id >> 8;
+    p[n++] = id;
+    memcpy(p + n, payload, len);
+    return n + len;
+}
+
+static void *broker_thread(void *arg)
+{
+    broker_t *b = arg;
+    int fd = accept(b->lfd, NULL, NULL);
+    read_packet(fd);                                       // CONNECT
+    send(fd, "\x20\x02\x00\x00", 4, MSG_NOSIGNAL);
+    read_packet(fd);                                       // SUBSCRIBE
+    send(fd, "\x90\x03\x00\x01\x01", 5, MSG_NOSIGNAL);
+
+    long copies = b->n_nodes * (b->messages / DUP_EVERY);
+    ack_reader_t a = { fd, &b->acks, b->n_nodes * b->messages + copies };
+    pthread_t t;
+    pthread_create(&t, NULL, ack_thread, &a);
+
+    // Round robin over the nodes, in batches of packets per send
+    static uint8_t batch[64 * 1024];
+    size_t len = 0;
+    uint16_t id = 1;
+    for (long i = 0; i < b->messages; i++) {
+        for (int k = 0; k < b->n_nodes; k++) {
+            node_t *nd = &b->nodes[k];
+            for (int f = 0; f < 3; f++)
+                nd->v[f] = fmax(nd->v[f] + (rnd() - 0.5) * (f ? 0.2 : 10), 0);
+            float v[3] = { nd->v[0], nd->v[1], nd->v[2] };
+            for (int f = 0; f < 3; f++) {
+                double scale = pow(10, nd->schema->decimals[f]);
+                nd->expect[i * 3 + f] = lrint((double)v[f] * scale) / scale;
+            }
+            uint32_t seq = nd->seq++;
+            uint8_t frame[TELEM_FRAME_MAX];
+            size_t flen;
+            telem_encode(&nd->enc, v, &seq, NULL, frame, sizeof(frame), &flen);
+            for (int copy = 0; copy <= (i % DUP_EVERY == DUP_EVERY - 1); copy++) {
+                len += put_publish(batch + len, nd->topic, frame, flen, id, copy);
+                id = id == 0xffff ? 1 : id + 1;
+                b->sent++;
+            }
+            if (len > sizeof(batch) - 256) {
+                send(fd, batch, len, MSG_NOSIGNAL);
+                len = 0;
+            }
+        }
+    }
+    send(fd, batch, len, MSG_NOSIGNAL);
+    pthread_join(t, NULL);
+    close(fd);
+    return NULL;
+}
+
+typedef struct
+{
+    ingest_t *in;
+    int64_t now_ms;
+    int n_nodes;
+} sink_t;
+
+// Arrival times on the nodes' 5 s grid, so consecutive points of a series
+// never share a millisecond
+static void on_message(void *ctx, const char *topic, const uint8_t *payload, size_t len)
+{
+    sink_t *s = ctx;
+    s->now_ms += PERIOD_MS / s->n_nodes / 2;
+    ingest_message(s->in, topic, payload, len, s->now_ms);
+}
+
+static bool bench_mqtt(int nodes_per_type, long messages)
+{
+    char dir[] = "/tmp/collector_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return false;
+    }
+
+    int n_nodes = 2 * nodes_per_type;
+    node_t *nodes = calloc(n_nodes, sizeof(node_t));
+    for (int k = 0; k < n_nodes; k++) {
+        bool gas = k < nodes_per_type;
+        nodes[k].schema = telem_schema_find(gas ? TELEM_SCHEMA_GAS : TELEM_SCHEMA_ENV);
+        telem_enc_init(&nodes[k].enc, nodes[k].schema, KEY_INTERVAL);
+        snprintf(nodes[k].topic, sizeof(nodes[k].topic), "esp32/sensors/%s/a4cf12f0%04x", gas ? "gas" : "env", k);
+        nodes[k].v[0] = gas ? 600 : 22.5;
+        nodes[k].v[1] = gas ? 4 : 1013.2;
+        nodes[k].v[2] = gas ? 1.5 : 45;
+        nodes[k].expect = malloc(messages * 3 * sizeof(double));
+    }
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t alen = sizeof(addr);
+    bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+    listen(lfd, 1);
+    getsockname(lfd, (struct sockaddr *)&addr, &alen);
+
+    broker_t b = { .lfd = lfd, .nodes = nodes, .n_nodes = n_nodes, .messages = messages };
+    pthread_t t;
+    pthread_create(&t, NULL, broker_thread, &b);
+
+    tsdb_t db;
+    ingest_t in;
+    static mqtt_sub_t m;
+    bool ok = tsdb_open(&db, dir) == ESP_OK;
+    ingest_init(&in, &db);
+    sink_t sink = { &in, 1700000000000LL, n_nodes };
+    ok &= mqtt_sub_connect(&m, "127.0.0.1", ntohs(addr.sin_port), "bench", false, 30, 1000) == ESP_OK &&
+          mqtt_sub_subscribe(&m, "esp32/sensors/#", 1) == ESP_OK;
+
+    long want = n_nodes * messages + n_nodes * (messages / DUP_EVERY);
+    double t0 = now_s();
+    while (ok && m.stats.messages < want)
+        ok &= mqtt_sub_poll(&m, 1000, on_message, &sink) == ESP_OK;
+    double dt = now_s() - t0;
+    mqtt_sub_close(&m);
+    pthread_join(t, NULL);
+    close(lfd);
+
+    printf("mqtt: %" PRIu32 " messages (%" PRIu64 " copies skipped), %.0f messages/s, %.2f M points/s, "
+           "%.1f MB/s\n",
+           m.stats.messages, in.stats.duplicates, m.stats.messages / dt, in.stats.points / dt / 1e6,
+           m.stats.bytes / dt / 1e6);
+    ok &= in.stats.undecodable == 0 && in.stats.rejected == 0 &&
+          in.stats.duplicates == (uint64_t)(n_nodes * (messages / DUP_EVERY)) &&
+          in.stats.points == (uint64_t)n_nodes * messages * 3 && m.stats.acked == m.stats.messages;
+
+    size_t series = db.n_series;
+    uint64_t points = 0;
+    for (size_t i = 0; i < series; i++)
+        points += db.series[i].points;
+    printf("stored: %zu series, %" PRIu64 " points, %" PRIu64 " undecodable, %" PRIu64 " rejected\n", series,
+           points, in.stats.undecodable, in.stats.rejected);
+    ok &= series == (size_t)n_nodes * 3 && points == (uint64_t)n_nodes * messages * 3;
+
+    // Values as encoded, in order
+    int wrong = 0;
+    double *v = malloc(messages * sizeof(double));
+    for (int k = 0; k < n_nodes; k++) {
+        for (int f = 0; f < 3; f++) {
+            for (long i = 0; i < messages; i++)
+                v[i] = nodes[k].expect[i * 3 + f];
+            char name[TSDB_NAME_MAX];
+            snprintf(name, sizeof(name), "%s.%s", nodes[k].topic, nodes[k].schema->name[f]);
+            for (char *p = name; *p; p++)
+                *p = *p == '/' ? '.' : *p;
+            size_t id;
+            expect_t e = { NULL, v, messages, 0, false };
+            if (tsdb_series(&db, name, &id) != ESP_OK || tsdb_query(&db, id, INT64_MIN, INT64_MAX, check_point, &e) ||
+                e.bad || e.next != messages)
+                wrong++;
+        }
+        free(nodes[k].expect);
+    }
+    free(v);
+    printf("values: %d of %d series differ from what was encoded\n", wrong, n_nodes * 3);
+    ok &= !wrong;
+
+    ingest_free(&in);
+    tsdb_close(&db);
+    free(nodes);
+    remove_dir(dir);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    long n = 200000, messages = 20000;
+    int nodes = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:k:m:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n = atol(optarg);
+                break;
+            case 'k':
+                nodes = atoi(optarg);
+                break;
+            case 'm':
+                messages = atol(optarg);
+                break;
+            case 's':
+                rng_state = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n POINTS] [-k NODES] [-m MESSAGES] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (n < 200 || nodes < 1 || nodes > 1000 || messages < 1) {
+        fprintf(stderr, "bad sizes\n");
+        return 2;
+    }
+
+    bool ok = bench_store(n);
+    ok &= bench_mqtt(nodes, messages);
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1177 @@
+/*
+ * A fleet of simulated MQTT nodes against a broker and a collector.
+ *
+ *   fleet_sim [-n NODES] [-p PERIOD_MS] [-t SECONDS] [-w THREADS] [-k KEY_INTERVAL] [-j]
+ *             [-d MEAN_UP_S] [-o MAX_OUTAGE_S] [-B BLACKOUT_S [-R]] [-q QUEUE_KB] [-c]
+ *             [-h BROKER] [-P PORT] [-s SEED]
+ *
+ * NODES (default 1000) virtual nodes, half gas and half environment, each
+ * with its own TCP connection, run the publishing path of GasNODE.c and
+ * TempNODE.c: a reading every PERIOD_MS (default 5000, random phase) with
+ * sensor-like noise goes into a backlog and is sent from there oldest
+ * first through the real mqtt_pub window (8 QoS 1 messages in flight), a
+ * few at a time, released only once acknowledged; payloads are the real
+ * telem_codec frames with sequence number and age (-k KEY_INTERVAL adds
+ * delta frames, -j sends the JSON the nodes used to send). The backlog is
+ * kept in RAM in place of the flash log and holds as many readings as
+ * the telemetry partition does. The client side behaves like esp-mqtt:
+ * messages stay in its outbox across disconnects and go again after a
+ * reconnect, expire after 30 s, and a lost connection is retried every
+ * 10 s.
+ *
+ * Each node's Wi-Fi drops now and then (every MEAN_UP_S on average,
+ * default 600, 0 = never) for 1 s to MAX_OUTAGE_S (default 30); with -B
+ * the broker goes away for BLACKOUT_S halfway through, dropping every
+ * connection, so all nodes reconnect at once. With -R as well every node
+ * restarts once in the first half of the blackout, with its backlog
+ * pending: the client's outbox is gone, the backlog stays, and it is
+ * down for 1 to 3 s. Its readings of the earlier boot are then aged the
+ * way mqtt_backlog does it, placed right before the new boot.
+ *
+ * The broker is a stand-in on the loopback (mqtt_broker, QUEUE_KB send
+ * queue per client, default 256) unless -h BROKER [-P PORT] names a real
+ * one. A subscriber like the collector's takes every message at QoS 1;
+ * with -c it also stores them through the collector's ingest path into a
+ * temporary tsdb directory.
+ *
+ * Readings are sampled for SECONDS (default 60), then the fleet gets time
+ * to deliver its backlogs. Reported: readings produced, delivered,
+ * duplicated and lost, and where they were lost; reconnects; broker and
+ * subscriber load; percentiles of the age of readings on arrival and of
+ * the time from the last publish to arrival. Fails when a reading is lost
+ * other than to a full node backlog, or with -c when the collector
+ * rejects a point or an age.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "ingest.h"
+#include "mqtt_broker.h"
+#include "mqtt_pub.h"
+#include "mqtt_sub.h"
+#include "telem_codec.h"
+#include "tsdb.h"
+
+// Node firmware
+#define MAX_INFLIGHT     8
+#define REPLAY_PERIOD_US 1000000
+#define REPLAY_PER_RUN   5
+#define BACKLOG_MAX      8192       // Readings the telemetry partition holds
+// esp-mqtt defaults
+#define RECONNECT_US     10000000
+#define NETWORK_TIMEOUT  10000000
+#define OUTBOX_EXPIRE_US 30000000
+#define KEEPALIVE_S      120
+
+#define MAC_PREFIX       "a4cf12"
+#define OUT_PKT_MAX      192
+#define NODE_TX_SIZE     (MAX_INFLIGHT * OUT_PKT_MAX + 64)
+#define SUB_FILTER       "esp32/sensors/#"
+#define DRAIN_EXTRA_S    60
+#define RUN_MAX_S        3600        // Publish times are kept as 32-bit microseconds
+
+// --- Time and randomness ----------------------------------------------------
+
+static int64_t t0_us;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - t0_us;
+}
+
+static int64_t wall_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static double cpu_s(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng_next(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static double uniform(uint32_t *s)
+{
+    return (rng_next(s) >> 8) / 16777216.0;
+}
+
+static double gauss(uint32_t *s)
+{
+    double u = uniform(s) + 1e-12, v = uniform(s);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// --- Fleet ------------------------------------------------------------------
+
+// Mean, random walk step and reading noise per field
+typedef struct
+{
+    double mean, walk, noise;
+} field_model_t;
+
+static const field_model_t gas_model[3] = { { 420, 2, 3 }, { 2, 0.05, 0.05 }, { 0.5, 0.02, 0.03 } };
+static const field_model_t env_model[3] = { { 22, 0.05, 0.1 }, { 1013, 0.05, 0.05 }, { 45, 0.2, 0.5 } };
+
+typedef enum { NODE_OFF, NODE_WAIT, NODE_CONNECTING, NODE_CONNACK, NODE_UP } node_state_t;
+
+typedef struct
+{
+    int64_t sample_ms;         // Current boot's clock; < 0 for earlier boots
+    float v[3];
+} reading_t;
+
+// Client outbox entry
+typedef struct
+{
+    int msg_id;
+    int64_t first_us;
+    size_t len;
+    uint8_t pkt[OUT_PKT_MAX];
+} out_msg_t;
+
+typedef struct fleet fleet_t;
+
+typedef struct
+{
+    fleet_t *f;
+    size_t index;
+    char topic[48];
+    const field_model_t *model;
+    telem_enc_t enc;
+    mqtt_pub_t pub;
+    uint32_t rng;
+    double level[3];
+
+    // Link and client
+    node_state_t state;
+    int fd;
+    int64_t wake_us;           // Boot, retry or CONNACK deadline
+    int64_t boot_us;
+    int64_t reboot_us;
+    int64_t link_up_us;        // Wi-Fi is down until then
+    int64_t next_drop_us;
+    int64_t next_sample_us;
+    int64_t next_replay_us;
+    int64_t last_tx_us;
+    uint16_t next_id;
+    out_msg_t box[MAX_INFLIGHT];
+    size_t n_box;
+    uint8_t tx[NODE_TX_SIZE];
+    size_t tx_len;
+    uint8_t rx[64];
+    size_t rx_len;
+
+    // Backlog, readings tail..head-1 by sequence number
+    reading_t *ring;
+    uint32_t ring_cap;         // Power of two
+    uint32_t head, tail, cursor;
+    struct { uint32_t seq; bool acked; } replay[MAX_INFLIGHT];
+    size_t n_replay;
+
+    // Per reading, indexed by sequence number
+    uint32_t *sample_us;       // Written here, read by the subscriber
+    uint32_t *pub_us;          // Last handed to the client
+    uint8_t *overwritten;      // Lost to a full backlog
+    uint8_t *got;              // Written by the subscriber
+
+    uint32_t link_drops, connects, failed_connects, conn_lost, reboots;
+} node_t;
+
+struct fleet
+{
+    // Options
+    size_t n_nodes;
+    int64_t period_us;
+    int64_t end_us;            // Sampling stops
+    uint32_t key_interval;
+    bool json;
+    double mean_up_s;
+    double max_outage_s;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    node_t *nodes;
+    uint32_t slots;            // Readings per node at most
+    bool done;                 // Atomic, workers stop
+
+    // Atomic counters
+    uint64_t produced;
+    uint64_t overwritten;
+    uint64_t delivered;
+    uint32_t connected;
+};
+
+// --- Node client ----------------------------------------------------------
+
+static bool tx_put(node_t *nd, const uint8_t *data, size_t len)
+{
+    if (nd->tx_len + len > sizeof(nd->tx))
+        return false;
+    memcpy(nd->tx + nd->tx_len, data, len);
+    nd->tx_len += len;
+    return true;
+}
+
+static void disconnect(node_t *nd, int64_t now, int64_t retry_us);
+
+static void flush_tx(node_t *nd, int64_t now)
+{
+    while (nd->tx_len && nd->fd >= 0) {
+        ssize_t n = send(nd->fd, nd->tx, nd->tx_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0) {
+            nd->conn_lost++;
+            disconnect(nd, now, now + RECONNECT_US);
+            return;
+        }
+        memmove(nd->tx, nd->tx + n, nd->tx_len - n);
+        nd->tx_len -= n;
+        nd->last_tx_us = now;
+    }
+}
+
+// mqtt_pub's send hook: esp_mqtt_client_publish() on the node
+static int client_publish(void *ctx, const char *topic, const char *data, size_t len, int qos)
+{
+    node_t *nd = ctx;
+    size_t tlen = strlen(topic), rem = 2 + tlen + (qos ? 2 : 0) + len;
+    if (nd->state != NODE_UP || nd->n_box == MAX_INFLIGHT || rem + 3 > OUT_PKT_MAX)
+        return -1;
+
+    out_msg_t *m = &nd->box[nd->n_box];
+    size_t n = 0;
+    m->pkt[n++] = 0x30 | qos << 1;
+    do {
+        m->pkt[n] = rem & 0x7f;
+        rem >>= 7;
+        if (rem)
+            m->pkt[n] |= 0x80;
+        n++;
+    } while (rem);
+    m->pkt[n++] = tlen >> 8;
+    m->pkt[n++] = tlen;
+    memcpy(m->pkt + n, topic, tlen);
+    n += tlen;
+    if (!++nd->next_id)
+        nd->next_id = 1;
+    if (qos) {
+        m->pkt[n++] = nd->next_id >> 8;
+        m->pkt[n++] = nd->next_id;
+    }
+    memcpy(m->pkt + n, data, len);
+    m->len = n + len;
+    if (!tx_put(nd, m->pkt, m->len))
+        return -1;
+    if (qos) {
+        m->msg_id = nd->next_id;
+        m->first_us = now_us();
+        nd->n_box++;
+    }
+    return nd->next_id;
+}
+
+static void disconnect(node_t *nd, int64_t now, int64_t retry_us)
+{
+    if (nd->fd >= 0)
+        close(nd->fd);
+    nd->fd = -1;
+    if (nd->state == NODE_UP) {
+        mqtt_pub_set_connected(&nd->pub, false);
+        __atomic_sub_fetch(&nd->f->connected, 1, __ATOMIC_RELAXED);
+    }
+    nd->state = NODE_WAIT;
+    nd->wake_us = retry_us;
+    nd->tx_len = nd->rx_len = 0;
+    (void)now;
+}
+
+static void start_connect(node_t *nd, int64_t now)
+{
+    fleet_t *f = nd->f;
+    if (now < nd->link_up_us) {
+        // No network yet; esp-mqtt tries again after its reconnect timeout
+        nd->failed_connects++;
+        nd->state = NODE_WAIT;
+        nd->wake_us = now + RECONNECT_US;
+        return;
+    }
+    nd->fd = socket(f->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (nd->fd < 0) {
+        nd->failed_connects++;
+        disconnect(nd, now, now + RECONNECT_US);
+        return;
+    }
+    int one = 1;
+    setsockopt(nd->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(nd->fd, (struct sockaddr *)&f->addr, f->addr_len) && errno != EINPROGRESS) {
+        nd->failed_connects++;
+        disconnect(nd, now, now + RECONNECT_US);
+        return;
+    }
+    nd->state = NODE_CONNECTING;
+    nd->wake_us = now + NETWORK_TIMEOUT;
+}
+
+static void send_connect(node_t *nd, int64_t now)
+{
+    char id[32];
+    int idlen = snprintf(id, sizeof(id), "fleet-%s", nd->topic + strlen(nd->topic) - 12);
+    uint8_t pkt[64];
+    size_t n = 0;
+    pkt[n++] = 0x10;
+    pkt[n++] = 10 + 2 + idlen;
+    memcpy(pkt + n, "\x00\x04MQTT\x04\x02", 8);  // Clean session, as esp-mqtt by default
+    n += 8;
+    pkt[n++] = KEEPALIVE_S >> 8;
+    pkt[n++] = KEEPALIVE_S & 0xff;
+    pkt[n++] = 0;
+    pkt[n++] = idlen;
+    memcpy(pkt + n, id, idlen);
+    n += idlen;
+    tx_put(nd, pkt, n);
+    nd->state = NODE_CONNACK;
+    flush_tx(nd, now);
+}
+
+static void on_connack(node_t *nd, int64_t now)
+{
+    nd->state = NODE_UP;
+    nd->connects++;
+    __atomic_add_fetch(&nd->f->connected, 1, __ATOMIC_RELAXED);
+    // The outbox goes again, marked as duplicates
+    for (size_t i = 0; i < nd->n_box; i++) {
+        nd->box[i].pkt[0] |= 0x08;
+        tx_put(nd, nd->box[i].pkt, nd->box[i].len);
+    }
+    mqtt_pub_set_connected(&nd->pub, true);
+    flush_tx(nd, now);
+}
+
+static void on_puback(node_t *nd, int msg_id)
+{
+    for (size_t i = 0; i < nd->n_box; i++) {
+        if (nd->box[i].msg_id == msg_id) {
+            nd->box[i] = nd->box[--nd->n_box];
+            mqtt_pub_done(&nd->pub, msg_id, true);
+            return;
+        }
+    }
+}
+
+static void node_read(node_t *nd, int64_t now)
+{
+    while (nd->fd >= 0) {
+        ssize_t n = recv(nd->fd, nd->rx + nd->rx_len, sizeof(nd->rx) - nd->rx_len, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0) {
+            if (nd->state == NODE_UP)
+                nd->conn_lost++;
+            else
+                nd->failed_connects++;
+            disconnect(nd, now, now + RECONNECT_US);
+            return;
+        }
+        nd->rx_len += n;
+
+        // Only CONNACK, PUBACK and PINGRESP come back, all short
+        size_t off = 0;
+        while (nd->rx_len - off >= 2 && nd->rx_len - off >= 2u + nd->rx[off + 1]) {
+            const uint8_t *p = nd->rx + off;
+            if (p[0] == 0x20 && p[1] == 2 && nd->state == NODE_CONNACK) {
+                if (p[3]) {
+                    nd->failed_connects++;
+                    disconnect(nd, now, now + RECONNECT_US);
+                    return;
+                }
+                on_connack(nd, now);
+            } else if (p[0] == 0x40 && p[1] == 2) {
+                on_puback(nd, p[2] << 8 | p[3]);
+            } else if (p[0] != 0xd0) {
+                nd->conn_lost++;
+                disconnect(nd, now, now + RECONNECT_US);
+                return;
+            }
+            off += 2 + p[1];
+        }
+        nd->rx_len -= off;
+        memmove(nd->rx, nd->rx + off, nd->rx_len);
+    }
+}
+
+// --- Node firmware --------------------------------------------------------
+
+static size_t encode_payload(node_t *nd, uint8_t *buf, size_t size, const reading_t *r, uint32_t seq, int64_t now)
+{
+    uint32_t age_ms = (now - nd->boot_us) / 1000 - r->sample_ms;
+    size_t len = 0;
+    telem_encode(&nd->enc, r->v, &seq, &age_ms, buf, size, &len);
+    if (!nd->f->json)
+        return len;
+
+    // The JSON of the same reading
+    telem_dec_t dec;
+    telem_frame_t frame;
+    telem_dec_init(&dec);
+    telem_enc_t e = nd->enc;
+    telem_enc_reset(&e);
+    uint8_t abs[TELEM_FRAME_MAX];
+    telem_encode(&e, r->v, &seq, &age_ms, abs, sizeof(abs), &len);
+    telem_decode(&dec, abs, len, &frame);
+    telem_to_json(&frame, (char *)buf, size, &len);
+    return len;
+}
+
+static void replay_done(void *ctx, uint32_t seq, bool acked)
+{
+    node_t *nd = ctx;
+    size_t i = 0;
+    while (i < nd->n_replay && nd->replay[i].seq != seq)
+        i++;
+    if (i == nd->n_replay)
+        return;
+
+    if (!acked) {
+        // The client gave up on it; everything not acknowledged goes again
+        nd->n_replay = 0;
+        nd->cursor = nd->tail;
+        telem_enc_reset(&nd->enc);
+        return;
+    }
+    nd->replay[i].acked = true;
+    size_t n = 0;
+    while (n < nd->n_replay && nd->replay[n].acked)
+        n++;
+    if (!n)
+        return;
+    uint32_t released = nd->replay[n - 1].seq + 1;
+    if ((int32_t)(released - nd->tail) > 0)
+        nd->tail = released;
+    nd->n_replay -= n;
+    memmove(nd->replay, nd->replay + n, nd->n_replay * sizeof(nd->replay[0]));
+}
+
+static void send_backlog(node_t *nd, int64_t now)
+{
+    // Readings lost to a full backlog since they were sent
+    if (nd->cursor - nd->tail > nd->head - nd->tail) {
+        nd->n_replay = 0;
+        nd->cursor = nd->tail;
+        telem_enc_reset(&nd->enc);
+    }
+
+    if (!mqtt_pub_ready(&nd->pub))
+        return;
+    for (int n = 0; n < REPLAY_PER_RUN && nd->cursor != nd->head; n++) {
+        uint32_t seq = nd->cursor;
+        const reading_t *r = &nd->ring[seq & (nd->ring_cap - 1)];
+        uint8_t payload[OUT_PKT_MAX];
+        size_t len = encode_payload(nd, payload, sizeof(payload), r, seq, now);
+        __atomic_store_n(&nd->pub_us[seq], (uint32_t)now, __ATOMIC_RELAXED);
+        if (mqtt_pub_send(&nd->pub, nd->topic, (const char *)payload, len, seq) != ESP_OK)
+            break;
+        nd->replay[nd->n_replay].seq = seq;
+        nd->replay[nd->n_replay++].acked = false;
+        nd->cursor++;
+    }
+}
+
+static void take_reading(node_t *nd, int64_t now)
+{
+    fleet_t *f = nd->f;
+    if (nd->head == f->slots)
+        return;
+
+    reading_t r = { .sample_ms = (now - nd->boot_us) / 1000 };
+    for (int i = 0; i < 3; i++) {
+        const field_model_t *m = &nd->model[i];
+        nd->level[i] += (m->mean - nd->level[i]) * 0.01 + m->walk * gauss(&nd->rng);
+        r.v[i] = fmax(nd->level[i] + m->noise * gauss(&nd->rng), 0);
+    }
+
+    if (nd->head - nd->tail == BACKLOG_MAX) {
+        // Full: the oldest reading goes, as in the flash log
+        nd->overwritten[nd->tail++] = 1;
+        __atomic_add_fetch(&f->overwritten, 1, __ATOMIC_RELAXED);
+    } else if (nd->head - nd->tail == nd->ring_cap) {
+        uint32_t cap = nd->ring_cap * 2;
+        reading_t *ring = malloc(cap * sizeof(*ring));
+        for (uint32_t s = nd->tail; s != nd->head; s++)
+            ring[s & (cap - 1)] = nd->ring[s & (nd->ring_cap - 1)];
+        free(nd->ring);
+        nd->ring = ring;
+        nd->ring_cap = cap;
+    }
+    uint32_t seq = nd->head++;
+    nd->ring[seq & (nd->ring_cap - 1)] = r;
+    __atomic_store_n(&nd->sample_us[seq], (uint32_t)now, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&f->produced, 1, __ATOMIC_RELAXED);
+
+    send_backlog(nd, now);
+}
+
+// The client and everything in RAM go; the backlog, in flash, stays
+static void reboot(node_t *nd, int64_t now)
+{
+    if (nd->state != NODE_WAIT)
+        disconnect(nd, now, now);
+    nd->reboots++;
+    nd->state = NODE_OFF;
+    nd->wake_us = now + (int64_t)((1 + 2 * uniform(&nd->rng)) * 1e6);
+    nd->reboot_us = INT64_MAX;
+
+    // esp-mqtt's outbox is in RAM; the counters carry on for the report
+    mqtt_pub_config_t cfg = nd->pub.cfg;
+    mqtt_pub_stats_t stats = nd->pub.stats;
+    mqtt_pub_init(&nd->pub, &cfg);
+    nd->pub.stats = stats;
+    nd->n_box = 0;
+    nd->n_replay = 0;
+    nd->cursor = nd->tail;
+    telem_enc_reset(&nd->enc);
+
+    // Readings of the boot that ends now end 1 ms before the next one
+    if (nd->head != nd->tail) {
+        int64_t last = nd->ring[(nd->head - 1) & (nd->ring_cap - 1)].sample_ms;
+        for (uint32_t s = nd->tail; s != nd->head; s++)
+            nd->ring[s & (nd->ring_cap - 1)].sample_ms -= last + 1;
+    }
+}
+
+// Runs the node's timers; returns when it next needs to run
+static int64_t node_run(node_t *nd, int64_t now)
+{
+    fleet_t *f = nd->f;
+
+    if (now >= nd->reboot_us)
+        reboot(nd, now);
+    if (nd->state == NODE_OFF) {
+        if (now < nd->wake_us)
+            return nd->wake_us;
+        nd->boot_us = now;
+        nd->next_sample_us = now;
+        nd->next_replay_us = now + REPLAY_PERIOD_US;
+        start_connect(nd, now);
+    }
+
+    // Wi-Fi drops
+    if (f->mean_up_s > 0 && now >= nd->next_drop_us) {
+        nd->link_drops++;
+        nd->link_up_us = now + (int64_t)((1 + uniform(&nd->rng) * (f->max_outage_s - 1)) * 1e6);
+        nd->next_drop_us = nd->link_up_us - log(uniform(&nd->rng) + 1e-12) * f->mean_up_s * 1e6;
+        if (nd->state != NODE_WAIT) {
+            if (nd->state == NODE_UP)
+                nd->conn_lost++;
+            disconnect(nd, now, now + RECONNECT_US);
+        }
+    }
+
+    switch (nd->state) {
+        case NODE_WAIT:
+            if (now >= nd->wake_us)
+                start_connect(nd, now);
+            break;
+        case NODE_CONNECTING:
+        case NODE_CONNACK:
+            if (now >= nd->wake_us) {
+                nd->failed_connects++;
+                disconnect(nd, now, now + RECONNECT_US);
+            }
+            break;
+        case NODE_UP:
+            if (now - nd->last_tx_us >= KEEPALIVE_S * 1000000LL / 2) {
+                static const uint8_t ping[2] = { 0xc0, 0 };
+                tx_put(nd, ping, sizeof(ping));
+            }
+            break;
+        default:
+            break;
+    }
+
+    // esp-mqtt deletes what has waited too long for its acknowledgement
+    for (size_t i = 0; i < nd->n_box;) {
+        if (now - nd->box[i].first_us < OUTBOX_EXPIRE_US) {
+            i++;
+            continue;
+        }
+        int id = nd->box[i].msg_id;
+        nd->box[i] = nd->box[--nd->n_box];
+        mqtt_pub_done(&nd->pub, id, false);
+    }
+
+    if (now >= nd->next_sample_us && nd->next_sample_us < f->end_us) {
+        take_reading(nd, now);
+        nd->next_sample_us += f->period_us;
+    }
+    if (now >= nd->next_replay_us) {
+        send_backlog(nd, now);
+        while (nd->next_replay_us <= now)
+            nd->next_replay_us += REPLAY_PERIOD_US;
+    }
+    flush_tx(nd, now);
+
+    // The replay job only matters with readings waiting to go or be released
+    int64_t next = nd->cursor != nd->head || nd->n_replay ? nd->next_replay_us : INT64_MAX;
+    if (nd->next_sample_us < f->end_us && nd->next_sample_us < next)
+        next = nd->next_sample_us;
+    if (nd->state != NODE_UP && nd->wake_us < next)
+        next = nd->wake_us;
+    if (f->mean_up_s > 0 && nd->next_drop_us < next)
+        next = nd->next_drop_us;
+    if (nd->reboot_us < next)
+        next = nd->reboot_us;
+    return next;
+}
+
+static void node_io(node_t *nd, short revents, int64_t now)
+{
+    if (nd->state == NODE_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+            return;
+        if (getsockopt(nd->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+            nd->failed_connects++;
+            disconnect(nd, now, now + RECONNECT_US);
+            return;
+        }
+        send_connect(nd, now);
+        return;
+    }
+    if (revents & (POLLIN | POLLERR | POLLHUP))
+        node_read(nd, now);
+    if (nd->fd >= 0 && (revents & POLLOUT))
+        flush_tx(nd, now);
+}
+
+typedef struct
+{
+    fleet_t *f;
+    size_t first, count;
+} worker_t;
+
+static void *worker_task(void *arg)
+{
+    worker_t *w = arg;
+    fleet_t *f = w->f;
+    struct pollfd *fds = malloc(w->count * sizeof(*fds));
+    node_t **polled = malloc(w->count * sizeof(*polled));
+
+    while (!__atomic_load_n(&f->done, __ATOMIC_ACQUIRE)) {
+        int64_t now = now_us(), next = now + 50000;
+        size_t n = 0;
+        for (size_t i = 0; i < w->count; i++) {
+            node_t *nd = &f->nodes[w->first + i];
+            int64_t due = node_run(nd, now);
+            if (due < next)
+                next = due;
+            if (nd->fd >= 0) {
+                short events = POLLIN;
+                if (nd->state == NODE_CONNECTING || nd->tx_len)
+                    events |= POLLOUT;
+                fds[n] = (struct pollfd) { .fd = nd->fd, .events = events };
+                polled[n++] = nd;
+            }
+        }
+        int64_t wait = next - now_us();
+        poll(fds, n, wait <= 0 ? 0 : (int)((wait + 999) / 1000));
+        now = now_us();
+        for (size_t k = 0; k < n; k++)
+            if (fds[k].revents)
+                node_io(polled[k], fds[k].revents, now);
+    }
+
+    for (size_t i = 0; i < w->count; i++) {
+        node_t *nd = &f->nodes[w->first + i];
+        if (nd->fd >= 0) {
+            static const uint8_t bye[2] = { 0xe0, 0 };
+            send(nd->fd, bye, sizeof(bye), MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(nd->fd);
+            nd->fd = -1;
+        }
+    }
+    free(fds);
+    free(polled);
+    return NULL;
+}
+
+// --- Subscriber -------------------------------------------------------------
+
+typedef struct
+{
+    fleet_t *f;
+    telem_dec_t *dec;          // Per node
+    ingest_t *in;              // NULL without -c
+    uint32_t *age_us;          // Per delivered reading
+    uint32_t *net_us;
+    size_t n_lat, cap_lat;
+    uint64_t duplicates, unknown, reconnects;
+    bool ready;                // Atomic, subscribed
+    bool stop;                 // Atomic
+    double cpu;
+} receiver_t;
+
+static void on_message(void *ctx, const char *topic, const uint8_t *payload, size_t len)
+{
+    receiver_t *r = ctx;
+    fleet_t *f = r->f;
+    int64_t now = now_us();
+    if (r->in)
+        ingest_message(r->in, topic, payload, len, wall_ms());
+
+    // Node from the MAC at the end of the topic
+    const char *mac = strrchr(topic, '/');
+    size_t idx = SIZE_MAX;
+    if (mac && strlen(mac + 1) == 12 && !strncmp(mac + 1, MAC_PREFIX, 6))
+        idx = strtoul(mac + 7, NULL, 16);
+    if (idx >= f->n_nodes) {
+        r->unknown++;
+        return;
+    }
+
+    uint32_t seq = UINT32_MAX;
+    if (len && payload[0] == '{') {
+        char text[256];
+        size_t n = len < sizeof(text) - 1 ? len : sizeof(text) - 1;
+        memcpy(text, payload, n);
+        text[n] = 0;
+        const char *p = strstr(text, "\"seq\":");
+        if (p)
+            seq = strtoul(p + 6, NULL, 10);
+    } else {
+        telem_frame_t fr;
+        esp_err_t err = telem_decode(&r->dec[idx], payload, len, &fr);
+        if ((err == ESP_OK || err == ESP_ERR_INVALID_STATE) && (fr.flags & TELEM_FLAG_SEQ))
+            seq = fr.seq;
+    }
+    node_t *nd = &f->nodes[idx];
+    if (seq >= f->slots) {
+        r->unknown++;
+        return;
+    }
+    if (nd->got[seq]) {
+        r->duplicates++;
+        return;
+    }
+    nd->got[seq] = 1;
+    __atomic_add_fetch(&f->delivered, 1, __ATOMIC_RELAXED);
+
+    if (r->n_lat == r->cap_lat) {
+        r->cap_lat = r->cap_lat ? 2 * r->cap_lat : 65536;
+        r->age_us = realloc(r->age_us, r->cap_lat * sizeof(*r->age_us));
+        r->net_us = realloc(r->net_us, r->cap_lat * sizeof(*r->net_us));
+    }
+    uint32_t sampled = __atomic_load_n(&nd->sample_us[seq], __ATOMIC_RELAXED);
+    uint32_t sent = __atomic_load_n(&nd->pub_us[seq], __ATOMIC_RELAXED);
+    r->age_us[r->n_lat] = (uint32_t)now - sampled;
+    r->net_us[r->n_lat++] = (uint32_t)now - sent;
+}
+
+static void *receiver_task(void *arg)
+{
+    receiver_t *r = arg;
+    fleet_t *f = r->f;
+    static mqtt_sub_t m;
+    char host[64], port[8];
+    getnameinfo((struct sockaddr *)&f->addr, f->addr_len, host, sizeof(host), port, sizeof(port),
+                NI_NUMERICHOST | NI_NUMERICSERV);
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        if (mqtt_sub_connect(&m, host, atoi(port), "fleet-collector", true, 30, 1000) != ESP_OK ||
+            mqtt_sub_subscribe(&m, SUB_FILTER, 1) != ESP_OK) {
+            mqtt_sub_close(&m);
+            usleep(100000);
+            continue;
+        }
+        if (__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE))
+            r->reconnects++;
+        __atomic_store_n(&r->ready, true, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE) && mqtt_sub_poll(&m, 100, on_message, r) == ESP_OK)
+            ;
+        mqtt_sub_close(&m);
+    }
+    r->cpu = cpu_s(CLOCK_THREAD_CPUTIME_ID);
+    return NULL;
+}
+
+// --- Report -----------------------------------------------------------------
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char *what, uint32_t *v, size_t n, double unit)
+{
+    if (!n) {
+        printf("%-34s no readings\n", what);
+        return;
+    }
+    qsort(v, n, sizeof(*v), cmp_u32);
+    static const double p[] = { 0.5, 0.9, 0.99, 0.999 };
+    printf("%-34s", what);
+    for (size_t i = 0; i < sizeof(p) / sizeof(p[0]); i++)
+        printf(" p%-5g %8.2f", p[i] * 100, v[(size_t)(p[i] * (n - 1))] * unit);
+    printf("  max %8.2f ms\n", v[n - 1] * unit);
+}
+
+static bool resolve(fleet_t *f, const char *host, const char *port)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    if (getaddrinfo(host, port, &hints, &res))
+        return false;
+    memcpy(&f->addr, res->ai_addr, res->ai_addrlen);
+    f->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static void remove_dir(const char *dir)
+{
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd))
+        fprintf(stderr, "could not remove %s\n", dir);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_nodes = 1000, n_threads = 4, queue_kb = 256;
+    long period_ms = 5000, seconds = 60, blackout_s = 0;
+    double mean_up_s = 600, max_outage_s = 30;
+    uint32_t key_interval = 1, seed = 1;
+    bool json = false, collect = false, reboot = false;
+    const char *host = NULL, *port = "1883";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:t:w:k:jd:o:B:Rq:ch:P:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n_nodes = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                period_ms = atol(optarg);
+                break;
+            case 't':
+                seconds = atol(optarg);
+                break;
+            case 'w':
+                n_threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                key_interval = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                json = true;
+                break;
+            case 'd':
+                mean_up_s = atof(optarg);
+                break;
+            case 'o':
+                max_outage_s = atof(optarg);
+                break;
+            case 'B':
+                blackout_s = atol(optarg);
+                break;
+            case 'R':
+                reboot = true;
+                break;
+            case 'q':
+                queue_kb = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                collect = true;
+                break;
+            case 'h':
+                host = optarg;
+                break;
+            case 'P':
+                port = optarg;
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-n NODES] [-p PERIOD_MS] [-t SECONDS] [-w THREADS] [-k KEY_INTERVAL] [-j]\n"
+                        "          [-d MEAN_UP_S] [-o MAX_OUTAGE_S] [-B BLACKOUT_S [-R]] [-q QUEUE_KB] [-c]\n"
+                        "          [-h BROKER] [-P PORT] [-s SEED]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (n_nodes < 1 || n_nodes > 0xffffff || n_threads < 1 || period_ms < 10 || seconds < 1 ||
+        mean_up_s < 0 || max_outage_s < 1 || blackout_s < 0 || (reboot && !blackout_s) || !seed ||
+        seconds + blackout_s + max_outage_s + DRAIN_EXTRA_S > RUN_MAX_S) {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+    if (n_threads > n_nodes)
+        n_threads = n_nodes;
+
+    // Two descriptors per node with the stand-in broker
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (host ? 1 : 2) * n_nodes + 64) {
+        fprintf(stderr, "%zu nodes need more than the %lu open files allowed\n", n_nodes,
+                (unsigned long)rl.rlim_cur);
+        return 1;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t0_us = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+    mqtt_broker_t *broker = NULL;
+    static fleet_t f;
+    f.n_nodes = n_nodes;
+    f.period_us = period_ms * 1000;
+    f.end_us = seconds * 1000000LL;
+    f.key_interval = key_interval;
+    f.json = json;
+    f.mean_up_s = mean_up_s;
+    f.max_outage_s = max_outage_s;
+    f.slots = seconds * 1000 / period_ms + 2;
+    if (!host) {
+        mqtt_broker_config_t bc = { .tx_limit = queue_kb * 1024 };
+        if (mqtt_broker_start(&broker, &bc) != ESP_OK) {
+            perror("broker");
+            return 1;
+        }
+        char p[8];
+        snprintf(p, sizeof(p), "%u", mqtt_broker_port(broker));
+        resolve(&f, "127.0.0.1", p);
+    } else if (!resolve(&f, host, port)) {
+        fprintf(stderr, "%s: cannot resolve\n", host);
+        return 1;
+    }
+
+    uint32_t rng = seed;
+    f.nodes = calloc(n_nodes, sizeof(node_t));
+    for (size_t i = 0; i < n_nodes; i++) {
+        node_t *nd = &f.nodes[i];
+        bool gas = i % 2 == 0;
+        nd->f = &f;
+        nd->index = i;
+        nd->fd = -1;
+        nd->rng = rng_next(&rng) | 1;
+        snprintf(nd->topic, sizeof(nd->topic), "esp32/sensors/%s/" MAC_PREFIX "%06zx", gas ? "gas" : "env", i);
+        nd->model = gas ? gas_model : env_model;
+        for (int k = 0; k < 3; k++)
+            nd->level[k] = nd->model[k].mean;
+        telem_enc_init(&nd->enc, telem_schema_find(gas ? TELEM_SCHEMA_GAS : TELEM_SCHEMA_ENV), key_interval);
+        mqtt_pub_config_t pc = { .send = client_publish, .ctx = nd, .qos = 1, .max_inflight = MAX_INFLIGHT,
+                                 .done = replay_done, .done_ctx = nd };
+        mqtt_pub_init(&nd->pub, &pc);
+        nd->ring_cap = 16;
+        nd->ring = malloc(nd->ring_cap * sizeof(reading_t));
+        nd->sample_us = calloc(f.slots, sizeof(uint32_t));
+        nd->pub_us = calloc(f.slots, sizeof(uint32_t));
+        nd->overwritten = calloc(f.slots, 1);
+        nd->got = calloc(f.slots, 1);
+        // Nodes power up over the first period, each on its own phase
+        nd->state = NODE_OFF;
+        nd->wake_us = (int64_t)(uniform(&nd->rng) * f.period_us);
+        nd->next_drop_us = mean_up_s > 0 ? -log(uniform(&nd->rng) + 1e-12) * mean_up_s * 1e6 : INT64_MAX;
+        nd->reboot_us = reboot ? f.end_us / 2 + (int64_t)(uniform(&nd->rng) * blackout_s * 5e5) : INT64_MAX;
+    }
+
+    // Subscriber first, so nothing is published before it listens
+    static receiver_t r;
+    r.f = &f;
+    r.dec = calloc(n_nodes, sizeof(telem_dec_t));
+    for (size_t i = 0; i < n_nodes; i++)
+        telem_dec_init(&r.dec[i]);
+    char dir[] = "/tmp/fleet_sim.XXXXXX";
+    static tsdb_t db;
+    static ingest_t in;
+    if (collect) {
+        if (!mkdtemp(dir) || tsdb_open(&db, dir) != ESP_OK) {
+            perror(dir);
+            return 1;
+        }
+        ingest_init(&in, &db);
+        r.in = &in;
+    }
+    pthread_t rt;
+    pthread_create(&rt, NULL, receiver_task, &r);
+    for (int i = 0; i < 50 && !__atomic_load_n(&r.ready, __ATOMIC_ACQUIRE); i++)
+        usleep(100000);
+    if (!__atomic_load_n(&r.ready, __ATOMIC_ACQUIRE)) {
+        fprintf(stderr, "cannot subscribe at the broker\n");
+        return 1;
+    }
+
+    printf("%zu nodes (%zu gas, %zu env), a reading every %ld ms each (%.0f/s), %ld s, %s%s, %zu threads\n",
+           n_nodes, (n_nodes + 1) / 2, n_nodes / 2, period_ms, n_nodes * 1000.0 / period_ms, seconds,
+           json ? "JSON" : "binary frames", !json && key_interval > 1 ? " with deltas" : "", n_threads);
+    if (mean_up_s > 0)
+        printf("Wi-Fi drops every %.0f s on average for up to %.0f s\n", mean_up_s, max_outage_s);
+    if (reboot)
+        printf("Every node restarts once while the broker is away\n");
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t0_us = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    double cpu0 = cpu_s(CLOCK_PROCESS_CPUTIME_ID);
+    worker_t *workers = calloc(n_threads, sizeof(worker_t));
+    pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+    for (size_t i = 0, first = 0; i < n_threads; i++) {
+        size_t count = n_nodes / n_threads + (i < n_nodes % n_threads);
+        workers[i] = (worker_t) { &f, first, count };
+        first += count;
+        pthread_create(&threads[i], NULL, worker_task, &workers[i]);
+    }
+
+    // Sampling, with the broker away for a while halfway through
+    int64_t blackout_at = blackout_s ? f.end_us / 2 : INT64_MAX, next_print = 10000000;
+    bool paused = false;
+    int64_t drain_end = f.end_us + (blackout_s + max_outage_s + DRAIN_EXTRA_S) * 1000000LL;
+    while (1) {
+        int64_t now = now_us();
+        uint64_t produced = __atomic_load_n(&f.produced, __ATOMIC_RELAXED);
+        uint64_t accounted = __atomic_load_n(&f.delivered, __ATOMIC_RELAXED) +
+                             __atomic_load_n(&f.overwritten, __ATOMIC_RELAXED);
+        if (now >= drain_end || (now >= f.end_us && accounted >= produced))
+            break;
+        if (broker && !paused && now >= blackout_at) {
+            printf("%6.1f s: broker away for %ld s\n", now / 1e6, blackout_s);
+            mqtt_broker_pause(broker, true);
+            paused = true;
+        }
+        if (broker && paused && now >= blackout_at + blackout_s * 1000000LL) {
+            printf("%6.1f s: broker back\n", now / 1e6);
+            mqtt_broker_pause(broker, false);
+            blackout_at = INT64_MAX;
+            paused = false;
+        }
+        if (now >= next_print) {
+            printf("%6.1f s: %" PRIu64 " readings, %" PRIu64 " delivered, %u nodes connected\n", now / 1e6,
+                   produced, __atomic_load_n(&f.delivered, __ATOMIC_RELAXED),
+                   __atomic_load_n(&f.connected, __ATOMIC_RELAXED));
+            fflush(stdout);
+            next_print += 10000000;
+        }
+        usleep(50000);
+    }
+    double run_s = now_us() / 1e6;
+
+    __atomic_store_n(&f.done, true, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+    // Stragglers still on their way to the subscriber
+    usleep(200000);
+    __atomic_store_n(&r.stop, true, __ATOMIC_RELEASE);
+    pthread_join(rt, NULL);
+    double cpu = cpu_s(CLOCK_PROCESS_CPUTIME_ID) - cpu0;
+    mqtt_broker_stats_t bs = { 0 };
+    if (broker) {
+        mqtt_broker_stats(broker, &bs);
+        mqtt_broker_stop(broker);
+    }
+
+    // Every reading delivered, lost to a full backlog, still waiting on its
+    // node or lost on the way
+    uint64_t produced = 0, delivered = 0, overwritten = 0, pending = 0, lost = 0;
+    uint64_t drops = 0, connects = 0, failed = 0, conn_lost = 0, reboots = 0, expired = 0, refused = 0;
+    uint32_t peak_inflight = 0;
+    for (size_t i = 0; i < n_nodes; i++) {
+        node_t *nd = &f.nodes[i];
+        produced += nd->head;
+        for (uint32_t s = 0; s < nd->head; s++) {
+            if (nd->got[s])
+                delivered++;
+            else if (nd->overwritten[s])
+                overwritten++;
+            else if ((int32_t)(s - nd->tail) >= 0)
+                pending++;
+            else
+                lost++;
+        }
+        drops += nd->link_drops;
+        connects += nd->connects;
+        failed += nd->failed_connects;
+        conn_lost += nd->conn_lost;
+        reboots += nd->reboots;
+        expired += nd->pub.stats.expired;
+        refused += nd->pub.stats.refused;
+        if (nd->pub.stats.peak_inflight > peak_inflight)
+            peak_inflight = nd->pub.stats.peak_inflight;
+    }
+
+    printf("readings: %" PRIu64 " produced, %" PRIu64 " delivered (%.3f %%), %" PRIu64 " duplicates, %" PRIu64
+           " lost to full backlogs, %" PRIu64 " still on the nodes, %" PRIu64 " lost\n",
+           produced, delivered, produced ? 100.0 * delivered / produced : 0.0, r.duplicates, overwritten, pending,
+           lost);
+    printf("nodes:    %" PRIu64 " connects, %" PRIu64 " failed, %" PRIu64 " connections lost, %" PRIu64
+           " Wi-Fi drops, %" PRIu64 " restarts, %" PRIu64 " outbox expiries, %" PRIu64 " sends refused, peak %" PRIu32
+           " in flight\n",
+           connects, failed, conn_lost, drops, reboots, expired, refused, peak_inflight);
+    if (broker)
+        printf("broker:   peak %" PRIu32 " clients, %" PRIu64 " received, %" PRIu64 " forwarded, %" PRIu64
+               " dropped at a full queue (peak %zu bytes), %" PRIu64 " unrouted, %" PRIu64 " refused, %.1f MB in\n",
+               bs.peak_clients, bs.received, bs.forwarded, bs.dropped, bs.peak_queue, bs.unrouted, bs.refused,
+               bs.bytes_in / 1e6);
+    printf("receiver: %" PRIu64 " reconnects, %" PRIu64 " unknown, %.1f %% of a core", r.reconnects, r.unknown,
+           100 * r.cpu / run_s);
+    bool collect_ok = true;
+    if (collect) {
+        uint64_t points = 0, bytes = 0;
+        tsdb_flush(&db, false);
+        for (size_t i = 0; i < db.n_series; i++) {
+            points += db.series[i].points;
+            bytes += db.series[i].file_bytes;
+        }
+        printf(", %" PRIu64 " points in %zu series (%" PRIu64 " rejected, %" PRIu64 " bad ages, %" PRIu64
+               " undecodable)",
+               points, db.n_series, in.stats.rejected, in.stats.bad_age, in.stats.undecodable);
+        collect_ok = !in.stats.rejected && !in.stats.bad_age;
+        ingest_free(&in);
+        tsdb_close(&db);
+        remove_dir(dir);
+    }
+    printf("\nprocess:  %.1f s, %.0f readings/s delivered, %.2f cores\n", run_s, delivered / run_s, cpu / run_s);
+    print_percentiles("age on arrival (ms):", r.age_us, r.n_lat, 1e-3);
+    print_percentiles("last publish to arrival (ms):", r.net_us, r.n_lat, 1e-3);
+
+    bool ok = !lost && (!broker || !bs.dropped) && collect_ok;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
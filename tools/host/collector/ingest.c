@@ -0,0 +1,280 @@
+/**
+ * @file ingest.c
+ *
+ * MQTT messages to tsdb points
+ */
+#include "ingest.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX   1024
+#define DUP_WINDOW 1024  // seq this far back is a redelivery, further back a reset backlog
+
+static const double scale[TELEM_DECIMALS_MAX + 1] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+
+void ingest_init(ingest_t *in, tsdb_t *db)
+{
+    memset(in, 0, sizeof(*in));
+    in->db = db;
+    in->max_age_ms = INGEST_AGE_MAX_MS;
+}
+
+// Series names allow letters, digits, '.', '_' and '-'
+static void sanitize(char *dst, const char *src, size_t size)
+{
+    size_t n = 0;
+    for (; *src && n + 1 < size; src++)
+    {
+        char c = *src;
+        dst[n++] = c == '/' ? '.' : isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.' ? c : '_';
+    }
+    dst[n] = 0;
+    if (dst[0] == '.')
+        dst[0] = '_';
+}
+
+static uint32_t hash(const char *s)
+{
+    uint32_t h = 2166136261u;  // FNV-1a
+    while (*s)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+// Slot of topic in the index: its stream or the free slot for it
+static size_t slot_for(const ingest_t *in, const char *topic)
+{
+    size_t mask = in->index_size - 1, i = hash(topic) & mask;
+    while (in->index[i] && strcmp(in->streams[in->index[i] - 1].topic, topic))
+        i = (i + 1) & mask;
+    return i;
+}
+
+static bool grow_index(ingest_t *in)
+{
+    size_t size = in->index_size ? 2 * in->index_size : 64;
+    uint32_t *index = calloc(size, sizeof(*index));
+    if (!index)
+        return false;
+    free(in->index);
+    in->index = index;
+    in->index_size = size;
+    for (size_t k = 0; k < in->n_streams; k++)
+        in->index[slot_for(in, in->streams[k].topic)] = k + 1;
+    return true;
+}
+
+// One stream per topic; thousands of nodes are looked up by hash
+static ingest_stream_t *stream_for(ingest_t *in, const char *topic)
+{
+    if (!in->index_size && !grow_index(in))
+        return NULL;
+    size_t slot = slot_for(in, topic);
+    if (in->index[slot])
+        return &in->streams[in->index[slot] - 1];
+
+    if (!*topic || strlen(topic) >= sizeof(in->streams[0].topic))
+        return NULL;
+    if (2 * (in->n_streams + 1) > in->index_size)
+    {
+        if (!grow_index(in))
+            return NULL;
+        slot = slot_for(in, topic);
+    }
+    if (in->n_streams == in->cap_streams)
+    {
+        size_t cap = in->cap_streams ? 2 * in->cap_streams : 16;
+        ingest_stream_t *streams = realloc(in->streams, cap * sizeof(*streams));
+        if (!streams)
+            return NULL;
+        in->streams = streams;
+        in->cap_streams = cap;
+    }
+    ingest_stream_t *s = &in->streams[in->n_streams++];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->topic, sizeof(s->topic), "%s", topic);
+    sanitize(s->prefix, topic, sizeof(s->prefix));
+    telem_dec_init(&s->dec);
+    in->index[slot] = in->n_streams;
+    return s;
+}
+
+static void store(ingest_t *in, ingest_stream_t *s, const char *field, int64_t ts_ms, double value)
+{
+    size_t i = 0, id;
+    while (i < s->n_fields && strcmp(s->field[i], field))
+        i++;
+    if (i < s->n_fields)
+        id = s->series[i];
+    else
+    {
+        char name[TSDB_NAME_MAX + 32], clean[32];
+        sanitize(clean, field, sizeof(clean));
+        snprintf(name, sizeof(name), "%s.%s", s->prefix, clean);
+        if (strlen(name) >= TSDB_NAME_MAX || tsdb_series(in->db, name, &id) != ESP_OK)
+        {
+            in->stats.rejected++;
+            return;
+        }
+        if (s->n_fields < INGEST_FIELDS_MAX && strlen(field) < sizeof(s->field[0]))
+        {
+            snprintf(s->field[s->n_fields], sizeof(s->field[0]), "%s", field);
+            s->series[s->n_fields++] = id;
+        }
+    }
+
+    if (tsdb_append(in->db, id, ts_ms, value) == ESP_OK)
+        in->stats.points++;
+    else
+        in->stats.rejected++;
+}
+
+// QoS 1 delivers again what was not acknowledged in time; backlog
+// sequence numbers survive reboots, so one not above the last is a copy
+static bool is_copy(const ingest_stream_t *s, const telem_frame_t *f)
+{
+    return (f->flags & TELEM_FLAG_SEQ) && s->have_seq && s->last_seq - f->seq < DUP_WINDOW;
+}
+
+static esp_err_t ingest_frame(ingest_t *in, ingest_stream_t *s, const uint8_t *payload, size_t len, int64_t now_ms)
+{
+    // A copy must not take the decoder back to its frame; a copy of a
+    // delta frame no longer follows the decoder's last frame at all
+    telem_frame_t f;
+    telem_dec_t dec = s->dec;
+    esp_err_t err = telem_decode(&dec, payload, len, &f);
+    if ((err == ESP_OK || err == ESP_ERR_INVALID_STATE) && is_copy(s, &f))
+    {
+        in->stats.frames++;
+        in->stats.duplicates++;
+        return ESP_OK;
+    }
+    if (err != ESP_OK)
+        return err;
+    in->stats.frames++;
+    s->dec = dec;
+    if (f.flags & TELEM_FLAG_SEQ)
+    {
+        s->last_seq = f.seq;
+        s->have_seq = true;
+    }
+
+    if ((f.flags & TELEM_FLAG_AGE) && f.age_ms > in->max_age_ms)
+    {
+        in->stats.bad_age++;
+        return ESP_OK;
+    }
+    int64_t ts = now_ms - (f.flags & TELEM_FLAG_AGE ? f.age_ms : 0);
+    for (size_t i = 0; i < f.schema->n_fields; i++)
+        if (f.mask & (1u << i))
+            store(in, s, f.schema->name[i], ts, f.raw[i] / scale[f.schema->decimals[i]]);
+    return ESP_OK;
+}
+
+typedef struct
+{
+    const char *key;
+    double value;
+} json_member_t;
+
+// One flat object of string keys; members that are not numbers are skipped
+static esp_err_t ingest_json(ingest_t *in, ingest_stream_t *s, const uint8_t *payload, size_t len, int64_t now_ms)
+{
+    char text[JSON_MAX];
+    if (len >= sizeof(text))
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(text, payload, len);
+    text[len] = 0;
+
+    json_member_t member[INGEST_FIELDS_MAX];
+    size_t n = 0;
+    double age_ms = 0;
+    char *p = text + 1;
+    while (1)
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '}')
+            break;
+        if (*p != '"')
+            return ESP_ERR_NOT_SUPPORTED;
+        char *key = ++p;
+        while (*p && *p != '"')
+            p++;
+        if (!*p)
+            return ESP_ERR_NOT_SUPPORTED;
+        *p++ = 0;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p++ != ':')
+            return ESP_ERR_NOT_SUPPORTED;
+        while (isspace((unsigned char)*p))
+            p++;
+
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p)
+        {
+            // Not a number: skip a string or a literal
+            if (*p == '"')
+                for (p++; *p && *p != '"'; p++)
+                    p += p[0] == '\\' && p[1];
+            while (*p && *p != ',' && *p != '}')
+                p++;
+        }
+        else
+        {
+            p = end;
+            if (!strcmp(key, "age_ms"))
+                age_ms = v;
+            else if (strcmp(key, "seq") && n < INGEST_FIELDS_MAX)
+                member[n++] = (json_member_t) { key, v };
+        }
+
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == ',')
+            p++;
+        else if (*p != '}')
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+    in->stats.json++;
+
+    // Checked before the conversion, which is undefined out of range
+    if (!(age_ms >= 0 && age_ms <= in->max_age_ms))
+    {
+        in->stats.bad_age++;
+        return ESP_OK;
+    }
+    for (size_t i = 0; i < n; i++)
+        store(in, s, member[i].key, now_ms - (int64_t)age_ms, member[i].value);
+    return ESP_OK;
+}
+
+esp_err_t ingest_message(ingest_t *in, const char *topic, const uint8_t *payload, size_t len, int64_t now_ms)
+{
+    in->stats.messages++;
+    ingest_stream_t *s = stream_for(in, topic);
+    if (!s)
+    {
+        in->stats.undecodable++;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = len && payload[0] == '{' ? ingest_json(in, s, payload, len, now_ms)
+                                             : ingest_frame(in, s, payload, len, now_ms);
+    if (err != ESP_OK)
+        in->stats.undecodable++;
+    return err;
+}
+
+void ingest_free(ingest_t *in)
+{
+    free(in->streams);
+    free(in->index);
+    in->streams = NULL;
+    in->index = NULL;
+    in->n_streams = in->cap_streams = in->index_size = 0;
+}
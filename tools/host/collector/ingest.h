@@ -0,0 +1,124 @@
+/**
+ * @file ingest.h
+ * @defgroup ingest ingest
+ * @{
+ *
+ * Turns the nodes' MQTT messages into tsdb points.
+ *
+ * Every topic is a stream of its own, with its own telem_codec decoder so
+ * delta frames work, and every field of it a series named after the
+ * topic and the field: `esp32/sensors/gas/a4cf12f0e1d4` carrying the gas
+ * schema gives `esp32.sensors.gas.a4cf12f0e1d4.co2`, `...ch4` and
+ * `...co`. Frames are stored at their decimal precision (the fixed-point
+ * value divided by 10^decimals), absent fields are skipped. A point is
+ * timestamped with the arrival time minus the frame's age when it carries
+ * one, so readings replayed from a node's backlog land when they were
+ * taken. A message with an age that is negative, not a number or above
+ * max_age_ms is counted in bad_age and not stored. Frames with a
+ * sequence number at or shortly below the last one of their stream are
+ * QoS 1 redeliveries and are skipped.
+ *
+ * Flat JSON objects (`{"co2": 412.50, "seq": 7}`), as nodes sent before
+ * telem_codec, are accepted too: every numeric member but seq and age_ms
+ * is a field.
+ */
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "telem_codec.h"
+#include "tsdb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INGEST_FIELDS_MAX 16   //!< Series remembered per stream
+
+/**
+ * Default max_age_ms: twice what a node's backlog holds (8192 readings
+ * at 5 s, about 11 h); anything older cannot be a replayed reading
+ */
+#define INGEST_AGE_MAX_MS (24 * 3600 * 1000LL)
+
+/**
+ * Stream of one topic
+ */
+typedef struct
+{
+    char topic[128];
+    char prefix[TSDB_NAME_MAX];      //!< Series name up to the field
+    telem_dec_t dec;
+    bool have_seq;
+    uint32_t last_seq;               //!< Of the last frame with one
+    size_t n_fields;
+    char field[INGEST_FIELDS_MAX][32];
+    size_t series[INGEST_FIELDS_MAX];
+} ingest_stream_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint64_t messages;
+    uint64_t frames;           //!< telem_codec frames decoded
+    uint64_t json;             //!< JSON messages parsed
+    uint64_t points;           //!< Points stored
+    uint64_t undecodable;      //!< Messages that could not be decoded
+    uint64_t duplicates;       //!< Frames with a sequence number seen before
+    uint64_t bad_age;          //!< Messages not stored for their age
+    uint64_t rejected;         //!< Points not stored: out of order, bad series name, I/O error
+} ingest_stats_t;
+
+/**
+ * Ingest state
+ */
+typedef struct
+{
+    tsdb_t *db;
+    int64_t max_age_ms;        //!< Oldest age accepted, INGEST_AGE_MAX_MS
+    ingest_stream_t *streams;
+    size_t n_streams;
+    size_t cap_streams;
+    uint32_t *index;           //!< Topic hash table of stream numbers + 1, 0 = free
+    size_t index_size;         //!< Power of two, at least twice n_streams
+    ingest_stats_t stats;
+} ingest_t;
+
+/**
+ * @brief Initialize
+ *
+ * @param in Ingest state
+ * @param db Open store, must stay valid
+ */
+void ingest_init(ingest_t *in, tsdb_t *db);
+
+/**
+ * @brief Store the points of one message
+ *
+ * @param in Ingest state
+ * @param topic Topic the message came on
+ * @param payload Message
+ * @param len Message length
+ * @param now_ms Arrival time, ms since the epoch
+ * @return `ESP_OK` if the message was decoded (points may still have been
+ *         rejected), `ESP_ERR_INVALID_ARG` for an unusable topic, or the
+ *         decoding error
+ */
+esp_err_t ingest_message(ingest_t *in, const char *topic, const uint8_t *payload, size_t len, int64_t now_ms);
+
+/**
+ * @brief Free the stream table
+ */
+void ingest_free(ingest_t *in);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __INGEST_H__ */
@@ -0,0 +1,667 @@
+/**
+ * @file mqtt_broker.c
+ *
+ * Minimal MQTT 3.1.1 broker stand-in
+ */
+#include "mqtt_broker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define DEFAULT_TX_LIMIT  (256 * 1024)
+#define CONTROL_HEADROOM  1024          // Acknowledgements still fit in a full queue
+#define PACKET_MAX        (64 * 1024)
+#define FILTER_MAX        128
+#define READ_PER_POLL     (64 * 1024)   // Per client, so one cannot starve the rest
+#define POLL_MS           100
+
+// Packet types, high nibble of the first byte
+#define CONNECT     0x10
+#define CONNACK     0x20
+#define PUBLISH     0x30
+#define PUBACK      0x40
+#define SUBSCRIBE   0x80
+#define SUBACK      0x90
+#define UNSUBSCRIBE 0xa0
+#define UNSUBACK    0xb0
+#define PINGREQ     0xc0
+#define PINGRESP    0xd0
+#define DISCONNECT  0xe0
+
+typedef struct
+{
+    char filter[FILTER_MAX];
+    uint8_t qos;
+} sub_t;
+
+typedef struct
+{
+    int fd;
+    bool connected;            // CONNECT accepted
+    bool dead;                 // Closed at the end of this round
+    uint16_t next_id;
+    size_t n_subs;
+    sub_t subs[MQTT_BROKER_FILTERS_MAX];
+    uint8_t *rx;
+    size_t rx_len, rx_cap;
+    uint8_t *tx;
+    size_t tx_off, tx_len, tx_cap;  // Queued bytes are tx[tx_off, tx_off + tx_len)
+} client_t;
+
+struct mqtt_broker
+{
+    mqtt_broker_config_t cfg;
+    int lfd;
+    int wake[2];
+    pthread_t thread;
+    bool stop;                 // Atomic
+    bool paused;               // Atomic
+    bool closed_all;           // Connections closed for the current pause
+    client_t **clients;
+    size_t n_clients, cap_clients;
+    client_t **subscribers;    // Clients with at least one filter
+    size_t n_subscribers;
+    bool subs_dirty;
+    struct pollfd *fds;
+    size_t cap_fds;
+    mqtt_broker_stats_t stats; // Broker thread only
+    pthread_mutex_t lock;
+    mqtt_broker_stats_t shared;
+};
+
+// --- Queues ---------------------------------------------------------------
+
+static bool reserve(uint8_t **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return true;
+    size_t cap2 = *cap ? *cap : 1024;
+    while (cap2 < need)
+        cap2 *= 2;
+    uint8_t *p = realloc(*buf, cap2);
+    if (!p)
+        return false;
+    *buf = p;
+    *cap = cap2;
+    return true;
+}
+
+// Room for len more bytes, or false when over the limit
+static bool tx_room(mqtt_broker_t *b, client_t *c, size_t len, bool control)
+{
+    size_t limit = b->cfg.tx_limit + (control ? CONTROL_HEADROOM : 0);
+    if (c->tx_len + len > limit)
+        return false;
+    if (c->tx_off && c->tx_off + c->tx_len + len > c->tx_cap)
+    {
+        memmove(c->tx, c->tx + c->tx_off, c->tx_len);
+        c->tx_off = 0;
+    }
+    return reserve(&c->tx, &c->tx_cap, c->tx_off + c->tx_len + len);
+}
+
+static void tx_put(client_t *c, const void *data, size_t len)
+{
+    memcpy(c->tx + c->tx_off + c->tx_len, data, len);
+    c->tx_len += len;
+}
+
+static void send_control(mqtt_broker_t *b, client_t *c, const uint8_t *pkt, size_t len)
+{
+    if (!tx_room(b, c, len, true))
+    {
+        c->dead = true;        // Not reading at all
+        return;
+    }
+    tx_put(c, pkt, len);
+}
+
+static void flush(mqtt_broker_t *b, client_t *c)
+{
+    while (c->tx_len && !c->dead)
+    {
+        ssize_t n = send(c->fd, c->tx + c->tx_off, c->tx_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            c->dead = true;
+            return;
+        }
+        b->stats.bytes_out += n;
+        c->tx_off += n;
+        c->tx_len -= n;
+    }
+    if (!c->tx_len)
+        c->tx_off = 0;
+}
+
+// --- Routing --------------------------------------------------------------
+
+// Filter levels against topic levels; '#' also matches the parent level
+static bool topic_matches(const char *filter, const char *topic, size_t tlen)
+{
+    const char *t = topic, *end = topic + tlen;
+    if (tlen && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#'))
+        return false;
+    while (1)
+    {
+        if (filter[0] == '#')
+            return true;
+        if (filter[0] == '+')
+        {
+            while (t < end && *t != '/')
+                t++;
+            filter++;
+        }
+        else
+        {
+            for (; *filter && *filter != '/'; filter++, t++)
+                if (t == end || *t != *filter)
+                    return false;
+        }
+        if (!*filter)
+            return t == end;
+        // filter is at '/'
+        if (t == end)
+            return filter[1] == '#' && !filter[2];
+        if (*t != '/')
+            return false;
+        filter++;
+        t++;
+    }
+}
+
+static void rebuild_subscribers(mqtt_broker_t *b)
+{
+    b->n_subscribers = 0;
+    for (size_t i = 0; i < b->n_clients; i++)
+        if (b->clients[i]->n_subs && !b->clients[i]->dead)
+            b->subscribers[b->n_subscribers++] = b->clients[i];
+    b->subs_dirty = false;
+}
+
+static size_t put_length(uint8_t *p, size_t len)
+{
+    size_t n = 0;
+    do
+    {
+        p[n] = len & 0x7f;
+        len >>= 7;
+        if (len)
+            p[n] |= 0x80;
+        n++;
+    } while (len);
+    return n;
+}
+
+static void route(mqtt_broker_t *b, const uint8_t *topic, size_t tlen, const uint8_t *payload, size_t plen,
+                  uint8_t qos)
+{
+    if (b->subs_dirty)
+        rebuild_subscribers(b);
+
+    char name[FILTER_MAX * 2];
+    if (tlen >= sizeof(name))
+    {
+        b->stats.unrouted++;
+        return;
+    }
+    memcpy(name, topic, tlen);
+    name[tlen] = 0;
+
+    bool routed = false;
+    for (size_t i = 0; i < b->n_subscribers; i++)
+    {
+        client_t *c = b->subscribers[i];
+        int granted = -1;
+        for (size_t k = 0; k < c->n_subs; k++)
+            if (c->subs[k].qos > granted && topic_matches(c->subs[k].filter, name, tlen))
+                granted = c->subs[k].qos;
+        if (granted < 0 || c->dead)
+            continue;
+        routed = true;
+
+        uint8_t q = qos < granted ? qos : granted;
+        uint8_t head[8];
+        size_t n = 0;
+        head[n++] = PUBLISH | q << 1;
+        n += put_length(head + n, 2 + tlen + (q ? 2 : 0) + plen);
+        head[n++] = tlen >> 8;
+        head[n++] = tlen;
+        if (!tx_room(b, c, n + tlen + 2 + plen, false))
+        {
+            b->stats.dropped++;
+            continue;
+        }
+        tx_put(c, head, n);
+        tx_put(c, topic, tlen);
+        if (q)
+        {
+            if (!++c->next_id)
+                c->next_id = 1;
+            uint8_t id[2] = { c->next_id >> 8, c->next_id };
+            tx_put(c, id, 2);
+        }
+        tx_put(c, payload, plen);
+        b->stats.forwarded++;
+        if (c->tx_len > b->stats.peak_queue)
+            b->stats.peak_queue = c->tx_len;
+    }
+    if (!routed)
+        b->stats.unrouted++;
+}
+
+// --- Packets --------------------------------------------------------------
+
+static void handle_connect(mqtt_broker_t *b, client_t *c, const uint8_t *body, size_t size)
+{
+    bool ok = size >= 10 && body[0] == 0 && body[1] == 4 && !memcmp(body + 2, "MQTT", 4);
+    uint8_t ack[4] = { CONNACK, 2, 0, ok && body[6] == 4 ? 0 : 1 };  // 1: unacceptable protocol level
+    send_control(b, c, ack, sizeof(ack));
+    if (ack[3])
+    {
+        flush(b, c);
+        c->dead = true;
+        return;
+    }
+    c->connected = true;
+    b->stats.connects++;
+}
+
+static void handle_publish(mqtt_broker_t *b, client_t *c, uint8_t flags, const uint8_t *body, size_t size)
+{
+    uint8_t qos = (flags >> 1) & 3;
+    size_t tlen = size >= 2 ? (size_t)(body[0] << 8 | body[1]) : SIZE_MAX;
+    size_t head = 2 + tlen + (qos ? 2 : 0);
+    if (qos > 1 || size < 2 || head > size)
+    {
+        c->dead = true;
+        return;
+    }
+    b->stats.received++;
+    route(b, body + 2, tlen, body + head, size - head, qos);
+    if (qos)
+    {
+        uint8_t ack[4] = { PUBACK, 2, body[2 + tlen], body[3 + tlen] };
+        send_control(b, c, ack, sizeof(ack));
+    }
+}
+
+static void handle_subscribe(mqtt_broker_t *b, client_t *c, const uint8_t *body, size_t size, bool unsub)
+{
+    if (size < 2)
+    {
+        c->dead = true;
+        return;
+    }
+    uint8_t ack[4 + 64];
+    size_t n = 2, off = 2;
+    ack[n++] = body[0];
+    ack[n++] = body[1];
+    while (off + 2 <= size && n < sizeof(ack))
+    {
+        size_t flen = body[off] << 8 | body[off + 1];
+        const char *filter = (const char *)body + off + 2;
+        off += 2 + flen + !unsub;
+        if (off > size)
+        {
+            c->dead = true;
+            return;
+        }
+        uint8_t qos = unsub ? 0 : body[off - 1];
+
+        size_t k = 0;
+        while (k < c->n_subs && (strlen(c->subs[k].filter) != flen || memcmp(c->subs[k].filter, filter, flen)))
+            k++;
+        if (unsub)
+        {
+            if (k < c->n_subs)
+                c->subs[k] = c->subs[--c->n_subs];
+            continue;
+        }
+        if (!flen || flen >= FILTER_MAX || qos > 2 || (k == c->n_subs && k == MQTT_BROKER_FILTERS_MAX))
+        {
+            ack[n++] = 0x80;
+            continue;
+        }
+        if (k == c->n_subs)
+            c->n_subs++;
+        memcpy(c->subs[k].filter, filter, flen);
+        c->subs[k].filter[flen] = 0;
+        c->subs[k].qos = qos > 1 ? 1 : qos;
+        ack[n++] = c->subs[k].qos;
+    }
+    b->subs_dirty = true;
+
+    if (unsub)
+        n = 4;
+    ack[0] = unsub ? UNSUBACK : SUBACK;
+    ack[1] = n - 2;
+    send_control(b, c, ack, n);
+}
+
+// Handles every complete packet in rx and keeps the rest
+static void handle_packets(mqtt_broker_t *b, client_t *c)
+{
+    size_t off = 0;
+    while (!c->dead && c->rx_len - off >= 2)
+    {
+        const uint8_t *p = c->rx + off;
+        size_t avail = c->rx_len - off, rem = 0, i = 1;
+        for (; i < avail && i <= 4; i++)
+        {
+            rem |= (size_t)(p[i] & 0x7f) << (7 * (i - 1));
+            if (!(p[i] & 0x80))
+                break;
+        }
+        if (i > 4 || i + 1 + rem > PACKET_MAX)
+        {
+            c->dead = true;
+            break;
+        }
+        if (i == avail || i + 1 + rem > avail)
+            break;
+
+        const uint8_t *body = p + i + 1;
+        uint8_t type = p[0] & 0xf0;
+        if (!c->connected && type != CONNECT)
+        {
+            c->dead = true;
+            break;
+        }
+        switch (type)
+        {
+            case CONNECT:
+                if (c->connected)
+                    c->dead = true;
+                else
+                    handle_connect(b, c, body, rem);
+                break;
+            case PUBLISH:
+                handle_publish(b, c, p[0] & 0x0f, body, rem);
+                break;
+            case PUBACK:
+                b->stats.sub_acks++;
+                break;
+            case SUBSCRIBE:
+            case UNSUBSCRIBE:
+                handle_subscribe(b, c, body, rem, type == UNSUBSCRIBE);
+                break;
+            case PINGREQ:
+            {
+                static const uint8_t pong[2] = { PINGRESP, 0 };
+                send_control(b, c, pong, sizeof(pong));
+                break;
+            }
+            case DISCONNECT:
+            default:
+                c->dead = true;
+                break;
+        }
+        off += i + 1 + rem;
+    }
+    c->rx_len -= off;
+    memmove(c->rx, c->rx + off, c->rx_len);
+}
+
+static void read_client(mqtt_broker_t *b, client_t *c)
+{
+    size_t total = 0;
+    while (!c->dead && total < READ_PER_POLL)
+    {
+        if (!reserve(&c->rx, &c->rx_cap, c->rx_len + 4096))
+        {
+            c->dead = true;
+            return;
+        }
+        ssize_t n = recv(c->fd, c->rx + c->rx_len, c->rx_cap - c->rx_len, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            c->dead = true;
+            return;
+        }
+        c->rx_len += n;
+        total += n;
+        b->stats.bytes_in += n;
+        handle_packets(b, c);
+    }
+}
+
+// --- Connections ----------------------------------------------------------
+
+static void accept_clients(mqtt_broker_t *b, bool paused)
+{
+    while (1)
+    {
+        int fd = accept(b->lfd, NULL, NULL);
+        if (fd < 0)
+            return;
+        if (paused)
+        {
+            close(fd);
+            b->stats.refused++;
+            continue;
+        }
+        client_t *c = calloc(1, sizeof(*c));
+        if (b->n_clients == b->cap_clients)
+        {
+            size_t cap = b->cap_clients ? 2 * b->cap_clients : 64;
+            client_t **clients = realloc(b->clients, cap * sizeof(*clients));
+            client_t **subscribers = realloc(b->subscribers, cap * sizeof(*subscribers));
+            if (clients)
+                b->clients = clients;
+            if (subscribers)
+                b->subscribers = subscribers;
+            if (clients && subscribers)
+                b->cap_clients = cap;
+        }
+        if (!c || b->n_clients == b->cap_clients)
+        {
+            free(c);
+            close(fd);
+            b->stats.refused++;
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->fd = fd;
+        b->clients[b->n_clients++] = c;
+        if (b->n_clients > b->stats.peak_clients)
+            b->stats.peak_clients = b->n_clients;
+    }
+}
+
+static void sweep(mqtt_broker_t *b)
+{
+    for (size_t i = 0; i < b->n_clients;)
+    {
+        client_t *c = b->clients[i];
+        if (!c->dead)
+        {
+            i++;
+            continue;
+        }
+        close(c->fd);
+        b->stats.closed++;
+        if (c->n_subs)
+            b->subs_dirty = true;
+        free(c->rx);
+        free(c->tx);
+        free(c);
+        b->clients[i] = b->clients[--b->n_clients];
+    }
+    if (b->subs_dirty)
+        rebuild_subscribers(b);
+}
+
+static void *broker_task(void *arg)
+{
+    mqtt_broker_t *b = arg;
+    while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE))
+    {
+        bool paused = __atomic_load_n(&b->paused, __ATOMIC_ACQUIRE);
+        if (paused && !b->closed_all)
+        {
+            for (size_t i = 0; i < b->n_clients; i++)
+                b->clients[i]->dead = true;
+            sweep(b);
+        }
+        b->closed_all = paused;
+
+        size_t nfds = 2 + b->n_clients;
+        if (nfds > b->cap_fds)
+        {
+            struct pollfd *fds = realloc(b->fds, 2 * nfds * sizeof(*fds));
+            if (!fds)
+                break;
+            b->fds = fds;
+            b->cap_fds = 2 * nfds;
+        }
+        b->fds[0] = (struct pollfd) { .fd = b->wake[0], .events = POLLIN };
+        b->fds[1] = (struct pollfd) { .fd = b->lfd, .events = POLLIN };
+        for (size_t i = 0; i < b->n_clients; i++)
+        {
+            client_t *c = b->clients[i];
+            b->fds[2 + i] = (struct pollfd) { .fd = c->fd, .events = POLLIN | (c->tx_len ? POLLOUT : 0) };
+        }
+        if (poll(b->fds, nfds, POLL_MS) < 0 && errno != EINTR)
+            break;
+
+        if (b->fds[0].revents)
+        {
+            uint8_t drain[64];
+            while (read(b->wake[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+        // Clients accepted now are polled from the next round on
+        size_t polled = b->n_clients;
+        if (b->fds[1].revents)
+            accept_clients(b, paused);
+        for (size_t i = 0; i < polled; i++)
+            if (b->fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR))
+                read_client(b, b->clients[i]);
+        // Everything routed this round goes out now, not on the next POLLOUT
+        for (size_t i = 0; i < b->n_clients; i++)
+            flush(b, b->clients[i]);
+        sweep(b);
+
+        pthread_mutex_lock(&b->lock);
+        b->shared = b->stats;
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+// --- API ------------------------------------------------------------------
+
+esp_err_t mqtt_broker_start(mqtt_broker_t **out, const mqtt_broker_config_t *cfg)
+{
+    CHECK_ARG(out && cfg);
+
+    mqtt_broker_t *b = calloc(1, sizeof(*b));
+    if (!b)
+        return ESP_ERR_NO_MEM;
+    b->cfg = *cfg;
+    if (!b->cfg.tx_limit)
+        b->cfg.tx_limit = DEFAULT_TX_LIMIT;
+    pthread_mutex_init(&b->lock, NULL);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(cfg->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t alen = sizeof(addr);
+    int one = 1;
+    b->lfd = socket(AF_INET, SOCK_STREAM, 0);
+    b->wake[0] = b->wake[1] = -1;
+    if (b->lfd < 0 || setsockopt(b->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+        bind(b->lfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(b->lfd, 1024) ||
+        getsockname(b->lfd, (struct sockaddr *)&addr, &alen) || pipe(b->wake))
+        goto fail;
+    b->cfg.port = ntohs(addr.sin_port);
+    fcntl(b->lfd, F_SETFL, fcntl(b->lfd, F_GETFL) | O_NONBLOCK);
+    fcntl(b->wake[0], F_SETFL, fcntl(b->wake[0], F_GETFL) | O_NONBLOCK);
+    if (pthread_create(&b->thread, NULL, broker_task, b))
+        goto fail;
+
+    *out = b;
+    return ESP_OK;
+
+fail:
+    if (b->lfd >= 0)
+        close(b->lfd);
+    if (b->wake[0] >= 0)
+    {
+        close(b->wake[0]);
+        close(b->wake[1]);
+    }
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+    return ESP_FAIL;
+}
+
+uint16_t mqtt_broker_port(const mqtt_broker_t *b)
+{
+    return b->cfg.port;
+}
+
+static void wake(mqtt_broker_t *b)
+{
+    ssize_t n = write(b->wake[1], "", 1);
+    (void)n;
+}
+
+void mqtt_broker_pause(mqtt_broker_t *b, bool paused)
+{
+    __atomic_store_n(&b->paused, paused, __ATOMIC_RELEASE);
+    wake(b);
+}
+
+void mqtt_broker_stats(mqtt_broker_t *b, mqtt_broker_stats_t *stats)
+{
+    pthread_mutex_lock(&b->lock);
+    *stats = b->shared;
+    pthread_mutex_unlock(&b->lock);
+}
+
+void mqtt_broker_stop(mqtt_broker_t *b)
+{
+    __atomic_store_n(&b->stop, true, __ATOMIC_RELEASE);
+    wake(b);
+    pthread_join(b->thread, NULL);
+
+    for (size_t i = 0; i < b->n_clients; i++)
+    {
+        close(b->clients[i]->fd);
+        free(b->clients[i]->rx);
+        free(b->clients[i]->tx);
+        free(b->clients[i]);
+    }
+    free(b->clients);
+    free(b->subscribers);
+    free(b->fds);
+    close(b->lfd);
+    close(b->wake[0]);
+    close(b->wake[1]);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
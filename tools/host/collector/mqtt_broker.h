@@ -0,0 +1,102 @@
+/**
+ * @file mqtt_broker.h
+ * @defgroup mqtt_broker mqtt_broker
+ * @{
+ *
+ * Minimal MQTT 3.1.1 broker to stand in for a real one in host tools:
+ * CONNECT, SUBSCRIBE with '+' and '#' filters, PUBLISH at QoS 0 and 1,
+ * PINGREQ and DISCONNECT.
+ *
+ * A QoS 1 PUBLISH is acknowledged to its sender once it has been queued
+ * to every matching subscriber, at the lower of the two QoS levels.
+ * Nothing is kept for a subscriber that is not connected, nothing is
+ * retransmitted and acknowledgements from subscribers are only counted:
+ * every session is a clean one. Each client has a send queue of
+ * tx_limit bytes; a message that does not fit is dropped for that
+ * subscriber and counted, as a real broker drops past its queue limit.
+ *
+ * One thread polls all connections; the stand-in can be paused, which
+ * closes every connection and refuses new ones, to play a broker restart.
+ */
+#ifndef __MQTT_BROKER_H__
+#define __MQTT_BROKER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_BROKER_FILTERS_MAX 4         //!< Subscriptions per client
+
+/**
+ * Configuration
+ */
+typedef struct
+{
+    uint16_t port;             //!< Loopback port, 0 = any free one
+    size_t tx_limit;           //!< Send queue per client in bytes, 0 = 256 KB
+} mqtt_broker_config_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint64_t connects;         //!< CONNECT packets accepted
+    uint64_t refused;          //!< Connections closed at once while paused
+    uint64_t closed;           //!< Connections ended by the client or an error
+    uint64_t received;         //!< PUBLISH packets from clients
+    uint64_t forwarded;        //!< PUBLISH packets queued to subscribers
+    uint64_t dropped;          //!< Not queued, the subscriber's queue was full
+    uint64_t unrouted;         //!< Received with no subscriber to take it
+    uint64_t sub_acks;         //!< PUBACK packets from subscribers
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t peak_clients;
+    size_t peak_queue;         //!< Largest send queue seen, bytes
+} mqtt_broker_stats_t;
+
+typedef struct mqtt_broker mqtt_broker_t;
+
+/**
+ * @brief Listen on the loopback and start serving from a new thread
+ *
+ * @param[out] b Broker
+ * @param cfg Configuration
+ * @return `ESP_OK` on success, `ESP_ERR_NO_MEM`, `ESP_FAIL` when the
+ *         port cannot be bound or the thread not started
+ */
+esp_err_t mqtt_broker_start(mqtt_broker_t **b, const mqtt_broker_config_t *cfg);
+
+/**
+ * @brief Port the broker listens on
+ */
+uint16_t mqtt_broker_port(const mqtt_broker_t *b);
+
+/**
+ * @brief Pause or resume; pausing closes every connection and refuses new
+ *        ones until resumed
+ */
+void mqtt_broker_pause(mqtt_broker_t *b, bool paused);
+
+/**
+ * @brief Copy the counters; safe while the broker runs
+ */
+void mqtt_broker_stats(mqtt_broker_t *b, mqtt_broker_stats_t *stats);
+
+/**
+ * @brief Close every connection, stop the thread and free the broker
+ */
+void mqtt_broker_stop(mqtt_broker_t *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQTT_BROKER_H__ */
@@ -0,0 +1,300 @@
+/**
+ * @file mqtt_sub.c
+ *
+ * Minimal MQTT 3.1.1 subscriber
+ */
+#include "mqtt_sub.h"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+// Packet types, high nibble of the first byte
+#define CONNECT     0x10
+#define CONNACK     0x20
+#define PUBLISH     0x30
+#define PUBACK      0x40
+#define SUBSCRIBE   0x82  // with the reserved flags set
+#define SUBACK      0x90
+#define PINGREQ     0xc0
+#define PINGRESP    0xd0
+#define DISCONNECT  0xe0
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static bool send_all(mqtt_sub_t *m, const uint8_t *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(m->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    m->last_tx_ms = now_ms();
+    return true;
+}
+
+static size_t put_length(uint8_t *p, size_t len)
+{
+    size_t n = 0;
+    do
+    {
+        p[n] = len & 0x7f;
+        len >>= 7;
+        if (len)
+            p[n] |= 0x80;
+        n++;
+    } while (len);
+    return n;
+}
+
+static size_t put_string(uint8_t *p, const char *s, size_t len)
+{
+    p[0] = len >> 8;
+    p[1] = len;
+    memcpy(p + 2, s, len);
+    return 2 + len;
+}
+
+esp_err_t mqtt_sub_connect(mqtt_sub_t *m, const char *host, uint16_t port, const char *client_id, bool clean,
+                           uint16_t keepalive_s, uint32_t timeout_ms)
+{
+    CHECK_ARG(m && host && client_id && strlen(client_id) <= 256);
+
+    m->fd = -1;
+    m->keepalive_s = keepalive_s;
+    m->next_id = 1;
+    m->ping_sent_ms = 0;
+    m->rx_len = 0;
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    if (getaddrinfo(host, service, &hints, &res))
+        return ESP_FAIL;
+    for (struct addrinfo *ai = res; ai && m->fd < 0; ai = ai->ai_next)
+    {
+        m->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (m->fd >= 0 && connect(m->fd, ai->ai_addr, ai->ai_addrlen))
+        {
+            close(m->fd);
+            m->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (m->fd < 0)
+        return ESP_FAIL;
+    int one = 1;
+    setsockopt(m->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // CONNECT: protocol name and level, flags, keep-alive, client id
+    uint8_t pkt[300], body[280];
+    size_t n = put_string(body, "MQTT", 4);
+    body[n++] = 4;
+    body[n++] = clean ? 0x02 : 0x00;
+    body[n++] = keepalive_s >> 8;
+    body[n++] = keepalive_s;
+    n += put_string(body + n, client_id, strlen(client_id));
+    size_t len = 0;
+    pkt[len++] = CONNECT;
+    len += put_length(pkt + len, n);
+    memcpy(pkt + len, body, n);
+    if (!send_all(m, pkt, len + n))
+    {
+        mqtt_sub_close(m);
+        return ESP_FAIL;
+    }
+
+    struct timeval tv = { timeout_ms / 1000, timeout_ms % 1000 * 1000 };
+    setsockopt(m->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    uint8_t ack[4];
+    ssize_t got = recv(m->fd, ack, sizeof(ack), MSG_WAITALL);
+    tv = (struct timeval) { 0, 0 };
+    setsockopt(m->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    esp_err_t err = ESP_OK;
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        err = ESP_ERR_TIMEOUT;
+    else if (got != sizeof(ack) || ack[0] != CONNACK || ack[1] != 2)
+        err = ESP_FAIL;
+    else if ((m->connack = ack[3]))
+        err = ESP_ERR_NOT_SUPPORTED;
+    if (err != ESP_OK)
+    {
+        close(m->fd);
+        m->fd = -1;
+    }
+    return err;
+}
+
+esp_err_t mqtt_sub_subscribe(mqtt_sub_t *m, const char *filter, uint8_t qos)
+{
+    CHECK_ARG(m && m->fd >= 0 && filter && *filter && strlen(filter) < MQTT_SUB_TOPIC_MAX && qos <= 1);
+
+    uint8_t pkt[MQTT_SUB_TOPIC_MAX + 16];
+    size_t flen = strlen(filter), len = 0;
+    pkt[len++] = SUBSCRIBE;
+    len += put_length(pkt + len, 2 + 2 + flen + 1);
+    pkt[len++] = m->next_id >> 8;
+    pkt[len++] = m->next_id;
+    if (!++m->next_id)
+        m->next_id = 1;
+    len += put_string(pkt + len, filter, flen);
+    pkt[len++] = qos;
+    return send_all(m, pkt, len) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t handle_publish(mqtt_sub_t *m, uint8_t flags, const uint8_t *body, size_t size,
+                                mqtt_sub_msg_fn_t fn, void *ctx)
+{
+    unsigned qos = (flags >> 1) & 3;
+    if (qos > 1)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (size < 2)
+        return ESP_ERR_INVALID_SIZE;
+    size_t tlen = body[0] << 8 | body[1];
+    size_t head = 2 + tlen + (qos ? 2 : 0);
+    if (head > size || tlen >= MQTT_SUB_TOPIC_MAX)
+        return ESP_ERR_INVALID_SIZE;
+
+    char topic[MQTT_SUB_TOPIC_MAX];
+    memcpy(topic, body + 2, tlen);
+    topic[tlen] = 0;
+    fn(ctx, topic, body + head, size - head);
+    m->stats.messages++;
+
+    if (qos)
+    {
+        uint8_t ack[4] = { PUBACK, 2, body[2 + tlen], body[3 + tlen] };
+        if (!send_all(m, ack, sizeof(ack)))
+            return ESP_FAIL;
+        m->stats.acked++;
+    }
+    return ESP_OK;
+}
+
+// Handles every complete packet in rx and keeps the rest
+static esp_err_t handle_packets(mqtt_sub_t *m, mqtt_sub_msg_fn_t fn, void *ctx)
+{
+    size_t off = 0;
+    esp_err_t err = ESP_OK;
+    while (err == ESP_OK && m->rx_len - off >= 2)
+    {
+        const uint8_t *p = m->rx + off;
+        size_t avail = m->rx_len - off, rem = 0, i = 1;
+        for (; i < avail && i <= 4; i++)
+        {
+            rem |= (size_t)(p[i] & 0x7f) << (7 * (i - 1));
+            if (!(p[i] & 0x80))
+                break;
+        }
+        if (i > 4)
+            return ESP_ERR_INVALID_SIZE;
+        if (i == avail)
+            break;
+        size_t total = i + 1 + rem;
+        if (total > sizeof(m->rx))
+            return ESP_ERR_INVALID_SIZE;
+        if (total > avail)
+            break;
+
+        const uint8_t *body = p + i + 1;
+        switch (p[0] & 0xf0)
+        {
+            case PUBLISH:
+                err = handle_publish(m, p[0] & 0x0f, body, rem, fn, ctx);
+                break;
+            case SUBACK:
+                for (size_t k = 2; k < rem; k++)
+                    if (body[k] & 0x80)
+                        err = ESP_ERR_NOT_SUPPORTED;
+                break;
+            case PINGRESP:
+                m->ping_sent_ms = 0;
+                break;
+            default:
+                err = ESP_ERR_NOT_SUPPORTED;
+                break;
+        }
+        off += total;
+    }
+    m->rx_len -= off;
+    memmove(m->rx, m->rx + off, m->rx_len);
+    return err;
+}
+
+esp_err_t mqtt_sub_poll(mqtt_sub_t *m, uint32_t timeout_ms, mqtt_sub_msg_fn_t fn, void *ctx)
+{
+    CHECK_ARG(m && m->fd >= 0 && fn);
+
+    int64_t now = now_ms(), deadline = now + timeout_ms;
+    while (1)
+    {
+        int64_t wait = deadline - now;
+        if (m->keepalive_s)
+        {
+            int64_t interval = m->keepalive_s * 1000LL;
+            if (m->ping_sent_ms && now - m->ping_sent_ms > interval)
+                return ESP_ERR_TIMEOUT;
+            // Ping at half the interval so the broker never sees it lapse
+            if (!m->ping_sent_ms && now - m->last_tx_ms >= interval / 2)
+            {
+                static const uint8_t ping[2] = { PINGREQ, 0 };
+                if (!send_all(m, ping, sizeof(ping)))
+                    return ESP_FAIL;
+                m->ping_sent_ms = now;
+                m->stats.pings++;
+            }
+            int64_t next = m->ping_sent_ms ? m->ping_sent_ms + interval : m->last_tx_ms + interval / 2;
+            if (next - now < wait)
+                wait = next - now;
+        }
+        if (wait < 0)
+            wait = 0;
+
+        // poll() rather than select(): the descriptor may be past FD_SETSIZE
+        struct pollfd pfd = { .fd = m->fd, .events = POLLIN };
+        int r = poll(&pfd, 1, (int)wait);
+        if (r < 0 && errno != EINTR)
+            return ESP_FAIL;
+        if (r > 0)
+        {
+            ssize_t n = recv(m->fd, m->rx + m->rx_len, sizeof(m->rx) - m->rx_len, 0);
+            if (n <= 0)
+                return ESP_FAIL;
+            m->rx_len += n;
+            m->stats.bytes += n;
+            return handle_packets(m, fn, ctx);
+        }
+
+        now = now_ms();
+        if (now >= deadline)
+            return ESP_OK;
+    }
+}
+
+void mqtt_sub_close(mqtt_sub_t *m)
+{
+    if (m->fd < 0)
+        return;
+    static const uint8_t disconnect[2] = { DISCONNECT, 0 };
+    send(m->fd, disconnect, sizeof(disconnect), MSG_NOSIGNAL);
+    close(m->fd);
+    m->fd = -1;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file mqtt_sub.h
+ * @defgroup mqtt_sub mqtt_sub
+ * @{
+ *
+ * Minimal MQTT 3.1.1 subscriber for the collector: connect, subscribe
+ * with QoS 0 or 1, receive PUBLISH packets and keep the connection alive.
+ *
+ * QoS 1 messages are acknowledged after the message callback has
+ * returned, so a message the callback has not seen is delivered again
+ * after a reconnect (with a persistent session, clean = false).
+ * QoS 2 is never granted since no subscription asks for it.
+ *
+ * Blocking sockets, one connection per mqtt_sub_t; use it from one
+ * thread.
+ */
+#ifndef __MQTT_SUB_H__
+#define __MQTT_SUB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_SUB_RX_SIZE    (64 * 1024)   //!< Largest packet accepted
+#define MQTT_SUB_TOPIC_MAX  256
+
+/**
+ * Message callback
+ */
+typedef void (*mqtt_sub_msg_fn_t)(void *ctx, const char *topic, const uint8_t *payload, size_t len);
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint32_t messages;
+    uint32_t acked;            //!< QoS 1 messages acknowledged
+    uint32_t pings;
+    uint64_t bytes;            //!< Bytes received
+} mqtt_sub_stats_t;
+
+/**
+ * Connection
+ */
+typedef struct
+{
+    int fd;
+    uint16_t keepalive_s;
+    uint16_t next_id;
+    int64_t last_tx_ms;
+    int64_t ping_sent_ms;      //!< 0 without a PINGREQ pending
+    uint8_t connack;           //!< Return code of the last CONNACK
+    size_t rx_len;
+    uint8_t rx[MQTT_SUB_RX_SIZE];
+    mqtt_sub_stats_t stats;
+} mqtt_sub_t;
+
+/**
+ * @brief Connect to a broker
+ *
+ * @param m Connection
+ * @param host Broker name or address
+ * @param port Broker port, usually 1883
+ * @param client_id Client identifier, also the name of a persistent session
+ * @param clean Start a new session instead of resuming one
+ * @param keepalive_s Keep-alive interval, 0 for none
+ * @param timeout_ms Longest wait for the CONNACK
+ * @return `ESP_OK` when connected, `ESP_ERR_NOT_SUPPORTED` if the broker
+ *         refused (return code in m->connack), `ESP_ERR_TIMEOUT`, or
+ *         `ESP_FAIL` on a network error
+ */
+esp_err_t mqtt_sub_connect(mqtt_sub_t *m, const char *host, uint16_t port, const char *client_id, bool clean,
+                           uint16_t keepalive_s, uint32_t timeout_ms);
+
+/**
+ * @brief Subscribe; the SUBACK is checked by mqtt_sub_poll()
+ *
+ * @param m Connection
+ * @param filter Topic filter, wildcards allowed
+ * @param qos 0 or 1
+ * @return `ESP_OK` when sent, `ESP_FAIL` on a network error
+ */
+esp_err_t mqtt_sub_subscribe(mqtt_sub_t *m, const char *filter, uint8_t qos);
+
+/**
+ * @brief Receive and handle packets for up to timeout_ms, sending pings
+ *        as the keep-alive needs
+ *
+ * @param m Connection
+ * @param timeout_ms Longest wait for data
+ * @param fn Called for every message
+ * @param ctx Passed to fn
+ * @return `ESP_OK`, or an error after which the connection must be
+ *         closed: `ESP_FAIL` (closed by the broker or network error),
+ *         `ESP_ERR_TIMEOUT` (no PINGRESP), `ESP_ERR_INVALID_SIZE` (packet
+ *         too large or malformed), `ESP_ERR_NOT_SUPPORTED` (subscription
+ *         refused or an unexpected packet)
+ */
+esp_err_t mqtt_sub_poll(mqtt_sub_t *m, uint32_t timeout_ms, mqtt_sub_msg_fn_t fn, void *ctx);
+
+/**
+ * @brief Send DISCONNECT and close
+ */
+void mqtt_sub_close(mqtt_sub_t *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __MQTT_SUB_H__ */
@@ -0,0 +1,519 @@
+/*
+ * Range query latency of the collector's rollups over a year of readings.
+ *
+ *   rollup_bench [-n NODES] [-D DAYS] [-p PERIOD_MS] [-q QUERIES] [-v VERIFY] [-s SEED]
+ *
+ * A fresh tsdb directory is filled with the CO2 series of NODES (default
+ * 100) gas nodes, a reading every PERIOD_MS (default 1000) with up to
+ * 20 ms of jitter for DAYS (default 365): a daily cycle on a wandering
+ * baseline with noise, at the reported two decimals, and an outage of
+ * 10 min to 12 h about every two weeks per node. Each simulated hour of
+ * all nodes is appended interleaved, then flushed, so the rollups are
+ * built as the collector builds them.
+ *
+ * Then QUERIES (default 200) ranges of each kind, from an hour at a 10 s
+ * step to the whole span at a week's step, at random nodes and times, go
+ * through tsdb_range(); VERIFY (default 3) of each are also answered by
+ * aggregating the points and must agree: count, min and max exactly,
+ * mean to 1e-9. Reported: per kind the resolution read, buckets
+ * returned, median, p99 and worst latency, and the latency of the same
+ * answer from the points.
+ *
+ * Last the store is closed, the rollup files of three series are damaged
+ * (records cut off the end of one, one file deleted, the last record of
+ * another overwritten) and the store opened again; answers taken before
+ * closing, up to the buckets still being filled, must come back
+ * identical.
+ *
+ * A separate store then takes a point 600,000,000 s (19 years) before
+ * START_MS, as a device age gone wrong can give, and two hours of
+ * readings from START_MS on. Its rollup files must stay small, and its
+ * answers must agree with the points before and after reopening.
+ *
+ * The defaults make about 3.2 billion points, 20 GB under /tmp and some
+ * minutes of filling; -D and -p scale them down.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tsdb.h"
+
+#define SEC          1000LL
+#define MIN          (60 * SEC)
+#define HOUR         (60 * MIN)
+#define DAY          (24 * HOUR)
+#define START_MS     1735689600000LL  // 2025-01-01 00:00 UTC
+#define JITTER_MS    20
+#define OUTAGE_EVERY (14 * DAY)
+#define CHECKED      3                // Series whose answers must survive reopening
+#define GAP_MS       600000000000LL   // Before the readings of the gap store
+#define GAP_MAX_SIZE 65536            // Rollup bytes the gap store may take
+#define ROLLUP_HEAD  8                // Rollup file layout, see tsdb.h
+#define ROLLUP_REC   40
+
+static uint32_t rng_state = 1;
+
+static double rnd(void)
+{
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return (rng_state >> 8) / 16777216.0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void remove_dir(const char *dir)
+{
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd))
+        fprintf(stderr, "could not remove %s\n", dir);
+}
+
+static uint64_t file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) ? 0 : st.st_size;
+}
+
+// --- Fill -----------------------------------------------------------------
+
+typedef struct
+{
+    char name[TSDB_NAME_MAX];
+    size_t id;
+    double base;               //!< Wandering baseline, ppm
+    double phase;              //!< Of the daily cycle
+    int64_t down_from;         //!< Next outage
+    int64_t down_to;
+} node_gen_t;
+
+static void next_outage(node_gen_t *g, int64_t after)
+{
+    g->down_from = after + (int64_t)(-log(1 - rnd()) * OUTAGE_EVERY);
+    g->down_to = g->down_from + 10 * MIN + (int64_t)(rnd() * (12 * HOUR - 10 * MIN));
+}
+
+static bool fill(tsdb_t *db, node_gen_t *gens, int nodes, int days, int64_t period, uint64_t *points)
+{
+    double t0 = now_s();
+    *points = 0;
+    for (int64_t hour = 0; hour < days * 24LL; hour++) {
+        int64_t from = START_MS + hour * HOUR;
+        for (int i = 0; i < nodes; i++) {
+            node_gen_t *g = &gens[i];
+            for (int64_t t = from; t < from + HOUR; t += period) {
+                if (t >= g->down_to)
+                    next_outage(g, t);
+                if (t >= g->down_from)
+                    continue;
+                g->base += (rnd() - 0.5) * 0.2;
+                g->base = g->base < 380 ? 380 : g->base > 900 ? 900 : g->base;
+                double v = g->base + 80 * sin(2 * M_PI * (t % DAY) / DAY + g->phase) + (rnd() - 0.5) * 4;
+                v = round(v * 100) / 100;
+                if (tsdb_append(db, g->id, t + (int64_t)(rnd() * JITTER_MS), v) != ESP_OK) {
+                    fprintf(stderr, "append failed\n");
+                    return false;
+                }
+                (*points)++;
+            }
+        }
+        if (tsdb_flush(db, false) != ESP_OK) {
+            perror("tsdb_flush");
+            return false;
+        }
+        if ((hour + 1) % (30 * 24) == 0 || hour + 1 == days * 24LL) {
+            double dt = now_s() - t0;
+            printf("  day %3" PRId64 ": %" PRIu64 " points, %.1f M points/s\n", (hour + 1) / 24, *points,
+                   *points / dt * 1e-6);
+            fflush(stdout);
+        }
+    }
+    return true;
+}
+
+// --- Queries --------------------------------------------------------------
+
+typedef struct
+{
+    const char *name;
+    int64_t span;
+    int64_t step;
+} kind_t;
+
+static const kind_t kinds[] = {
+    { "1 h at 10 s", HOUR, 10 * SEC },
+    { "1 day at 1 min", DAY, MIN },
+    { "1 week at 15 min", 7 * DAY, 15 * MIN },
+    { "30 days at 1 h", 30 * DAY, HOUR },
+    { "90 days at 6 h", 90 * DAY, 6 * HOUR },
+    { "1 year at 1 day", 365 * DAY, DAY },
+    { "1 year at 1 week", 365 * DAY, 7 * DAY },
+};
+
+#define N_KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+typedef struct
+{
+    tsdb_bucket_t *b;
+    size_t n;
+    size_t cap;
+} buckets_t;
+
+static void add_bucket(void *ctx, const tsdb_bucket_t *b)
+{
+    buckets_t *r = ctx;
+    if (r->n == r->cap) {
+        r->cap = r->cap ? 2 * r->cap : 256;
+        r->b = realloc(r->b, r->cap * sizeof(*r->b));
+    }
+    r->b[r->n++] = *b;
+}
+
+// The answer from the points, as a dashboard without rollups gets it
+typedef struct
+{
+    buckets_t *out;
+    int64_t step;
+    tsdb_bucket_t cur;
+    double sum;
+} scan_t;
+
+static void scan_emit(scan_t *sc)
+{
+    if (!sc->cur.count)
+        return;
+    sc->cur.mean = sc->sum / sc->cur.count;
+    add_bucket(sc->out, &sc->cur);
+    sc->cur.count = 0;
+}
+
+static void scan_point(void *ctx, int64_t ts_ms, double value)
+{
+    scan_t *sc = ctx;
+    int64_t b = ts_ms / sc->step * sc->step;
+    if (sc->cur.count && b != sc->cur.ts_ms)
+        scan_emit(sc);
+    if (!sc->cur.count) {
+        sc->cur = (tsdb_bucket_t){ b, 0, value, value, 0 };
+        sc->sum = 0;
+    }
+    sc->cur.count++;
+    sc->cur.min = value < sc->cur.min ? value : sc->cur.min;
+    sc->cur.max = value > sc->cur.max ? value : sc->cur.max;
+    sc->sum += value;
+}
+
+// Mean to a relative tol; the rest exactly, not by memcmp(), which sees
+// the padding
+static bool same_answer(const buckets_t *a, const buckets_t *b, double tol)
+{
+    if (a->n != b->n)
+        return false;
+    for (size_t i = 0; i < a->n; i++) {
+        const tsdb_bucket_t *x = &a->b[i], *y = &b->b[i];
+        if (x->ts_ms != y->ts_ms || x->count != y->count || x->min != y->min || x->max != y->max ||
+            fabs(x->mean - y->mean) > tol * fabs(y->mean))
+            return false;
+    }
+    return true;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static bool run_queries(tsdb_t *db, const node_gen_t *gens, int nodes, int days, int queries, int verify)
+{
+    bool ok = true;
+    int64_t end = START_MS + days * DAY;
+    double *lat = malloc(queries * sizeof(*lat));
+    printf("%-18s %6s %9s %10s %10s %10s %12s\n", "query", "reads", "buckets", "p50 ms", "p99 ms", "max ms",
+           "points ms");
+    for (size_t k = 0; k < N_KINDS; k++) {
+        const kind_t *q = &kinds[k];
+        int64_t span = q->span < days * DAY ? q->span : days * DAY;
+        int64_t res = tsdb_range_resolution(q->step);
+        uint64_t buckets = 0;
+        double scan_s = 0;
+        int bad = 0;
+        for (int i = 0; i < queries; i++) {
+            size_t id = gens[(int)(rnd() * nodes)].id;
+            int64_t from = START_MS + (int64_t)(rnd() * (end - START_MS - span + 1));
+            from -= from % q->step;
+            buckets_t got = { 0 };
+            double t = now_s();
+            esp_err_t err = tsdb_range(db, id, from, from + span, q->step, add_bucket, &got);
+            lat[i] = now_s() - t;
+            buckets += got.n;
+            if (err != ESP_OK) {
+                fprintf(stderr, "%s: %s\n", q->name, esp_err_to_name(err));
+                bad++;
+            }
+            if (i < verify) {
+                // tsdb_range() widens the range to whole steps
+                int64_t to = (from + span + q->step - 1) / q->step * q->step;
+                buckets_t want = { 0 };
+                scan_t sc = { .out = &want, .step = q->step };
+                t = now_s();
+                err = tsdb_query(db, id, from, to, scan_point, &sc);
+                scan_emit(&sc);
+                scan_s += now_s() - t;
+                if (err != ESP_OK || !same_answer(&got, &want, 1e-9)) {
+                    fprintf(stderr, "%s from %" PRId64 ": %zu buckets from the rollups, %zu from the points\n",
+                            q->name, from, got.n, want.n);
+                    bad++;
+                }
+                free(want.b);
+            }
+            free(got.b);
+        }
+        qsort(lat, queries, sizeof(*lat), cmp_double);
+        printf("%-18s %6s %9.0f %10.3f %10.3f %10.3f %12.1f%s\n", q->name,
+               res == DAY ? "1 day" : res == HOUR ? "1 h" : res == MIN ? "1 min" : "points",
+               (double)buckets / queries, lat[queries / 2] * 1e3, lat[queries * 99 / 100] * 1e3,
+               lat[queries - 1] * 1e3, verify ? scan_s / (verify < queries ? verify : queries) * 1e3 : 0,
+               bad ? "  WRONG" : "");
+        ok &= !bad;
+    }
+    free(lat);
+    return ok;
+}
+
+// --- Reopening ------------------------------------------------------------
+
+// Answers up to the end of the data, so the buckets still being filled
+// are in them
+static void take_answers(tsdb_t *db, const node_gen_t *gens, int days, buckets_t *answers)
+{
+    int64_t end = START_MS + days * DAY;
+    for (int n = 0; n < CHECKED; n++) {
+        size_t id;
+        tsdb_series(db, gens[n].name, &id);
+        for (size_t k = 0; k < N_KINDS; k++) {
+            int64_t span = kinds[k].span < days * DAY ? kinds[k].span : days * DAY;
+            buckets_t *a = &answers[n * N_KINDS + k];
+            memset(a, 0, sizeof(*a));
+            tsdb_range(db, id, end - span, end, kinds[k].step, add_bucket, a);
+        }
+    }
+}
+
+static bool damage(const char *dir, const node_gen_t *gens)
+{
+    char path[512];
+    // Records and a part of one cut off the end
+    snprintf(path, sizeof(path), "%s/%s.1m", dir, gens[0].name);
+    uint64_t size = file_size(path);
+    bool ok = size > ROLLUP_HEAD + 1000 * ROLLUP_REC && !truncate(path, size - 1000 * ROLLUP_REC - 5);
+    // Gone
+    snprintf(path, sizeof(path), "%s/%s.1h", dir, gens[1].name);
+    ok &= !unlink(path);
+    // Garbage in the last record
+    snprintf(path, sizeof(path), "%s/%s.1d", dir, gens[2].name);
+    size = file_size(path);
+    FILE *f = fopen(path, "r+b");
+    ok &= f && size >= ROLLUP_HEAD + ROLLUP_REC && !fseek(f, size - ROLLUP_REC, SEEK_SET) &&
+          fwrite("\xff\xff\xff\xff", 4, 1, f) == 1;
+    if (f)
+        fclose(f);
+    return ok;
+}
+
+static bool reopen(tsdb_t *db, const char *dir, const node_gen_t *gens, int days)
+{
+    buckets_t before[CHECKED * N_KINDS], after[CHECKED * N_KINDS];
+    take_answers(db, gens, days, before);
+    if (tsdb_close(db) != ESP_OK) {
+        perror("tsdb_close");
+        return false;
+    }
+    if (!damage(dir, gens)) {
+        fprintf(stderr, "%s: could not damage the rollups\n", dir);
+        return false;
+    }
+
+    double t = now_s();
+    if (tsdb_open(db, dir) != ESP_OK) {
+        perror(dir);
+        return false;
+    }
+    printf("reopened in %.2f s: %zu series, %" PRIu64 " rollup records rebuilt, %" PRIu64 " torn\n",
+           now_s() - t, db->n_series, db->stats.rebuilt, db->stats.torn);
+
+    take_answers(db, gens, days, after);
+    int differ = 0;
+    for (size_t i = 0; i < CHECKED * N_KINDS; i++) {
+        if (!same_answer(&before[i], &after[i], 0))
+            differ++;
+        free(before[i].b);
+        free(after[i].b);
+    }
+    printf("answers after reopening: %d of %zu differ\n", differ, CHECKED * N_KINDS);
+    return !differ;
+}
+
+// --- Gap ------------------------------------------------------------------
+
+static bool gap_answers_ok(tsdb_t *db, size_t id)
+{
+    static const kind_t gap_kinds[] = {
+        { "2 h at 1 min", 2 * HOUR, MIN },
+        { "19 years at 1 day", GAP_MS + 2 * HOUR, DAY },
+        { "19 years at 1 week", GAP_MS + 2 * HOUR, 7 * DAY },
+    };
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(gap_kinds) / sizeof(gap_kinds[0]); k++) {
+        const kind_t *q = &gap_kinds[k];
+        int64_t from = START_MS + 2 * HOUR - q->span;
+        int64_t to = START_MS + 2 * HOUR;
+        buckets_t got = { 0 }, want = { 0 };
+        scan_t sc = { .out = &want, .step = q->step };
+        esp_err_t err = tsdb_range(db, id, from, to, q->step, add_bucket, &got);
+        if (err == ESP_OK) {
+            from -= (from % q->step + q->step) % q->step;
+            err = tsdb_query(db, id, from, to, scan_point, &sc);
+        }
+        scan_emit(&sc);
+        if (err != ESP_OK || !same_answer(&got, &want, 1e-9)) {
+            fprintf(stderr, "gap, %s: %zu buckets from the rollups, %zu from the points\n", q->name, got.n,
+                    want.n);
+            ok = false;
+        }
+        free(got.b);
+        free(want.b);
+    }
+    return ok;
+}
+
+static bool gap_check(int64_t period)
+{
+    char dir[] = "/tmp/rollup_bench_gap.XXXXXX";
+    tsdb_t db;
+    size_t id;
+    if (!mkdtemp(dir) || tsdb_open(&db, dir) != ESP_OK || tsdb_series(&db, "gap", &id) != ESP_OK) {
+        perror(dir);
+        return false;
+    }
+    double t = now_s();
+    bool ok = tsdb_append(&db, id, START_MS - GAP_MS, 400) == ESP_OK;
+    for (int64_t ts = START_MS; ok && ts < START_MS + 2 * HOUR; ts += period)
+        ok = tsdb_append(&db, id, ts, 400 + ts / period % 100) == ESP_OK;
+    ok = ok && tsdb_flush(&db, false) == ESP_OK;
+    t = now_s() - t;
+
+    uint64_t bytes = 0;
+    static const char *const ext[TSDB_ROLLUPS] = { ".1m", ".1h", ".1d" };
+    for (int l = 0; l < TSDB_ROLLUPS; l++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/gap%s", dir, ext[l]);
+        bytes += file_size(path);
+    }
+    printf("gap of %.0f years: filled in %.3f s, %" PRIu64 " bytes of rollups\n", GAP_MS / (365.25 * DAY), t,
+           bytes);
+    ok = ok && bytes <= GAP_MAX_SIZE && gap_answers_ok(&db, id);
+    ok = ok && tsdb_close(&db) == ESP_OK && tsdb_open(&db, dir) == ESP_OK && tsdb_series(&db, "gap", &id) == ESP_OK;
+    ok = ok && gap_answers_ok(&db, id);
+    tsdb_close(&db);
+    remove_dir(dir);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int nodes = 100, days = 365, queries = 200, verify = 3;
+    int64_t period = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:D:p:q:v:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                nodes = atoi(optarg);
+                break;
+            case 'D':
+                days = atoi(optarg);
+                break;
+            case 'p':
+                period = atoll(optarg);
+                break;
+            case 'q':
+                queries = atoi(optarg);
+                break;
+            case 'v':
+                verify = atoi(optarg);
+                break;
+            case 's':
+                rng_state = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n NODES] [-D DAYS] [-p PERIOD_MS] [-q QUERIES] [-v VERIFY] [-s SEED]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (nodes < CHECKED || days < 2 || period <= JITTER_MS || period > HOUR || queries < 1 || verify < 0) {
+        fprintf(stderr, "bad sizes\n");
+        return 2;
+    }
+
+    char dir[] = "/tmp/rollup_bench.XXXXXX";
+    tsdb_t db;
+    if (!mkdtemp(dir) || tsdb_open(&db, dir) != ESP_OK) {
+        perror(dir);
+        return 1;
+    }
+    node_gen_t *gens = calloc(nodes, sizeof(*gens));
+    for (int i = 0; i < nodes; i++) {
+        node_gen_t *g = &gens[i];
+        snprintf(g->name, sizeof(g->name), "esp32.sensors.gas.a4cf12%06x.co2", i);
+        tsdb_series(&db, g->name, &g->id);
+        g->base = 420 + rnd() * 200;
+        g->phase = rnd() * 2 * M_PI;
+        next_outage(g, START_MS);
+    }
+
+    printf("%d nodes, a reading every %" PRId64 " ms for %d days\n", nodes, period, days);
+    double t = now_s();
+    uint64_t points;
+    bool ok = fill(&db, gens, nodes, days, period, &points);
+    if (ok) {
+        double fill_s = now_s() - t;
+        uint64_t raw = 0, rollup[TSDB_ROLLUPS] = { 0 };
+        static const char *const ext[TSDB_ROLLUPS] = { ".1m", ".1h", ".1d" };
+        for (int i = 0; i < nodes; i++) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s.tsb", dir, gens[i].name);
+            raw += file_size(path);
+            for (int l = 0; l < TSDB_ROLLUPS; l++) {
+                snprintf(path, sizeof(path), "%s/%s%s", dir, gens[i].name, ext[l]);
+                rollup[l] += file_size(path);
+            }
+        }
+        printf("filled in %.1f s: %" PRIu64 " points, %.1f M points/s with rollups; %.2f GB of blocks "
+               "(%.2f bytes/point), rollups 1 min %.1f MB, 1 h %.2f MB, 1 day %.3f MB\n",
+               fill_s, points, points / fill_s * 1e-6, raw * 1e-9, (double)raw / points, rollup[0] * 1e-6,
+               rollup[1] * 1e-6, rollup[2] * 1e-6);
+        ok = run_queries(&db, gens, nodes, days, queries, verify);
+        ok &= reopen(&db, dir, gens, days);
+    }
+    ok &= gap_check(period);
+    tsdb_close(&db);
+    remove_dir(dir);
+    free(gens);
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
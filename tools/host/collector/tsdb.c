@@ -0,0 +1,1158 @@
+/**
+ * @file tsdb.c
+ *
+ * Append-only time-series store with Gorilla compression
+ */
+#include "tsdb.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define CHECK_ARG(VAL) do { if (!(VAL)) return ESP_ERR_INVALID_ARG; } while (0)
+
+#define BLOCK_MAGIC    0x31425354  // "TSB1"
+#define BLOCK_MAX_SIZE (TSDB_BLOCK_HEADER + TSDB_TS_BYTES + TSDB_VAL_BYTES)
+#define NO_WINDOW      64
+#define ROLLUP_MAGIC   0x32525354  // "TSR2"
+#define ROLLUP_HEADER  8
+#define ROLLUP_RECORD  40
+#define ROLLUP_CHUNK   1024        // Records read at a time
+
+// --- Checksum and byte order ----------------------------------------------
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    if (!crc_table[1])
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = v >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// --- Bit streams ----------------------------------------------------------
+
+static void put_bits(uint8_t *buf, size_t *pos, uint64_t v, unsigned n)
+{
+    while (n)
+    {
+        size_t byte = *pos >> 3;
+        unsigned used = *pos & 7, room = 8 - used;
+        unsigned take = n < room ? n : room;
+        uint8_t chunk = (v >> (n - take)) & ((1u << take) - 1);
+        if (!used)
+            buf[byte] = 0;
+        buf[byte] |= chunk << (room - take);
+        *pos += take;
+        n -= take;
+    }
+}
+
+typedef struct
+{
+    const uint8_t *buf;
+    size_t bits;
+    size_t pos;
+    bool bad;                  //!< Read past the end
+} bit_reader_t;
+
+static uint64_t get_bits(bit_reader_t *r, unsigned n)
+{
+    if (r->pos + n > r->bits)
+    {
+        r->bad = true;
+        return 0;
+    }
+    uint64_t v = 0;
+    while (n)
+    {
+        unsigned used = r->pos & 7, room = 8 - used;
+        unsigned take = n < room ? n : room;
+        v = v << take | ((r->buf[r->pos >> 3] >> (room - take)) & ((1u << take) - 1));
+        r->pos += take;
+        n -= take;
+    }
+    return v;
+}
+
+static int64_t sign_extend(uint64_t v, unsigned bits)
+{
+    uint64_t sign = 1ull << (bits - 1);
+    return (int64_t)((v ^ sign) - sign);
+}
+
+// --- Block encoding -------------------------------------------------------
+
+static uint64_t double_bits(double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static void block_reset(tsdb_block_t *b)
+{
+    b->count = 0;
+    b->ts_bits = b->val_bits = 0;
+}
+
+static void block_add(tsdb_block_t *b, int64_t ts, double value)
+{
+    uint64_t bits = double_bits(value);
+
+    if (!b->count)
+    {
+        b->first_ts = b->last_ts = ts;
+        b->prev_delta = 0;
+        put_bits(b->val, &b->val_bits, bits, 64);
+        b->prev_value = bits;
+        b->lead = NO_WINDOW;
+        b->trail = 0;
+        b->count = 1;
+        return;
+    }
+
+    int64_t delta = ts - b->last_ts;
+    int64_t dod = delta - b->prev_delta;
+    if (dod == 0)
+        put_bits(b->ts, &b->ts_bits, 0, 1);
+    else if (dod >= -64 && dod <= 63)
+    {
+        put_bits(b->ts, &b->ts_bits, 0x2, 2);
+        put_bits(b->ts, &b->ts_bits, dod, 7);
+    }
+    else if (dod >= -256 && dod <= 255)
+    {
+        put_bits(b->ts, &b->ts_bits, 0x6, 3);
+        put_bits(b->ts, &b->ts_bits, dod, 9);
+    }
+    else if (dod >= -2048 && dod <= 2047)
+    {
+        put_bits(b->ts, &b->ts_bits, 0xe, 4);
+        put_bits(b->ts, &b->ts_bits, dod, 12);
+    }
+    else
+    {
+        put_bits(b->ts, &b->ts_bits, 0xf, 4);
+        put_bits(b->ts, &b->ts_bits, dod, 64);
+    }
+    b->prev_delta = delta;
+    b->last_ts = ts;
+
+    uint64_t x = bits ^ b->prev_value;
+    if (!x)
+        put_bits(b->val, &b->val_bits, 0, 1);
+    else
+    {
+        unsigned lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+        if (lead > 31)
+            lead = 31;
+        if (b->lead != NO_WINDOW && lead >= b->lead && trail >= b->trail)
+        {
+            put_bits(b->val, &b->val_bits, 0x2, 2);
+            put_bits(b->val, &b->val_bits, x >> b->trail, 64 - b->lead - b->trail);
+        }
+        else
+        {
+            unsigned sig = 64 - lead - trail;
+            put_bits(b->val, &b->val_bits, 0x3, 2);
+            put_bits(b->val, &b->val_bits, lead, 5);
+            put_bits(b->val, &b->val_bits, sig & 63, 6);
+            put_bits(b->val, &b->val_bits, x >> trail, sig);
+            b->lead = lead;
+            b->trail = trail;
+        }
+    }
+    b->prev_value = bits;
+    b->count++;
+}
+
+// Walks the points of a block; its state at the end is the encoder's
+typedef struct
+{
+    bit_reader_t ts;
+    bit_reader_t val;
+    uint32_t count;
+    uint32_t i;
+    int64_t last_ts;
+    int64_t prev_delta;
+    uint64_t prev_value;
+    uint8_t lead;
+    uint8_t trail;
+} block_reader_t;
+
+static void reader_init(block_reader_t *r, uint32_t count, int64_t first_ts, const uint8_t *ts, size_t ts_bits,
+                        const uint8_t *val, size_t val_bits)
+{
+    memset(r, 0, sizeof(*r));
+    r->ts = (bit_reader_t) { ts, ts_bits, 0, false };
+    r->val = (bit_reader_t) { val, val_bits, 0, false };
+    r->count = count;
+    r->last_ts = first_ts;
+    r->lead = NO_WINDOW;
+}
+
+// false at the end or on a malformed column
+static bool reader_next(block_reader_t *r, int64_t *ts, double *value)
+{
+    if (r->i == r->count)
+        return false;
+
+    if (!r->i)
+        r->prev_value = get_bits(&r->val, 64);
+    else
+    {
+        int64_t dod;
+        if (!get_bits(&r->ts, 1))
+            dod = 0;
+        else if (!get_bits(&r->ts, 1))
+            dod = sign_extend(get_bits(&r->ts, 7), 7);
+        else if (!get_bits(&r->ts, 1))
+            dod = sign_extend(get_bits(&r->ts, 9), 9);
+        else if (!get_bits(&r->ts, 1))
+            dod = sign_extend(get_bits(&r->ts, 12), 12);
+        else
+            dod = get_bits(&r->ts, 64);
+        r->prev_delta += dod;
+        r->last_ts += r->prev_delta;
+
+        if (get_bits(&r->val, 1))
+        {
+            if (get_bits(&r->val, 1))
+            {
+                r->lead = get_bits(&r->val, 5);
+                unsigned sig = get_bits(&r->val, 6);
+                if (!sig)
+                    sig = 64;
+                if (r->lead + sig > 64)
+                    return false;
+                r->trail = 64 - r->lead - sig;
+            }
+            else if (r->lead == NO_WINDOW)
+                return false;
+            r->prev_value ^= get_bits(&r->val, 64 - r->lead - r->trail) << r->trail;
+        }
+    }
+    if (r->ts.bad || r->val.bad)
+        return false;
+
+    *ts = r->last_ts;
+    memcpy(value, &r->prev_value, sizeof(*value));
+    r->i++;
+    return true;
+}
+
+// --- Block files ----------------------------------------------------------
+
+static void block_header(const tsdb_block_t *b, uint8_t *h)
+{
+    size_t ts_len = (b->ts_bits + 7) / 8, val_len = (b->val_bits + 7) / 8;
+    put_le(h, BLOCK_MAGIC, 4);
+    put_le(h + 4, b->count, 4);
+    put_le(h + 8, b->first_ts, 8);
+    put_le(h + 16, b->last_ts, 8);
+    put_le(h + 24, b->ts_bits, 4);
+    put_le(h + 28, b->val_bits, 4);
+    uint32_t crc = crc32_update(0, h, 32);
+    crc = crc32_update(crc, b->ts, ts_len);
+    crc = crc32_update(crc, b->val, val_len);
+    put_le(h + 32, crc, 4);
+}
+
+static bool write_block(int fd, const tsdb_block_t *b, size_t *size)
+{
+    uint8_t h[TSDB_BLOCK_HEADER];
+    block_header(b, h);
+    struct iovec iov[3] = {
+        { h, sizeof(h) },
+        { (void *)b->ts, (b->ts_bits + 7) / 8 },
+        { (void *)b->val, (b->val_bits + 7) / 8 },
+    };
+    *size = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    return writev(fd, iov, 3) == (ssize_t)*size;
+}
+
+typedef struct
+{
+    uint32_t count;
+    int64_t first_ts;
+    int64_t last_ts;
+    size_t ts_bits;
+    size_t val_bits;
+    uint32_t crc;
+    size_t size;               //!< Header and columns
+} header_t;
+
+static bool parse_header(const uint8_t *h, header_t *out)
+{
+    if (get_le(h, 4) != BLOCK_MAGIC)
+        return false;
+    out->count = get_le(h + 4, 4);
+    out->first_ts = get_le(h + 8, 8);
+    out->last_ts = get_le(h + 16, 8);
+    out->ts_bits = get_le(h + 24, 4);
+    out->val_bits = get_le(h + 28, 4);
+    out->crc = get_le(h + 32, 4);
+    out->size = TSDB_BLOCK_HEADER + (out->ts_bits + 7) / 8 + (out->val_bits + 7) / 8;
+    return out->count && out->count <= TSDB_BLOCK_POINTS && out->ts_bits <= TSDB_TS_BYTES * 8 &&
+           out->val_bits <= TSDB_VAL_BYTES * 8 && out->last_ts >= out->first_ts;
+}
+
+// buf holds a whole block of hdr->size bytes
+static bool block_crc_ok(const uint8_t *buf, const header_t *hdr)
+{
+    uint32_t crc = crc32_update(0, buf, 32);
+    return crc32_update(crc, buf + TSDB_BLOCK_HEADER, hdr->size - TSDB_BLOCK_HEADER) == hdr->crc;
+}
+
+static void series_path(const tsdb_t *db, const char *name, const char *ext, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%s%s", db->dir, name, ext);
+}
+
+static bool valid_name(const char *name)
+{
+    size_t n = strlen(name);
+    if (!n || n >= TSDB_NAME_MAX || name[0] == '.')
+        return false;
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' ||
+              c == '_' || c == '-'))
+            return false;
+    }
+    return true;
+}
+
+static bool add_ref(tsdb_series_t *s, const tsdb_block_ref_t *ref)
+{
+    if (s->n_blocks == s->cap_blocks)
+    {
+        size_t cap = s->cap_blocks ? 2 * s->cap_blocks : 16;
+        tsdb_block_ref_t *blocks = realloc(s->blocks, cap * sizeof(*blocks));
+        if (!blocks)
+            return false;
+        s->blocks = blocks;
+        s->cap_blocks = cap;
+    }
+    s->blocks[s->n_blocks++] = *ref;
+    return true;
+}
+
+// Indexes the blocks of a .tsb file and cuts off a torn one at the end
+static esp_err_t scan_blocks(tsdb_t *db, tsdb_series_t *s, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st))
+        return ESP_FAIL;
+
+    uint64_t off = 0, end = st.st_size;
+    uint8_t *buf = malloc(BLOCK_MAX_SIZE);
+    if (!buf)
+        return ESP_ERR_NO_MEM;
+    while (off < end)
+    {
+        uint8_t h[TSDB_BLOCK_HEADER];
+        header_t hdr;
+        if (end - off < TSDB_BLOCK_HEADER || pread(fd, h, sizeof(h), off) != sizeof(h) ||
+            !parse_header(h, &hdr) || off + hdr.size > end ||
+            (s->n_blocks && hdr.first_ts <= s->blocks[s->n_blocks - 1].last_ts))
+            break;
+        // Only the last block can be torn; the others are checked when read
+        if (off + hdr.size == end &&
+            (pread(fd, buf, hdr.size, off) != (ssize_t)hdr.size || !block_crc_ok(buf, &hdr)))
+            break;
+
+        tsdb_block_ref_t ref = { off, hdr.size, hdr.count, hdr.first_ts, hdr.last_ts };
+        if (!add_ref(s, &ref))
+        {
+            free(buf);
+            return ESP_ERR_NO_MEM;
+        }
+        s->points += hdr.count;
+        off += hdr.size;
+    }
+    free(buf);
+
+    if (off < end)
+    {
+        fprintf(stderr, "tsdb: %s: cutting off %llu bytes after the last good block\n", s->name,
+                (unsigned long long)(end - off));
+        if (ftruncate(fd, off))
+            return ESP_FAIL;
+        db->stats.torn++;
+    }
+    s->file_bytes = off;
+    return ESP_OK;
+}
+
+// Picks up the block that was being filled, unless it was sealed since
+static void load_open_block(const tsdb_t *db, tsdb_series_t *s)
+{
+    char path[512];
+    series_path(db, s->name, ".open", path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    uint8_t *buf = malloc(BLOCK_MAX_SIZE);
+    ssize_t n = buf ? read(fd, buf, BLOCK_MAX_SIZE) : -1;
+    close(fd);
+
+    header_t hdr;
+    block_reader_t r;
+    bool ok = n >= TSDB_BLOCK_HEADER && parse_header(buf, &hdr) && (size_t)n == hdr.size &&
+              block_crc_ok(buf, &hdr) &&
+              (!s->n_blocks || hdr.first_ts > s->blocks[s->n_blocks - 1].last_ts);
+    if (ok)
+    {
+        const uint8_t *ts = buf + TSDB_BLOCK_HEADER, *val = ts + (hdr.ts_bits + 7) / 8;
+        reader_init(&r, hdr.count, hdr.first_ts, ts, hdr.ts_bits, val, hdr.val_bits);
+        int64_t t;
+        double v;
+        while (reader_next(&r, &t, &v))
+            ;
+        ok = r.i == hdr.count && r.last_ts == hdr.last_ts;
+    }
+    if (ok)
+    {
+        tsdb_block_t *b = s->open;
+        b->count = hdr.count;
+        b->first_ts = hdr.first_ts;
+        b->last_ts = r.last_ts;
+        b->prev_delta = r.prev_delta;
+        b->prev_value = r.prev_value;
+        b->lead = r.lead;
+        b->trail = r.trail;
+        b->ts_bits = hdr.ts_bits;
+        b->val_bits = hdr.val_bits;
+        memcpy(b->ts, buf + TSDB_BLOCK_HEADER, (hdr.ts_bits + 7) / 8);
+        memcpy(b->val, buf + TSDB_BLOCK_HEADER + (hdr.ts_bits + 7) / 8, (hdr.val_bits + 7) / 8);
+        s->points += hdr.count;
+    }
+    else
+        unlink(path);
+    free(buf);
+}
+
+// --- Rollups --------------------------------------------------------------
+
+static const int64_t rollup_res[TSDB_ROLLUPS] = { 60000, 3600000, 86400000 };
+static const char *const rollup_ext[TSDB_ROLLUPS] = { ".1m", ".1h", ".1d" };
+
+typedef void (*agg_fn_t)(void *ctx, int64_t ts, const tsdb_agg_t *a);
+
+// Start of the bucket holding ts, also for times before the epoch
+static int64_t bucket_of(int64_t ts, int64_t res)
+{
+    int64_t q = ts / res;
+    if (ts % res < 0)
+        q--;
+    return q * res;
+}
+
+static void agg_add(tsdb_agg_t *a, const tsdb_agg_t *b)
+{
+    if (!b->count)
+        return;
+    if (!a->count)
+    {
+        *a = *b;
+        return;
+    }
+    a->count += b->count;
+    if (b->min < a->min)
+        a->min = b->min;
+    if (b->max > a->max)
+        a->max = b->max;
+    a->sum += b->sum;
+}
+
+static void record_put(uint8_t *p, const tsdb_rollup_rec_t *rec)
+{
+    put_le(p, rec->ts, 8);
+    put_le(p + 8, rec->agg.count, 4);
+    put_le(p + 12, double_bits(rec->agg.min), 8);
+    put_le(p + 20, double_bits(rec->agg.max), 8);
+    put_le(p + 28, double_bits(rec->agg.sum), 8);
+    put_le(p + 36, crc32_update(0, p, 36), 4);
+}
+
+static bool record_get(const uint8_t *p, tsdb_rollup_rec_t *rec)
+{
+    if (get_le(p + 36, 4) != crc32_update(0, p, 36))
+        return false;
+    uint64_t bits[3] = { get_le(p + 12, 8), get_le(p + 20, 8), get_le(p + 28, 8) };
+    rec->ts = get_le(p, 8);
+    rec->agg.count = get_le(p + 8, 4);
+    memcpy(&rec->agg.min, &bits[0], sizeof(rec->agg.min));
+    memcpy(&rec->agg.max, &bits[1], sizeof(rec->agg.max));
+    memcpy(&rec->agg.sum, &bits[2], sizeof(rec->agg.sum));
+    return true;
+}
+
+static esp_err_t record_read(int fd, uint64_t i, tsdb_rollup_rec_t *rec)
+{
+    uint8_t p[ROLLUP_RECORD];
+    if (pread(fd, p, sizeof(p), ROLLUP_HEADER + i * ROLLUP_RECORD) != sizeof(p))
+        return ESP_FAIL;
+    return record_get(p, rec) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+// Appends the finished buckets of a level to its file
+static esp_err_t rollup_write(tsdb_t *db, tsdb_series_t *s, int level)
+{
+    tsdb_rollup_t *r = &s->rollups[level];
+    if (!r->n_pending)
+        return ESP_OK;
+
+    size_t head = r->written ? 0 : ROLLUP_HEADER, size = head + r->n_pending * ROLLUP_RECORD;
+    uint8_t *buf = malloc(size);
+    if (!buf)
+        return ESP_ERR_NO_MEM;
+    if (head)
+    {
+        put_le(buf, ROLLUP_MAGIC, 4);
+        put_le(buf + 4, rollup_res[level] / 1000, 4);
+    }
+    for (size_t i = 0; i < r->n_pending; i++)
+        record_put(buf + head + i * ROLLUP_RECORD, &r->pending[i]);
+
+    char path[512];
+    series_path(db, s->name, rollup_ext[level], path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | (r->written ? 0 : O_TRUNC), 0644);
+    off_t off = r->written ? ROLLUP_HEADER + r->written * ROLLUP_RECORD : 0;
+    bool ok = fd >= 0 && pwrite(fd, buf, size, off) == (ssize_t)size;
+    if (!ok && fd >= 0)
+    {
+        int unused = ftruncate(fd, off);
+        (void)unused;
+    }
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    if (!ok)
+        return ESP_FAIL;
+
+    r->written += r->n_pending;
+    db->stats.rollups += r->n_pending;
+    r->n_pending = 0;
+    return ESP_OK;
+}
+
+static esp_err_t rollup_push(tsdb_t *db, tsdb_series_t *s, int level, int64_t ts, const tsdb_agg_t *a)
+{
+    tsdb_rollup_t *r = &s->rollups[level];
+    // Write a full batch out; keep it, and grow, while that fails
+    if (r->n_pending == r->cap_pending &&
+        (r->n_pending < TSDB_ROLLUP_BATCH || rollup_write(db, s, level) != ESP_OK))
+    {
+        size_t cap = r->cap_pending ? 2 * r->cap_pending : 16;
+        tsdb_rollup_rec_t *pending = realloc(r->pending, cap * sizeof(*pending));
+        if (!pending)
+            return ESP_ERR_NO_MEM;
+        r->pending = pending;
+        r->cap_pending = cap;
+    }
+    r->pending[r->n_pending++] = (tsdb_rollup_rec_t) { ts, *a };
+    r->next_ts = ts + rollup_res[level];
+    return ESP_OK;
+}
+
+static esp_err_t rollup_fold(tsdb_t *db, tsdb_series_t *s, int level, int64_t ts, const tsdb_agg_t *a,
+                             bool cascade);
+
+// Finishes the bucket being filled and folds it into the next level
+static esp_err_t rollup_finish(tsdb_t *db, tsdb_series_t *s, int level, bool cascade)
+{
+    tsdb_rollup_t *r = &s->rollups[level];
+    if (r->first_ts == INT64_MIN)
+        r->first_ts = r->open_ts;
+
+    esp_err_t err = rollup_push(db, s, level, r->open_ts, &r->open);
+    if (err == ESP_OK && cascade && level + 1 < TSDB_ROLLUPS)
+        err = rollup_fold(db, s, level + 1, r->open_ts, &r->open, true);
+    r->open.count = 0;
+    return err;
+}
+
+// Adds a point (level 0) or a finished bucket of the level below
+static esp_err_t rollup_fold(tsdb_t *db, tsdb_series_t *s, int level, int64_t ts, const tsdb_agg_t *a,
+                             bool cascade)
+{
+    tsdb_rollup_t *r = &s->rollups[level];
+    int64_t b = bucket_of(ts, rollup_res[level]);
+    // Finished already: the level was written further than the one below
+    // before a crash
+    if (b < r->next_ts || (r->open.count && b < r->open_ts))
+        return ESP_OK;
+
+    esp_err_t err = ESP_OK;
+    if (r->open.count && b != r->open_ts)
+        err = rollup_finish(db, s, level, cascade);
+    if (!r->open.count)
+        r->open_ts = b;
+    agg_add(&r->open, a);
+    return err;
+}
+
+// Calls fn for the finished buckets of a level with from <= ts < to
+static esp_err_t rollup_read(const tsdb_t *db, const tsdb_series_t *s, int level, int64_t from, int64_t to,
+                             agg_fn_t fn, void *ctx)
+{
+    const tsdb_rollup_t *r = &s->rollups[level];
+    if (r->first_ts == INT64_MIN || to <= r->first_ts || from >= r->next_ts)
+        return ESP_OK;
+
+    esp_err_t err = ESP_OK;
+    bool past = false;
+    if (r->written && (!r->n_pending || from < r->pending[0].ts))
+    {
+        char path[512];
+        series_path(db, s->name, rollup_ext[level], path, sizeof(path));
+        uint8_t *buf = malloc(ROLLUP_CHUNK * ROLLUP_RECORD);
+        int fd = open(path, O_RDONLY);
+        if (!buf || fd < 0)
+            err = !buf ? ESP_ERR_NO_MEM : ESP_FAIL;
+
+        // First record with from <= ts
+        uint64_t i = 0, hi = r->written;
+        while (err == ESP_OK && from > r->first_ts && i < hi)
+        {
+            uint64_t mid = i + (hi - i) / 2;
+            tsdb_rollup_rec_t rec;
+            err = record_read(fd, mid, &rec);
+            if (err == ESP_OK && rec.ts < from)
+                i = mid + 1;
+            else
+                hi = mid;
+        }
+        while (err == ESP_OK && !past && i < r->written)
+        {
+            size_t n = r->written - i < ROLLUP_CHUNK ? r->written - i : ROLLUP_CHUNK;
+            if (pread(fd, buf, n * ROLLUP_RECORD, ROLLUP_HEADER + i * ROLLUP_RECORD) != (ssize_t)(n * ROLLUP_RECORD))
+            {
+                err = ESP_FAIL;
+                break;
+            }
+            for (size_t k = 0; k < n && !past; k++)
+            {
+                tsdb_rollup_rec_t rec;
+                if (!record_get(buf + k * ROLLUP_RECORD, &rec))
+                {
+                    err = ESP_ERR_INVALID_CRC;
+                    break;
+                }
+                past = rec.ts >= to;
+                if (!past)
+                    fn(ctx, rec.ts, &rec.agg);
+            }
+            i += n;
+        }
+        free(buf);
+        if (fd >= 0)
+            close(fd);
+    }
+    for (size_t i = 0; err == ESP_OK && !past && i < r->n_pending; i++)
+    {
+        past = r->pending[i].ts >= to;
+        if (!past && r->pending[i].ts >= from)
+            fn(ctx, r->pending[i].ts, &r->pending[i].agg);
+    }
+    return err;
+}
+
+// Picks up a level's file, cutting off records a crash left unfinished
+static void rollup_open(tsdb_t *db, tsdb_series_t *s, int level)
+{
+    tsdb_rollup_t *r = &s->rollups[level];
+    int64_t res = rollup_res[level];
+    r->first_ts = r->next_ts = INT64_MIN;
+
+    char path[512];
+    series_path(db, s->name, rollup_ext[level], path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return;
+    struct stat st;
+    uint8_t h[ROLLUP_HEADER] = { 0 };
+    bool ok = !fstat(fd, &st) && st.st_size >= ROLLUP_HEADER && pread(fd, h, sizeof(h), 0) == sizeof(h) &&
+              get_le(h, 4) == ROLLUP_MAGIC && (int64_t)get_le(h + 4, 4) == res / 1000;
+    uint64_t n = ok ? (st.st_size - ROLLUP_HEADER) / ROLLUP_RECORD : 0;
+    tsdb_rollup_rec_t first, last;
+    while (n && (record_read(fd, n - 1, &last) != ESP_OK || last.ts != bucket_of(last.ts, res)))
+        n--;
+    if (ok && n && (uint64_t)st.st_size != ROLLUP_HEADER + n * ROLLUP_RECORD)
+    {
+        fprintf(stderr, "tsdb: %s%s: cutting off %llu bytes after the last good record\n", s->name,
+                rollup_ext[level], (unsigned long long)(st.st_size - ROLLUP_HEADER - n * ROLLUP_RECORD));
+        ok = !ftruncate(fd, ROLLUP_HEADER + n * ROLLUP_RECORD);
+        db->stats.torn++;
+    }
+    ok = ok && n && record_read(fd, 0, &first) == ESP_OK && first.ts <= last.ts;
+    close(fd);
+    if (!ok)
+    {
+        // Rebuilt whole from the level below; so is a file of an older
+        // format
+        unlink(path);
+        return;
+    }
+    r->first_ts = first.ts;
+    r->written = n;
+    r->next_ts = last.ts + res;
+}
+
+typedef struct
+{
+    tsdb_t *db;
+    tsdb_series_t *s;
+    int level;
+    esp_err_t err;
+} rebuild_t;
+
+static void rebuild_bucket(void *ctx, int64_t ts, const tsdb_agg_t *a)
+{
+    rebuild_t *rb = ctx;
+    if (rb->err == ESP_OK)
+        rb->err = rollup_fold(rb->db, rb->s, rb->level, ts, a, false);
+}
+
+static void rebuild_point(void *ctx, int64_t ts, double value)
+{
+    tsdb_agg_t a = { 1, value, value, value };
+    rebuild_bucket(ctx, ts, &a);
+}
+
+// Loads the rollups of a series and rebuilds, level by level, what they
+// lack from the level below, in the order appending would have
+static esp_err_t rollup_load(tsdb_t *db, size_t id)
+{
+    tsdb_series_t *s = &db->series[id];
+    esp_err_t err = ESP_OK;
+    for (int level = 0; level < TSDB_ROLLUPS && err == ESP_OK; level++)
+    {
+        tsdb_rollup_t *r = &s->rollups[level];
+        rollup_open(db, s, level);
+        uint64_t had = r->written;
+        rebuild_t rb = { db, s, level, ESP_OK };
+        err = level ? rollup_read(db, s, level - 1, r->next_ts, INT64_MAX, rebuild_bucket, &rb)
+                    : tsdb_query(db, id, r->next_ts, INT64_MAX, rebuild_point, &rb);
+        if (err == ESP_OK)
+            err = rb.err;
+        db->stats.rebuilt += r->written + r->n_pending - had;
+    }
+    return err;
+}
+
+// Loads a series file: index of blocks, open block and rollups
+static esp_err_t add_series(tsdb_t *db, const char *name, size_t *id)
+{
+    if (db->n_series == db->cap_series)
+    {
+        size_t cap = db->cap_series ? 2 * db->cap_series : 16;
+        tsdb_series_t *series = realloc(db->series, cap * sizeof(*series));
+        if (!series)
+            return ESP_ERR_NO_MEM;
+        db->series = series;
+        db->cap_series = cap;
+    }
+
+    tsdb_series_t *s = &db->series[db->n_series];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->open = malloc(sizeof(tsdb_block_t));
+    if (!s->open)
+        return ESP_ERR_NO_MEM;
+    block_reset(s->open);
+
+    // Files are opened only while used, so thousands of series do not
+    // hold thousands of descriptors
+    char path[512];
+    series_path(db, name, ".tsb", path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    esp_err_t err = fd < 0 ? ESP_FAIL : scan_blocks(db, s, fd);
+    if (fd >= 0)
+        close(fd);
+    if (err != ESP_OK)
+    {
+        free(s->open);
+        free(s->blocks);
+        return err;
+    }
+    load_open_block(db, s);
+
+    *id = db->n_series++;
+    // The points are what counts; the rollups of a series whose blocks
+    // cannot be read stay incomplete
+    err = rollup_load(db, *id);
+    if (err != ESP_OK)
+        fprintf(stderr, "tsdb: %s: rollups not rebuilt: %s\n", name, esp_err_to_name(err));
+    return ESP_OK;
+}
+
+static int64_t series_last_ts(const tsdb_series_t *s)
+{
+    if (s->open->count)
+        return s->open->last_ts;
+    return s->n_blocks ? s->blocks[s->n_blocks - 1].last_ts : INT64_MIN;
+}
+
+static esp_err_t seal(tsdb_t *db, tsdb_series_t *s)
+{
+    char path[512];
+    series_path(db, s->name, ".tsb", path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_APPEND);
+    size_t size;
+    bool ok = fd >= 0 && write_block(fd, s->open, &size);
+    if (!ok && fd >= 0)
+    {
+        // Take back a partial write; should that fail too, the next open
+        // cuts the torn block off
+        int unused = ftruncate(fd, s->file_bytes);
+        (void)unused;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (!ok)
+        return ESP_FAIL;
+
+    tsdb_block_ref_t ref = { s->file_bytes, size, s->open->count, s->open->first_ts, s->open->last_ts };
+    if (!add_ref(s, &ref))
+        return ESP_ERR_NO_MEM;
+    s->file_bytes += size;
+    block_reset(s->open);
+    s->dirty = false;
+    s->unsynced = true;
+    db->stats.sealed++;
+
+    series_path(db, s->name, ".open", path, sizeof(path));
+    unlink(path);
+    return ESP_OK;
+}
+
+// --- Public API -----------------------------------------------------------
+
+esp_err_t tsdb_open(tsdb_t *db, const char *dir)
+{
+    CHECK_ARG(db && dir && strlen(dir) < sizeof(db->dir));
+
+    memset(db, 0, sizeof(*db));
+    snprintf(db->dir, sizeof(db->dir), "%s", dir);
+    if (mkdir(dir, 0755) && errno != EEXIST)
+        return ESP_FAIL;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        return ESP_FAIL;
+    struct dirent *e;
+    esp_err_t err = ESP_OK;
+    while (err == ESP_OK && (e = readdir(d)))
+    {
+        size_t n = strlen(e->d_name);
+        if (n <= 4 || n - 4 >= TSDB_NAME_MAX || strcmp(e->d_name + n - 4, ".tsb"))
+            continue;
+        char name[TSDB_NAME_MAX];
+        memcpy(name, e->d_name, n - 4);
+        name[n - 4] = 0;
+        size_t id;
+        if (valid_name(name))
+            err = add_series(db, name, &id);
+    }
+    closedir(d);
+    if (err != ESP_OK)
+        tsdb_close(db);
+    return err;
+}
+
+esp_err_t tsdb_series(tsdb_t *db, const char *name, size_t *id)
+{
+    CHECK_ARG(db && name && id && valid_name(name));
+
+    for (size_t i = 0; i < db->n_series; i++)
+    {
+        if (!strcmp(db->series[i].name, name))
+        {
+            *id = i;
+            return ESP_OK;
+        }
+    }
+    return add_series(db, name, id);
+}
+
+esp_err_t tsdb_append(tsdb_t *db, size_t id, int64_t ts_ms, double value)
+{
+    CHECK_ARG(db && id < db->n_series);
+
+    tsdb_series_t *s = &db->series[id];
+    if (ts_ms <= series_last_ts(s))
+    {
+        db->stats.rejected++;
+        return ESP_ERR_INVALID_STATE;
+    }
+    // A full block whose sealing failed before is retried first
+    if (s->open->count == TSDB_BLOCK_POINTS && seal(db, s) != ESP_OK)
+        return ESP_FAIL;
+
+    block_add(s->open, ts_ms, value);
+    s->points++;
+    s->dirty = true;
+    db->stats.appended++;
+    tsdb_agg_t a = { 1, value, value, value };
+    esp_err_t err = rollup_fold(db, s, 0, ts_ms, &a, true);
+    if (s->open->count == TSDB_BLOCK_POINTS)
+        seal(db, s);
+    return err;
+}
+
+esp_err_t tsdb_flush(tsdb_t *db, bool sync)
+{
+    CHECK_ARG(db);
+
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < db->n_series; i++)
+    {
+        tsdb_series_t *s = &db->series[i];
+        char tmp[512], path[512];
+        if (sync && s->unsynced)
+        {
+            series_path(db, s->name, ".tsb", path, sizeof(path));
+            int fd = open(path, O_WRONLY);
+            if (fd < 0 || fdatasync(fd))
+                err = ESP_FAIL;
+            else
+                s->unsynced = false;
+            if (fd >= 0)
+                close(fd);
+        }
+        for (int level = 0; level < TSDB_ROLLUPS; level++)
+            if (rollup_write(db, s, level) != ESP_OK)
+                err = ESP_FAIL;
+        if (!s->dirty)
+            continue;
+
+        series_path(db, s->name, ".open.tmp", tmp, sizeof(tmp));
+        series_path(db, s->name, ".open", path, sizeof(path));
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        size_t size;
+        bool ok = fd >= 0 && write_block(fd, s->open, &size) && (!sync || !fdatasync(fd));
+        if (fd >= 0)
+            close(fd);
+        if (ok && !rename(tmp, path))
+            s->dirty = false;
+        else
+        {
+            unlink(tmp);
+            err = ESP_FAIL;
+        }
+    }
+    db->stats.flushes++;
+    return err;
+}
+
+static void emit(block_reader_t *r, int64_t from_ms, int64_t to_ms, tsdb_point_fn_t fn, void *ctx)
+{
+    int64_t ts;
+    double v;
+    while (reader_next(r, &ts, &v) && ts < to_ms)
+        if (ts >= from_ms)
+            fn(ctx, ts, v);
+}
+
+esp_err_t tsdb_query(tsdb_t *db, size_t id, int64_t from_ms, int64_t to_ms, tsdb_point_fn_t fn, void *ctx)
+{
+    CHECK_ARG(db && id < db->n_series && fn);
+
+    tsdb_series_t *s = &db->series[id];
+    // First block that can hold from_ms
+    size_t lo = 0, hi = s->n_blocks;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (s->blocks[mid].last_ts < from_ms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    esp_err_t err = ESP_OK;
+    uint8_t *buf = NULL;
+    int fd = -1;
+    if (lo < s->n_blocks && s->blocks[lo].first_ts < to_ms)
+    {
+        char path[512];
+        series_path(db, s->name, ".tsb", path, sizeof(path));
+        buf = malloc(BLOCK_MAX_SIZE);
+        fd = open(path, O_RDONLY);
+        if (!buf || fd < 0)
+            err = !buf ? ESP_ERR_NO_MEM : ESP_FAIL;
+    }
+    for (size_t i = lo; i < s->n_blocks && s->blocks[i].first_ts < to_ms && err == ESP_OK; i++)
+    {
+        const tsdb_block_ref_t *ref = &s->blocks[i];
+        header_t hdr;
+        if (pread(fd, buf, ref->size, ref->offset) != (ssize_t)ref->size)
+            err = ESP_FAIL;
+        else if (!parse_header(buf, &hdr) || hdr.size != ref->size || !block_crc_ok(buf, &hdr))
+            err = ESP_ERR_INVALID_CRC;
+        else
+        {
+            block_reader_t r;
+            const uint8_t *ts = buf + TSDB_BLOCK_HEADER;
+            reader_init(&r, hdr.count, hdr.first_ts, ts, hdr.ts_bits, ts + (hdr.ts_bits + 7) / 8, hdr.val_bits);
+            emit(&r, from_ms, to_ms, fn, ctx);
+        }
+    }
+    free(buf);
+    if (fd >= 0)
+        close(fd);
+    if (err != ESP_OK)
+        return err;
+
+    const tsdb_block_t *b = s->open;
+    if (b->count && b->last_ts >= from_ms && b->first_ts < to_ms)
+    {
+        block_reader_t r;
+        reader_init(&r, b->count, b->first_ts, b->ts, b->ts_bits, b->val, b->val_bits);
+        emit(&r, from_ms, to_ms, fn, ctx);
+    }
+    return ESP_OK;
+}
+
+typedef struct
+{
+    int64_t step;
+    int64_t from;
+    int64_t to;
+    int64_t ts;                //!< Bucket being gathered
+    tsdb_agg_t agg;
+    tsdb_bucket_fn_t fn;
+    void *ctx;
+} range_t;
+
+static void range_emit(range_t *q)
+{
+    if (!q->agg.count)
+        return;
+    tsdb_bucket_t b = { q->ts, q->agg.count, q->agg.min, q->agg.max, q->agg.sum / q->agg.count };
+    q->fn(q->ctx, &b);
+    q->agg.count = 0;
+}
+
+static void range_add(void *ctx, int64_t ts, const tsdb_agg_t *a)
+{
+    range_t *q = ctx;
+    if (ts < q->from || ts >= q->to)
+        return;
+    int64_t b = bucket_of(ts, q->step);
+    if (q->agg.count && b != q->ts)
+        range_emit(q);
+    if (!q->agg.count)
+        q->ts = b;
+    agg_add(&q->agg, a);
+}
+
+static void range_point(void *ctx, int64_t ts, double value)
+{
+    tsdb_agg_t a = { 1, value, value, value };
+    range_add(ctx, ts, &a);
+}
+
+int64_t tsdb_range_resolution(int64_t step_ms)
+{
+    for (int level = TSDB_ROLLUPS - 1; level >= 0; level--)
+        if (step_ms > 0 && step_ms % rollup_res[level] == 0)
+            return rollup_res[level];
+    return 0;
+}
+
+esp_err_t tsdb_range(tsdb_t *db, size_t id, int64_t from_ms, int64_t to_ms, int64_t step_ms,
+                     tsdb_bucket_fn_t fn, void *ctx)
+{
+    CHECK_ARG(db && id < db->n_series && step_ms > 0 && fn);
+
+    // Far enough from the ends of int64 to widen to whole steps
+    const int64_t limit = INT64_C(1) << 62;
+    from_ms = from_ms < -limit ? -limit : from_ms > limit ? limit : from_ms;
+    to_ms = to_ms < -limit ? -limit : to_ms > limit ? limit : to_ms;
+    if (to_ms <= from_ms)
+        return ESP_OK;
+    range_t q = {
+        .step = step_ms,
+        .from = bucket_of(from_ms, step_ms),
+        .to = bucket_of(to_ms - 1, step_ms) + step_ms,
+        .fn = fn,
+        .ctx = ctx,
+    };
+
+    tsdb_series_t *s = &db->series[id];
+    int64_t res = tsdb_range_resolution(step_ms);
+    int level = TSDB_ROLLUPS - 1;
+    while (level >= 0 && rollup_res[level] != res)
+        level--;
+    esp_err_t err;
+    if (level < 0)
+        err = tsdb_query(db, id, q.from, q.to, range_point, &q);
+    else
+    {
+        err = rollup_read(db, s, level, q.from, q.to, range_add, &q);
+        // Then the buckets being filled, each after the one above it
+        for (int l = level; l >= 0 && err == ESP_OK; l--)
+        {
+            const tsdb_rollup_t *r = &s->rollups[l];
+            if (r->open.count && r->open_ts >= s->rollups[level].next_ts)
+                range_add(&q, r->open_ts, &r->open);
+        }
+    }
+    if (err == ESP_OK)
+        range_emit(&q);
+    return err;
+}
+
+esp_err_t tsdb_close(tsdb_t *db)
+{
+    CHECK_ARG(db);
+
+    esp_err_t err = db->n_series ? tsdb_flush(db, true) : ESP_OK;
+    for (size_t i = 0; i < db->n_series; i++)
+    {
+        free(db->series[i].open);
+        free(db->series[i].blocks);
+        for (int level = 0; level < TSDB_ROLLUPS; level++)
+            free(db->series[i].rollups[level].pending);
+    }
+    free(db->series);
+    db->series = NULL;
+    db->n_series = db->cap_series = 0;
+    return err;
+}
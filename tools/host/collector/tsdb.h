@@ -0,0 +1,312 @@
+/**
+ * @file tsdb.h
+ * @defgroup tsdb tsdb
+ * @{
+ *
+ * Append-only time-series store for the collector, one file per series,
+ * compressed as in Facebook's Gorilla.
+ *
+ * A series is a sequence of (timestamp in ms, double) points with
+ * strictly increasing timestamps. Points are packed into blocks of up to
+ * TSDB_BLOCK_POINTS, each holding a timestamp column and a value column:
+ *
+ *     magic "TSB1" (4) | count (4) | first_ts (8) | last_ts (8) |
+ *     ts_bits (4) | val_bits (4) | crc32 (4) | ts column | value column
+ *
+ * (little-endian; the CRC covers the header before it and both columns).
+ *
+ * Timestamps: the first is in the header; each further one is stored as
+ * the change of the interval to its predecessor (delta of delta), with a
+ * prefix code sized for a few ms of jitter on a fixed period:
+ *
+ *     0                    same interval
+ *     10   + 7 bits        -64..63 ms
+ *     110  + 9 bits        -256..255 ms
+ *     1110 + 12 bits       -2048..2047 ms
+ *     1111 + 64 bits       anything else
+ *
+ * Values: the first is stored as its 64 bits, each further one as the XOR
+ * with its predecessor: 0 when equal, 10 + the meaningful bits when they
+ * fit the window of leading and trailing zeros used last, 11 + 5 bits of
+ * leading zeros + 6 bits of length + the meaningful bits otherwise.
+ *
+ * Full blocks are appended to `<dir>/<series>.tsb` and never rewritten.
+ * The block being filled lives in memory and is written to
+ * `<dir>/<series>.open` (to a temporary file, then renamed) on every
+ * tsdb_flush(), so a crash loses at most what came in since the last
+ * flush. On open, a torn block at the end of a .tsb file is cut off and
+ * the .open block is picked up again.
+ *
+ * Every series also keeps rollups at 1 min, 1 h and 1 day, updated as
+ * points are appended: count, min, max and sum per bucket, buckets
+ * aligned to whole minutes, hours and days since the epoch (UTC). Each
+ * finished 1 min bucket is folded into its hour and each hour into its
+ * day. Finished buckets are written to `<dir>/<series>.1m`, `.1h` and
+ * `.1d` on tsdb_flush() or every TSDB_ROLLUP_BATCH of them:
+ *
+ *     magic "TSR2" (4) | resolution in s (4)
+ *
+ * then one record per bucket that holds points, oldest first, so a gap
+ * in the data takes no room and a range is found by binary search:
+ *
+ *     bucket in ms (8) | count (4) | min (8) | max (8) | sum (8) | crc32 (4)
+ *
+ * Rollups are derived data: on open, records missing at the end of a
+ * file (not written before a crash, torn, or a store from before rollups)
+ * are rebuilt from the level below, and the bucket being filled at each
+ * level from what the level below holds after it.
+ *
+ * Not thread-safe; use a store from one thread.
+ */
+#ifndef __TSDB_H__
+#define __TSDB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TSDB_BLOCK_POINTS 1024
+#define TSDB_BLOCK_HEADER 36   //!< Bytes before the columns
+#define TSDB_NAME_MAX     64   //!< Series name, NUL included
+#define TSDB_ROLLUPS      3    //!< 1 min, 1 h and 1 day
+#define TSDB_ROLLUP_BATCH 1024 //!< Finished buckets kept before writing them
+
+/**
+ * Worst-case column sizes of a full block
+ */
+#define TSDB_TS_BYTES     ((TSDB_BLOCK_POINTS * 68 + 7) / 8)
+#define TSDB_VAL_BYTES    ((TSDB_BLOCK_POINTS * 77 + 7) / 8)
+
+/**
+ * Block being filled, with the encoder state
+ */
+typedef struct
+{
+    uint32_t count;
+    int64_t first_ts;
+    int64_t last_ts;
+    int64_t prev_delta;
+    uint64_t prev_value;       //!< Bits of the last value
+    uint8_t lead;              //!< Leading zeros of the XOR window, 64 before the first window
+    uint8_t trail;             //!< Trailing zeros of the XOR window
+    size_t ts_bits;
+    size_t val_bits;
+    uint8_t ts[TSDB_TS_BYTES];
+    uint8_t val[TSDB_VAL_BYTES];
+} tsdb_block_t;
+
+/**
+ * Sealed block in a series file
+ */
+typedef struct
+{
+    uint64_t offset;
+    uint32_t size;             //!< Header and columns
+    uint32_t count;
+    int64_t first_ts;
+    int64_t last_ts;
+} tsdb_block_ref_t;
+
+/**
+ * Aggregate of a rollup bucket
+ */
+typedef struct
+{
+    uint32_t count;            //!< 0 = empty
+    double min;
+    double max;
+    double sum;
+} tsdb_agg_t;
+
+/**
+ * Finished rollup bucket
+ */
+typedef struct
+{
+    int64_t ts;                //!< Start of the bucket
+    tsdb_agg_t agg;
+} tsdb_rollup_rec_t;
+
+/**
+ * Rollup level of a series
+ */
+typedef struct
+{
+    int64_t first_ts;          //!< Bucket of the first record, INT64_MIN before there is one
+    int64_t next_ts;           //!< Bucket after the last finished one; earlier input is ignored
+    uint64_t written;          //!< Records in the file
+    tsdb_rollup_rec_t *pending; //!< Finished buckets not written yet, after those in the file
+    size_t n_pending;
+    size_t cap_pending;
+    int64_t open_ts;           //!< Bucket being filled
+    tsdb_agg_t open;           //!< Finished buckets of the level below (points for 1 min) in it
+} tsdb_rollup_t;
+
+/**
+ * Series
+ */
+typedef struct
+{
+    char name[TSDB_NAME_MAX];
+    tsdb_block_t *open;
+    bool dirty;                //!< open changed since the last flush
+    bool unsynced;             //!< Blocks sealed since the last synced flush
+    tsdb_block_ref_t *blocks;  //!< Sealed blocks, oldest first
+    size_t n_blocks;
+    size_t cap_blocks;
+    uint64_t points;           //!< Sealed and open
+    uint64_t file_bytes;       //!< Size of the .tsb file
+    tsdb_rollup_t rollups[TSDB_ROLLUPS];
+} tsdb_series_t;
+
+/**
+ * Counters
+ */
+typedef struct
+{
+    uint64_t appended;
+    uint64_t rejected;         //!< Points not newer than their series' last
+    uint64_t sealed;           //!< Blocks appended to .tsb files
+    uint64_t flushes;
+    uint64_t torn;             //!< Broken blocks cut off on open
+    uint64_t rollups;          //!< Rollup records written
+    uint64_t rebuilt;          //!< Rollup records rebuilt on open
+} tsdb_stats_t;
+
+/**
+ * Store
+ */
+typedef struct
+{
+    char dir[256];
+    tsdb_series_t *series;
+    size_t n_series;
+    size_t cap_series;
+    tsdb_stats_t stats;
+} tsdb_t;
+
+/**
+ * Point callback of tsdb_query()
+ */
+typedef void (*tsdb_point_fn_t)(void *ctx, int64_t ts_ms, double value);
+
+/**
+ * Bucket of tsdb_range()
+ */
+typedef struct
+{
+    int64_t ts_ms;             //!< Start
+    uint32_t count;            //!< Points in it, never 0
+    double min;
+    double max;
+    double mean;
+} tsdb_bucket_t;
+
+/**
+ * Bucket callback of tsdb_range()
+ */
+typedef void (*tsdb_bucket_fn_t)(void *ctx, const tsdb_bucket_t *b);
+
+/**
+ * @brief Open a store, creating the directory if needed, and load the
+ *        series in it
+ *
+ * @param db Store
+ * @param dir Directory
+ * @return `ESP_OK` on success, `ESP_FAIL` on an I/O error (errno is set)
+ */
+esp_err_t tsdb_open(tsdb_t *db, const char *dir);
+
+/**
+ * @brief Find a series by name or create it
+ *
+ * @param db Store
+ * @param name Letters, digits, '.', '_' and '-'
+ * @param[out] id Series index
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_ARG` for a bad name,
+ *         `ESP_FAIL` on an I/O error
+ */
+esp_err_t tsdb_series(tsdb_t *db, const char *name, size_t *id);
+
+/**
+ * @brief Append a point
+ *
+ * @param db Store
+ * @param id Series
+ * @param ts_ms Timestamp, later than the series' last one
+ * @param value Value
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_STATE` for a point not
+ *         newer than the last one (counted, not stored), `ESP_FAIL` if
+ *         sealing a full block failed, `ESP_ERR_NO_MEM` for a point
+ *         stored but left out of the rollups
+ */
+esp_err_t tsdb_append(tsdb_t *db, size_t id, int64_t ts_ms, double value);
+
+/**
+ * @brief Write the open blocks of the series that changed and the
+ *        finished rollup buckets
+ *
+ * @param db Store
+ * @param sync Also wait until the files are on disk
+ * @return `ESP_OK` on success, `ESP_FAIL` on an I/O error
+ */
+esp_err_t tsdb_flush(tsdb_t *db, bool sync);
+
+/**
+ * @brief Call fn for every point of a series with from_ms <= ts < to_ms,
+ *        in time order
+ *
+ * Sealed blocks outside the range are not read.
+ *
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_CRC` for a damaged block,
+ *         `ESP_FAIL` on an I/O error
+ */
+esp_err_t tsdb_query(tsdb_t *db, size_t id, int64_t from_ms, int64_t to_ms, tsdb_point_fn_t fn, void *ctx);
+
+/**
+ * @brief Call fn for every non-empty bucket of step_ms in a series,
+ *        in time order
+ *
+ * Buckets are aligned to whole steps since the epoch and the range is
+ * widened to whole steps. They are made from the coarsest rollup whose
+ * resolution divides step_ms (see tsdb_range_resolution()), including
+ * the buckets still being filled, or from the points for a step that no
+ * rollup divides.
+ *
+ * @param db Store
+ * @param id Series
+ * @param from_ms Start of the range
+ * @param to_ms End of the range, exclusive
+ * @param step_ms Bucket size
+ * @param fn Callback
+ * @param ctx Callback context
+ * @return `ESP_OK` on success, `ESP_ERR_INVALID_CRC` for a damaged block
+ *         or record, `ESP_FAIL` on an I/O error
+ */
+esp_err_t tsdb_range(tsdb_t *db, size_t id, int64_t from_ms, int64_t to_ms, int64_t step_ms,
+                     tsdb_bucket_fn_t fn, void *ctx);
+
+/**
+ * @brief Resolution tsdb_range() reads for a step
+ *
+ * @return 60000, 3600000 or 86400000 for a rollup, 0 for the points
+ */
+int64_t tsdb_range_resolution(int64_t step_ms);
+
+/**
+ * @brief Flush, close the files and free the store
+ */
+esp_err_t tsdb_close(tsdb_t *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __TSDB_H__ */
@@ -0,0 +1,272 @@
+/*
+ * Checks fixfmt against snprintf and compares their speed on the lines
+ * the firmware formats.
+ *
+ *   fixfmt_bench [-n VALUES] [-i ITERATIONS] [-s SEED]
+ *
+ * VALUES (default 2000000) floats, random bit patterns plus values in
+ * the ranges the sensors report, are written with 0 to 6 decimals by both
+ * and must come out byte for byte the same. Then the OLED status lines,
+ * the console line of main.c and a ThingSpeak bulk entry are each built
+ * ITERATIONS times (default 1000000) both ways and timed.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fixfmt.h"
+
+static uint32_t rng_state;
+
+static uint32_t rnd32(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool check_float(float v, int decimals, long *diffs)
+{
+    char ref[80], out[80];
+    fixfmt_t f;
+    snprintf(ref, sizeof(ref), "%.*f", decimals, v);
+    fixfmt_init(&f, out, sizeof(out));
+    fixfmt_float(&f, v, decimals);
+    if (!strcmp(ref, out))
+        return true;
+    if ((*diffs)++ < 5)
+        printf("  %a with %d decimals: printf \"%s\", fixfmt \"%s\"\n", v, decimals, ref, out);
+    return false;
+}
+
+static bool check_exact(long n)
+{
+    long diffs = 0;
+    for (long i = 0; i < n; i++) {
+        uint32_t bits = rnd32();
+        float v;
+        if (i & 1) {
+            memcpy(&v, &bits, sizeof(v));
+        } else {
+            // Sensor-like magnitudes, where two-decimal ties actually occur
+            v = (float)(bits % 20000000) / (float)(1u << (bits >> 28)) - 1000.0f;
+        }
+        check_float(v, i % (FIXFMT_DECIMALS_MAX + 1), &diffs);
+    }
+    static const float special[] = { 0.0f, -0.0f, 0.5f, 1.5f, 2.5f, -0.004f, 0.125f, 1e-45f, 3.4028235e38f,
+                                     1.8446744e19f, 1e10f, 21.45f, 1013.25f };
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++)
+        for (int d = 0; d <= FIXFMT_DECIMALS_MAX; d++)
+            check_float(special[i], d, &diffs);
+    float inf = 1.0f / 0.0f;
+    check_float(inf, 2, &diffs);
+    check_float(-inf, 2, &diffs);
+
+    char out[64];
+    fixfmt_t f;
+    fixfmt_init(&f, out, sizeof(out));
+    fixfmt_json_str(&f, "a\"b\\c\nd\x01");
+    if (strcmp(out, "\"a\\\"b\\\\c\\nd\\u0001\"")) {
+        printf("  JSON string: %s\n", out);
+        diffs++;
+    }
+    fixfmt_init(&f, out, 8);
+    fixfmt_str(&f, "1234");
+    fixfmt_float(&f, 5.5f, 2);
+    if (!f.overflow || strcmp(out, "1234")) {
+        printf("  overflow: \"%s\", flag %d\n", out, f.overflow);
+        diffs++;
+    }
+    fixfmt_init(&f, out, sizeof(out));
+    fixfmt_int(&f, INT64_MIN);
+    fixfmt_char(&f, ' ');
+    fixfmt_fixed(&f, -5, 2);
+    if (strcmp(out, "-9223372036854775808 -0.05")) {
+        printf("  integers: %s\n", out);
+        diffs++;
+    }
+
+    printf("%ld values with 0-%d decimals: %ld differ from snprintf\n", n, FIXFMT_DECIMALS_MAX, diffs);
+    return !diffs;
+}
+
+typedef struct {
+    float temp;
+    uint32_t pressure;
+    int gas;
+    bool motion;
+    bool alert;
+} frame_t;
+
+static size_t oled_printf(const frame_t *s, char lines[4][32])
+{
+    snprintf(lines[0], 32, "T:%.1fC", s->temp);
+    snprintf(lines[1], 32, "P:%.0fhPa", s->pressure / 100.0);
+    snprintf(lines[2], 32, "G:%d", s->gas);
+    snprintf(lines[3], 32, "M:%s[%s]", s->motion ? "Y" : "N", s->alert ? "DNG" : "SAFE");
+    return strlen(lines[0]) + strlen(lines[1]);
+}
+
+static size_t oled_fixfmt(const frame_t *s, char lines[4][32])
+{
+    fixfmt_t f;
+    fixfmt_init(&f, lines[0], 32);
+    fixfmt_str(&f, "T:");
+    fixfmt_float(&f, s->temp, 1);
+    fixfmt_char(&f, 'C');
+    fixfmt_init(&f, lines[1], 32);
+    fixfmt_str(&f, "P:");
+    fixfmt_float(&f, s->pressure / 100.0f, 0);
+    fixfmt_str(&f, "hPa");
+    fixfmt_init(&f, lines[2], 32);
+    fixfmt_str(&f, "G:");
+    fixfmt_int(&f, s->gas);
+    fixfmt_init(&f, lines[3], 32);
+    fixfmt_str(&f, "M:");
+    fixfmt_str(&f, s->motion ? "Y" : "N");
+    fixfmt_char(&f, '[');
+    fixfmt_str(&f, s->alert ? "DNG" : "SAFE");
+    fixfmt_char(&f, ']');
+    return strlen(lines[0]) + strlen(lines[1]);
+}
+
+static size_t console_printf(const frame_t *s, char *buf, size_t size)
+{
+    return snprintf(buf, size, "Temp: %.1f C | Pressure: %.0f hPa | Gas: %d | Motion: %s | Status: %s",
+                    s->temp, s->pressure / 100.0, s->gas, s->motion ? "YES" : "NO", s->alert ? "DANGER" : "SAFE");
+}
+
+static size_t console_fixfmt(const frame_t *s, char *buf, size_t size)
+{
+    fixfmt_t f;
+    fixfmt_init(&f, buf, size);
+    fixfmt_str(&f, "Temp: ");
+    fixfmt_float(&f, s->temp, 1);
+    fixfmt_str(&f, " C | Pressure: ");
+    fixfmt_float(&f, s->pressure / 100.0f, 0);
+    fixfmt_str(&f, " hPa | Gas: ");
+    fixfmt_int(&f, s->gas);
+    fixfmt_str(&f, " | Motion: ");
+    fixfmt_str(&f, s->motion ? "YES" : "NO");
+    fixfmt_str(&f, " | Status: ");
+    fixfmt_str(&f, s->alert ? "DANGER" : "SAFE");
+    return f.len;
+}
+
+static size_t entry_printf(const frame_t *s, char *buf, size_t size)
+{
+    return snprintf(buf, size, ",{\"delta_t\":%ld.%03d,\"field1\":%.*f,\"field2\":%.*f,\"field3\":%.*f,\"field4\":%.*f}",
+                    1L, 0, 2, s->temp, 2, s->pressure / 100.0f, 0, (float)s->gas, 0, (float)s->motion);
+}
+
+static size_t entry_fixfmt(const frame_t *s, char *buf, size_t size)
+{
+    fixfmt_t f;
+    fixfmt_init(&f, buf, size);
+    fixfmt_str(&f, ",{\"delta_t\":");
+    fixfmt_fixed(&f, 1000, 3);
+    fixfmt_str(&f, ",\"field1\":");
+    fixfmt_float(&f, s->temp, 2);
+    fixfmt_str(&f, ",\"field2\":");
+    fixfmt_float(&f, s->pressure / 100.0f, 2);
+    fixfmt_str(&f, ",\"field3\":");
+    fixfmt_float(&f, s->gas, 0);
+    fixfmt_str(&f, ",\"field4\":");
+    fixfmt_float(&f, s->motion, 0);
+    fixfmt_char(&f, '}');
+    return f.len;
+}
+
+int main(int argc, char **argv)
+{
+    long n = 2000000, iterations = 1000000;
+    int opt;
+
+    rng_state = 2463534242u;
+    while ((opt = getopt(argc, argv, "n:i:s:")) != -1) {
+        switch (opt) {
+            case 'n': n = strtol(optarg, NULL, 10); break;
+            case 'i': iterations = strtol(optarg, NULL, 10); break;
+            case 's': rng_state = strtoul(optarg, NULL, 10) | 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n VALUES] [-i ITERATIONS] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    bool ok = check_exact(n);
+
+    enum { FRAMES = 256 };
+    static frame_t frames[FRAMES];
+    for (int i = 0; i < FRAMES; i++)
+        frames[i] = (frame_t) { .temp = 18 + (rnd32() % 1000) / 100.0f, .pressure = 99000 + rnd32() % 4000,
+                                .gas = rnd32() % 4096, .motion = rnd32() & 1, .alert = (rnd32() & 7) == 0 };
+
+    // Same text both ways first, then time them
+    char a[4][32], b[4][32], la[160], lb[160];
+    for (int i = 0; i < FRAMES; i++) {
+        const frame_t *s = &frames[i];
+        oled_printf(s, a);
+        oled_fixfmt(s, b);
+        console_printf(s, la, sizeof(la));
+        console_fixfmt(s, lb, sizeof(lb));
+        bool same = !strcmp(la, lb);
+        for (int l = 0; l < 4; l++)
+            same = same && !strcmp(a[l], b[l]);
+        entry_printf(s, la, sizeof(la));
+        entry_fixfmt(s, lb, sizeof(lb));
+        if (!same || strcmp(la, lb)) {
+            printf("frame %d formats differently: \"%s\" / \"%s\"\n", i, la, lb);
+            ok = false;
+            break;
+        }
+    }
+
+    static const struct {
+        const char *name;
+        size_t (*with_printf)(const frame_t *, char *, size_t);
+        size_t (*with_fixfmt)(const frame_t *, char *, size_t);
+    } lines[] = {
+        { "console line", console_printf, console_fixfmt },
+        { "ThingSpeak entry", entry_printf, entry_fixfmt },
+    };
+    volatile size_t sink = 0;
+    double t0 = now_s();
+    for (long i = 0; i < iterations; i++)
+        sink += oled_printf(&frames[i % FRAMES], a);
+    double t_printf = now_s() - t0;
+    t0 = now_s();
+    for (long i = 0; i < iterations; i++)
+        sink += oled_fixfmt(&frames[i % FRAMES], b);
+    double t_fixfmt = now_s() - t0;
+    printf("%-17s snprintf %7.1f ns, fixfmt %6.1f ns (x%.1f)\n", "OLED lines", t_printf / iterations * 1e9,
+           t_fixfmt / iterations * 1e9, t_printf / t_fixfmt);
+    for (size_t l = 0; l < sizeof(lines) / sizeof(lines[0]); l++) {
+        t0 = now_s();
+        for (long i = 0; i < iterations; i++)
+            sink += lines[l].with_printf(&frames[i % FRAMES], la, sizeof(la));
+        t_printf = now_s() - t0;
+        t0 = now_s();
+        for (long i = 0; i < iterations; i++)
+            sink += lines[l].with_fixfmt(&frames[i % FRAMES], lb, sizeof(lb));
+        t_fixfmt = now_s() - t0;
+        printf("%-17s snprintf %7.1f ns, fixfmt %6.1f ns (x%.1f)\n", lines[l].name, t_printf / iterations * 1e9,
+               t_fixfmt / iterations * 1e9, t_printf / t_fixfmt);
+    }
+    (void)sink;
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
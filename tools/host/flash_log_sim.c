@@ -0,0 +1,345 @@
+/*
+ * Power-loss and wear test of flash_log on a simulated NOR flash.
+ *
+ *   flash_log_sim [-t TRIALS] [-c CUTS] [-S SECTORS] [-s SEED]
+ *
+ * The simulated flash behaves like NOR: programming can only clear bits
+ * (an attempt to set one is counted as a violation), erase sets a sector
+ * to 0xff. Power fails after a random number of programmed bytes: the
+ * write in progress stops part way, with the byte being programmed left
+ * with a random subset of its bits, and an erase in progress leaves a
+ * random mix of erased and old bytes.
+ *
+ * Each trial (default 300) runs a random mix of appends and delivered
+ * batches on a SECTORS-sector log (default 6 x 4 KB) until power has
+ * failed CUTS times (default 20). After every failure the log is mounted
+ * again and must hold every record between the last acknowledged one and
+ * the last completed append, intact and in order; only the operation that
+ * was interrupted may or may not have taken effect.
+ *
+ * A final run without failures checks that erases stay level across
+ * sectors over many laps.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash_log.h"
+
+#define SECTOR_SIZE 4096
+
+typedef struct
+{
+    uint8_t *mem;
+    size_t size;
+    uint32_t *erase_counts;
+    long budget;                // bytes until power fails, -1 = never
+    bool dead;
+    long violations;            // writes that tried to set a bit
+} nor_t;
+
+static esp_err_t nor_write(void *ctx, size_t off, const void *data, size_t len)
+{
+    nor_t *n = ctx;
+    const uint8_t *d = data;
+    if (n->dead)
+        return ESP_FAIL;
+    if (off + len > n->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    size_t todo = len;
+    if (n->budget >= 0 && (long)len > n->budget)
+        todo = n->budget;
+    for (size_t i = 0; i < todo; i++) {
+        if ((n->mem[off + i] & d[i]) != d[i])
+            n->violations++;
+        n->mem[off + i] &= d[i];
+    }
+    if (todo < len) {
+        n->mem[off + todo] &= d[todo] | (uint8_t)rand();
+        n->dead = true;
+        return ESP_FAIL;
+    }
+    if (n->budget >= 0)
+        n->budget -= len;
+    return ESP_OK;
+}
+
+static esp_err_t nor_erase(void *ctx, size_t off, size_t len)
+{
+    nor_t *n = ctx;
+    const long cost = 256;      // an erase takes as long as programming this much
+    if (n->dead)
+        return ESP_FAIL;
+    if (off % SECTOR_SIZE || len != SECTOR_SIZE || off + len > n->size)
+        return ESP_ERR_INVALID_ARG;
+
+    n->erase_counts[off / SECTOR_SIZE]++;
+    if (n->budget >= 0 && n->budget < cost) {
+        for (size_t i = 0; i < len; i++)
+            if (rand() & 1)
+                n->mem[off + i] = 0xff;
+        n->dead = true;
+        return ESP_FAIL;
+    }
+    memset(n->mem + off, 0xff, len);
+    if (n->budget >= 0)
+        n->budget -= cost;
+    return ESP_OK;
+}
+
+static flog_flash_t nor_flash(nor_t *n)
+{
+    return (flog_flash_t) {
+        .size = n->size, .sector_size = SECTOR_SIZE, .map = n->mem,
+        .write = nor_write, .erase = nor_erase, .ctx = n,
+    };
+}
+
+// Power losses so far when each sequence number was last appended. After
+// a torn append the same number is written again with other data, as a
+// real node would, so rewriting a torn area cannot go unnoticed
+static uint8_t *generation;
+static size_t generation_cap;
+static uint8_t power_losses;
+
+static void set_generation(uint32_t seq)
+{
+    if (seq >= generation_cap) {
+        generation_cap = 2 * seq + 1024;
+        generation = realloc(generation, generation_cap);
+    }
+    generation[seq] = power_losses;
+}
+
+// Payload of record seq: mostly sample-sized, now and then the largest
+static size_t payload(uint32_t seq, uint8_t *buf)
+{
+    uint32_t x = (seq * 2654435761u + 1) ^ (seq < generation_cap ? generation[seq] * 0x9e3779b9u : 0);
+    size_t len = (x >> 8) % 16 == 0 ? FLOG_PAYLOAD_MAX : 8 + (x >> 12) % 32;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = x;
+    }
+    return len;
+}
+
+// Walks the pending records and checks every one of them
+static bool verify(const flog_t *log, const nor_t *n, const char *when)
+{
+    flog_cursor_t c = log->tail;
+    flog_record_t rec;
+    uint32_t expect = log->tail.seq;
+    uint8_t buf[FLOG_PAYLOAD_MAX];
+
+    while (flog_next(log, &c, &rec) == ESP_OK) {
+        size_t len = payload(rec.seq, buf);
+        if (rec.seq != expect || rec.len != len || memcmp(rec.data, buf, len) ||
+            rec.data < n->mem || rec.data + rec.len > n->mem + n->size) {
+            printf("%s: record %" PRIu32 " (expected %" PRIu32 ") len %zu/%zu wrong\n",
+                   when, rec.seq, expect, rec.len, len);
+            return false;
+        }
+        expect++;
+    }
+    if (expect != log->next_seq) {
+        printf("%s: read up to %" PRIu32 ", log ends at %" PRIu32 "\n", when, expect, log->next_seq);
+        return false;
+    }
+    return true;
+}
+
+typedef enum { OP_APPEND, OP_DELIVER } op_t;
+
+// One random operation; deliver_pct of them deliver a batch. On return
+// *acked_to holds the sequence number the tail moves to if the operation
+// completes
+static esp_err_t random_op(flog_t *log, int deliver_pct, op_t *op, uint32_t *acked_to)
+{
+    uint8_t buf[FLOG_PAYLOAD_MAX];
+    *acked_to = log->tail.seq;
+
+    if (rand() % 100 >= deliver_pct || !flog_pending(log)) {
+        *op = OP_APPEND;
+        set_generation(log->next_seq);
+        size_t len = payload(log->next_seq, buf);
+        return flog_append(log, buf, len, NULL);
+    }
+
+    *op = OP_DELIVER;
+    flog_cursor_t c = log->tail;
+    flog_record_t rec, last;
+    int want = 1 + rand() % 40, got = 0;
+    while (got < want && flog_next(log, &c, &rec) == ESP_OK) {
+        last = rec;
+        got++;
+    }
+    if (!got)
+        return ESP_OK;
+    *acked_to = last.seq + 1;
+    return flog_ack(log, &last);
+}
+
+static bool run_trial(int sectors, int cuts, long *ops_total, long *drops_total, long *torn_total)
+{
+    nor_t n = { .size = (size_t)sectors * SECTOR_SIZE, .budget = -1 };
+    n.mem = malloc(n.size);
+    n.erase_counts = calloc(sectors, sizeof(uint32_t));
+    memset(n.mem, 0xff, n.size);
+    flog_flash_t flash = nor_flash(&n);
+    flog_t log;
+    bool ok = flog_mount(&log, &flash) == ESP_OK;
+    // From an outage that overruns the log to a link that keeps up
+    int deliver_pct = rand() % 30;
+
+    for (int cut = 0; ok && cut < cuts; cut++) {
+        n.budget = rand() % (8 * SECTOR_SIZE);
+        for (;;) {
+            uint32_t pre_tail = log.tail.seq, pre_next = log.next_seq, acked_to;
+            op_t op;
+            esp_err_t err = random_op(&log, deliver_pct, &op, &acked_to);
+            (*ops_total)++;
+            if (!n.dead) {
+                if (err != ESP_OK) {
+                    printf("operation failed without power loss: %s\n", esp_err_to_name(err));
+                    ok = false;
+                }
+                if (!ok)
+                    break;
+                continue;
+            }
+
+            // Power lost during op; the tail may already have moved past
+            // records of a sector that was being erased
+            uint32_t ram_tail = log.tail.seq;
+            *drops_total += log.stats.dropped;
+            power_losses++;
+            n.dead = false;
+            n.budget = -1;
+            ok = flog_mount(&log, &flash) == ESP_OK;
+            *torn_total += log.stats.torn;
+
+            bool next_ok = log.next_seq == pre_next || (op == OP_APPEND && log.next_seq == pre_next + 1);
+            bool tail_ok = op == OP_DELIVER ? (log.tail.seq == pre_tail || log.tail.seq == acked_to)
+                                            : (log.tail.seq >= pre_tail && log.tail.seq <= ram_tail);
+            if (!next_ok || !tail_ok) {
+                printf("after loss in %s: log %" PRIu32 "..%" PRIu32 ", before %" PRIu32 "..%" PRIu32
+                       ", tail in RAM %" PRIu32 "\n", op == OP_APPEND ? "append" : "ack",
+                       log.tail.seq, log.next_seq, pre_tail, pre_next, ram_tail);
+                ok = false;
+            }
+            ok = ok && verify(&log, &n, "after power loss");
+            break;
+        }
+    }
+    if (n.violations) {
+        printf("%ld writes tried to set bits without an erase\n", n.violations);
+        ok = false;
+    }
+    *drops_total += log.stats.dropped;
+    free(n.mem);
+    free(n.erase_counts);
+    return ok;
+}
+
+// Many laps without power loss: erase counts must stay level and the
+// records stay readable after a remount
+static bool run_wear(int sectors)
+{
+    nor_t n = { .size = (size_t)sectors * SECTOR_SIZE, .budget = -1 };
+    n.mem = malloc(n.size);
+    n.erase_counts = calloc(sectors, sizeof(uint32_t));
+    memset(n.mem, 0xff, n.size);
+    flog_flash_t flash = nor_flash(&n);
+    flog_t log;
+    uint8_t buf[FLOG_PAYLOAD_MAX];
+    long appends = 0;
+
+    flog_mount(&log, &flash);
+    while (log.stats.erases < 100u * sectors) {
+        set_generation(log.next_seq);
+        size_t len = payload(log.next_seq, buf);
+        flog_append(&log, buf, len, NULL);
+        appends++;
+        // Deliver in batches of 50, as a replay would
+        if (appends % 50 == 0) {
+            flog_cursor_t c = log.tail;
+            flog_record_t rec, last;
+            bool any = false;
+            while (flog_next(&log, &c, &rec) == ESP_OK) {
+                last = rec;
+                any = true;
+            }
+            if (any)
+                flog_ack(&log, &last);
+        }
+    }
+    flog_stats_t st = log.stats;
+
+    double t0 = (double)clock() / CLOCKS_PER_SEC;
+    flog_mount(&log, &flash);
+    double mount_us = ((double)clock() / CLOCKS_PER_SEC - t0) * 1e6;
+
+    uint32_t min, max, real_min = UINT32_MAX, real_max = 0;
+    flog_wear(&log, &min, &max);
+    for (int s = 0; s < sectors; s++) {
+        if (n.erase_counts[s] < real_min) real_min = n.erase_counts[s];
+        if (n.erase_counts[s] > real_max) real_max = n.erase_counts[s];
+    }
+    printf("wear: %ld appends, %" PRIu32 " erases (%" PRIu32 " skipped as blank), %" PRIu32
+           " acked, %" PRIu32 " dropped\n", appends, st.erases, st.erases_skipped, st.acked, st.dropped);
+    printf("      erases per sector %" PRIu32 "..%" PRIu32 " (log headers say %" PRIu32 "..%" PRIu32
+           "), remount %.0f us, %" PRIu32 " pending\n", real_min, real_max, min, max, mount_us, flog_pending(&log));
+
+    bool ok = real_max - real_min <= 1 && max - min <= 1 && st.erases_skipped == (uint32_t)sectors &&
+              verify(&log, &n, "after wear run") && !n.violations;
+    free(n.mem);
+    free(n.erase_counts);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int trials = 300, cuts = 20, sectors = 6;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:S:s:")) != -1) {
+        switch (opt) {
+            case 't': trials = atoi(optarg); break;
+            case 'c': cuts = atoi(optarg); break;
+            case 'S': sectors = atoi(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-t TRIALS] [-c CUTS] [-S SECTORS] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (sectors < 2) {
+        fprintf(stderr, "need at least 2 sectors\n");
+        return 2;
+    }
+    srand(seed);
+
+    int failed = 0;
+    long ops = 0, drops = 0, torn = 0;
+    for (int t = 0; t < trials; t++) {
+        if (!run_trial(sectors, cuts, &ops, &drops, &torn)) {
+            printf("trial %d failed\n", t);
+            failed++;
+        }
+    }
+    printf("power loss: %d trials x %d cuts, %ld operations, %ld torn appends recovered, "
+           "%ld records dropped to full log, %d failed\n", trials, cuts, ops, torn, drops, failed);
+
+    bool wear_ok = run_wear(sectors);
+    bool ok = !failed && wear_ok;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
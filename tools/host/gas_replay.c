@@ -0,0 +1,266 @@
+/*
+ * Replay a recorded gas ADC trace through the baseline tracker and CUSUM
+ * detector and compare them with the fixed boot-time threshold main.c
+ * used before.
+ *
+ *   gas_replay [options] [TRACE]
+ *
+ *   TRACE      one sample per line; with CSV lines the last field is used.
+ *              Reads stdin when omitted.
+ *   -s HOURS   instead of a trace, synthesize HOURS of 20 Hz data with
+ *              heater drift, a daily temperature swing, noise and a
+ *              60 s gas event every 30 min; detection is scored against
+ *              the known events
+ *   -u N -d N  baseline shift up / down (default 12 / 6)
+ *   -l N       hold limit in samples (default 12000)
+ *   -D N       alarm delta above baseline (default 300)
+ *   -c N       calibration samples for both baselines (default 100)
+ *   -k Q8 -h Q8  CUSUM drift allowance / threshold in sigma, Q8
+ *              (default 256 / 2560, i.e. 1 / 10 sigma)
+ *   -v         print i,raw,baseline,threshold_alarm,cusum_alarm per sample
+ *   -b         benchmark: CUSUM throughput and mean detection latency on
+ *              synthetic steps of 1..8 sigma, then exit
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gas_baseline.h"
+#include "gas_cusum.h"
+
+#define SYNTH_HZ        20
+#define EVENT_PERIOD_S  1800
+#define EVENT_LEN_S     60
+#define SYNTH_SIGMA     8
+
+typedef struct {
+    const char *name;
+    long onsets;          // rising edges of the alarm condition
+    long alarm_samples;
+    long hit_events;      // synthetic only
+    long false_onsets;    // synthetic only
+    bool last;
+} score_t;
+
+static void score(score_t *s, bool alarm, bool in_event, bool event_start, bool *event_hit)
+{
+    if (alarm && !s->last) {
+        s->onsets++;
+        if (!in_event)
+            s->false_onsets++;
+    }
+    if (alarm)
+        s->alarm_samples++;
+    if (event_start)
+        *event_hit = false;
+    if (alarm && in_event && !*event_hit) {
+        *event_hit = true;
+        s->hit_events++;
+    }
+    s->last = alarm;
+}
+
+static double gauss(void)
+{
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// Synthetic MQ135 trace: heater drift + daily temperature swing + noise
+static int synth_sample(long i, bool *in_event, bool *event_start)
+{
+    double t = (double)i / SYNTH_HZ;
+    double v = 800 + 15 * t / 3600 + 120 * sin(2 * M_PI * t / 86400) + SYNTH_SIGMA * gauss();
+    long pos = (long)t % EVENT_PERIOD_S;
+    *in_event = t >= EVENT_PERIOD_S && pos < EVENT_LEN_S;
+    *event_start = *in_event && i % (EVENT_PERIOD_S * SYNTH_HZ) == 0;
+    if (*in_event)
+        v += 400;
+    if (v < 0) v = 0;
+    if (v > 4095) v = 4095;
+    return (int)v;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Steps of d sigma on a flat baseline: mean samples from step to alarm,
+// and false alarms in the quiet lead-in before each step
+static void bench(const gas_cusum_config_t *cfg)
+{
+    enum { TRIALS = 2000, N = 1 << 20 };
+    const int mu = 800;
+    static int32_t noise[N];
+    for (int i = 0; i < N; i++)
+        noise[i] = mu + (int32_t)lround(SYNTH_SIGMA * gauss());
+
+    gas_cusum_t c;
+    gas_cusum_init(&c, cfg, SYNTH_SIGMA);
+    volatile int sink = 0;
+    double t0 = now_s();
+    for (int rep = 0; rep < 20; rep++)
+        for (int i = 0; i < N; i++)
+            sink += gas_cusum_update(&c, noise[i], mu);
+    double dt = now_s() - t0;
+    (void)sink;
+    printf("cusum update: %.1f samples/us (%.2f ns/sample)\n", 20.0 * N / dt / 1e6, dt / (20.0 * N) * 1e9);
+
+    static const int shifts[] = { 1, 2, 3, 5, 8 };
+    for (size_t si = 0; si < sizeof(shifts) / sizeof(shifts[0]); si++) {
+        int d = shifts[si];
+        long total_delay = 0, detected = 0, false_alarms = 0, quiet = 0;
+        long pos = 0;
+        for (int trial = 0; trial < TRIALS; trial++) {
+            gas_cusum_init(&c, cfg, SYNTH_SIGMA);
+            int lead = 200 + rand() % 200;
+            for (int i = 0; i < lead; i++, quiet++) {
+                bool was = c.alarm;
+                if (gas_cusum_update(&c, noise[pos++ % N], mu) && !was)
+                    false_alarms++;
+            }
+            gas_cusum_reset(&c);
+            for (int i = 0; i < 2000; i++) {
+                if (gas_cusum_update(&c, noise[pos++ % N] + d * SYNTH_SIGMA, mu)) {
+                    total_delay += i + 1;
+                    detected++;
+                    break;
+                }
+            }
+        }
+        double mean = detected ? (double)total_delay / detected : 0;
+        printf("step %d sigma: detected %ld/%d, mean delay %.1f samples (%.0f ms at %d Hz, predicted %d), "
+               "false alarms %.2g per 1000 quiet samples\n",
+               d, detected, TRIALS, mean, mean * 1000 / SYNTH_HZ, SYNTH_HZ,
+               gas_cusum_expected_delay(cfg, d * 256), 1000.0 * false_alarms / quiet);
+    }
+}
+
+static bool next_trace_sample(FILE *f, int *out)
+{
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *field = strrchr(line, ',');
+        field = field ? field + 1 : line;
+        char *end;
+        long v = strtol(field, &end, 10);
+        if (end != field) {
+            *out = (int)v;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    gas_baseline_config_t cfg = { .shift_up = 12, .shift_down = 6, .hold_limit = 12000 };
+    gas_cusum_config_t cusum_cfg = { .k_q8 = 256, .h_q8 = 2560, .noise_shift = 8, .min_sigma = 2 };
+    double synth_hours = 0;
+    int delta = 300, calib = 100;
+    bool verbose = false, run_bench = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:u:d:l:D:c:k:h:vb")) != -1) {
+        switch (opt) {
+            case 's': synth_hours = atof(optarg); break;
+            case 'u': cfg.shift_up = atoi(optarg); break;
+            case 'd': cfg.shift_down = atoi(optarg); break;
+            case 'l': cfg.hold_limit = strtoul(optarg, NULL, 10); break;
+            case 'D': delta = atoi(optarg); break;
+            case 'c': calib = atoi(optarg); break;
+            case 'k': cusum_cfg.k_q8 = atoi(optarg); break;
+            case 'h': cusum_cfg.h_q8 = atoi(optarg); break;
+            case 'v': verbose = true; break;
+            case 'b': run_bench = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-s HOURS] [-u N] [-d N] [-l N] [-D N] [-c N] [-k Q8] [-h Q8] [-v] [-b] [TRACE]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (run_bench) {
+        bench(&cusum_cfg);
+        return 0;
+    }
+
+    FILE *trace = NULL;
+    if (synth_hours <= 0) {
+        trace = optind < argc ? fopen(argv[optind], "r") : stdin;
+        if (!trace) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    long synth_samples = (long)(synth_hours * 3600 * SYNTH_HZ);
+
+    gas_baseline_t tracker;
+    gas_baseline_init(&tracker, &cfg);
+    gas_cusum_t cusum;
+    score_t fixed = { .name = "fixed" }, tracked = { .name = "tracked" }, cusum_score = { .name = "cusum" };
+    bool hit_fixed = false, hit_tracked = false, hit_cusum = false;
+    long events = 0, sum = 0, sum_sq = 0;
+    int fixed_base = 0;
+
+    for (long i = 0;; i++) {
+        int raw;
+        bool in_event = false, event_start = false;
+
+        if (trace) {
+            if (!next_trace_sample(trace, &raw))
+                break;
+        } else {
+            if (i >= synth_samples)
+                break;
+            raw = synth_sample(i, &in_event, &event_start);
+            events += event_start;
+        }
+
+        // Both start from the same boot-time calibration mean
+        if (i < calib) {
+            sum += raw;
+            sum_sq += (long)raw * raw;
+            if (i == calib - 1) {
+                fixed_base = sum / calib;
+                gas_baseline_reset(&tracker, fixed_base);
+                double var = (double)sum_sq / calib - (double)fixed_base * fixed_base;
+                gas_cusum_init(&cusum, &cusum_cfg, var > 0 ? (int32_t)sqrt(var) : 0);
+            }
+            continue;
+        }
+
+        bool alarm_fixed = raw > fixed_base + delta;
+        bool alarm_tracked = gas_baseline_exceeded(&tracker, raw, delta);
+        bool alarm_cusum = gas_cusum_update(&cusum, raw, gas_baseline_get(&tracker));
+        gas_baseline_update(&tracker, raw, alarm_tracked || alarm_cusum);
+
+        score(&fixed, alarm_fixed, in_event, event_start, &hit_fixed);
+        score(&tracked, alarm_tracked, in_event, event_start, &hit_tracked);
+        score(&cusum_score, alarm_cusum, in_event, event_start, &hit_cusum);
+
+        if (verbose)
+            printf("%ld,%d,%ld,%d,%d\n", i, raw, (long)gas_baseline_get(&tracker), alarm_tracked, alarm_cusum);
+    }
+
+    if (trace && trace != stdin)
+        fclose(trace);
+
+    const score_t *all[] = { &fixed, &tracked, &cusum_score };
+    for (int k = 0; k < 3; k++) {
+        const score_t *s = all[k];
+        fprintf(stderr, "%-8s onsets %6ld  alarm samples %8ld", s->name, s->onsets, s->alarm_samples);
+        if (!trace)
+            fprintf(stderr, "  events hit %ld/%ld  false onsets %ld", s->hit_events, events, s->false_onsets);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "final baseline: fixed %d, tracked %ld\n", fixed_base, (long)gas_baseline_get(&tracker));
+    return 0;
+}
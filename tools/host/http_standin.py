@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the ThingSpeak HTTP API, for exercising the uplink
+code on a host.
+
+    http_standin.py [--port 8080] [--close-every N] [--idle-timeout S] [--chunked] [--reject STATUS]
+
+Endpoints:
+    GET  /update?api_key=...&field1=...   single update, replies with an entry id
+    POST /channels/<id>/bulk_update.json  JSON bulk update, replies 202
+    GET  /stats                           counters as JSON (not counted)
+    POST /stats/reset                     zero the counters
+
+Every TCP connection and request is counted, so a client that reuses its
+connection shows up as many requests on one connection. --close-every
+answers every Nth request with "Connection: close", --idle-timeout drops
+keep-alive connections idle for S seconds (as real servers do) and
+--chunked sends replies with chunked transfer encoding. --reject answers
+every update with STATUS (e.g. 429 or 503) instead, for checking that the
+client backs off.
+
+Bulk updates are checked like ThingSpeak does (write_api_key present, at
+most 960 updates, every update with delta_t or created_at and at least
+one field) and each update counts as one entry in "updates".
+"""
+import argparse
+import json
+import math
+import re
+import socket
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+
+BULK_PATH = re.compile(r"/channels/\d+/bulk_update\.json")
+BULK_MAX = 960
+
+
+class Counters:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        self.connections = 0
+        self.requests = 0
+        self.updates = 0
+        self.bulk_requests = 0
+        self.max_batch = 0
+        self.span_s = 0.0
+        self.per_connection = {}
+
+    def snapshot(self):
+        with self.lock:
+            return {
+                "connections": self.connections,
+                "requests": self.requests,
+                "updates": self.updates,
+                "bulk_requests": self.bulk_requests,
+                "max_batch": self.max_batch,
+                "max_span_s": round(self.span_s, 3),
+                "max_requests_per_connection": max(self.per_connection.values(), default=0),
+            }
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "standin/1"
+    counters = None
+    options = None
+
+    def setup(self):
+        super().setup()
+        # Headers and body go out in separate writes; without this Nagle
+        # and the client's delayed ACK add ~40 ms to every reply
+        self.request.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        if self.options.idle_timeout:
+            self.request.settimeout(self.options.idle_timeout)
+        with self.counters.lock:
+            self.counters.connections += 1
+            self.conn_id = self.counters.connections
+            self.counters.per_connection[self.conn_id] = 0
+
+    def log_message(self, fmt, *args):
+        if self.options.verbose:
+            super().log_message(fmt, *args)
+
+    def reply(self, status, body, content_type="text/plain", close=False):
+        data = body.encode()
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        if close:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        if self.options.chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for i in range(0, len(data), 7):
+                part = data[i:i + 7]
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(part), part))
+            self.wfile.write(b"0\r\n\r\n")
+        else:
+            self.send_header("Content-Length", str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+
+    def count_request(self):
+        with self.counters.lock:
+            self.counters.requests += 1
+            # A reset may have forgotten this connection
+            self.counters.per_connection[self.conn_id] = self.counters.per_connection.get(self.conn_id, 0) + 1
+            n = self.counters.requests
+        every = self.options.close_every
+        return bool(every) and n % every == 0
+
+    def read_body(self):
+        length = int(self.headers.get("Content-Length", 0))
+        return self.rfile.read(length) if length else b""
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        if url.path == "/stats":
+            self.reply(200, json.dumps(self.counters.snapshot()), "application/json")
+            return
+        close = self.count_request()
+        if self.options.reject:
+            self.reply(self.options.reject, "rejected", close=close)
+        elif url.path == "/update":
+            query = parse_qs(url.query)
+            if "api_key" not in query:
+                self.reply(400, "0", close=close)
+                return
+            with self.counters.lock:
+                self.counters.updates += 1
+                entry = self.counters.updates
+            self.reply(200, str(entry), close=close)
+        else:
+            self.reply(404, "not found", close=close)
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        body = self.read_body()
+        if url.path == "/stats/reset":
+            with self.counters.lock:
+                self.counters.reset()
+            self.reply(200, "{}", "application/json")
+            return
+        close = self.count_request()
+        if self.options.reject:
+            self.reply(self.options.reject, "rejected", close=close)
+        elif BULK_PATH.fullmatch(url.path):
+            self.bulk_update(body, close)
+        else:
+            self.reply(404, "not found", close=close)
+
+    def bulk_update(self, body, close):
+        try:
+            doc = json.loads(body)
+            updates = doc["updates"]
+            if not doc.get("write_api_key") or not 0 < len(updates) <= BULK_MAX:
+                raise ValueError("bad key or batch size")
+            span = 0.0
+            for u in updates:
+                if "created_at" not in u:
+                    delta = float(u["delta_t"])
+                    if delta < 0 or math.isnan(delta):
+                        raise ValueError("bad delta_t")
+                    span += delta
+                if not any(k.startswith("field") for k in u):
+                    raise ValueError("update without fields")
+        except (ValueError, KeyError, TypeError) as e:
+            self.reply(400, json.dumps({"success": False, "error": str(e)}), "application/json", close)
+            return
+        with self.counters.lock:
+            self.counters.updates += len(updates)
+            self.counters.bulk_requests += 1
+            self.counters.max_batch = max(self.counters.max_batch, len(updates))
+            self.counters.span_s = max(self.counters.span_s, span)
+        self.reply(202, json.dumps({"success": True}), "application/json", close)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--close-every", type=int, default=0)
+    parser.add_argument("--idle-timeout", type=float, default=0)
+    parser.add_argument("--chunked", action="store_true")
+    parser.add_argument("--reject", type=int, default=0, metavar="STATUS")
+    parser.add_argument("--verbose", action="store_true")
+    options = parser.parse_args()
+
+    Handler.counters = Counters()
+    Handler.options = options
+    server = ThreadingHTTPServer(("127.0.0.1", options.port), Handler)
+    server.daemon_threads = True
+    print(f"listening on 127.0.0.1:{options.port}", flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
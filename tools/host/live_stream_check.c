@@ -0,0 +1,385 @@
+/*
+ * Runs live_stream on the loopback with real clients and a producer thread
+ * publishing at a fixed rate, and checks what each client receives.
+ *
+ *   live_stream_check [-r RATE_HZ] [-s SECONDS] [-p PORT]
+ *
+ * The producer publishes RATE_HZ samples a second (default 1000, fifty
+ * times the node's gas frame rate) for SECONDS (default 2) with no client,
+ * then again with three: one taking every sample, one with ?every=10 and
+ * one that sends its request and never reads. The first two must receive
+ * every sample (every tenth) from the one they joined at to the last, in
+ * order and with the published values; the stalled one must be dropped.
+ * A fourth connection must get 503 and an unknown path 404. The publish
+ * time and the producer's wake-up lateness are printed for both runs:
+ * clients must not change them beyond the host's own noise.
+ *
+ * With -p the stream is served on PORT at 20 Hz until interrupted, for
+ * `curl -N http://localhost:PORT/stream` or a browser EventSource.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "live_stream.h"
+
+#define POLL_MS  5
+#define STALL_MS 300
+#define DECIM    10
+
+static live_stream_t ls;
+static volatile bool serving;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { ms / 1000, ms % 1000 * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+// Values of sample seq, as the clients expect them back
+static void sample_values(uint32_t seq, float *v)
+{
+    v[0] = seq % 4096;
+    v[1] = (seq % 1000) / 10.0f;
+    v[2] = seq % 50 ? (float)(seq & 1) : NAN;
+}
+
+static void *server_thread(void *arg)
+{
+    (void)arg;
+    while (serving)
+        live_stream_poll(&ls, POLL_MS);
+    return NULL;
+}
+
+// --- Producer -------------------------------------------------------------
+
+typedef struct
+{
+    int rate_hz;
+    double seconds;
+    uint32_t samples;
+    int64_t publish_sum_ns;
+    int64_t publish_max_ns;
+    int64_t late_sum_ns;
+    int64_t late_max_ns;
+} producer_t;
+
+static void *producer_thread(void *arg)
+{
+    producer_t *p = arg;
+    int64_t period = 1000000000LL / p->rate_hz;
+    uint32_t n = p->seconds * p->rate_hz;
+    int64_t deadline = now_ns();
+
+    for (uint32_t i = 0; i < n; i++) {
+        deadline += period;
+        struct timespec ts = { deadline / 1000000000LL, deadline % 1000000000LL };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        int64_t t0 = now_ns();
+        int64_t late = t0 - deadline;
+
+        float v[3];
+        sample_values(ls.head, v);
+        live_stream_publish(&ls, t0 / 1000, v);
+        int64_t dt = now_ns() - t0;
+
+        p->samples++;
+        p->publish_sum_ns += dt;
+        if (dt > p->publish_max_ns)
+            p->publish_max_ns = dt;
+        p->late_sum_ns += late;
+        if (late > p->late_max_ns)
+            p->late_max_ns = late;
+    }
+    return NULL;
+}
+
+static void run_producer(producer_t *p, const char *label)
+{
+    pthread_t t;
+    pthread_create(&t, NULL, producer_thread, p);
+    pthread_join(t, NULL);
+    printf("%-12s %" PRIu32 " samples, publish %.0f ns avg %.1f us max, wake-up late %.1f us avg %.0f us max\n",
+           label, p->samples, (double)p->publish_sum_ns / p->samples, p->publish_max_ns / 1e3,
+           p->late_sum_ns / 1e3 / p->samples, p->late_max_ns / 1e3);
+}
+
+// --- Clients --------------------------------------------------------------
+
+static int connect_to(uint16_t port, int rcvbuf)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int get(uint16_t port, const char *path, int rcvbuf)
+{
+    int fd = connect_to(port, rcvbuf);
+    if (fd < 0)
+        return -1;
+    char req[128];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\nAccept: text/event-stream\r\n\r\n",
+                     path);
+    send(fd, req, n, MSG_NOSIGNAL);
+    return fd;
+}
+
+// Status code of a response that closes the connection
+static int status_of(uint16_t port, const char *path)
+{
+    int fd = get(port, path, 0);
+    char buf[256];
+    int status = 0;
+    ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (n > 0) {
+        buf[n] = 0;
+        sscanf(buf, "HTTP/1.1 %d", &status);
+    }
+    close(fd);
+    return status;
+}
+
+typedef struct
+{
+    int fd;
+    uint32_t every;
+    volatile bool stop;
+    bool header_ok;
+    uint32_t events;
+    uint32_t first;
+    uint32_t last;
+    uint32_t gaps;      // events not following the previous one
+    uint32_t bad;       // events with wrong values or unparseable
+    size_t bytes;
+} client_t;
+
+static bool value_is(const char *data, const char *key, float want)
+{
+    const char *p = strstr(data, key);
+    if (!p)
+        return false;
+    p += strlen(key);
+    if (!strncmp(p, "null", 4))
+        return isnan(want);
+    return !isnan(want) && fabs(strtod(p, NULL) - want) < 1e-3;
+}
+
+static void check_event(client_t *c, char *ev)
+{
+    unsigned id, seq;
+    char *data = strstr(ev, "\ndata: ");
+    if (sscanf(ev, "id: %u", &id) != 1 || !data || sscanf(data, "\ndata: {\"seq\":%u,", &seq) != 1 || id != seq) {
+        c->bad++;
+        return;
+    }
+
+    float v[3];
+    sample_values(seq, v);
+    if (!value_is(data, "\"raw\":", v[0]) || !value_is(data, "\"level\":", v[1]) ||
+        !value_is(data, "\"flag\":", v[2]) || seq % c->every)
+        c->bad++;
+    if (!c->events)
+        c->first = seq;
+    else if (seq != c->last + c->every)
+        c->gaps++;
+    c->last = seq;
+    c->events++;
+}
+
+static void *client_thread(void *arg)
+{
+    client_t *c = arg;
+    static __thread char buf[64 * 1024];
+    size_t len = 0;
+    bool in_body = false;
+
+    while (!c->stop) {
+        ssize_t n = recv(c->fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if (n == 0)
+            break;
+        if (n < 0)
+            continue;
+        c->bytes += n;
+        len += n;
+        buf[len] = 0;
+
+        char *p = buf;
+        if (!in_body) {
+            char *end = strstr(p, "\r\n\r\n");
+            if (!end)
+                continue;
+            c->header_ok = !strncmp(p, "HTTP/1.1 200", 12) && strstr(p, "Content-Type: text/event-stream");
+            in_body = true;
+            p = end + 4;
+        }
+        char *end;
+        while ((end = strstr(p, "\n\n"))) {
+            *end = 0;
+            check_event(c, p);
+            p = end + 2;
+        }
+        len -= p - buf;
+        memmove(buf, p, len);
+    }
+    return NULL;
+}
+
+static bool check_client(const char *label, const client_t *c, uint32_t published)
+{
+    uint32_t want_last = (published - 1) / c->every * c->every;
+    bool ok = c->header_ok && c->events > 0 && !c->gaps && !c->bad && c->last == want_last;
+    printf("%-12s %" PRIu32 " events %" PRIu32 "..%" PRIu32 ", %zu bytes, %" PRIu32 " gaps, %" PRIu32
+           " wrong: %s\n",
+           label, c->events, c->first, c->last, c->bytes, c->gaps, c->bad, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+// --- Demo server ----------------------------------------------------------
+
+static int serve(uint16_t port)
+{
+    printf("serving http://localhost:%u/stream at 20 Hz\n", port);
+    pthread_t t;
+    serving = true;
+    pthread_create(&t, NULL, server_thread, NULL);
+    while (1) {
+        float v[3];
+        sample_values(ls.head, v);
+        live_stream_publish(&ls, now_ns() / 1000, v);
+        sleep_ms(50);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rate = 1000;
+    double seconds = 2;
+    int port = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:s:p:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r RATE_HZ] [-s SECONDS] [-p PORT]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (rate < 1 || rate > 100000 || seconds <= 0) {
+        fprintf(stderr, "bad rate or duration\n");
+        return 2;
+    }
+
+    live_stream_config_t cfg = {
+        .port = port < 0 ? 0 : port,
+        .n_values = 3,
+        .names = { "raw", "level", "flag" },
+        .decimals = { 0, 1, 0 },
+        .stall_ms = STALL_MS,
+    };
+    if (live_stream_init(&ls, &cfg) != ESP_OK) {
+        perror("live_stream_init");
+        return 1;
+    }
+    if (port >= 0)
+        return serve(port);
+
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    getsockname(ls.listen_fd, (struct sockaddr *)&addr, &alen);
+    uint16_t bound = ntohs(addr.sin_port);
+    bool ok = true;
+
+    pthread_t server;
+    serving = true;
+    pthread_create(&server, NULL, server_thread, NULL);
+
+    producer_t alone = { .rate_hz = rate, .seconds = seconds };
+    run_producer(&alone, "no clients:");
+
+    int status = status_of(bound, "/nope");
+    printf("GET /nope: %d\n", status);
+    ok &= status == 404;
+    sleep_ms(2 * POLL_MS);
+
+    // Two readers and one that never reads, with a small receive window so
+    // the server's socket fills up quickly
+    client_t fast = { .fd = get(bound, "/stream", 0), .every = 1 };
+    client_t decim = { .fd = get(bound, "/stream?every=10", 0), .every = DECIM };
+    int stalled = get(bound, "/stream", 2048);
+    pthread_t tf, td;
+    pthread_create(&tf, NULL, client_thread, &fast);
+    pthread_create(&td, NULL, client_thread, &decim);
+    sleep_ms(10 * POLL_MS);
+    printf("clients streaming: %zu\n", live_stream_clients(&ls));
+    ok &= live_stream_clients(&ls) == 3;
+
+    status = status_of(bound, "/stream");
+    printf("fourth client: %d\n", status);
+    ok &= status == 503;
+
+    producer_t with = { .rate_hz = rate, .seconds = seconds };
+    run_producer(&with, "3 clients:");
+
+    // Let the server catch up, then stop serving and reading
+    sleep_ms(10 * POLL_MS);
+    serving = false;
+    pthread_join(server, NULL);
+    sleep_ms(10 * POLL_MS);
+    fast.stop = decim.stop = true;
+    pthread_join(tf, NULL);
+    pthread_join(td, NULL);
+    ok &= check_client("every:", &fast, ls.head);
+    ok &= check_client("every 10:", &decim, ls.head);
+
+    const live_stream_stats_t *st = &ls.stats;
+    printf("stalled client dropped: %" PRIu32 " slow, %" PRIu32 " lagging; %" PRIu32 " rejected, %" PRIu32
+           " events, %" PRIu64 " bytes sent\n",
+           st->dropped_slow, st->dropped_lagging, st->rejected, st->events, st->bytes);
+    ok &= st->dropped_slow + st->dropped_lagging == 1 && st->rejected == 2 && live_stream_clients(&ls) == 2;
+
+    close(fast.fd);
+    close(decim.fd);
+    close(stalled);
+    live_stream_close(&ls);
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
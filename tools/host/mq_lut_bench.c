@@ -0,0 +1,145 @@
+/*
+ * Accuracy and throughput of the MQ raw-to-ppm lookup table against the
+ * per-sample log10/pow chain used before, for the three GasNODE sensors.
+ *
+ *   mq_lut_bench [-n SAMPLES] [-r CLEAN_AIR_RAW] [-c CHANNELS]
+ *
+ * R0 is derived as if calibration had seen CLEAN_AIR_RAW (default 400)
+ * in clean air. The last section converts whole frames of CHANNELS
+ * sensors (default 64) through mq_model_convert.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mq_model.h"
+
+typedef struct {
+    const char *name;
+    mq_curve_t curve;
+    float clean_air_ratio;
+} sensor_t;
+
+static const mq_circuit_t circuit = { .rl = 10000.0f, .v_ref = 1100.0f, .v_supply = 5000.0f };
+
+static const sensor_t sensors[] = {
+    { "MQ-135 (CO2)", { -0.42f,  1.92f }, 3.6f },
+    { "MQ-5 (CH4)",   { -2.632f, 2.5f  }, 6.5f },
+    { "MQ-9 (CO)",    { -0.48f,  1.58f }, 9.8f },
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    long samples = 20000000;
+    int clean_raw = 400;
+    size_t channels = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:c:")) != -1) {
+        switch (opt) {
+            case 'n': samples = strtol(optarg, NULL, 10); break;
+            case 'r': clean_raw = atoi(optarg); break;
+            case 'c': channels = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n SAMPLES] [-r CLEAN_AIR_RAW] [-c CHANNELS]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    // Pseudo-random but reproducible raw codes, shared by both paths
+    enum { CODES = 4096 };
+    static uint16_t codes[CODES];
+    uint32_t x = 12345;
+    for (int i = 0; i < CODES; i++) {
+        x = x * 1664525u + 1013904223u;
+        codes[i] = 1 + (x >> 16) % MQ_ADC_MAX;
+    }
+
+    printf("table: %d entries (shift %d), %zu bytes per sensor\n",
+           MQ_LUT_SIZE, MQ_LUT_SHIFT, sizeof(mq_lut_t));
+
+    for (size_t s = 0; s < sizeof(sensors) / sizeof(sensors[0]); s++) {
+        const sensor_t *sn = &sensors[s];
+        float r0 = mq_gas_rs(&circuit, mq_gas_voltage(&circuit, clean_raw)) / sn->clean_air_ratio;
+
+        static mq_lut_t lut;
+        double t0 = now_s();
+        mq_lut_build(&lut, &circuit, &sn->curve, r0);
+        double build_us = (now_s() - t0) * 1e6;
+
+        float abs_all, rel_all, abs_16, rel_16;
+        mq_lut_error(&lut, &circuit, &sn->curve, r0, 1, &abs_all, &rel_all);
+        mq_lut_error(&lut, &circuit, &sn->curve, r0, 16, &abs_16, &rel_16);
+
+        volatile float sink = 0;
+        t0 = now_s();
+        for (long i = 0; i < samples; i++) {
+            uint16_t raw = codes[i & (CODES - 1)];
+            float rs = mq_gas_rs(&circuit, mq_gas_voltage(&circuit, raw));
+            sink += mq_gas_ppm(&sn->curve, rs, r0);
+        }
+        double t_ref = now_s() - t0;
+
+        t0 = now_s();
+        for (long i = 0; i < samples; i++)
+            sink += mq_lut_ppm(&lut, codes[i & (CODES - 1)]);
+        double t_lut = now_s() - t0;
+        (void)sink;
+
+        printf("%-13s R0=%.0f ohm  build %.0f us\n", sn->name, r0, build_us);
+        printf("  max error raw>=1:  %.4g ppm, %.3f %%\n", abs_all, rel_all * 100);
+        printf("  max error raw>=16: %.4g ppm, %.3f %%\n", abs_16, rel_16 * 100);
+        printf("  formula: %8.2f Mconv/s\n", samples / t_ref / 1e6);
+        printf("  table:   %8.2f Mconv/s  (x%.1f)\n", samples / t_lut / 1e6, t_ref / t_lut);
+    }
+
+    // Whole-frame conversion over a model cycling through the three curves
+    if (channels > 0) {
+        const size_t n_sensors = sizeof(sensors) / sizeof(sensors[0]);
+        mq_sensor_desc_t *desc = calloc(channels, sizeof(mq_sensor_desc_t));
+        mq_lut_t *luts = calloc(channels, sizeof(mq_lut_t));
+        uint16_t *raw = malloc(channels * sizeof(uint16_t));
+        float *ppm = malloc(channels * sizeof(float));
+        mq_model_t model;
+
+        if (!desc || !luts || !raw || !ppm)
+            return 1;
+        for (size_t i = 0; i < channels; i++) {
+            const sensor_t *sn = &sensors[i % n_sensors];
+            desc[i] = (mq_sensor_desc_t) {
+                .name = sn->name, .channel = i, .circuit = circuit, .curve = sn->curve,
+                .clean_air_ratio = sn->clean_air_ratio,
+                .r0 = mq_gas_rs(&circuit, mq_gas_voltage(&circuit, clean_raw)) / sn->clean_air_ratio,
+            };
+        }
+        mq_model_init(&model, desc, luts, channels);
+
+        long frames = samples / channels;
+        volatile float sink = 0;
+        double t0 = now_s();
+        for (long f = 0; f < frames; f++) {
+            for (size_t i = 0; i < channels; i++)
+                raw[i] = codes[(f * channels + i) & (CODES - 1)];
+            mq_model_convert(&model, raw, ppm);
+            sink += ppm[f % channels];
+        }
+        double t = now_s() - t0;
+        (void)sink;
+
+        printf("frame kernel, %zu channels: %.2f Mconv/s, %.1f ns/frame\n",
+               channels, frames * (double)channels / t / 1e6, t / frames * 1e9);
+        free(desc);
+        free(luts);
+        free(raw);
+        free(ppm);
+    }
+    return 0;
+}
@@ -0,0 +1,463 @@
+/*
+ * Reconnect-storm simulation of mqtt_pub with the node publishing policy.
+ *
+ *   mqtt_pub_sim [-H HOURS] [-w WINDOW] [-s SEED]
+ *
+ * A simulated esp-mqtt client keeps QoS 1 messages in an outbox until the
+ * broker acknowledges them, in order, after a random latency; it keeps
+ * them across disconnects and retransmits on reconnect, and drops any
+ * message older than 30 s as esp-mqtt does by default. The link flaps
+ * every couple of minutes with occasional long outages, and the broker
+ * now and then stalls for longer than the expiry.
+ *
+ * Over HOURS (default 48) of readings every 5 s, three nodes are run:
+ *
+ * - backlog: every reading goes through mqtt_backlog, the nodes' own code:
+ *   into a flash_log backlog, sent from there with mqtt_pub_send(), a few
+ *   records at a time, and released only once the broker has acknowledged
+ *   it and all before it. Every reading must reach the broker.
+ * - latest: mqtt_pub_latest() without a backlog; every reading must be
+ *   delivered, expired or counted as coalesced.
+ * - naive: publishes straight to the client while connected, keeps
+ *   readings in the backlog otherwise and replays them a few a second,
+ *   releasing them as soon as the client has them, as the nodes did
+ *   before.
+ *
+ * The outbox of the first two must never hold more than WINDOW (default 8)
+ * messages, however many reconnects there are. The nodes' own payloads,
+ * telem_codec frames on a per-MAC topic, are checked separately.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash_log.h"
+#include "mqtt_backlog.h"
+#include "mqtt_pub.h"
+#include "telem_codec.h"
+
+#define TICK_MS         100
+#define READING_TICKS   50      // 5 s
+#define REPLAY_TICKS    10      // 1 s
+#define REPLAY_PER_RUN  5
+#define EXPIRE_TICKS    300     // esp-mqtt outbox expiry, 30 s
+#define SECTOR_SIZE     4096
+#define SECTORS         16
+#define TOPIC           "sim/readings"
+
+typedef enum { NODE_BACKLOG, NODE_LATEST, NODE_NAIVE } node_mode_t;
+
+typedef struct
+{
+    int msg_id;
+    uint32_t id;                // Reading carried
+    long sent_at;
+    long due;                   // Acknowledged at this tick while connected
+} out_msg_t;
+
+// Link, client outbox and broker
+typedef struct
+{
+    long now;
+    bool up;
+    long next_flip;
+    long slow_until;            // Broker stalls until then
+    out_msg_t *box;
+    size_t n, cap, peak;
+    int next_msg_id;
+    uint32_t *received;         // Per reading
+    bool *expired;              // Per reading, its message expired
+    long acked, dropped, reconnects;
+    mqtt_pub_t *pub;
+} world_t;
+
+static long latency(world_t *w)
+{
+    if (w->now < w->slow_until)
+        return w->slow_until - w->now + rand() % 5;
+    return 1 + rand() % 5;
+}
+
+static void flip_link(world_t *w)
+{
+    w->up = !w->up;
+    if (w->up) {
+        // Retransmitted in order after the reconnect
+        long due = w->now;
+        for (size_t i = 0; i < w->n; i++)
+            w->box[i].due = due += latency(w);
+        w->reconnects++;
+        w->next_flip = w->now + 100 + rand() % 2400;
+    } else {
+        w->next_flip = w->now + (rand() % 20 ? 10 + rand() % 300 : 3000 + rand() % 9000);
+    }
+    if (w->pub)
+        mqtt_pub_set_connected(w->pub, w->up);
+}
+
+static void remove_msg(world_t *w, size_t i, bool acked)
+{
+    out_msg_t m = w->box[i];
+    memmove(&w->box[i], &w->box[i + 1], (w->n - i - 1) * sizeof(out_msg_t));
+    w->n--;
+    if (acked) {
+        w->received[m.id]++;
+        w->acked++;
+    } else {
+        w->expired[m.id] = true;
+        w->dropped++;
+    }
+    if (w->pub)
+        mqtt_pub_done(w->pub, m.msg_id, acked);
+}
+
+static void step_client(world_t *w)
+{
+    if (w->now == w->next_flip)
+        flip_link(w);
+    if (!(rand() % 20000))
+        w->slow_until = w->now + 400 + rand() % 200;
+
+    while (w->up && w->n && w->box[0].due <= w->now)
+        remove_msg(w, 0, true);
+    for (size_t i = 0; i < w->n;)
+        if (w->now - w->box[i].sent_at >= EXPIRE_TICKS)
+            remove_msg(w, i, false);
+        else
+            i++;
+}
+
+static int client_publish(void *ctx, const char *topic, const char *data, size_t len, int qos)
+{
+    world_t *w = ctx;
+    const char *p = strstr(data, "\"id\":");
+    (void)topic;
+    (void)len;
+    if (!p || !qos)
+        return -1;
+    if (w->n == w->cap) {
+        w->cap = w->cap ? 2 * w->cap : 64;
+        w->box = realloc(w->box, w->cap * sizeof(out_msg_t));
+    }
+    long due = w->n ? w->box[w->n - 1].due : w->now;
+    w->box[w->n++] = (out_msg_t) {
+        .msg_id = ++w->next_msg_id & 0xffff,
+        .id = strtoul(p + 5, NULL, 10),
+        .sent_at = w->now,
+        .due = (due > w->now ? due : w->now) + latency(w),
+    };
+    if (w->n > w->peak)
+        w->peak = w->n;
+    return w->box[w->n - 1].msg_id;
+}
+
+// --- Node, as TempNODE / GasNODE ------------------------------------------
+
+static esp_err_t ram_write(void *ctx, size_t off, const void *data, size_t len)
+{
+    uint8_t *mem = ctx;
+    const uint8_t *d = data;
+    for (size_t i = 0; i < len; i++)
+        mem[off + i] &= d[i];
+    return ESP_OK;
+}
+
+static esp_err_t ram_erase(void *ctx, size_t off, size_t len)
+{
+    memset((uint8_t *)ctx + off, 0xff, len);
+    return ESP_OK;
+}
+
+typedef struct
+{
+    node_mode_t mode;
+    mqtt_pub_t pub;
+    mqtt_backlog_t backlog;     // Backlog node
+    flog_t log;                 // Naive node
+    bool *live;                 // Per reading, sent without the backlog
+} node_t;
+
+static void pub_done(void *ctx, uint32_t seq, bool acked)
+{
+    node_t *n = ctx;
+    mqtt_backlog_done(&n->backlog, seq, acked);
+}
+
+static size_t encode_reading(void *ctx, const float *values, const uint32_t *seq, const uint32_t *age_ms,
+                             uint8_t *buf, size_t size)
+{
+    (void)ctx;
+    (void)age_ms;
+    int len = seq ? snprintf((char *)buf, size, "{\"id\":%.0f,\"seq\":%" PRIu32 "}", values[0], *seq)
+                  : snprintf((char *)buf, size, "{\"id\":%.0f}", values[0]);
+    return len < (int)size ? (size_t)len : 0;
+}
+
+static void node_reading(node_t *n, world_t *w, uint32_t id)
+{
+    char payload[32];
+    snprintf(payload, sizeof(payload), "{\"id\":%" PRIu32 "}", id);
+
+    switch (n->mode) {
+        case NODE_NAIVE:
+            if (w->up && !flog_pending(&n->log)) {
+                client_publish(w, TOPIC, payload, strlen(payload), 1);
+                n->live[id] = true;
+                break;
+            }
+            flog_append(&n->log, &id, sizeof(id), NULL);
+            break;
+        case NODE_LATEST:
+            mqtt_pub_latest(&n->pub, TOPIC, payload, strlen(payload), MQTT_PUB_UNTAGGED);
+            break;
+        case NODE_BACKLOG: {
+            // Exact in a float for 2^24 readings, nearly 3 years of them
+            float value = id;
+            mqtt_backlog_publish(&n->backlog, &value, w->now * TICK_MS);
+            break;
+        }
+    }
+}
+
+// Hands REPLAY_PER_RUN records to the client and releases them at once,
+// whatever the state of its outbox
+static void naive_replay(node_t *n, world_t *w)
+{
+    flog_cursor_t c = n->log.tail;
+    flog_record_t rec, last;
+    int sent = 0;
+    while (w->up && sent < REPLAY_PER_RUN && flog_next(&n->log, &c, &rec) == ESP_OK) {
+        uint32_t id;
+        memcpy(&id, rec.data, sizeof(id));
+        char payload[48];
+        snprintf(payload, sizeof(payload), "{\"id\":%" PRIu32 ",\"seq\":%" PRIu32 "}", id, rec.seq);
+        client_publish(w, TOPIC, payload, strlen(payload), 1);
+        last = rec;
+        sent++;
+    }
+    if (sent)
+        flog_ack(&n->log, &last);
+}
+
+static void node_replay(node_t *n, world_t *w)
+{
+    if (n->mode == NODE_NAIVE) {
+        naive_replay(n, w);
+        return;
+    }
+    if (n->mode == NODE_BACKLOG)
+        mqtt_backlog_poll(&n->backlog, w->now * TICK_MS);
+    else
+        mqtt_pub_poll(&n->pub);
+}
+
+static bool node_idle(node_t *n, world_t *w)
+{
+    if (n->mode == NODE_NAIVE)
+        return !w->n && !flog_pending(&n->log);
+    return !w->n && !n->pub.slot_topic && !mqtt_backlog_pending(&n->backlog);
+}
+
+static bool run(node_mode_t mode, double hours, uint32_t window, unsigned seed)
+{
+    static const char *names[] = { "backlog", "latest", "naive" };
+    uint32_t readings = hours * 3600 * 1000 / (READING_TICKS * TICK_MS);
+    world_t w = { .next_flip = 1 };
+    node_t *n = calloc(1, sizeof(node_t));
+    uint8_t *flash = malloc(SECTORS * SECTOR_SIZE);
+    w.received = calloc(readings, sizeof(uint32_t));
+    w.expired = calloc(readings, sizeof(bool));
+    n->live = calloc(readings, sizeof(bool));
+    memset(flash, 0xff, SECTORS * SECTOR_SIZE);
+    srand(seed);
+
+    n->mode = mode;
+    mqtt_pub_config_t cfg = {
+        .send = client_publish, .ctx = &w, .qos = 1, .max_inflight = window,
+        .done = pub_done, .done_ctx = n,
+    };
+    flog_flash_t ff = {
+        .size = SECTORS * SECTOR_SIZE, .sector_size = SECTOR_SIZE, .map = flash,
+        .write = ram_write, .erase = ram_erase, .ctx = flash,
+    };
+    mqtt_backlog_config_t bcfg = {
+        .pub = &n->pub, .topic = TOPIC, .n_values = 1, .per_run = REPLAY_PER_RUN, .boot_id = 1,
+        .encode = encode_reading,
+    };
+    if (mqtt_pub_init(&n->pub, &cfg) != ESP_OK)
+        return false;
+    if (mode == NODE_NAIVE ? flog_mount(&n->log, &ff) != ESP_OK
+                           : mqtt_backlog_init(&n->backlog, &bcfg, mode == NODE_BACKLOG ? &ff : NULL) != ESP_OK)
+        return false;
+    if (mode != NODE_NAIVE)
+        w.pub = &n->pub;
+
+    uint32_t next_id = 0;
+    long end = (long)readings * READING_TICKS;
+    for (w.now = 0; w.now < end; w.now++) {
+        step_client(&w);
+        if (w.now % READING_TICKS == 0)
+            node_reading(n, &w, next_id++);
+        if (w.now % REPLAY_TICKS == 0)
+            node_replay(n, &w);
+    }
+
+    // Link back for good, so everything kept can drain
+    if (!w.up)
+        flip_link(&w);
+    w.next_flip = -1;
+    w.slow_until = 0;
+    long drain_start = w.now;
+    for (; !node_idle(n, &w) && w.now < drain_start + 100000; w.now++) {
+        step_client(&w);
+        if (w.now % REPLAY_TICKS == 0)
+            node_replay(n, &w);
+    }
+    if (mode != NODE_NAIVE)
+        mqtt_pub_poll(&n->pub);
+
+    long delivered = 0, duplicates = 0, missing = 0, lost_live = 0;
+    for (uint32_t i = 0; i < readings; i++) {
+        if (w.received[i])
+            delivered++;
+        if (w.received[i] > 1)
+            duplicates += w.received[i] - 1;
+        if (!w.received[i]) {
+            if (w.expired[i] && (mode == NODE_LATEST || n->live[i]))
+                lost_live++;
+            else
+                missing++;
+        }
+    }
+
+    bool ok = true;
+    const mqtt_pub_stats_t *s = &n->pub.stats;
+    printf("%-8s %" PRIu32 " readings, %ld reconnects, outbox peak %zu", names[mode], readings, w.reconnects,
+           w.peak);
+    if (mode == NODE_NAIVE) {
+        printf("\n         %ld delivered, %ld live and %ld replayed readings lost to expiry\n", delivered, lost_live,
+               missing);
+        goto out;
+    }
+    printf(" (window %" PRIu32 ")\n", window);
+    printf("         %ld delivered, %ld duplicates, %ld lost, drained in %ld s\n", delivered, duplicates,
+           missing + lost_live, (w.now - drain_start) * TICK_MS / 1000);
+    printf("         publisher: %" PRIu32 " published, %" PRIu32 " acked, %" PRIu32 " expired, %" PRIu32
+           " refused, %" PRIu32 " coalesced\n", s->published, s->acked, s->expired, s->refused, s->coalesced);
+
+    if (w.peak > window || s->peak_inflight > window || !node_idle(n, &w) || n->pub.n_inflight) {
+        printf("         FAILED: outbox exceeded the window or did not drain\n");
+        ok = false;
+    }
+    if (mode == NODE_BACKLOG && (missing || lost_live || n->backlog.log.stats.dropped)) {
+        printf("         FAILED: %ld readings lost, %" PRIu32 " dropped by the backlog\n", missing + lost_live,
+               n->backlog.log.stats.dropped);
+        ok = false;
+    }
+    if (mode == NODE_LATEST && (missing != (long)s->coalesced || delivered + lost_live + missing != (long)readings)) {
+        printf("         FAILED: %ld delivered + %ld expired + %" PRIu32 " coalesced != %" PRIu32 "\n", delivered,
+               lost_live, s->coalesced, readings);
+        ok = false;
+    }
+
+out:
+    free(w.box);
+    free(w.received);
+    free(w.expired);
+    free(n->live);
+    free(n);
+    free(flash);
+    return ok;
+}
+
+// --- Stock payload, as both nodes send it --------------------------------
+
+typedef struct
+{
+    char topic[64];
+    uint8_t data[64];
+    size_t len;
+    int n;
+} capture_t;
+
+static int capture_publish(void *ctx, const char *topic, const char *data, size_t len, int qos)
+{
+    capture_t *c = ctx;
+    (void)qos;
+    snprintf(c->topic, sizeof(c->topic), "%s", topic);
+    c->len = len < sizeof(c->data) ? len : 0;
+    memcpy(c->data, data, c->len);
+    return ++c->n;
+}
+
+static bool check_frames(void)
+{
+    static const uint8_t mac[6] = { 0x24, 0x0a, 0xc4, 0x12, 0xab, 0xcd };
+    static mqtt_pub_t pub;
+    static mqtt_backlog_t b;
+    capture_t c = { 0 };
+    char topic[MQTT_BACKLOG_TOPIC_SIZE("esp32/sensors/env/")];
+    bool ok = mqtt_backlog_topic_mac("esp32/sensors/env/", mac, topic, sizeof(topic) - 1) == ESP_ERR_INVALID_SIZE &&
+              mqtt_backlog_topic_mac("esp32/sensors/env/", mac, topic, sizeof(topic)) == ESP_OK &&
+              !strcmp(topic, "esp32/sensors/env/240ac412abcd");
+
+    mqtt_pub_config_t cfg = { .send = capture_publish, .ctx = &c, .qos = 1, .max_inflight = 1 };
+    mqtt_backlog_config_t bcfg = {
+        .pub = &pub, .topic = topic, .schema = telem_schema_find(TELEM_SCHEMA_ENV), .key_interval = 1,
+    };
+    ok &= mqtt_pub_init(&pub, &cfg) == ESP_OK && mqtt_backlog_init(&b, &bcfg, NULL) == ESP_OK &&
+          b.cfg.n_values == 3;
+    bcfg.schema = NULL;
+    ok &= mqtt_backlog_init(&b, &bcfg, NULL) == ESP_ERR_INVALID_ARG;
+    bcfg.schema = telem_schema_find(TELEM_SCHEMA_ENV);
+    ok &= mqtt_backlog_init(&b, &bcfg, NULL) == ESP_OK;
+    mqtt_pub_set_connected(&pub, true);
+
+    // Without a log a reading goes out with neither a sequence number nor
+    // an age
+    const float values[3] = { 21.5f, 1013.2f, 44.0f };
+    telem_dec_t dec;
+    telem_frame_t f;
+    telem_dec_init(&dec);
+    ok &= mqtt_backlog_publish(&b, values, 0) == ESP_OK && c.n == 1 && !strcmp(c.topic, topic) &&
+          telem_decode(&dec, c.data, c.len, &f) == ESP_OK && f.schema == bcfg.schema;
+    for (size_t i = 0; ok && i < 3; i++)
+        ok &= f.value[i] == values[i];
+
+    printf("stock payload: %s, %zu byte frame: %s\n", topic, c.len, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    double hours = 48;
+    uint32_t window = 8;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:w:s:")) != -1) {
+        switch (opt) {
+            case 'H': hours = atof(optarg); break;
+            case 'w': window = strtoul(optarg, NULL, 10); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-H HOURS] [-w WINDOW] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (!window || window > MQTT_PUB_INFLIGHT_MAX) {
+        fprintf(stderr, "WINDOW must be 1..%d\n", MQTT_PUB_INFLIGHT_MAX);
+        return 2;
+    }
+
+    bool ok = run(NODE_BACKLOG, hours, window, seed);
+    ok &= run(NODE_LATEST, hours, window, seed);
+    run(NODE_NAIVE, hours, window, seed);
+    ok &= check_frames();
+    printf("publisher state %zu bytes, fixed\n", sizeof(mqtt_pub_t));
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
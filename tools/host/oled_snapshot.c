@@ -0,0 +1,158 @@
+/*
+ * Render the node's OLED status screen on the host, export the framebuffer
+ * as PBM/PGM and optionally compare against previously saved images.
+ *
+ *   oled_snapshot [-o DIR] [-g] [-c DIR] [-n CYCLES]
+ *
+ *   -o DIR     write <scenario>.pbm (or .pgm with -g) into DIR
+ *   -g         export 8-bit PGM instead of 1-bit PBM
+ *   -c DIR     compare each scenario against DIR/<scenario>.pbm|.pgm,
+ *              print differing pixel counts, exit 1 on any mismatch
+ *   -n CYCLES  time CYCLES clear + draw + encode cycles per scenario
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ssd1306.h"
+#include "status_screen.h"
+
+#define WIDTH   128
+#define HEIGHT  64
+
+typedef struct {
+    const char *name;
+    status_screen_t screen;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "status_safe",   { .temp = 23.4f,  .pressure = 101325, .gas = 812,  .motion = false, .alert = false } },
+    { "status_motion", { .temp = 24.0f,  .pressure = 100980, .gas = 905,  .motion = true,  .alert = false } },
+    { "status_danger", { .temp = 27.9f,  .pressure = 101002, .gas = 1544, .motion = true,  .alert = true  } },
+    { "status_limits", { .temp = -12.5f, .pressure = 0,      .gas = 4095, .motion = false, .alert = true  } },
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t encode(const ssd1306_t *oled, bool gray, uint8_t *out, size_t cap)
+{
+    return gray ? ssd1306_snapshot_pgm(oled, out, cap) : ssd1306_snapshot_pbm(oled, out, cap);
+}
+
+static long read_file(const char *path, uint8_t *buf, size_t cap)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, cap, f);
+    fclose(f);
+    return (long)n;
+}
+
+// Count differing pixels between two encodings of the same geometry
+static int diff_pixels(const ssd1306_t *oled, bool gray, const uint8_t *a, const uint8_t *b, size_t hdr)
+{
+    int diff = 0;
+    size_t row_bytes = gray ? WIDTH : (WIDTH + 7) / 8;
+    for (int y = 0; y < oled->height; y++) {
+        for (int x = 0; x < oled->width; x++) {
+            size_t off = hdr + y * row_bytes;
+            int pa, pb;
+            if (gray) {
+                pa = a[off + x];
+                pb = b[off + x];
+            } else {
+                pa = (a[off + x / 8] >> (7 - x % 8)) & 1;
+                pb = (b[off + x / 8] >> (7 - x % 8)) & 1;
+            }
+            diff += pa != pb;
+        }
+    }
+    return diff;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_dir = NULL, *cmp_dir = NULL;
+    bool gray = false;
+    long cycles = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:gc:n:")) != -1) {
+        switch (opt) {
+            case 'o': out_dir = optarg; break;
+            case 'g': gray = true; break;
+            case 'c': cmp_dir = optarg; break;
+            case 'n': cycles = strtol(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-o DIR] [-g] [-c DIR] [-n CYCLES]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    static uint8_t fb[SSD1306_FB_SIZE(WIDTH, HEIGHT)];
+    static uint8_t img[SSD1306_PGM_SIZE(WIDTH, HEIGHT)];
+    static uint8_t ref[SSD1306_PGM_SIZE(WIDTH, HEIGHT)];
+    const char *ext = gray ? "pgm" : "pbm";
+    ssd1306_t oled;
+    int failures = 0;
+
+    if (ssd1306_init_fb(&oled, WIDTH, HEIGHT, fb) != ESP_OK) {
+        fprintf(stderr, "framebuffer init failed\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const scenario_t *sc = &scenarios[i];
+        char path[512];
+
+        status_screen_render(&oled, &sc->screen);
+        size_t len = encode(&oled, gray, img, sizeof(img));
+
+        if (out_dir) {
+            snprintf(path, sizeof(path), "%s/%s.%s", out_dir, sc->name, ext);
+            FILE *f = fopen(path, "wb");
+            if (!f || fwrite(img, 1, len, f) != len) {
+                fprintf(stderr, "%s: write failed\n", path);
+                return 1;
+            }
+            fclose(f);
+        }
+
+        if (cmp_dir) {
+            snprintf(path, sizeof(path), "%s/%s.%s", cmp_dir, sc->name, ext);
+            long ref_len = read_file(path, ref, sizeof(ref));
+            if (ref_len < 0) {
+                printf("%-16s MISSING %s\n", sc->name, path);
+                failures++;
+            } else if ((size_t)ref_len != len) {
+                printf("%-16s MISMATCH size %ld != %zu\n", sc->name, ref_len, len);
+                failures++;
+            } else if (memcmp(ref, img, len) != 0) {
+                size_t hdr = len - (gray ? (size_t)WIDTH * HEIGHT : (size_t)(WIDTH + 7) / 8 * HEIGHT);
+                printf("%-16s MISMATCH %d pixels differ\n", sc->name, diff_pixels(&oled, gray, ref, img, hdr));
+                failures++;
+            } else {
+                printf("%-16s ok\n", sc->name);
+            }
+        }
+
+        if (cycles > 0) {
+            double t0 = now_s();
+            for (long c = 0; c < cycles; c++) {
+                status_screen_render(&oled, &sc->screen);
+                len = encode(&oled, gray, img, sizeof(img));
+            }
+            double us = (now_s() - t0) * 1e6 / cycles;
+            printf("%-16s %.3f us/frame (clear+draw+%s encode, %zu bytes)\n", sc->name, us, ext, len);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
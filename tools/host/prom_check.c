@@ -0,0 +1,695 @@
+/*
+ * Renders a node's /metrics page with prom_metrics, checks it against the
+ * Prometheus text format and scrapes it over HTTP on the loopback.
+ *
+ *   prom_check [-b BUF_SIZE] [-i ITERATIONS] [-p PORT [-n SCRAPES]]
+ *
+ * The page carries what main.c exports: sensor values, the acquisition
+ * scheduler's job timings after a simulated hour, I2C and uplink counters,
+ * plus label values and floats that need escaping or special spelling.
+ *
+ * Every buffer size from the longest line up to 4 KB must give the same
+ * text as one large buffer, in sink calls that each end on a line
+ * boundary; smaller buffers must fail with ESP_ERR_INVALID_SIZE, and a
+ * failing sink must stop the page. The page is then parsed: HELP/TYPE
+ * before and samples grouped under their family, valid names, labels and
+ * values, cumulative histogram buckets ending in +Inf = _count. Then a
+ * server thread sends it chunked, as esp_http_server does, to a scraper
+ * on an ephemeral port, which must get the same page. Last, render time
+ * per page with a BUF_SIZE buffer (default 1024, the node's) over
+ * ITERATIONS pages (default 20000).
+ *
+ * With -p the page is served on PORT for an external scraper (curl,
+ * promtool check metrics, Prometheus) until SCRAPES requests have been
+ * answered (default 0, forever); the scheduler advances between scrapes.
+ */
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom_metrics.h"
+
+#define PAGE_MAX (64 * 1024)
+#define NODE_BUF_SIZE 1024   // PROM_ESP_BUF_SIZE
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// --- Simulated node -------------------------------------------------------
+
+static int64_t virt_us;
+
+static int64_t virt_now(void *ctx)
+{
+    return *(int64_t *)ctx;
+}
+
+static void virt_sleep_until(void *ctx, int64_t t)
+{
+    int64_t *now = ctx;
+    if (t > *now)
+        *now = t;
+}
+
+typedef struct {
+    uint32_t exec_min_us;
+    uint32_t exec_max_us;
+} sim_job_t;
+
+static void sim_work(void *ctx)
+{
+    const sim_job_t *j = ctx;
+    virt_us += j->exec_min_us + rand() % (j->exec_max_us - j->exec_min_us + 1);
+}
+
+static psched_t sched;
+
+static void node_init(void)
+{
+    static psched_job_t jobs[4];
+    // Rough execution times on the node: BMP180 conversion, ADC average,
+    // frame hand-off, stats logging
+    static sim_job_t work[] = { { 25000, 31000 }, { 40, 90 }, { 15, 60 }, { 800, 5000 } };
+    static const psched_job_config_t cfg[] = {
+        { "bmp180", sim_work, &work[0], 2000000, 0 },
+        { "mq135", sim_work, &work[1], 1000000, 250000 },
+        { "sample", sim_work, &work[2], 1000000, 500000 },
+        { "stats", sim_work, &work[3], 600000000, 600000000 },
+    };
+    psched_clock_t clock = { virt_now, virt_sleep_until, &virt_us };
+
+    psched_init(&sched, &clock, jobs, 4);
+    for (size_t i = 0; i < 4; i++)
+        psched_add(&sched, &cfg[i], NULL);
+}
+
+static void node_run(int64_t us)
+{
+    int64_t until = virt_us + us;
+    while (virt_us < until)
+        psched_run_once(&sched);
+}
+
+// What main.c's collect callback writes, with fixed values
+static void node_collect(prom_writer_t *w)
+{
+    prom_family(w, "node_temperature_celsius", PROM_GAUGE, "BMP180 temperature.");
+    prom_float(w, "node_temperature_celsius", NULL, 0, 23.45f, 2);
+    prom_family(w, "node_pressure_pascals", PROM_GAUGE, "BMP180 pressure.");
+    prom_uint(w, "node_pressure_pascals", NULL, 0, 101325);
+    prom_family(w, "node_gas_raw", PROM_GAUGE, "MQ135 ADC reading.");
+    prom_int(w, "node_gas_raw", NULL, 0, 1873);
+    prom_family(w, "node_alert", PROM_GAUGE, "1 while the gas and motion alert is raised.");
+    prom_int(w, "node_alert", NULL, 0, 0);
+
+    prom_label_t acq = { "loop", "acquisition" };
+    prom_psched(w, &sched, &acq);
+
+    prom_label_t port = { "port", "0" };
+    prom_family(w, "node_i2c_transfers_total", PROM_COUNTER, "I2C reads and writes.");
+    prom_uint(w, "node_i2c_transfers_total", &port, 1, 5400);
+    prom_family(w, "node_i2c_errors_total", PROM_COUNTER, "Failed I2C transfers, timeouts included.");
+    prom_uint(w, "node_i2c_errors_total", &port, 1, 3);
+
+    static const char *const results[] = { "ok", "failed", "skipped" };
+    static const uint32_t counts[] = { 238, 4, 17 };
+    prom_family(w, "node_uplink_requests_total", PROM_COUNTER, "ThingSpeak uploads by result.");
+    for (size_t i = 0; i < 3; i++) {
+        prom_label_t result = { "result", results[i] };
+        prom_uint(w, "node_uplink_requests_total", &result, 1, counts[i]);
+    }
+
+    // Edge cases
+    prom_family(w, "prom_check_edge", PROM_GAUGE, "Back\\slash and\nnewline in help.");
+    prom_label_t odd[] = { { "text", "a \"quoted\" back\\slash\nnewline" }, { "empty", "" } };
+    prom_int(w, "prom_check_edge", odd, 2, -9223372036854775807LL - 1);
+    prom_label_t kinds[3] = { { "kind", "nan" }, { "kind", "pos" }, { "kind", "neg" } };
+    prom_float(w, "prom_check_edge", &kinds[0], 1, NAN, 2);
+    prom_float(w, "prom_check_edge", &kinds[1], 1, INFINITY, 2);
+    prom_float(w, "prom_check_edge", &kinds[2], 1, -INFINITY, 2);
+    prom_label_t big = { "kind", "max" };
+    prom_uint(w, "prom_check_edge", &big, 1, UINT64_MAX);
+}
+
+// --- Sinks ----------------------------------------------------------------
+
+typedef struct {
+    char *text;
+    size_t len;
+    size_t calls;
+    bool split_line;       // a call did not end on a newline
+    size_t fail_after;     // 0: never fail
+} mem_sink_t;
+
+static esp_err_t mem_write(void *ctx, const char *data, size_t size)
+{
+    mem_sink_t *m = ctx;
+    if (m->fail_after && m->calls == m->fail_after)
+        return ESP_FAIL;
+    m->calls++;
+    if (!size || data[size - 1] != '\n')
+        m->split_line = true;
+    if (m->len + size < PAGE_MAX) {
+        memcpy(m->text + m->len, data, size);
+        m->len += size;
+        m->text[m->len] = '\0';
+    }
+    return ESP_OK;
+}
+
+static esp_err_t null_write(void *ctx, const char *data, size_t size)
+{
+    (void)data;
+    *(size_t *)ctx += size;
+    return ESP_OK;
+}
+
+static esp_err_t render(char *buf, size_t size, prom_sink_fn_t sink, void *ctx, prom_writer_t *w)
+{
+    prom_init(w, buf, size, sink, ctx);
+    node_collect(w);
+    return prom_finish(w);
+}
+
+// --- Format check -----------------------------------------------------------
+
+typedef struct {
+    char name[64];
+    char type[16];
+} family_t;
+
+static bool valid_name(const char *s, size_t n)
+{
+    if (!n)
+        return false;
+    for (size_t i = 0; i < n; i++) {
+        char c = s[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' ||
+                  (i && c >= '0' && c <= '9');
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static bool parse_value(const char *s, double *v)
+{
+    if (!strcmp(s, "NaN")) {
+        *v = NAN;
+        return true;
+    }
+    if (!strcmp(s, "+Inf") || !strcmp(s, "-Inf")) {
+        *v = s[0] == '+' ? INFINITY : -INFINITY;
+        return true;
+    }
+    char *end;
+    *v = strtod(s, &end);
+    return end != s && !*end;
+}
+
+static bool has_suffix(const char *s, size_t n, const char *suffix)
+{
+    size_t k = strlen(suffix);
+    return n > k && !memcmp(s + n - k, suffix, k);
+}
+
+// Checks the page line by line; returns the number of problems and counts
+// families and samples
+static int check_format(const char *page, int *n_families, int *n_samples)
+{
+    static family_t fams[128];
+    int nf = 0, ns = 0, bad = 0;
+    const family_t *cur = NULL;
+    char help_for[64] = "";
+    // Histogram series state
+    char series[512] = "";
+    double prev_le = -INFINITY, prev_count = 0, inf_count = -1;
+
+    for (const char *line = page; *line;) {
+        const char *nl = strchr(line, '\n');
+        if (!nl) {
+            printf("  last line not terminated\n");
+            return bad + 1;
+        }
+        char buf[1024];
+        size_t len = nl - line;
+        if (len >= sizeof(buf)) {
+            bad++;
+            line = nl + 1;
+            continue;
+        }
+        memcpy(buf, line, len);
+        buf[len] = '\0';
+        line = nl + 1;
+
+        if (!strncmp(buf, "# HELP ", 7)) {
+            const char *name = buf + 7, *sp = strchr(name, ' ');
+            size_t n = sp ? (size_t)(sp - name) : strlen(name);
+            if (!valid_name(name, n) || n >= sizeof(help_for)) {
+                printf("  bad HELP: %s\n", buf);
+                bad++;
+                continue;
+            }
+            memcpy(help_for, name, n);
+            help_for[n] = '\0';
+            continue;
+        }
+        if (!strncmp(buf, "# TYPE ", 7)) {
+            char name[64], type[16];
+            if (sscanf(buf + 7, "%63s %15s", name, type) != 2 || !valid_name(name, strlen(name)) ||
+                (strcmp(type, "counter") && strcmp(type, "gauge") && strcmp(type, "histogram"))) {
+                printf("  bad TYPE: %s\n", buf);
+                bad++;
+                continue;
+            }
+            for (int i = 0; i < nf; i++)
+                if (!strcmp(fams[i].name, name)) {
+                    printf("  family %s appears twice\n", name);
+                    bad++;
+                }
+            if (strcmp(help_for, name)) {
+                printf("  TYPE %s not after its HELP\n", name);
+                bad++;
+            }
+            if (nf < 128) {
+                strcpy(fams[nf].name, name);
+                strcpy(fams[nf].type, type);
+                cur = &fams[nf++];
+            }
+            continue;
+        }
+        if (buf[0] == '#')
+            continue;
+
+        // name{labels} value
+        ns++;
+        const char *p = buf;
+        while (*p && *p != '{' && *p != ' ')
+            p++;
+        size_t name_len = p - buf;
+        bool is_hist = cur && !strcmp(cur->type, "histogram");
+        size_t fam_len = cur ? strlen(cur->name) : 0;
+        bool in_family = cur && ((name_len == fam_len && !memcmp(buf, cur->name, fam_len)) ||
+                                 (is_hist && name_len > fam_len && !memcmp(buf, cur->name, fam_len) &&
+                                  (has_suffix(buf, name_len, "_bucket") || has_suffix(buf, name_len, "_sum") ||
+                                   has_suffix(buf, name_len, "_count"))));
+        if (!valid_name(buf, name_len) || !in_family) {
+            printf("  sample outside its family: %s\n", buf);
+            bad++;
+            continue;
+        }
+
+        char key[512] = "", le[256] = "";
+        size_t key_len = 0;
+        if (*p == '{') {
+            p++;
+            while (*p != '}') {
+                const char *ln = p;
+                while (*p && *p != '=')
+                    p++;
+                if (!valid_name(ln, p - ln) || p[0] != '=' || p[1] != '"') {
+                    printf("  bad label: %s\n", buf);
+                    bad++;
+                    goto next;
+                }
+                size_t lname_len = p - ln;
+                p += 2;
+                char val[256];
+                size_t vl = 0;
+                while (*p && *p != '"') {
+                    char c = *p++;
+                    if (c == '\\') {
+                        c = *p++;
+                        if (c == 'n')
+                            c = '\n';
+                        else if (c != '\\' && c != '"') {
+                            printf("  bad escape: %s\n", buf);
+                            bad++;
+                            goto next;
+                        }
+                    }
+                    if (vl < sizeof(val) - 1)
+                        val[vl++] = c;
+                }
+                val[vl] = '\0';
+                if (*p++ != '"') {
+                    printf("  unterminated label value: %s\n", buf);
+                    bad++;
+                    goto next;
+                }
+                if (lname_len == 2 && !memcmp(ln, "le", 2))
+                    snprintf(le, sizeof(le), "%s", val);
+                else
+                    key_len += snprintf(key + key_len, sizeof(key) - key_len, "%.*s=%s,", (int)lname_len, ln, val);
+                if (*p == ',')
+                    p++;
+                else if (*p != '}') {
+                    printf("  bad label list: %s\n", buf);
+                    bad++;
+                    goto next;
+                }
+            }
+            p++;
+        }
+        double v;
+        if (*p != ' ' || !parse_value(p + 1, &v)) {
+            printf("  bad value: %s\n", buf);
+            bad++;
+            continue;
+        }
+        if (!strcmp(cur->type, "counter") && !(v >= 0)) {
+            printf("  negative counter: %s\n", buf);
+            bad++;
+        }
+
+        if (is_hist && has_suffix(buf, name_len, "_bucket")) {
+            double le_v;
+            if (strcmp(series, key)) {
+                snprintf(series, sizeof(series), "%s", key);
+                prev_le = -INFINITY;
+                prev_count = 0;
+                inf_count = -1;
+            }
+            if (!parse_value(le, &le_v) || le_v <= prev_le || v < prev_count) {
+                printf("  bucket out of order: %s\n", buf);
+                bad++;
+            }
+            prev_le = le_v;
+            prev_count = v;
+            if (isinf(le_v))
+                inf_count = v;
+        } else if (is_hist && has_suffix(buf, name_len, "_count")) {
+            if (strcmp(series, key) || inf_count != v) {
+                printf("  _count does not match the +Inf bucket: %s\n", buf);
+                bad++;
+            }
+        }
+    next:;
+    }
+
+    *n_families = nf;
+    *n_samples = ns;
+    return bad;
+}
+
+// Value of the sample "name{labels} " in the page, NAN if missing
+static double sample_value(const char *page, const char *series)
+{
+    size_t n = strlen(series);
+    for (const char *p = page; (p = strstr(p, series)); p++)
+        if ((p == page || p[-1] == '\n') && p[n] == ' ')
+            return strtod(p + n + 1, NULL);
+    return NAN;
+}
+
+// --- HTTP -----------------------------------------------------------------
+
+typedef struct {
+    int fd;
+} http_sink_t;
+
+static bool send_all(int fd, const char *data, size_t size)
+{
+    while (size) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// One HTTP chunk per sink call, like httpd_resp_send_chunk()
+static esp_err_t http_write(void *ctx, const char *data, size_t size)
+{
+    http_sink_t *h = ctx;
+    char head[16];
+    int n = snprintf(head, sizeof(head), "%zx\r\n", size);
+    if (!send_all(h->fd, head, n) || !send_all(h->fd, data, size) || !send_all(h->fd, "\r\n", 2))
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+static int listen_on(uint16_t port, uint16_t *bound)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(port ? INADDR_ANY : INADDR_LOOPBACK) };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    *bound = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void serve_one(int lfd, size_t buf_size)
+{
+    int fd = accept(lfd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    char req[2048] = "";
+    size_t len = 0;
+    while (len < sizeof(req) - 1 && !strstr(req, "\r\n\r\n")) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0)
+            break;
+        len += n;
+        req[len] = '\0';
+    }
+    req[len] = '\0';
+
+    if (strncmp(req, "GET /metrics ", 13) && strncmp(req, "GET /metrics?", 13)) {
+        static const char nf[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, nf, sizeof(nf) - 1);
+    } else {
+        static const char ok[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                 "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+        char buf[buf_size];
+        http_sink_t h = { fd };
+        prom_writer_t w;
+        if (send_all(fd, ok, sizeof(ok) - 1) && render(buf, buf_size, http_write, &h, &w) == ESP_OK)
+            send_all(fd, "0\r\n\r\n", 5);
+    }
+    close(fd);
+}
+
+typedef struct {
+    int lfd;
+    size_t buf_size;
+    int requests;
+} server_t;
+
+static void *server_thread(void *arg)
+{
+    server_t *s = arg;
+    for (int i = 0; i < s->requests; i++)
+        serve_one(s->lfd, s->buf_size);
+    return NULL;
+}
+
+// GET /metrics; returns the decoded body length, -1 on error
+static long scrape(uint16_t port, char *body, size_t size, size_t *chunks)
+{
+    static char raw[PAGE_MAX * 2];
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    static const char req[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\nAccept: text/plain\r\n\r\n";
+    send_all(fd, req, sizeof(req) - 1);
+
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(raw) - 1 && (n = recv(fd, raw + len, sizeof(raw) - 1 - len, 0)) > 0)
+        len += n;
+    raw[len] = '\0';
+    close(fd);
+
+    const char *p = strstr(raw, "\r\n\r\n");
+    if (strncmp(raw, "HTTP/1.1 200", 12) || !p || !strstr(raw, "Transfer-Encoding: chunked") ||
+        !strstr(raw, "text/plain; version=0.0.4"))
+        return -1;
+    p += 4;
+
+    size_t out = 0;
+    *chunks = 0;
+    while (1) {
+        char *end;
+        unsigned long k = strtoul(p, &end, 16);
+        if (end == p || strncmp(end, "\r\n", 2))
+            return -1;
+        p = end + 2;
+        if (!k)
+            break;
+        if (out + k >= size || (size_t)(raw + len - p) < k + 2)
+            return -1;
+        memcpy(body + out, p, k);
+        out += k;
+        p += k + 2;
+        (*chunks)++;
+    }
+    body[out] = '\0';
+    return out;
+}
+
+// --- Main -----------------------------------------------------------------
+
+static int serve(uint16_t port, int scrapes, size_t buf_size)
+{
+    uint16_t bound;
+    int lfd = listen_on(port, &bound);
+    if (lfd < 0)
+        return 1;
+    printf("serving http://localhost:%u/metrics\n", bound);
+    fflush(stdout);
+    for (int i = 0; !scrapes || i < scrapes; i++) {
+        serve_one(lfd, buf_size);
+        node_run(15 * 1000000);
+    }
+    close(lfd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t buf_size = NODE_BUF_SIZE;
+    long iterations = 20000;
+    int port = -1, scrapes = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:i:p:n:")) != -1) {
+        switch (opt) {
+            case 'b': buf_size = strtoul(optarg, NULL, 10); break;
+            case 'i': iterations = strtol(optarg, NULL, 10); break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': scrapes = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-b BUF_SIZE] [-i ITERATIONS] [-p PORT [-n SCRAPES]]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    srand(1);
+    node_init();
+    node_run(3600LL * 1000000);
+    if (port >= 0)
+        return serve(port, scrapes, buf_size);
+
+    static char ref_text[PAGE_MAX], text[PAGE_MAX], big[PAGE_MAX];
+    bool ok = true;
+
+    // Reference page, and its longest line
+    mem_sink_t ref = { .text = ref_text };
+    prom_writer_t w;
+    if (render(big, sizeof(big), mem_write, &ref, &w) != ESP_OK || ref.calls != 1) {
+        printf("reference render failed\n");
+        return 1;
+    }
+    size_t longest = 0;
+    for (const char *p = ref_text; *p;) {
+        const char *nl = strchr(p, '\n');
+        // HELP and TYPE go out together
+        size_t n = nl - p + 1;
+        if (!strncmp(p, "# HELP ", 7)) {
+            nl = strchr(nl + 1, '\n');
+            n = nl - p + 1;
+        }
+        if (n > longest)
+            longest = n;
+        p = nl + 1;
+    }
+    printf("page: %zu bytes, longest line %zu bytes\n", ref.len, longest);
+
+    // Every buffer size gives the same page, in whole lines
+    int wrong = 0;
+    for (size_t size = 2; size <= 4096; size++) {
+        mem_sink_t m = { .text = text };
+        text[0] = '\0';
+        esp_err_t err = render(big, size, mem_write, &m, &w);
+        bool fits = size > longest;
+        if (fits ? err != ESP_OK || m.len != ref.len || memcmp(text, ref_text, ref.len) || m.split_line
+                 : err != ESP_ERR_INVALID_SIZE)
+            wrong++;
+    }
+    mem_sink_t m = { .text = text };
+    render(big, buf_size, mem_write, &m, &w);
+    printf("buffer sizes 2..4096: %d wrong; %zu bytes: %zu sink calls\n", wrong, buf_size, m.calls);
+    ok &= !wrong;
+
+    // A failing sink stops the page
+    mem_sink_t fail = { .text = text, .fail_after = 2 };
+    esp_err_t err = render(big, 256, mem_write, &fail, &w);
+    printf("sink failing on call 3: %s after %zu calls\n", esp_err_to_name(err), fail.calls);
+    ok &= err == ESP_FAIL && fail.calls == 2;
+
+    // Format
+    int n_families = 0, n_samples = 0;
+    int bad = check_format(ref_text, &n_families, &n_samples);
+    printf("format: %d families, %d samples, %d problems\n", n_families, n_samples, bad);
+    ok &= !bad;
+
+    // Values made it through
+    const psched_stats_t *st = psched_stats(&sched, 2);
+    double runs = sample_value(ref_text, "node_job_runs_total{job=\"sample\",loop=\"acquisition\"}");
+    double count = sample_value(ref_text, "node_job_exec_seconds_count{job=\"sample\",loop=\"acquisition\"}");
+    double sum = sample_value(ref_text, "node_job_exec_seconds_sum{job=\"bmp180\",loop=\"acquisition\"}");
+    bool values = runs == st->runs && count == st->runs &&
+                  fabs(sum - psched_stats(&sched, 0)->exec_sum_us / 1e6) < 1e-6 &&
+                  sample_value(ref_text, "node_temperature_celsius") == 23.45 &&
+                  isnan(sample_value(ref_text, "prom_check_edge{kind=\"nan\"}"));
+    printf("values: sample job %" PRIu32 " runs, page says %.0f runs, %.0f in histogram: %s\n", st->runs, runs,
+           count, values ? "ok" : "wrong");
+    ok &= values;
+
+    // Scrape over HTTP, chunked
+    uint16_t bound;
+    server_t srv = { .lfd = listen_on(0, &bound), .buf_size = buf_size, .requests = 1 };
+    if (srv.lfd < 0)
+        return 1;
+    pthread_t t;
+    pthread_create(&t, NULL, server_thread, &srv);
+    size_t chunks = 0;
+    long got = scrape(bound, text, sizeof(text), &chunks);
+    pthread_join(t, NULL);
+    close(srv.lfd);
+    bool scraped = got == (long)ref.len && !memcmp(text, ref_text, ref.len);
+    printf("scrape from port %u: %ld bytes in %zu chunks, %s\n", bound, got, chunks,
+           scraped ? "same page" : "DIFFERENT");
+    ok &= scraped;
+
+    // Render time
+    size_t total = 0;
+    double t0 = now_s();
+    for (long i = 0; i < iterations; i++)
+        render(big, buf_size, null_write, &total, &w);
+    double dt = now_s() - t0;
+    printf("render: %.1f us per page, %.0f MB/s (%zu byte buffer)\n", dt / iterations * 1e6,
+           total / dt / 1e6, buf_size);
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
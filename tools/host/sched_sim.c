@@ -0,0 +1,187 @@
+/*
+ * Runs periodic_sched against a virtual clock and checks its timing.
+ *
+ *   sched_sim [-H HOURS] [-s SEED]
+ *
+ * Simulates the SmartNode schedules for HOURS of virtual time (default
+ * 24): a sensor task (BMP180 every 2 s, gas frame every 1 s) and an
+ * uplink task (every 16 s, with occasional network stalls). They are
+ * separate tasks on the target, so each scheduler gets its own virtual
+ * clock. Job bodies advance their clock by a random execution time.
+ *
+ * Checks that every job stays on its absolute release grid, that run
+ * counts match the elapsed time minus skipped periods, that stalls are
+ * reported as overruns and that they do not disturb the sensor jobs.
+ * Compares with the drift of the old "work, then vTaskDelay" loop.
+ * Exits non-zero if a check fails.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "periodic_sched.h"
+
+static int64_t virt_now(void *ctx)
+{
+    return *(int64_t *)ctx;
+}
+
+static void virt_sleep_until(void *ctx, int64_t t)
+{
+    int64_t *now = ctx;
+    if (t > *now)
+        *now = t;
+}
+
+typedef struct {
+    uint32_t exec_min_us;
+    uint32_t exec_max_us;
+    uint32_t stall_permille;  // chance of a stall instead of normal work
+    uint32_t stall_us;
+    bool off_grid;            // started away from a release time
+    size_t id;
+    const psched_t *s;
+    int64_t *now;
+} sim_job_t;
+
+static uint32_t rnd(uint32_t lo, uint32_t hi)
+{
+    return hi > lo ? lo + (uint32_t)(rand() % (hi - lo + 1)) : lo;
+}
+
+static void sim_work(void *ctx)
+{
+    sim_job_t *j = ctx;
+    const psched_job_t *job = &j->s->jobs[j->id];
+    int64_t offset = *j->now - j->s->start_us - job->cfg.phase_us;
+
+    // A late start is fine, but only ever relative to a grid point
+    if ((job->release_us - j->s->start_us - job->cfg.phase_us) % job->cfg.period_us != 0 || offset < 0)
+        j->off_grid = true;
+
+    if (j->stall_permille && (uint32_t)(rand() % 1000) < j->stall_permille)
+        *j->now += j->stall_us;
+    else
+        *j->now += rnd(j->exec_min_us, j->exec_max_us);
+}
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("  %-52s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok)
+        failures++;
+}
+
+static void print_stats(const psched_t *s)
+{
+    for (size_t i = 0; i < s->n_jobs; i++) {
+        const psched_stats_t *st = psched_stats(s, i);
+        printf("%-8s runs %7" PRIu32 "  jitter avg %6.0f max %7" PRIu32 " us  exec max %7" PRIu32
+               " us  overruns %4" PRIu32 "  skipped %4" PRIu32 "\n",
+               s->jobs[i].cfg.name, st->runs, st->runs ? (double)st->jitter_sum_us / st->runs : 0.0,
+               st->jitter_max_us, st->exec_max_us, st->overruns, st->skipped);
+        printf("         exec:");
+        for (unsigned b = 0; b < PSCHED_HIST_BINS; b++)
+            if (st->exec_hist[b])
+                printf(" >=%" PRIu32 "us:%" PRIu32, psched_hist_floor_us(b), st->exec_hist[b]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double hours = 24;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:s:")) != -1) {
+        switch (opt) {
+            case 'H': hours = atof(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-H HOURS] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+    srand(seed);
+
+    const int64_t duration = (int64_t)(hours * 3600e6);
+    int64_t sensor_now = 0, uplink_now = 0;
+    psched_clock_t sensor_clock = { .now_us = virt_now, .sleep_until_us = virt_sleep_until, .ctx = &sensor_now };
+    psched_clock_t uplink_clock = { .now_us = virt_now, .sleep_until_us = virt_sleep_until, .ctx = &uplink_now };
+    psched_job_t sensor_jobs[2], uplink_jobs[1];
+    psched_t sensors, uplink;
+    psched_init(&sensors, &sensor_clock, sensor_jobs, 2);
+    psched_init(&uplink, &uplink_clock, uplink_jobs, 1);
+
+    sim_job_t bmp = { .exec_min_us = 25000, .exec_max_us = 32000, .s = &sensors, .now = &sensor_now };
+    sim_job_t gas = { .exec_min_us = 50, .exec_max_us = 400, .s = &sensors, .now = &sensor_now };
+    // HTTP request: 150-900 ms; 1 % of them stall for 35 s (DNS and
+    // connect timeouts) and run past the next two releases
+    sim_job_t up = { .exec_min_us = 150000, .exec_max_us = 900000,
+                     .stall_permille = 10, .stall_us = 35000000, .s = &uplink, .now = &uplink_now };
+    psched_job_config_t bmp_cfg = { .name = "bmp180", .fn = sim_work, .ctx = &bmp, .period_us = 2000000 };
+    psched_job_config_t gas_cfg = { .name = "gas", .fn = sim_work, .ctx = &gas,
+                                    .period_us = 1000000, .phase_us = 500000 };
+    psched_job_config_t up_cfg = { .name = "uplink", .fn = sim_work, .ctx = &up,
+                                   .period_us = 16000000, .phase_us = 100000 };
+    psched_add(&sensors, &bmp_cfg, &bmp.id);
+    psched_add(&sensors, &gas_cfg, &gas.id);
+    psched_add(&uplink, &up_cfg, &up.id);
+
+    while (sensor_now < duration)
+        psched_run_once(&sensors);
+    while (uplink_now < duration)
+        psched_run_once(&uplink);
+
+    printf("%.1f h virtual time, seed %u\n", hours, seed);
+    print_stats(&sensors);
+    print_stats(&uplink);
+
+    printf("checks:\n");
+    const sim_job_t *sims[] = { &bmp, &gas, &up };
+    for (size_t i = 0; i < 3; i++) {
+        const psched_t *s = sims[i]->s;
+        const psched_job_t *job = &s->jobs[sims[i]->id];
+        const psched_stats_t *st = &job->stats;
+        int64_t elapsed = *sims[i]->now - s->start_us;
+        char what[80];
+        // Releases up to the end of the run, at most one still pending
+        int64_t releases = (elapsed - job->cfg.phase_us) / job->cfg.period_us + 1;
+        int64_t accounted = (int64_t)st->runs + st->skipped;
+
+        snprintf(what, sizeof(what), "%s: all runs released on the grid", job->cfg.name);
+        check(!sims[i]->off_grid, what);
+        snprintf(what, sizeof(what), "%s: runs + skipped == releases (%" PRId64 ")", job->cfg.name, releases);
+        check(accounted == releases || accounted == releases - 1, what);
+    }
+    const psched_stats_t *up_st = psched_stats(&uplink, up.id);
+    check(up_st->overruns > 0 && up_st->skipped >= up_st->overruns,
+          "uplink: stalls counted as overruns with skips");
+    check(psched_stats(&sensors, bmp.id)->overruns == 0 && psched_stats(&sensors, gas.id)->overruns == 0,
+          "bmp180, gas: no overruns");
+    check(psched_stats(&sensors, gas.id)->jitter_max_us == 0,
+          "gas: phase keeps it clear of bmp180, no jitter");
+
+    // The loop this replaces: 8 x (work + vTaskDelay(2000)) per upload
+    int64_t t = 0;
+    long loops = 0, uploads = 0;
+    srand(seed);
+    while (t < duration) {
+        t += rnd(25000, 32000) + 2000000;
+        if (++loops % 8 == 0) {
+            uploads++;
+            t += rnd(150000, 900000);
+        }
+    }
+    printf("vTaskDelay loop: %ld uploads, mean interval %.2f s (nominal 16 s); "
+           "scheduler: %" PRIu32 " uploads\n",
+           uploads, duration / 1e6 / uploads, up_st->runs);
+
+    printf("%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
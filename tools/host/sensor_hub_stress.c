@@ -0,0 +1,186 @@
+/*
+ * Concurrency check and throughput of the sensor_hub last-value cache.
+ *
+ *   sensor_hub_stress [-r READERS] [-t SECONDS] [-p PERIOD_US]
+ *
+ * A scheduler thread samples a fake sensor whose values all equal its
+ * sample count, every PERIOD_US (default 1: as fast as possible), while
+ * READERS threads (default 4) read the cache for SECONDS (default 2).
+ * Every read must see one consistent sample: all values equal to each
+ * other and to the sample count, counts never going backwards. Also
+ * checks that the number of samples taken does not depend on the number
+ * of readers, with READERS * 4 consumers polling every 100 us. Exits
+ * non-zero on a torn or stale read.
+ */
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sensor_hub.h"
+
+static int64_t mono_us(void *ctx)
+{
+    (void)ctx;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void mono_sleep_until(void *ctx, int64_t t)
+{
+    (void)ctx;
+    struct timespec ts = { .tv_sec = t / 1000000, .tv_nsec = (t % 1000000) * 1000 };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static const sensor_channel_t fake_channels[] = {
+    { "a", "" }, { "b", "" }, { "c", "" }, { "d", "" },
+};
+
+static esp_err_t fake_sample(void *dev, float *values)
+{
+    uint32_t *calls = dev;
+    ++*calls;
+    for (int i = 0; i < SENSOR_HUB_MAX_VALUES; i++)
+        values[i] = (float)(*calls & 0xFFFFFF);  // exact in a float
+    return ESP_OK;
+}
+
+static const sensor_driver_t fake_driver = {
+    .type = "fake",
+    .n_values = SENSOR_HUB_MAX_VALUES,
+    .channels = fake_channels,
+    .sample = fake_sample,
+};
+
+typedef struct {
+    const sensor_hub_t *hub;
+    volatile bool *stop;
+    uint32_t pause_us;
+    uint64_t reads;
+    uint64_t errors;
+} reader_t;
+
+static void *reader_thread(void *arg)
+{
+    reader_t *r = arg;
+    uint32_t last = 0;
+
+    while (!*r->stop) {
+        sensor_reading_t rd;
+        if (sensor_hub_read(r->hub, 0, &rd) != ESP_OK)
+            continue;
+        bool ok = rd.count >= last && rd.values[0] == (float)(rd.count & 0xFFFFFF);
+        for (int i = 1; i < SENSOR_HUB_MAX_VALUES; i++)
+            ok = ok && rd.values[i] == rd.values[0];
+        if (!ok)
+            r->errors++;
+        last = rd.count;
+        r->reads++;
+        if (r->pause_us)
+            usleep(r->pause_us);
+    }
+    return NULL;
+}
+
+typedef struct {
+    psched_t *sched;
+    volatile bool *stop;
+} writer_t;
+
+static void *writer_thread(void *arg)
+{
+    writer_t *w = arg;
+    while (!*w->stop)
+        psched_run_once(w->sched);
+    return NULL;
+}
+
+// Runs one configuration; returns samples taken and the releases that
+// fell into the run, adds bad reads to *errors
+static uint32_t run(int readers, uint32_t pause_us, double seconds, uint32_t period_us,
+                    uint64_t *errors, double *reads_per_s, uint32_t *releases)
+{
+    psched_clock_t clock = { .now_us = mono_us, .sleep_until_us = mono_sleep_until };
+    psched_job_t jobs[1];
+    psched_t sched;
+    sensor_hub_entry_t entries[1];
+    sensor_hub_t hub;
+    uint32_t calls = 0;
+    volatile bool stop = false;
+
+    psched_init(&sched, &clock, jobs, 1);
+    sensor_hub_init(&hub, &sched, entries, 1);
+    sensor_hub_sensor_config_t cfg = { .name = "fake", .driver = &fake_driver, .dev = &calls, .period_us = period_us };
+    sensor_hub_add(&hub, &cfg, NULL);
+
+    writer_t w = { .sched = &sched, .stop = &stop };
+    reader_t *r = calloc(readers, sizeof(reader_t));
+    pthread_t wt, *rt = calloc(readers, sizeof(pthread_t));
+
+    pthread_create(&wt, NULL, writer_thread, &w);
+    for (int i = 0; i < readers; i++) {
+        r[i] = (reader_t) { .hub = &hub, .stop = &stop, .pause_us = pause_us };
+        pthread_create(&rt[i], NULL, reader_thread, &r[i]);
+    }
+    usleep((useconds_t)(seconds * 1e6));
+    stop = true;
+    pthread_join(wt, NULL);
+    *releases = (uint32_t)((mono_us(NULL) - sched.start_us) / period_us + 1);
+
+    uint64_t reads = 0;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(rt[i], NULL);
+        reads += r[i].reads;
+        *errors += r[i].errors;
+    }
+    *reads_per_s = reads / seconds;
+    free(r);
+    free(rt);
+    return calls;
+}
+
+int main(int argc, char **argv)
+{
+    int readers = 4;
+    double seconds = 2;
+    uint32_t period_us = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:t:p:")) != -1) {
+        switch (opt) {
+            case 'r': readers = atoi(optarg); break;
+            case 't': seconds = atof(optarg); break;
+            case 'p': period_us = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-r READERS] [-t SECONDS] [-p PERIOD_US]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (period_us == 0)
+        period_us = 1;
+
+    uint64_t errors = 0;
+    double rps;
+    uint32_t releases;
+    uint32_t samples = run(readers, 0, seconds, period_us, &errors, &rps, &releases);
+    printf("%d readers, %.1f s, period %" PRIu32 " us: %" PRIu32 " samples, %.1f M reads/s, %" PRIu64 " bad reads\n",
+           readers, seconds, period_us, samples, rps / 1e6, errors);
+
+    // Sampling is owned by the schedule, not by the readers
+    uint32_t alone_rel, crowded_rel;
+    uint32_t alone = run(0, 0, 0.5, 10000, &errors, &rps, &alone_rel);
+    uint32_t crowded = run(readers * 4, 100, 0.5, 10000, &errors, &rps, &crowded_rel);
+    printf("10 ms period: %" PRIu32 "/%" PRIu32 " releases sampled with no readers, "
+           "%" PRIu32 "/%" PRIu32 " with %d\n", alone, alone_rel, crowded, crowded_rel, readers * 4);
+
+    bool ok = errors == 0 && alone <= alone_rel && crowded <= crowded_rel &&
+              alone >= alone_rel - 1 && crowded >= crowded_rel - 1;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/*
+ * Size and speed of the telem_codec frames against the JSON payloads the
+ * MQTT nodes used to build with snprintf.
+ *
+ *   telem_bench [-n SAMPLES] [-k KEY_INTERVAL] [-l LOSS_PERCENT] [-s SEED]
+ *
+ * Feeds SAMPLES (default 200000) slowly drifting readings of both node
+ * types through the old JSON formatting, through absolute frames and
+ * through delta frames with an absolute one every KEY_INTERVAL (default
+ * 16), and reports bytes per sample and encode/decode time. Every frame
+ * is decoded again and must match the reading to half a unit in the last
+ * reported digit, and the JSON rendered from it must equal the old
+ * payload byte for byte. Finally LOSS_PERCENT (default 1) of the delta
+ * frames are dropped to show how many frames the decoder then refuses.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telem_codec.h"
+
+typedef struct {
+    uint32_t seq;
+    uint32_t age_ms;
+    float v[TELEM_FIELDS_MAX];
+} sample_t;
+
+static uint32_t rng_state;
+
+static double rnd(void)
+{
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return (rng_state >> 8) / 16777216.0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Readings wander like the real ones: CO2 around 400-2000 ppm, gas traces
+// of a few ppm, room temperature, air pressure and humidity
+static void make_samples(sample_t *s, long n, telem_schema_id_t id)
+{
+    double a = id == TELEM_SCHEMA_GAS ? 600 : 22.5, b = id == TELEM_SCHEMA_GAS ? 4 : 1013.2;
+    double c = id == TELEM_SCHEMA_GAS ? 1.5 : 45;
+    for (long i = 0; i < n; i++) {
+        if (id == TELEM_SCHEMA_GAS) {
+            a = fmin(fmax(a + (rnd() - 0.5) * 20, 400), 2000);
+            b = fmax(b + (rnd() - 0.5) * 0.2, 0);
+            c = fmax(c + (rnd() - 0.5) * 0.1, 0);
+        } else {
+            a += (rnd() - 0.5) * 0.1;
+            b += (rnd() - 0.5) * 0.05;
+            c = fmin(fmax(c + (rnd() - 0.5) * 0.4, 0), 100);
+        }
+        s[i] = (sample_t) { .seq = 1000 + i, .age_ms = i % 50 ? 3 + i % 7 : 40000 + i % 1000,
+                            .v = { (float)a, (float)b, (float)c } };
+    }
+}
+
+// The payloads GasNODE and TempNODE built before the codec
+static int format_json(char *buf, size_t size, telem_schema_id_t id, const sample_t *s)
+{
+    int len;
+    if (id == TELEM_SCHEMA_GAS)
+        len = snprintf(buf, size, "{\"co2\": %.2f, \"ch4\": %.2f, \"co\": %.2f", s->v[0], s->v[1], s->v[2]);
+    else
+        len = snprintf(buf, size, "{\"temperature\": %.2f, \"pressure\": %.2f, \"humidity\": %.1f",
+                       s->v[0], s->v[1], s->v[2]);
+    len += snprintf(buf + len, size - len, ", \"seq\": %" PRIu32 ", \"age_ms\": %" PRIu32 "}", s->seq, s->age_ms);
+    return len;
+}
+
+typedef struct {
+    double bytes;
+    double enc_ns;
+    double dec_ns;
+    long deltas;
+    long mismatch;     // Decoded value off by more than half a digit
+    long json_diff;    // Rendered JSON differs from the old payload
+} result_t;
+
+static bool run_codec(const telem_schema_t *schema, const sample_t *s, long n, uint32_t key_interval,
+                      uint8_t *frames, size_t *lens, result_t *res)
+{
+    telem_enc_t enc;
+    telem_enc_init(&enc, schema, key_interval);
+    memset(res, 0, sizeof(*res));
+
+    double t0 = now_s();
+    size_t total = 0;
+    for (long i = 0; i < n; i++) {
+        if (telem_encode(&enc, s[i].v, &s[i].seq, &s[i].age_ms, frames + i * TELEM_FRAME_MAX, TELEM_FRAME_MAX,
+                         &lens[i]) != ESP_OK)
+            return false;
+        total += lens[i];
+    }
+    res->enc_ns = (now_s() - t0) / n * 1e9;
+    res->bytes = (double)total / n;
+
+    telem_dec_t dec;
+    telem_dec_init(&dec);
+    static telem_frame_t f;
+    t0 = now_s();
+    for (long i = 0; i < n; i++)
+        if (telem_decode(&dec, frames + i * TELEM_FRAME_MAX, lens[i], &f) != ESP_OK)
+            return false;
+    res->dec_ns = (now_s() - t0) / n * 1e9;
+
+    // Correctness pass, untimed
+    telem_dec_init(&dec);
+    for (long i = 0; i < n; i++) {
+        telem_decode(&dec, frames + i * TELEM_FRAME_MAX, lens[i], &f);
+        if (f.flags & TELEM_FLAG_DELTA)
+            res->deltas++;
+        bool ok = f.seq == s[i].seq && f.age_ms == s[i].age_ms;
+        for (int k = 0; k < schema->n_fields; k++) {
+            double lsb = pow(10, -schema->decimals[k]);
+            ok = ok && fabs((double)f.value[k] - s[i].v[k]) <= lsb * 0.5 + fabs(s[i].v[k]) * 1e-6;
+        }
+        if (!ok)
+            res->mismatch++;
+
+        char old[160], now[160];
+        format_json(old, sizeof(old), schema->id, &s[i]);
+        telem_to_json(&f, now, sizeof(now), NULL);
+        if (strcmp(old, now))
+            res->json_diff++;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    long n = 200000;
+    uint32_t key_interval = 16;
+    double loss = 1;
+    int opt;
+
+    rng_state = 1;
+    while ((opt = getopt(argc, argv, "n:k:l:s:")) != -1) {
+        switch (opt) {
+            case 'n': n = strtol(optarg, NULL, 10); break;
+            case 'k': key_interval = strtoul(optarg, NULL, 10); break;
+            case 'l': loss = atof(optarg); break;
+            case 's': rng_state = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n SAMPLES] [-k KEY_INTERVAL] [-l LOSS_PERCENT] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (n < 1 || key_interval < 2) {
+        fprintf(stderr, "need SAMPLES >= 1 and KEY_INTERVAL >= 2\n");
+        return 2;
+    }
+
+    sample_t *s = malloc(n * sizeof(sample_t));
+    uint8_t *frames = malloc(n * TELEM_FRAME_MAX);
+    size_t *lens = malloc(n * sizeof(size_t));
+    if (!s || !frames || !lens)
+        return 1;
+
+    static const telem_schema_id_t ids[] = { TELEM_SCHEMA_GAS, TELEM_SCHEMA_ENV };
+    bool ok = true;
+    for (size_t t = 0; t < sizeof(ids) / sizeof(ids[0]); t++) {
+        const telem_schema_t *schema = telem_schema_find(ids[t]);
+        make_samples(s, n, ids[t]);
+
+        char json[160];
+        volatile size_t sink = 0;
+        size_t total = 0;
+        double t0 = now_s();
+        for (long i = 0; i < n; i++) {
+            int len = format_json(json, sizeof(json), ids[t], &s[i]);
+            total += len;
+            sink += json[len - 2];
+        }
+        double json_ns = (now_s() - t0) / n * 1e9;
+        (void)sink;
+
+        result_t abs_res, delta_res;
+        if (!run_codec(schema, s, n, 1, frames, lens, &abs_res) ||
+            !run_codec(schema, s, n, key_interval, frames, lens, &delta_res)) {
+            printf("%s: encode or decode failed\n", ids[t] == TELEM_SCHEMA_GAS ? "gas" : "env");
+            return 1;
+        }
+
+        printf("%s node, %ld samples with seq and age_ms:\n", ids[t] == TELEM_SCHEMA_GAS ? "gas" : "env", n);
+        printf("  JSON:           %6.1f bytes/sample, encode %7.1f ns\n", (double)total / n, json_ns);
+        printf("  absolute:       %6.1f bytes/sample, encode %7.1f ns, decode %6.1f ns  (%.1fx smaller, %.1fx faster)\n",
+               abs_res.bytes, abs_res.enc_ns, abs_res.dec_ns, total / (abs_res.bytes * n),
+               json_ns / abs_res.enc_ns);
+        printf("  delta (key %2" PRIu32 "): %6.1f bytes/sample, encode %7.1f ns, decode %6.1f ns  (%.1fx smaller, %ld deltas)\n",
+               key_interval, delta_res.bytes, delta_res.enc_ns, delta_res.dec_ns, total / (delta_res.bytes * n),
+               delta_res.deltas);
+        printf("  round trip: %ld / %ld values off, JSON differs from the old payload for %ld / %ld\n",
+               abs_res.mismatch, delta_res.mismatch, abs_res.json_diff, delta_res.json_diff);
+        if (abs_res.mismatch || delta_res.mismatch || abs_res.json_diff || delta_res.json_diff || abs_res.deltas)
+            ok = false;
+
+        // Lost delta frames: the decoder refuses what follows until the
+        // next absolute frame, and never returns a wrong value
+        telem_dec_t dec;
+        telem_frame_t f;
+        telem_dec_init(&dec);
+        long dropped = 0, refused = 0, wrong = 0;
+        for (long i = 0; i < n; i++) {
+            if (rnd() * 100 < loss) {
+                dropped++;
+                continue;
+            }
+            esp_err_t err = telem_decode(&dec, frames + i * TELEM_FRAME_MAX, lens[i], &f);
+            if (err == ESP_ERR_INVALID_STATE)
+                refused++;
+            else if (err != ESP_OK || fabsf(f.value[0] - s[i].v[0]) > 0.01f)
+                wrong++;
+        }
+        printf("  %.1f%% lost: %ld dropped, %ld refused (%.1f per loss, at most %" PRIu32 "), %ld wrong\n",
+               loss, dropped, refused, dropped ? (double)refused / dropped : 0.0, key_interval - 1, wrong);
+        if (wrong || refused > dropped * (long)(key_interval - 1))
+            ok = false;
+    }
+
+    // Malformed input is rejected, not misread
+    telem_dec_t dec;
+    telem_frame_t f;
+    telem_dec_init(&dec);
+    const uint8_t json_start[] = "{\"co2\": 1}";
+    const uint8_t truncated[] = { 0x13, TELEM_SCHEMA_GAS, 0x07, 0x80 };
+    const uint8_t unknown[] = { 0x10, 0x7f, 0x00 };
+    if (telem_decode(&dec, json_start, sizeof(json_start) - 1, &f) != ESP_ERR_NOT_SUPPORTED ||
+        telem_decode(&dec, truncated, sizeof(truncated), &f) != ESP_ERR_INVALID_SIZE ||
+        telem_decode(&dec, unknown, sizeof(unknown), &f) != ESP_ERR_NOT_SUPPORTED) {
+        printf("malformed frames not rejected\n");
+        ok = false;
+    }
+
+    free(s);
+    free(frames);
+    free(lens);
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
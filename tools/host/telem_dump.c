@@ -0,0 +1,92 @@
+/*
+ * Turns telem_codec frames back into the JSON the nodes used to send, for
+ * the receiving side of the MQTT topics.
+ *
+ *   mosquitto_sub -h BROKER -t 'esp32/sensors/#' -F '%t %x' | telem_dump
+ *
+ * Reads one message per line, as hex, optionally preceded by its topic,
+ * and prints "topic json" (or just the JSON). Each topic is decoded as a
+ * stream of its own so delta frames work with several nodes; payloads
+ * that already are JSON are passed through unchanged.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telem_codec.h"
+
+#define TOPICS_MAX 32
+
+typedef struct {
+    char topic[128];
+    telem_dec_t dec;
+} stream_t;
+
+static stream_t streams[TOPICS_MAX];
+static size_t n_streams;
+
+static telem_dec_t *decoder_for(const char *topic)
+{
+    for (size_t i = 0; i < n_streams; i++)
+        if (!strcmp(streams[i].topic, topic))
+            return &streams[i].dec;
+    stream_t *s = &streams[n_streams < TOPICS_MAX ? n_streams++ : TOPICS_MAX - 1];
+    snprintf(s->topic, sizeof(s->topic), "%s", topic);
+    telem_dec_init(&s->dec);
+    return &s->dec;
+}
+
+static int hex_value(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = tolower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+int main(void)
+{
+    char line[1024];
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char *hex = strrchr(line, ' ');
+        const char *topic = "";
+        if (hex) {
+            *hex++ = 0;
+            topic = line;
+        } else {
+            hex = line;
+        }
+
+        uint8_t msg[sizeof(line) / 2 + 1];
+        size_t len = 0;
+        bool bad = strlen(hex) % 2;
+        for (const char *p = hex; !bad && p[0]; p += 2) {
+            int hi = hex_value(p[0]), lo = hex_value(p[1]);
+            bad = hi < 0 || lo < 0;
+            msg[len++] = hi << 4 | lo;
+        }
+        const char *sep = *topic ? " " : "";
+        if (bad || !len) {
+            printf("%s%s(not hex: %s)\n", topic, sep, hex);
+            continue;
+        }
+        if (msg[0] == '{') {
+            msg[len] = 0;
+            printf("%s%s%s\n", topic, sep, (const char *)msg);
+            continue;
+        }
+
+        telem_frame_t f;
+        char json[256];
+        esp_err_t err = telem_decode(decoder_for(topic), msg, len, &f);
+        if (err == ESP_OK)
+            err = telem_to_json(&f, json, sizeof(json), NULL);
+        if (err == ESP_OK)
+            printf("%s%s%s\n", topic, sep, json);
+        else
+            printf("%s%s(%zu byte frame not decoded: %s)\n", topic, sep, len, esp_err_to_name(err));
+        fflush(stdout);
+    }
+    return 0;
+}
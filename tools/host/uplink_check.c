@@ -0,0 +1,193 @@
+/*
+ * Drives http_uplink against a local HTTP server (see http_standin.py) and
+ * reports how many connections and DNS lookups a series of uploads took.
+ *
+ *   uplink_check [-H HOST] [-p PORT] [-n REQUESTS] [-i INTERVAL_MS] [-f] [-d] [-r]
+ *
+ * Sends REQUESTS (default 50) ThingSpeak-style GET updates INTERVAL_MS
+ * apart (default 20), then compares the client's counters with the
+ * server's /stats. Against a plain stand-in every request must share one
+ * connection and one lookup; with --close-every or --idle-timeout on the
+ * server the reconnects must match the server's connection count.
+ *
+ * -f closes the connection after every request, like the old
+ * init/perform/cleanup sequence, for comparing per-request latency.
+ *
+ * -d instead targets PORT with nothing listening for 3 s and shows the
+ * backoff: connection attempts grow logarithmically, not per request.
+ *
+ * -r does the same against a stand-in started with --reject 503 (or 429):
+ * the server answers, but requests must still back off.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http_uplink.h"
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_stats(const http_uplink_stats_t *st)
+{
+    printf("client: %" PRIu32 " requests, %" PRIu32 " connects, %" PRIu32 " DNS lookups, %" PRIu32
+           " reused, %" PRIu32 " retries, %" PRIu32 " failures, %" PRIu32 " backoff skips\n",
+           st->requests, st->connects, st->dns_lookups, st->reused, st->retries, st->failures,
+           st->backoff_skips);
+    printf("client: %" PRIu32 " answers with 429 or 5xx\n", st->refused);
+}
+
+static long json_field(const char *json, const char *key)
+{
+    char pat[64];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(json, pat);
+    return p ? strtol(p + strlen(pat), NULL, 10) : -1;
+}
+
+static int check_down(const char *host, uint16_t port)
+{
+    http_uplink_t u;
+    http_uplink_config_t cfg = { .host = host, .port = port, .timeout_ms = 500,
+                                 .backoff_min_ms = 50, .backoff_max_ms = 1000 };
+    http_uplink_init(&u, &cfg);
+    http_uplink_request_t req = { .method = "GET", .path = "/update?api_key=x&field1=1" };
+
+    double t0 = now_s();
+    long calls = 0;
+    while (now_s() - t0 < 3) {
+        http_uplink_request(&u, &req, NULL);
+        calls++;
+        usleep(10000);
+    }
+    print_stats(&u.stats);
+    printf("%ld upload calls in 3 s, %" PRIu32 " connection attempts, backoff now %" PRIu32 " ms\n",
+           calls, u.stats.failures, u.backoff_ms);
+    bool ok = u.stats.connects == 0 && u.stats.failures <= 10 && u.stats.backoff_skips > 0;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int check_rejected(const char *host, uint16_t port)
+{
+    http_uplink_t u;
+    http_uplink_config_t cfg = { .host = host, .port = port, .timeout_ms = 500,
+                                 .backoff_min_ms = 50, .backoff_max_ms = 1000 };
+    http_uplink_init(&u, &cfg);
+    http_uplink_request_t req = { .method = "GET", .path = "/update?api_key=x&field1=1" };
+    http_uplink_response_t resp = { 0 };
+
+    double t0 = now_s();
+    long calls = 0;
+    int status = 0;
+    while (now_s() - t0 < 3) {
+        if (http_uplink_request(&u, &req, &resp) == ESP_OK)
+            status = resp.status;
+        calls++;
+        usleep(10000);
+    }
+    print_stats(&u.stats);
+    printf("%ld upload calls in 3 s, %" PRIu32 " answered with %d, backoff now %" PRIu32 " ms\n",
+           calls, u.stats.refused, status, u.backoff_ms);
+    bool ok = u.stats.refused > 0 && u.stats.refused <= 10 && u.stats.requests == u.stats.refused &&
+              u.stats.backoff_skips > 0;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "localhost";
+    uint16_t port = 8080;
+    int n = 50, interval_ms = 20;
+    bool down = false, fresh = false, rejected = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:n:i:fdr")) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': n = atoi(optarg); break;
+            case 'i': interval_ms = atoi(optarg); break;
+            case 'f': fresh = true; break;
+            case 'd': down = true; break;
+            case 'r': rejected = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-H HOST] [-p PORT] [-n REQUESTS] [-i INTERVAL_MS] [-f] [-d] [-r]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (down)
+        return check_down(host, port);
+    if (rejected)
+        return check_rejected(host, port);
+
+    http_uplink_t u;
+    http_uplink_config_t cfg = { .host = host, .port = port, .timeout_ms = 2000,
+                                 .backoff_min_ms = 100, .backoff_max_ms = 2000 };
+    http_uplink_init(&u, &cfg);
+
+    char body[256];
+    http_uplink_response_t resp = { .body = body, .body_size = sizeof(body) };
+    http_uplink_request_t reset = { .method = "POST", .path = "/stats/reset", .body = "", .body_len = 0 };
+    if (http_uplink_request(&u, &reset, &resp) != ESP_OK) {
+        fprintf(stderr, "no server on %s:%u\n", host, port);
+        return 1;
+    }
+    // Counted from a fresh connection; the cached address is kept
+    http_uplink_close(&u);
+    http_uplink_stats_t base = u.stats;
+
+    int ok_requests = 0;
+    double t0 = now_s(), worst = 0;
+    for (int i = 0; i < n; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/update?api_key=TEST&field1=%d.5&field3=%d", 20 + i % 5, 400 + i);
+        http_uplink_request_t req = { .method = "GET", .path = path };
+
+        double t = now_s();
+        esp_err_t err = http_uplink_request(&u, &req, &resp);
+        t = now_s() - t;
+        if (t > worst)
+            worst = t;
+        if (err == ESP_OK && resp.status == 200)
+            ok_requests++;
+        else
+            fprintf(stderr, "request %d: %s, status %d\n", i, esp_err_to_name(err), resp.status);
+        if (fresh)
+            http_uplink_close(&u);
+        usleep(interval_ms * 1000);
+    }
+    double elapsed = now_s() - t0 - n * interval_ms / 1000.0;
+
+    // The server counts the connection but not the request of /stats
+    http_uplink_request_t stats = { .method = "GET", .path = "/stats" };
+    if (http_uplink_request(&u, &stats, &resp) != ESP_OK) {
+        fprintf(stderr, "stats request failed\n");
+        return 1;
+    }
+    http_uplink_stats_t st = u.stats;
+    st.requests -= base.requests + 1;
+    st.connects -= base.connects;
+    st.reused -= base.reused;
+    long server_conns = json_field(body, "connections");
+    long server_reqs = json_field(body, "requests");
+
+    print_stats(&st);
+    printf("server: %ld connections, %ld requests (%s)\n", server_conns, server_reqs, body);
+    printf("%d/%d ok, %.2f ms per request on average, worst %.2f ms\n",
+           ok_requests, n, elapsed * 1000 / n, worst * 1000);
+
+    bool ok = ok_requests == n && server_reqs == n && server_conns == (long)st.connects &&
+              st.dns_lookups == 1;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
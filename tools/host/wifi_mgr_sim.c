@@ -0,0 +1,357 @@
+/*
+ * Virtual-clock simulation of wifi_mgr against a simulated AP and driver.
+ *
+ *   wifi_mgr_sim [-n BOOTS] [-H HOURS] [-b BACKOFF_MAX_MS] [-s SEED]
+ *
+ * The driver model uses rough ESP32 timings: an all-channel scan takes
+ * about 1.6 s, joining a known BSSID on its channel 80-250 ms, a fast
+ * attempt whose BSSID is gone fails only after scanning every channel,
+ * and DHCP answers in 0.2-1.5 s (now and then after a 4 s retransmit).
+ *
+ * First BOOTS (default 1000) boots each of a cold node without a cache, a
+ * warm node with DHCP and with the cached address, and a warm node whose
+ * AP moved to another channel or was replaced; time to an address is
+ * reported. Then HOURS (default 24) with the AP going away every 5-60 min
+ * for 1 s to 15 min: every outage must end in a reconnect within
+ * BACKOFF_MAX_MS (default 60000) plus the attempts around it, and the
+ * attempts made while the AP is away are counted. The old connect-once
+ * startup is run through the same outages for comparison.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wifi_mgr.h"
+
+#define CHANNELS        13
+#define CHANNEL_SCAN_MS 120
+#define JOIN_MIN_MS     80
+#define JOIN_MAX_MS     250
+#define DHCP_MIN_MS     200
+#define DHCP_MAX_MS     1500
+#define DHCP_RETRY_MS   4000
+#define STATIC_IP_MS    5
+
+// Worst cases, for the reconnect bound
+#define SCAN_MAX_MS     (CHANNELS * CHANNEL_SCAN_MS + 200)
+#define DHCP_WORST_MS   (DHCP_MAX_MS + DHCP_RETRY_MS)
+
+typedef enum { EV_NONE, EV_ASSOCIATED, EV_FAILED, EV_GOT_IP } event_t;
+
+// AP, driver and the manager driving it
+typedef struct
+{
+    int64_t now;
+    bool ap_up;
+    int64_t ap_flip;            // AP goes down or up then; INT64_MAX if never
+    uint8_t ap_bssid[6];
+    uint8_t ap_channel;
+    event_t pending;
+    int64_t pending_at;
+    bool static_ip;             // Current attempt uses the cached address
+    bool connect_once;          // Old behaviour: one full attempt, no handler
+    bool tried;
+    wifi_mgr_t m;
+} world_t;
+
+static const uint8_t BSSID_A[6] = { 0x24, 0x0a, 0xc4, 0x11, 0x22, 0x33 };
+static const uint8_t BSSID_B[6] = { 0x24, 0x0a, 0xc4, 0x44, 0x55, 0x66 };
+
+static int64_t rnd(int64_t lo, int64_t hi)
+{
+    return lo + rand() % (hi - lo + 1);
+}
+
+static int64_t scan_ms(void)
+{
+    return CHANNELS * CHANNEL_SCAN_MS + rnd(0, 200);
+}
+
+static int64_t dhcp_ms(void)
+{
+    int64_t ms = rnd(DHCP_MIN_MS, DHCP_MAX_MS);
+    if (rand() % 20 == 0)
+        ms += DHCP_RETRY_MS;
+    return ms;
+}
+
+static void start_attempt(world_t *w, wifi_mgr_action_t action)
+{
+    const wifi_mgr_cache_t *c = &w->m.cache;
+    bool found = w->ap_up;
+    int64_t ms;
+
+    if (action == WIFI_MGR_CONNECT_FAST) {
+        // The driver scans from the given channel on and joins only the
+        // given BSSID
+        found = found && !memcmp(c->bssid, w->ap_bssid, 6);
+        int hops = (w->ap_channel - c->channel + CHANNELS) % CHANNELS;
+        ms = found ? (int64_t)hops * CHANNEL_SCAN_MS + rnd(JOIN_MIN_MS, JOIN_MAX_MS) : scan_ms();
+    } else {
+        ms = scan_ms() + (found ? rnd(JOIN_MIN_MS, JOIN_MAX_MS) : 0);
+    }
+    w->static_ip = wifi_mgr_static_ip(&w->m);
+    w->pending = found ? EV_ASSOCIATED : EV_FAILED;
+    w->pending_at = w->now + ms;
+}
+
+// Runs the world until `until` or, with stop_online, until an address
+static void run_until(world_t *w, int64_t until, bool stop_online)
+{
+    while (w->now < until) {
+        if (stop_online && w->m.state == WIFI_MGR_ONLINE)
+            return;
+
+        if (w->m.state == WIFI_MGR_IDLE && w->pending == EV_NONE && !(w->connect_once && w->tried)) {
+            wifi_mgr_action_t a = wifi_mgr_next(&w->m, w->now);
+            if (a != WIFI_MGR_WAIT) {
+                if (w->connect_once)
+                    a = WIFI_MGR_CONNECT_FULL;
+                w->tried = true;
+                start_attempt(w, a);
+            }
+        }
+
+        int64_t next = until;
+        if (w->pending != EV_NONE && w->pending_at < next)
+            next = w->pending_at;
+        if (w->ap_flip < next)
+            next = w->ap_flip;
+        if (w->m.state == WIFI_MGR_IDLE && w->pending == EV_NONE && !(w->connect_once && w->tried)) {
+            uint32_t wait = wifi_mgr_wait_ms(&w->m, w->now);
+            if (w->now + wait < next)
+                next = w->now + wait;
+        }
+        w->now = next;
+
+        if (w->ap_flip == w->now) {
+            w->ap_up = !w->ap_up;
+            w->ap_flip = INT64_MAX;
+            if (!w->ap_up && w->m.state != WIFI_MGR_IDLE) {
+                // Beacon loss ends the association or the attempt
+                w->pending = EV_NONE;
+                wifi_mgr_disconnected(&w->m, w->now);
+            }
+            return;
+        }
+        if (w->pending != EV_NONE && w->pending_at == w->now) {
+            event_t ev = w->pending;
+            w->pending = EV_NONE;
+            switch (ev) {
+                case EV_ASSOCIATED:
+                    wifi_mgr_associated(&w->m, w->ap_bssid, w->ap_channel, w->now);
+                    w->pending = EV_GOT_IP;
+                    w->pending_at = w->now + (w->static_ip ? STATIC_IP_MS : dhcp_ms());
+                    break;
+                case EV_FAILED:
+                    wifi_mgr_disconnected(&w->m, w->now);
+                    break;
+                case EV_GOT_IP:
+                    wifi_mgr_got_ip(&w->m, 0x0a01a8c0, 0x00ffffff, 0x0101a8c0, 0x0101a8c0, !w->static_ip, w->now);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+static void world_init(world_t *w, const wifi_mgr_config_t *cfg, const wifi_mgr_cache_t *cache)
+{
+    memset(w, 0, sizeof(*w));
+    w->ap_up = true;
+    w->ap_flip = INT64_MAX;
+    memcpy(w->ap_bssid, BSSID_A, 6);
+    w->ap_channel = 6;
+    wifi_mgr_init(&w->m, cfg, cache, 0);
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_dist(const char *name, int64_t *v, size_t n)
+{
+    if (!n) {
+        printf("%-22s none\n", name);
+        return;
+    }
+    qsort(v, n, sizeof(*v), cmp_i64);
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += v[i];
+    printf("%-22s mean %6" PRId64 " ms, p50 %6" PRId64 ", p95 %6" PRId64 ", max %6" PRId64 "\n", name,
+           sum / (int64_t)n, v[n / 2], v[n * 95 / 100], v[n - 1]);
+}
+
+typedef enum { BOOT_COLD, BOOT_WARM, BOOT_STATIC, BOOT_MOVED, BOOT_REPLACED } boot_t;
+
+static bool run_boots(boot_t kind, long boots, const wifi_mgr_config_t *base)
+{
+    static const char *names[] = { "cold boot", "warm boot, DHCP", "warm boot, cached IP", "AP moved channel",
+                                   "AP replaced" };
+    int64_t *t = calloc(boots, sizeof(*t));
+    wifi_mgr_config_t cfg = *base;
+    cfg.reuse_ip = kind == BOOT_STATIC;
+    wifi_mgr_cache_t cache = {
+        .version = WIFI_MGR_CACHE_VERSION,
+        .ap_valid = true,
+        .ip_valid = true,
+        .channel = 6,
+        .ip = 0x0a01a8c0,
+        .netmask = 0x00ffffff,
+        .gw = 0x0101a8c0,
+        .dns = 0x0101a8c0,
+    };
+    memcpy(cache.bssid, BSSID_A, 6);
+    bool ok = true;
+    uint32_t fast = 0, full = 0;
+
+    for (long i = 0; i < boots; i++) {
+        world_t w;
+        world_init(&w, &cfg, kind == BOOT_COLD ? NULL : &cache);
+        if (kind == BOOT_MOVED)
+            w.ap_channel = 11;
+        if (kind == BOOT_REPLACED)
+            memcpy(w.ap_bssid, BSSID_B, 6);
+        run_until(&w, 600000, true);
+        t[i] = w.now;
+        fast += w.m.stats.fast_attempts;
+        full += w.m.stats.full_attempts;
+        if (w.m.state != WIFI_MGR_ONLINE)
+            ok = false;
+
+        // The cache must now describe the AP actually joined
+        wifi_mgr_cache_t saved;
+        bool changed = wifi_mgr_take_cache(&w.m, &saved);
+        bool expect = kind == BOOT_COLD || kind == BOOT_MOVED || kind == BOOT_REPLACED;
+        if (changed != expect || (changed && (saved.channel != w.ap_channel || memcmp(saved.bssid, w.ap_bssid, 6))))
+            ok = false;
+    }
+    print_dist(names[kind], t, boots);
+    printf("%-22s %.2f fast + %.2f full attempts per boot\n", "", (double)fast / boots, (double)full / boots);
+    if (!ok)
+        printf("%-22s FAILED: not online or cache not updated\n", "");
+    free(t);
+    return ok;
+}
+
+// Outage run; returns false if a reconnect took longer than the bound
+static bool run_outages(double hours, const wifi_mgr_config_t *cfg, bool connect_once, int64_t bound)
+{
+    world_t w;
+    world_init(&w, cfg, NULL);
+    w.connect_once = connect_once;
+    int64_t end = (int64_t)(hours * 3600000);
+    size_t cap = 1024, n = 0;
+    int64_t *delays = malloc(cap * sizeof(*delays));
+    int64_t offline = 0, away = 0, up_at = 0;
+    uint32_t attempts_away = 0, outages = 0;
+    bool ok = true;
+
+    w.ap_flip = rnd(300000, 3600000);
+    while (w.now < end) {
+        bool was_online = w.m.state == WIFI_MGR_ONLINE;
+        bool was_up = w.ap_up;
+        uint32_t attempts = w.m.stats.fast_attempts + w.m.stats.full_attempts;
+        int64_t t0 = w.now;
+        run_until(&w, end, up_at >= 0);
+        if (!was_online)
+            offline += w.now - t0;
+        if (!was_up) {
+            away += w.now - t0;
+            attempts_away += w.m.stats.fast_attempts + w.m.stats.full_attempts - attempts;
+        }
+
+        if (w.ap_flip == INT64_MAX) {
+            // The AP just changed; schedule the next change
+            if (w.ap_up) {
+                w.ap_flip = w.now + rnd(300000, 3600000);
+                up_at = w.now;
+            } else {
+                w.ap_flip = w.now + rnd(1000, 900000);
+                outages++;
+            }
+        }
+        if (up_at >= 0 && w.m.state == WIFI_MGR_ONLINE) {
+            if (n == cap)
+                delays = realloc(delays, (cap *= 2) * sizeof(*delays));
+            delays[n++] = w.now - up_at;
+            if (w.now - up_at > bound)
+                ok = false;
+            up_at = -1;
+        }
+    }
+
+    const char *name = connect_once ? "connect once" : "wifi_mgr";
+    printf("%-22s %" PRIu32 " outages, %.1f%% of the time away, offline %.1f%%\n", name, outages,
+           100.0 * away / end, 100.0 * offline / end);
+    if (!connect_once) {
+        print_dist("  address after AP up", delays, n);
+        printf("  %.1f attempts per hour away (%" PRIu32 " fast, %" PRIu32 " full in total, %" PRIu32 " drops)\n",
+               away ? attempts_away * 3600000.0 / away : 0.0, w.m.stats.fast_attempts, w.m.stats.full_attempts,
+               w.m.stats.drops);
+        // The first entry is the initial connect; the last outage may
+        // still be going on at the end
+        if (n != outages + 1 && !(n == outages && up_at >= 0))
+            ok = false;
+        if (!ok)
+            printf("  FAILED: a reconnect exceeded %" PRId64 " ms or never happened\n", bound);
+    } else {
+        printf("  %zu reconnects\n", n ? n - 1 : 0);
+    }
+    free(delays);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    long boots = 1000;
+    double hours = 24;
+    wifi_mgr_config_t cfg = { .backoff_max_ms = 60000 };
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:H:b:s:")) != -1) {
+        switch (opt) {
+            case 'n': boots = strtol(optarg, NULL, 10); break;
+            case 'H': hours = atof(optarg); break;
+            case 'b': cfg.backoff_max_ms = strtoul(optarg, NULL, 10); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n BOOTS] [-H HOURS] [-b BACKOFF_MAX_MS] [-s SEED]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (boots < 1) {
+        fprintf(stderr, "BOOTS must be at least 1\n");
+        return 2;
+    }
+
+    srand(seed);
+    bool ok = true;
+    for (int kind = BOOT_COLD; kind <= BOOT_REPLACED; kind++)
+        ok &= run_boots(kind, boots, &cfg);
+
+    // A full attempt that just missed the AP, the longest wait, then the
+    // fast attempts and a full one with the slowest DHCP answer
+    wifi_mgr_t probe;
+    wifi_mgr_init(&probe, &cfg, NULL, 0);
+    int64_t bound = SCAN_MAX_MS + probe.cfg.backoff_max_ms + (int64_t)probe.cfg.fast_attempts * SCAN_MAX_MS +
+                    SCAN_MAX_MS + JOIN_MAX_MS + DHCP_WORST_MS;
+    printf("\n%.0f h of AP outages, backoff up to %" PRIu32 " ms, reconnect bound %" PRId64 " ms\n", hours,
+           probe.cfg.backoff_max_ms, bound);
+    srand(seed);
+    ok &= run_outages(hours, &cfg, false, bound);
+    srand(seed);
+    run_outages(hours, &cfg, true, bound);
+
+    printf("manager state %zu bytes, cache %zu bytes\n", sizeof(wifi_mgr_t), sizeof(wifi_mgr_cache_t));
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}